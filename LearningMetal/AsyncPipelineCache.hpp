@@ -0,0 +1,348 @@
+//
+//  AsyncPipelineCache.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/27.
+//
+
+#ifndef AsyncPipelineCache_hpp
+#define AsyncPipelineCache_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "PipelineCache.hpp"
+
+namespace pipeline_cache {
+    enum class CompilePriority : uint8_t {
+        Immediate,  // needed by a draw this frame
+        High,
+        Normal,
+        Background  // pre-warming
+    };
+
+    struct AsyncStats {
+        uint64_t requests = 0;
+        uint64_t compiled = 0;
+        uint64_t failed = 0;
+        uint64_t fallbackDraws = 0;
+        uint64_t skippedDraws = 0;
+        uint64_t hitchFrames = 0;  // frames where at least one draw had no pipeline ready
+        uint64_t recompiles = 0;   // ready pipelines replaced by recompile()
+        uint64_t frames = 0;
+        size_t maxQueueDepth = 0;
+        double compileSeconds = 0.0;
+    };
+
+    /**
+     * Non-blocking pipeline cache. Missing pipelines are queued by priority and handed to an asynchronous compiler,
+     * with at most maxInFlight compiles outstanding; the compiler reports back through a completion callback from
+     * any thread. On device the compiler wraps the completion-handler newRenderPipelineState, elsewhere a mock.
+     */
+    template <typename State>
+    class AsyncPipelineCache {
+    public:
+        using Completion = std::function<void(State* pState)>;
+        using Compiler = std::function<void(const RenderPipelineKey& key, Completion done)>;
+        using Releaser = std::function<void(State* pState)>;
+        // Called with the cache lock held, once per distinct key, the first time a draw resolves it.
+        using DrawObserver = std::function<void(const RenderPipelineKey& key)>;
+
+        AsyncPipelineCache(Compiler compile, Releaser release, uint32_t maxInFlight = 2): _compile(std::move(compile)), _release(std::move(release)), _maxInFlight(maxInFlight) {}
+
+        // Queued compiles are dropped; ones already started are waited for, down to the last completion handler
+        // returning, since those run on the compiler's threads and touch the cache after their state is delivered.
+        ~AsyncPipelineCache() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stopping = true;
+            _idle.wait(lock, [this] { return _inFlight == 0 && _inHandler == 0; });
+            lock.unlock();
+            for (auto& [hash, entries] : _entries) {
+                for (std::unique_ptr<Entry>& entry : entries) {
+                    if (entry->pState) {
+                        _release(entry->pState);
+                    }
+                }
+            }
+        }
+
+        AsyncPipelineCache(const AsyncPipelineCache&) = delete;
+        AsyncPipelineCache& operator=(const AsyncPipelineCache&) = delete;
+
+        // Returns the pipeline if it is ready, otherwise queues it (or raises its priority) and returns nullptr.
+        State* request(const RenderPipelineKey& key, CompilePriority priority) {
+            Entry* pEntry = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                ++_stats.requests;
+                pEntry = findOrInsert(key);
+                if (pEntry->status == Status::Ready) {
+                    return pEntry->pState;
+                }
+                if (pEntry->status == Status::New) {
+                    pEntry->status = Status::Queued;
+                    pEntry->priority = priority;
+                    pEntry->sequence = _nextSequence++;
+                    _queue.push_back(pEntry);
+                    _stats.maxQueueDepth = std::max(_stats.maxQueueDepth, _queue.size());
+                } else if (pEntry->status == Status::Queued && priority < pEntry->priority) {
+                    pEntry->priority = priority;
+                }
+            }
+            pump();
+            // A compiler that finishes synchronously (or a very fast one) has already delivered.
+            std::lock_guard<std::mutex> lock(_mutex);
+            return pEntry->status == Status::Ready ? pEntry->pState : nullptr;
+        }
+
+        // For draws: the requested pipeline if ready, else fallback (which may be nullptr, meaning skip the draw).
+        State* resolve(const RenderPipelineKey& key, State* pFallback) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                Entry* pEntry = findOrInsert(key);
+                if (!pEntry->drawn) {
+                    pEntry->drawn = true;
+                    if (_observer) {
+                        _observer(key);
+                    }
+                }
+            }
+            State* pState = request(key, CompilePriority::Immediate);
+            if (pState) {
+                return pState;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _frameHitched = true;
+            if (pFallback) {
+                ++_stats.fallbackDraws;
+            } else {
+                ++_stats.skippedDraws;
+            }
+            return pFallback;
+        }
+
+        void beginFrame() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_frameHitched) {
+                ++_stats.hitchFrames;
+            }
+            _frameHitched = false;
+            ++_stats.frames;
+        }
+
+        void waitIdle() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _idle.wait(lock, [this] { return _queue.empty() && _inFlight == 0 && _inHandler == 0; });
+        }
+
+        // Blocks until nothing at the given priority or above is queued or compiling; lower priorities keep going.
+        void waitFor(CompilePriority priority) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _idle.wait(lock, [this, priority] {
+                for (size_t p = 0; p <= static_cast<size_t>(priority); ++p) {
+                    if (_inFlightAt[p] > 0) {
+                        return false;
+                    }
+                }
+                for (const Entry* pEntry : _queue) {
+                    if (pEntry->priority <= priority) {
+                        return false;
+                    }
+                }
+                return true;
+            });
+        }
+
+        /**
+         * Rebuilds every pipeline matching the predicate, e.g. after its shader library was swapped. A ready pipeline
+         * keeps being served until its replacement arrives and is released then (Metal command buffers retain the
+         * states they use, so frames in flight are unaffected); if the rebuild fails the old one stays. Failed
+         * pipelines are retried, and ones still compiling are rebuilt again once they finish.
+         */
+        template <typename Predicate>
+        size_t recompile(Predicate matches, CompilePriority priority = CompilePriority::High) {
+            size_t count = 0;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto& [hash, entries] : _entries) {
+                    for (std::unique_ptr<Entry>& entry : entries) {
+                        if (!matches(entry->key)) {
+                            continue;
+                        }
+                        Entry* pEntry = entry.get();
+                        const bool rebuilding = pEntry->recompiling && std::find(_queue.begin(), _queue.end(), pEntry) == _queue.end();
+                        if (pEntry->status == Status::Compiling || rebuilding) {
+                            pEntry->recompileAfter = true;
+                            ++count;
+                        } else if ((pEntry->status == Status::Ready && !pEntry->recompiling) || pEntry->status == Status::Failed) {
+                            pEntry->recompiling = pEntry->status == Status::Ready;
+                            if (pEntry->status == Status::Failed) {
+                                pEntry->status = Status::Queued;
+                            }
+                            pEntry->priority = priority;
+                            pEntry->sequence = _nextSequence++;
+                            _queue.push_back(pEntry);
+                            ++count;
+                        }
+                    }
+                }
+                _stats.maxQueueDepth = std::max(_stats.maxQueueDepth, _queue.size());
+            }
+            pump();
+            return count;
+        }
+
+        void setDrawObserver(DrawObserver observer) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _observer = std::move(observer);
+        }
+
+        AsyncStats stats() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _stats;
+        }
+
+        size_t pendingCount() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _queue.size() + _inFlight;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Status : uint8_t {
+            New,
+            Queued,
+            Compiling,
+            Ready,
+            Failed
+        };
+
+        struct Entry {
+            RenderPipelineKey key;
+            State* pState;
+            Status status;
+            CompilePriority priority;
+            uint64_t sequence;
+            Clock::time_point started;
+            bool drawn;
+            bool recompiling;     // Ready, with a replacement queued or compiling
+            bool recompileAfter;  // compiling against a library that has since been replaced
+        };
+
+        Entry* findOrInsert(const RenderPipelineKey& key) {
+            std::vector<std::unique_ptr<Entry>>& bucket = _entries[key.hash()];
+            for (std::unique_ptr<Entry>& entry : bucket) {
+                if (entry->key == key) {
+                    return entry.get();
+                }
+            }
+            bucket.push_back(std::unique_ptr<Entry>(new Entry { key, nullptr, Status::New, CompilePriority::Background, 0, {}, false, false, false }));
+            return bucket.back().get();
+        }
+
+        // Starts compiles until the in-flight limit is reached. The compiler is called without the lock held because a
+        // synchronous compiler runs its completion, and so pump(), before returning; the nested call returns at once
+        // and the outer loop picks up the next entry instead of recursing.
+        void pump() {
+            static thread_local bool sPumping = false;
+            if (sPumping) {
+                return;
+            }
+            sPumping = true;
+            for (;;) {
+                Entry* pNext = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (_stopping || _inFlight >= _maxInFlight || _queue.empty()) {
+                        break;
+                    }
+                    auto best = _queue.begin();
+                    for (auto it = _queue.begin(); it != _queue.end(); ++it) {
+                        if ((*it)->priority < (*best)->priority || ((*it)->priority == (*best)->priority && (*it)->sequence < (*best)->sequence)) {
+                            best = it;
+                        }
+                    }
+                    pNext = *best;
+                    _queue.erase(best);
+                    if (!pNext->recompiling) {
+                        pNext->status = Status::Compiling;
+                    }
+                    pNext->started = Clock::now();
+                    ++_inFlight;
+                    ++_inFlightAt[static_cast<size_t>(pNext->priority)];
+                }
+
+                _compile(pNext->key, [this, pNext](State* pState) {
+                    State* pReplaced = nullptr;
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        if (pNext->recompiling) {
+                            pNext->recompiling = false;
+                            if (pState) {
+                                pReplaced = pNext->pState;
+                                pNext->pState = pState;
+                                ++_stats.recompiles;
+                            }
+                        } else {
+                            pNext->pState = pState;
+                            pNext->status = pState ? Status::Ready : Status::Failed;
+                        }
+                        _stats.compileSeconds += std::chrono::duration<double>(Clock::now() - pNext->started).count();
+                        if (pState) {
+                            ++_stats.compiled;
+                        } else {
+                            ++_stats.failed;
+                        }
+                        --_inFlight;
+                        --_inFlightAt[static_cast<size_t>(pNext->priority)];
+                        if (pNext->recompileAfter) {
+                            pNext->recompileAfter = false;
+                            pNext->recompiling = pNext->status == Status::Ready;
+                            if (pNext->status == Status::Failed) {
+                                pNext->status = Status::Queued;
+                            }
+                            pNext->sequence = _nextSequence++;
+                            _queue.push_back(pNext);
+                        }
+                        ++_inHandler;
+                    }
+                    if (pReplaced) {
+                        _release(pReplaced);
+                    }
+                    pump();
+                    // Notified with the lock held: once it is dropped a waiting destructor may free the cache.
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    --_inHandler;
+                    _idle.notify_all();
+                });
+            }
+            sPumping = false;
+        }
+
+        Compiler _compile;
+        Releaser _release;
+        uint32_t _maxInFlight;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _idle;
+        std::unordered_map<uint64_t, std::vector<std::unique_ptr<Entry>>> _entries;
+        std::vector<Entry*> _queue;
+        uint32_t _inFlight = 0;
+        uint32_t _inFlightAt[4] = {};
+        uint32_t _inHandler = 0;  // completion handlers still running after delivering their state
+        bool _stopping = false;
+        uint64_t _nextSequence = 0;
+        bool _frameHitched = false;
+        AsyncStats _stats;
+        DrawObserver _observer;
+    };
+}
+
+#endif /* AsyncPipelineCache_hpp */
@@ -0,0 +1,90 @@
+//
+//  CompileProfile.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/28.
+//
+
+#include "CompileProfile.hpp"
+#include "Statistics.hpp"
+#include <algorithm>
+
+namespace compile_profile {
+std::string CompileProfile::describe() const {
+    std::string text = fastMath ? "fast-math" : "precise-math";
+    text += optimizationLevel == 1 ? " -Os" : " -O";
+    if (preserveInvariance) {
+        text += " invariant";
+    }
+    for (const auto& [name, value] : macros) {
+        text += " -D" + name + "=" + value;
+    }
+    return text;
+}
+
+void ProfileRules::add(const std::string& vertexFunction, uint32_t variantMask, uint32_t variantValue, uint32_t profile) {
+    _rules.push_back(Rule { vertexFunction, variantMask, variantValue & variantMask, profile });
+}
+
+uint32_t ProfileRules::profileFor(const std::string& vertexFunction, uint32_t variant) const {
+    for (const Rule& rule : _rules) {
+        if ((rule.vertexFunction.empty() || rule.vertexFunction == vertexFunction) && (variant & rule.variantMask) == rule.variantValue) {
+            return rule.profile;
+        }
+    }
+    return kBuildTimeProfile;
+}
+
+bool ProfileRules::uses(uint32_t profile) const {
+    return std::any_of(_rules.begin(), _rules.end(), [profile](const Rule& rule) { return rule.profile == profile; });
+}
+
+FrameTimeBenchmark::FrameTimeBenchmark(uint32_t profileCount, uint32_t framesPerBlock, uint32_t rounds, uint32_t settleFrames): _profileCount(profileCount), _framesPerBlock(framesPerBlock), _rounds(rounds), _settleFrames(settleFrames), _timings(profileCount) {
+
+}
+
+uint32_t FrameTimeBenchmark::activeProfile() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _block % _profileCount;
+}
+
+bool FrameTimeBenchmark::isFinished() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _block >= _profileCount * _rounds;
+}
+
+void FrameTimeBenchmark::recordFrame(uint32_t profile, double gpuMilliseconds, double frameMilliseconds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Frames still in flight from the previous block complete after the switch; they belong to no block.
+    if (_block >= _profileCount * _rounds || profile != _block % _profileCount) {
+        return;
+    }
+    if (_blockFrames++ >= _settleFrames) {
+        _timings[profile].gpuMilliseconds.push_back(gpuMilliseconds);
+        _timings[profile].frameMilliseconds.push_back(frameMilliseconds);
+    }
+    if (_blockFrames == _settleFrames + _framesPerBlock) {
+        ++_block;
+        _blockFrames = 0;
+    }
+}
+
+void FrameTimeBenchmark::printReport(const std::vector<CompileProfile>& profiles) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint32_t fastest = 0;
+    double fastestMedian = 0.0;
+    __builtin_printf("Compile profile benchmark (%u frames per profile)\n", _framesPerBlock * _rounds);
+    __builtin_printf("  %-12s %9s %9s %9s  %s\n", "profile", "gpu p50", "gpu p95", "frame p50", "options");
+    for (uint32_t i = 0; i < _profileCount; ++i) {
+        const double gpuMedian = statistics::percentile(_timings[i].gpuMilliseconds, 0.5);
+        __builtin_printf("  %-12s %7.3fms %7.3fms %7.3fms  %s\n", profiles[i].name.c_str(), gpuMedian,
+                         statistics::percentile(_timings[i].gpuMilliseconds, 0.95), statistics::percentile(_timings[i].frameMilliseconds, 0.5),
+                         i == kBuildTimeProfile ? "build-time metallib" : profiles[i].describe().c_str());
+        if (i == 0 || gpuMedian < fastestMedian) {
+            fastest = i;
+            fastestMedian = gpuMedian;
+        }
+    }
+    __builtin_printf("  fastest: %s\n", profiles[fastest].name.c_str());
+}
+}
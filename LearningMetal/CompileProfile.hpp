@@ -0,0 +1,93 @@
+//
+//  CompileProfile.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/28.
+//
+
+#ifndef CompileProfile_hpp
+#define CompileProfile_hpp
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace compile_profile {
+    // Profile 0 is always the library compiled into the app's metallib at build time.
+    static constexpr uint32_t kBuildTimeProfile = 0;
+
+    /**
+     * MTL::CompileOptions for a runtime shader compile. optimizationLevel holds the raw MTL::LibraryOptimizationLevel.
+     */
+    struct CompileProfile {
+        std::string name;
+        bool fastMath = true;
+        uint32_t optimizationLevel = 0;
+        bool preserveInvariance = false;
+        std::vector<std::pair<std::string, std::string>> macros;
+
+        std::string describe() const;
+    };
+
+    /**
+     * Picks a profile per pipeline. Rules are checked in order and the first match wins; a rule matches a vertex
+     * function by name (empty matches all) and a variant by the bits selected in variantMask. Mesh pipelines are
+     * matched by their mesh function.
+     */
+    class ProfileRules {
+    public:
+        void add(const std::string& vertexFunction, uint32_t variantMask, uint32_t variantValue, uint32_t profile);
+        uint32_t profileFor(const std::string& vertexFunction, uint32_t variant) const;
+        // Whether any rule picks this profile, i.e. whether its library is needed at all.
+        bool uses(uint32_t profile) const;
+
+    private:
+        struct Rule {
+            std::string vertexFunction;
+            uint32_t variantMask;
+            uint32_t variantValue;
+            uint32_t profile;
+        };
+
+        std::vector<Rule> _rules;
+    };
+
+    struct ProfileTimings {
+        std::vector<double> gpuMilliseconds;
+        std::vector<double> frameMilliseconds;
+    };
+
+    /**
+     * A/B frame-time comparison. Frames rotate through the profiles in short blocks, so clock or thermal drift over
+     * the run lands on every profile rather than the last one measured; the first frames of each block are thrown
+     * away while the GPU settles on the new pipelines.
+     */
+    class FrameTimeBenchmark {
+    public:
+        FrameTimeBenchmark(uint32_t profileCount, uint32_t framesPerBlock = 60, uint32_t rounds = 5, uint32_t settleFrames = 10);
+
+        // The profile the next frame should render with.
+        uint32_t activeProfile() const;
+        // Called from command buffer completion handlers with the profile the frame was encoded with.
+        void recordFrame(uint32_t profile, double gpuMilliseconds, double frameMilliseconds);
+        bool isFinished() const;
+
+        const ProfileTimings& timings(uint32_t profile) const { return _timings[profile]; }
+        void printReport(const std::vector<CompileProfile>& profiles) const;
+
+    private:
+        uint32_t _profileCount;
+        uint32_t _framesPerBlock;
+        uint32_t _rounds;
+        uint32_t _settleFrames;
+
+        mutable std::mutex _mutex;
+        uint32_t _block = 0;
+        uint32_t _blockFrames = 0;
+        std::vector<ProfileTimings> _timings;
+    };
+}
+
+#endif /* CompileProfile_hpp */
@@ -0,0 +1,106 @@
+//
+//  FileWatcher.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "FileWatcher.hpp"
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+namespace hot_reload {
+FileWatcher::FileWatcher() {
+#if defined(__linux__)
+    _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#if defined(__linux__)
+    if (_inotify >= 0) {
+        close(_inotify);
+    }
+#endif
+}
+
+FileWatcher::Stamp FileWatcher::stamp(const std::string& path) {
+    struct stat info;
+    Stamp result;
+    if (stat(path.c_str(), &info) != 0) {
+        return result;
+    }
+#if defined(__APPLE__)
+    result.modifiedNanoseconds = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    result.modifiedNanoseconds = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    result.size = info.st_size;
+    return result;
+}
+
+bool FileWatcher::add(const std::string& path) {
+    const Stamp current = stamp(path);
+    if (current.size < 0) {
+        return false;
+    }
+    _files[path] = current;
+
+#if defined(__linux__)
+    if (_inotify >= 0) {
+        const size_t slash = path.find_last_of('/');
+        const std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+        const int wd = inotify_add_watch(_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd >= 0) {
+            _directories[wd] = directory;
+        }
+    }
+#endif
+    return true;
+}
+
+std::vector<std::string> FileWatcher::poll() {
+    std::vector<std::string> candidates;
+#if defined(__linux__)
+    if (_inotify >= 0) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(_inotify, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + length;) {
+                const inotify_event* pEvent = reinterpret_cast<const inotify_event*>(p);
+                auto directory = _directories.find(pEvent->wd);
+                if (pEvent->len > 0 && directory != _directories.end()) {
+                    const std::string path = directory->second + "/" + pEvent->name;
+                    if (_files.count(path)) {
+                        candidates.push_back(path);
+                    }
+                }
+                p += sizeof(inotify_event) + pEvent->len;
+            }
+        }
+    } else
+#endif
+    {
+        for (const auto& [path, previous] : _files) {
+            candidates.push_back(path);
+        }
+    }
+
+    // Events only say something happened; the stamp says whether the contents can have changed, and also drops
+    // the duplicate events a single save produces.
+    std::vector<std::string> changed;
+    for (const std::string& path : candidates) {
+        const Stamp current = stamp(path);
+        Stamp& previous = _files[path];
+        if (current.size >= 0 && current != previous && std::find(changed.begin(), changed.end(), path) == changed.end()) {
+            previous = current;
+            changed.push_back(path);
+        }
+    }
+    return changed;
+}
+}
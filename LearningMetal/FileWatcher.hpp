@@ -0,0 +1,50 @@
+//
+//  FileWatcher.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef FileWatcher_hpp
+#define FileWatcher_hpp
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hot_reload {
+    /**
+     * Reports files that were written since the last poll. On Linux this is inotify on the parent directories, so
+     * editors that save by writing a temporary and renaming it over the original are caught too. Elsewhere (iOS has
+     * no FSEvents) it compares modification times and sizes, which for a handful of shader files costs nothing.
+     */
+    class FileWatcher {
+    public:
+        FileWatcher();
+        ~FileWatcher();
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        bool add(const std::string& path);
+        // Never blocks. Each changed path is reported once per call.
+        std::vector<std::string> poll();
+
+    private:
+        struct Stamp {
+            int64_t modifiedNanoseconds = -1;
+            int64_t size = -1;
+            bool operator!=(const Stamp& other) const { return modifiedNanoseconds != other.modifiedNanoseconds || size != other.size; }
+        };
+
+        static Stamp stamp(const std::string& path);
+
+        std::unordered_map<std::string, Stamp> _files;
+#if defined(__linux__)
+        int _inotify = -1;
+        std::unordered_map<int, std::string> _directories; // watch descriptor to directory
+#endif
+    };
+}
+
+#endif /* FileWatcher_hpp */
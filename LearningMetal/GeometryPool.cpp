@@ -0,0 +1,321 @@
+//
+//  GeometryPool.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "GeometryPool.hpp"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+namespace geometry_pool {
+RangeAllocator::RangeAllocator(uint32_t capacity): _capacity(0), _used(0) {
+    grow(capacity);
+}
+
+void RangeAllocator::insertFree(uint32_t offset, uint32_t size) {
+    _freeByOffset.emplace(offset, size);
+    _freeBySize.emplace(size, offset);
+}
+
+void RangeAllocator::eraseFree(std::map<uint32_t, uint32_t>::iterator it) {
+    _freeBySize.erase({ it->second, it->first });
+    _freeByOffset.erase(it);
+}
+
+// Allocates from the start of a free range, keeping the rest of it free.
+void RangeAllocator::take(std::map<uint32_t, uint32_t>::iterator it, uint32_t size) {
+    const uint32_t offset = it->first;
+    const uint32_t remaining = it->second - size;
+    eraseFree(it);
+    if (remaining > 0) {
+        insertFree(offset + size, remaining);
+    }
+    _used += size;
+}
+
+uint32_t RangeAllocator::allocate(uint32_t size) {
+    if (size == 0) {
+        return kInvalidOffset;
+    }
+    const auto best = _freeBySize.lower_bound({ size, 0 });
+    if (best == _freeBySize.end()) {
+        return kInvalidOffset;
+    }
+    const uint32_t offset = best->second;
+    take(_freeByOffset.find(offset), size);
+    return offset;
+}
+
+uint32_t RangeAllocator::allocateBelow(uint32_t size, uint32_t limit) {
+    // Only ranges at least size long are candidates, and after churn those are few next to the small holes.
+    auto lowest = _freeBySize.end();
+    for (auto it = _freeBySize.lower_bound({ size, 0 }); it != _freeBySize.end(); ++it) {
+        if (it->second + size <= limit && (lowest == _freeBySize.end() || it->second < lowest->second)) {
+            lowest = it;
+        }
+    }
+    if (lowest == _freeBySize.end()) {
+        return kInvalidOffset;
+    }
+    const uint32_t offset = lowest->second;
+    take(_freeByOffset.find(offset), size);
+    return offset;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t size) {
+    if (size == 0) {
+        return;
+    }
+    _used -= size;
+    auto next = _freeByOffset.lower_bound(offset);
+    if (next != _freeByOffset.end() && offset + size == next->first) {
+        size += next->second;
+        eraseFree(next);
+    }
+    auto previous = _freeByOffset.lower_bound(offset);
+    if (previous != _freeByOffset.begin()) {
+        --previous;
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            eraseFree(previous);
+        }
+    }
+    insertFree(offset, size);
+}
+
+void RangeAllocator::grow(uint32_t newCapacity) {
+    if (newCapacity <= _capacity) {
+        return;
+    }
+    const uint32_t offset = _capacity;
+    const uint32_t size = newCapacity - _capacity;
+    _capacity = newCapacity;
+    // Counted as used for the moment, so that free() can merge it with a free range ending at the old capacity.
+    _used += size;
+    free(offset, size);
+}
+
+bool RangeAllocator::shrink(uint32_t newCapacity) {
+    if (newCapacity >= _capacity) {
+        return newCapacity == _capacity;
+    }
+    if (newCapacity < end()) {
+        return false;
+    }
+    // end() is below the capacity, so the last free range runs up to it.
+    const auto last = std::prev(_freeByOffset.end());
+    const uint32_t offset = last->first;
+    eraseFree(last);
+    if (offset < newCapacity) {
+        insertFree(offset, newCapacity - offset);
+    }
+    _capacity = newCapacity;
+    return true;
+}
+
+uint32_t RangeAllocator::largestFree() const {
+    return _freeBySize.empty() ? 0 : _freeBySize.rbegin()->first;
+}
+
+uint32_t RangeAllocator::end() const {
+    if (_freeByOffset.empty()) {
+        return _capacity;
+    }
+    const auto& last = *_freeByOffset.rbegin();
+    return last.first + last.second == _capacity ? last.first : _capacity;
+}
+
+float PoolStats::fragmentation(Stream stream) const {
+    const size_t s = static_cast<size_t>(stream);
+    const uint32_t free = capacity[s] - used[s] - pending[s];
+    return free == 0 ? 0.0f : 1.0f - static_cast<float>(largestFree[s]) / static_cast<float>(free);
+}
+
+GeometryPool::GeometryPool(PoolBackend* pBackend, uint32_t vertexStride, uint32_t indexSize, uint32_t vertexCapacity, uint32_t indexCapacity,
+                           uint32_t framesInFlight)
+: _pBackend(pBackend), _stride { vertexStride, indexSize }, _framesInFlight(framesInFlight), _frame(0), _pendingSize { 0, 0 } {
+    const uint32_t capacity[2] = { vertexCapacity, indexCapacity };
+    for (size_t s = 0; s < 2; ++s) {
+        if (capacity[s] > 0 && _pBackend->resize(static_cast<Stream>(s), size_t(capacity[s]) * _stride[s])) {
+            _allocators[s].grow(capacity[s]);
+        }
+    }
+}
+
+uint32_t& GeometryPool::offsetOf(Mesh& mesh, Stream stream) {
+    return stream == Stream::Vertices ? mesh.range.baseVertex : mesh.range.firstIndex;
+}
+
+uint32_t GeometryPool::sizeOf(const Mesh& mesh, Stream stream) const {
+    return stream == Stream::Vertices ? mesh.range.vertexCount : mesh.range.indexCount;
+}
+
+// Grows by at least half again when full, so a run of additions grows a logarithmic number of times.
+uint32_t GeometryPool::allocate(Stream stream, uint32_t size) {
+    const size_t s = static_cast<size_t>(stream);
+    RangeAllocator& allocator = _allocators[s];
+    uint32_t offset = allocator.allocate(size);
+    if (offset != RangeAllocator::kInvalidOffset) {
+        return offset;
+    }
+
+    const uint64_t capacity = allocator.capacity();
+    const uint64_t needed = uint64_t(allocator.end()) + size;
+    const uint64_t grown = std::min<uint64_t>(std::max(needed, capacity + capacity / 2), RangeAllocator::kInvalidOffset - 1);
+    if (grown < needed || !_pBackend->resize(stream, size_t(grown) * _stride[s])) {
+        return RangeAllocator::kInvalidOffset;
+    }
+    allocator.grow(static_cast<uint32_t>(grown));
+    ++_stats.growths;
+    return allocator.allocate(size);
+}
+
+void GeometryPool::retire(Stream stream, uint32_t offset, uint32_t size) {
+    if (size > 0) {
+        _pending.push_back({ _frame, stream, offset, size });
+        _pendingSize[static_cast<size_t>(stream)] += size;
+    }
+}
+
+MeshHandle GeometryPool::addMesh(const void* pVertices, uint32_t vertexCount, const void* pIndices, uint32_t indexCount) {
+    if (vertexCount == 0 || indexCount == 0) {
+        return kInvalidMesh;
+    }
+    const uint32_t baseVertex = allocate(Stream::Vertices, vertexCount);
+    if (baseVertex == RangeAllocator::kInvalidOffset) {
+        return kInvalidMesh;
+    }
+    const uint32_t firstIndex = allocate(Stream::Indices, indexCount);
+    if (firstIndex == RangeAllocator::kInvalidOffset) {
+        _allocators[0].free(baseVertex, vertexCount);
+        return kInvalidMesh;
+    }
+    _pBackend->write(Stream::Vertices, size_t(baseVertex) * _stride[0], pVertices, size_t(vertexCount) * _stride[0]);
+    _pBackend->write(Stream::Indices, size_t(firstIndex) * _stride[1], pIndices, size_t(indexCount) * _stride[1]);
+
+    MeshHandle handle;
+    if (_freeHandles.empty()) {
+        handle = static_cast<MeshHandle>(_meshes.size());
+        _meshes.emplace_back();
+    } else {
+        handle = _freeHandles.back();
+        _freeHandles.pop_back();
+    }
+    _meshes[handle] = { { baseVertex, vertexCount, firstIndex, indexCount }, true };
+    ++_stats.meshCount;
+    return handle;
+}
+
+void GeometryPool::removeMesh(MeshHandle handle) {
+    if (handle >= _meshes.size() || !_meshes[handle].live) {
+        return;
+    }
+    Mesh& mesh = _meshes[handle];
+    retire(Stream::Vertices, mesh.range.baseVertex, mesh.range.vertexCount);
+    retire(Stream::Indices, mesh.range.firstIndex, mesh.range.indexCount);
+    mesh.live = false;
+    _freeHandles.push_back(handle);
+    --_stats.meshCount;
+}
+
+void GeometryPool::trimIndices(MeshHandle handle, uint32_t first, uint32_t count) {
+    if (handle >= _meshes.size() || !_meshes[handle].live) {
+        return;
+    }
+    MeshRange& range = _meshes[handle].range;
+    if (count == 0 || uint64_t(first) + count > range.indexCount) {
+        return;
+    }
+    retire(Stream::Indices, range.firstIndex, first);
+    retire(Stream::Indices, range.firstIndex + first + count, range.indexCount - first - count);
+    range.firstIndex += first;
+    range.indexCount = count;
+}
+
+void GeometryPool::advanceFrame() {
+    ++_frame;
+    size_t kept = 0;
+    for (const PendingFree& pending : _pending) {
+        if (pending.frame + _framesInFlight <= _frame) {
+            _allocators[static_cast<size_t>(pending.stream)].free(pending.offset, pending.size);
+            _pendingSize[static_cast<size_t>(pending.stream)] -= pending.size;
+        } else {
+            _pending[kept++] = pending;
+        }
+    }
+    _pending.resize(kept);
+}
+
+size_t GeometryPool::compact(size_t maxBytes) {
+    size_t moved = 0;
+    std::vector<std::pair<uint32_t, MeshHandle>> byOffset;
+    for (size_t s = 0; s < 2 && moved < maxBytes; ++s) {
+        const Stream stream = static_cast<Stream>(s);
+        byOffset.clear();
+        for (MeshHandle handle = 0; handle < _meshes.size(); ++handle) {
+            if (_meshes[handle].live) {
+                byOffset.emplace_back(offsetOf(_meshes[handle], stream), handle);
+            }
+        }
+        std::sort(byOffset.begin(), byOffset.end(), std::greater<>());
+
+        // Highest first: each move lowers the top of the stream. The destination is free space, so it never
+        // overlaps the source, and the source stays intact for frames in flight until it is retired.
+        for (const auto& [offset, handle] : byOffset) {
+            Mesh& mesh = _meshes[handle];
+            const uint32_t size = sizeOf(mesh, stream);
+            const size_t bytes = size_t(size) * _stride[s];
+            if (moved + bytes > maxBytes && moved > 0) {
+                break;
+            }
+            if (_allocators[s].largestFree() < size) {
+                continue;
+            }
+            const uint32_t destination = _allocators[s].allocateBelow(size, offset);
+            if (destination == RangeAllocator::kInvalidOffset) {
+                continue;
+            }
+            _pBackend->copy(stream, size_t(offset) * _stride[s], size_t(destination) * _stride[s], bytes);
+            retire(stream, offset, size);
+            offsetOf(mesh, stream) = destination;
+            moved += bytes;
+            ++_stats.movedMeshes;
+            _stats.movedBytes += bytes;
+        }
+    }
+    return moved;
+}
+
+size_t GeometryPool::shrinkToFit() {
+    size_t released = 0;
+    for (size_t s = 0; s < 2; ++s) {
+        RangeAllocator& allocator = _allocators[s];
+        const uint32_t end = allocator.end();
+        // An empty stream keeps its storage; backends need not support zero-length buffers.
+        if (end == 0 || end == allocator.capacity() || !_pBackend->resize(static_cast<Stream>(s), size_t(end) * _stride[s])) {
+            continue;
+        }
+        released += size_t(allocator.capacity() - end) * _stride[s];
+        allocator.shrink(end);
+    }
+    return released;
+}
+
+PoolStats GeometryPool::stats() const {
+    PoolStats stats = _stats;
+    for (size_t s = 0; s < 2; ++s) {
+        const RangeAllocator& allocator = _allocators[s];
+        stats.capacity[s] = allocator.capacity();
+        stats.pending[s] = _pendingSize[s];
+        stats.used[s] = allocator.used() - _pendingSize[s];
+        stats.end[s] = allocator.end();
+        stats.largestFree[s] = allocator.largestFree();
+        stats.freeRanges[s] = allocator.freeRangeCount();
+    }
+    return stats;
+}
+}
@@ -0,0 +1,168 @@
+//
+//  GeometryPool.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef GeometryPool_hpp
+#define GeometryPool_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace geometry_pool {
+    /**
+     * Free list over [0, capacity) in elements. Best fit by size, with neighbouring free ranges merged on free, so
+     * a steady churn of similar sizes keeps reusing the same holes.
+     */
+    class RangeAllocator {
+    public:
+        static constexpr uint32_t kInvalidOffset = UINT32_MAX;
+
+        explicit RangeAllocator(uint32_t capacity = 0);
+
+        uint32_t allocate(uint32_t size);
+        // The lowest free range that fits and ends at or below limit; for compaction.
+        uint32_t allocateBelow(uint32_t size, uint32_t limit);
+        void free(uint32_t offset, uint32_t size);
+        // Adds [capacity, newCapacity) as free space.
+        void grow(uint32_t newCapacity);
+        // Removes [newCapacity, capacity), which has to be free; false if it is not.
+        bool shrink(uint32_t newCapacity);
+
+        uint32_t capacity() const { return _capacity; }
+        uint32_t used() const { return _used; }
+        uint32_t largestFree() const;
+        size_t freeRangeCount() const { return _freeByOffset.size(); }
+        // One past the last allocated element.
+        uint32_t end() const;
+
+    private:
+        void insertFree(uint32_t offset, uint32_t size);
+        void eraseFree(std::map<uint32_t, uint32_t>::iterator it);
+        void take(std::map<uint32_t, uint32_t>::iterator it, uint32_t size);
+
+        uint32_t _capacity;
+        uint32_t _used;
+        std::map<uint32_t, uint32_t> _freeByOffset;          // offset -> size
+        std::set<std::pair<uint32_t, uint32_t>> _freeBySize; // (size, offset)
+    };
+
+    enum class Stream : uint8_t {
+        Vertices,
+        Indices,
+        Count
+    };
+
+    /**
+     * Storage of the two streams. On device these are shared MTL::Buffers; moves are memcpy since the pool never
+     * writes a range that a frame in flight may still read.
+     */
+    class PoolBackend {
+    public:
+        virtual ~PoolBackend() = default;
+        // Makes the stream bytes long, keeping the contents that fit. May replace the underlying buffer.
+        virtual bool resize(Stream stream, size_t bytes) = 0;
+        virtual void write(Stream stream, size_t offset, const void* pData, size_t size) = 0;
+        // The two ranges never overlap.
+        virtual void copy(Stream stream, size_t sourceOffset, size_t destinationOffset, size_t size) = 0;
+    };
+
+    using MeshHandle = uint32_t;
+    static constexpr MeshHandle kInvalidMesh = UINT32_MAX;
+
+    // What a draw needs: indices are relative to the mesh, so they go with baseVertex.
+    struct MeshRange {
+        uint32_t baseVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    struct PoolStats {
+        size_t meshCount = 0;
+        uint64_t growths = 0;
+        uint64_t movedMeshes = 0;
+        uint64_t movedBytes = 0;
+        uint32_t capacity[2] = {}; // in elements, per Stream
+        uint32_t used[2] = {};
+        uint32_t pending[2] = {}; // freed but possibly still read by a frame in flight
+        uint32_t end[2] = {};
+        uint32_t largestFree[2] = {};
+        size_t freeRanges[2] = {};
+
+        // 0 when all free space is one range, towards 1 as it splinters.
+        float fragmentation(Stream stream) const;
+    };
+
+    /**
+     * One vertex stream and one index stream shared by every mesh of a vertex layout, so a frame binds them once
+     * and each mesh is a draw with its own baseVertex and index offset. Meshes are added and removed at any time;
+     * freed ranges return to the allocator only after framesInFlight calls to advanceFrame(), when no frame can
+     * still be reading them. A full stream grows, and compact() moves meshes down into lower holes a byte budget
+     * at a time, so the free space collects at the top again.
+     */
+    class GeometryPool {
+    public:
+        GeometryPool(PoolBackend* pBackend, uint32_t vertexStride, uint32_t indexSize, uint32_t vertexCapacity, uint32_t indexCapacity,
+                     uint32_t framesInFlight);
+
+        // pVertices holds vertexCount vertices at the pool's stride and pIndices indexCount indices of its index
+        // size, relative to the mesh's first vertex. kInvalidMesh if the backend cannot grow.
+        MeshHandle addMesh(const void* pVertices, uint32_t vertexCount, const void* pIndices, uint32_t indexCount);
+        void removeMesh(MeshHandle handle);
+        // Keeps count of the mesh's indices from first on and retires the rest as removeMesh would, e.g. the finest
+        // levels of a LOD chain, which lead its indices. The kept indices stay where they are.
+        void trimIndices(MeshHandle handle, uint32_t first, uint32_t count);
+        const MeshRange& range(MeshHandle handle) const { return _meshes[handle].range; }
+
+        // Once per frame, before recording it.
+        void advanceFrame();
+        // Moves meshes from the top of each stream into the lowest hole that fits, until maxBytes have moved.
+        // Returns the bytes moved; ranges change, so draws read them after this.
+        size_t compact(size_t maxBytes);
+        // Cuts each stream back to its last allocated element, once compaction has collected the free space above
+        // it. The backend replaces its buffers as when growing. Returns the bytes given back.
+        size_t shrinkToFit();
+
+        uint32_t vertexStride() const { return _stride[0]; }
+        uint32_t indexSize() const { return _stride[1]; }
+        PoolStats stats() const;
+
+    private:
+        struct Mesh {
+            MeshRange range;
+            bool live;
+        };
+
+        struct PendingFree {
+            uint64_t frame;
+            Stream stream;
+            uint32_t offset;
+            uint32_t size;
+        };
+
+        uint32_t allocate(Stream stream, uint32_t size);
+        void retire(Stream stream, uint32_t offset, uint32_t size);
+        uint32_t& offsetOf(Mesh& mesh, Stream stream);
+        uint32_t sizeOf(const Mesh& mesh, Stream stream) const;
+
+        PoolBackend* _pBackend;
+        uint32_t _stride[2];
+        uint32_t _framesInFlight;
+        uint64_t _frame;
+        RangeAllocator _allocators[2];
+        std::vector<Mesh> _meshes;
+        std::vector<MeshHandle> _freeHandles;
+        std::vector<PendingFree> _pending;
+        uint32_t _pendingSize[2];
+        PoolStats _stats;
+    };
+}
+
+#endif /* GeometryPool_hpp */
@@ -0,0 +1,27 @@
+//
+//  Hash.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef Hash_hpp
+#define Hash_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hashing {
+    // 64-bit FNV-1a over size bytes, continuing from hash so fields can be chained. Stable across runs and builds,
+    // which pipeline keys and mesh cache files rely on.
+    inline uint64_t fnv1a(const void* pData, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+        const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= pBytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+}
+
+#endif /* Hash_hpp */
@@ -0,0 +1,289 @@
+//
+//  MappedMesh.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/21.
+//
+
+#include "MappedMesh.hpp"
+#include "Hash.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mesh_io {
+size_t pageSize() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+size_t alignToPage(size_t size) {
+    const size_t page = pageSize();
+    return (size + page - 1) / page * page;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char* path) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(st.st_size);
+    const size_t mappedLength = alignToPage(size);
+    // Private writable mapping: the GPU only reads it, and copy-on-write keeps the file untouched.
+    void* pData = mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (pData == MAP_FAILED) {
+        return false;
+    }
+
+    _pData = pData;
+    _size = size;
+    _mappedLength = mappedLength;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_pData) {
+        munmap(_pData, _mappedLength);
+    }
+    _pData = nullptr;
+    _size = 0;
+    _mappedLength = 0;
+}
+
+static bool fail(std::string* pError, const std::string& message) {
+    if (pError) {
+        *pError = message;
+    }
+    return false;
+}
+
+// Fixed rather than the host page size: files written on a 4 KiB-page machine must stay valid on 16 KiB-page iOS.
+static constexpr uint64_t kSectionAlignment = 16 * 1024;
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+}
+
+static uint64_t hashSections(const MeshSection* pSections, uint32_t sectionCount, const void* const* ppData) {
+    uint64_t h = hashing::fnv1a(&sectionCount, sizeof(sectionCount));
+    for (uint32_t i = 0; i < sectionCount; ++i) {
+        h = hashing::fnv1a(&pSections[i], sizeof(MeshSection), h);
+        h = hashing::fnv1a(ppData[i], pSections[i].count * pSections[i].elementSize, h);
+    }
+    return h;
+}
+
+bool MappedMesh::load(const char* path) {
+    if (!_file.open(path)) {
+        return false;
+    }
+
+    const size_t size = _file.size();
+    const MeshFileHeader& h = header();
+    if (size < sizeof(MeshFileHeader) || h.magic != kMeshFileMagic) {
+        __builtin_printf("Invalid mesh file: %s\n", path);
+        _file.close();
+        return false;
+    }
+    if (h.version != kMeshFileVersion) {
+        __builtin_printf("Mesh file %s has version %u, expected %u; rebuild it with mesh-convert\n", path, h.version, kMeshFileVersion);
+        _file.close();
+        return false;
+    }
+
+    const uint64_t tableEnd = sizeof(MeshFileHeader) + uint64_t(h.sectionCount) * sizeof(MeshSection);
+    bool valid = h.fileSize == size && tableEnd <= size;
+    for (uint32_t i = 0; valid && i < h.sectionCount; ++i) {
+        const MeshSection& section = sections()[i];
+        valid = section.elementSize != 0
+            && section.offset % kSectionAlignment == 0
+            && section.offset >= tableEnd
+            && section.offset <= size
+            && section.count <= (size - section.offset) / section.elementSize
+            && (section.type != SectionType::Indices || section.elementSize == 2 || section.elementSize == 4);
+    }
+
+    if (!valid) {
+        __builtin_printf("Invalid mesh file: %s\n", path);
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedMesh::verify() const {
+    const MeshFileHeader& h = header();
+    std::vector<const void*> data(h.sectionCount);
+    for (uint32_t i = 0; i < h.sectionCount; ++i) {
+        data[i] = sectionData(sections()[i]);
+    }
+    return hashSections(sections(), h.sectionCount, data.data()) == h.contentHash;
+}
+
+const MeshSection* MappedMesh::findSection(SectionType type, uint32_t index) const {
+    for (uint32_t i = 0; i < header().sectionCount; ++i) {
+        if (sections()[i].type == type && index-- == 0) {
+            return &sections()[i];
+        }
+    }
+    return nullptr;
+}
+
+bool writeMeshFile(const char* path, const std::vector<SectionData>& sections, uint64_t sourceHash, std::string* pError) {
+    const uint32_t sectionCount = static_cast<uint32_t>(sections.size());
+    std::vector<MeshSection> table(sectionCount);
+    std::vector<const void*> data(sectionCount);
+    uint64_t end = sizeof(MeshFileHeader) + uint64_t(sectionCount) * sizeof(MeshSection);
+    for (uint32_t i = 0; i < sectionCount; ++i) {
+        const SectionData& in = sections[i];
+        if (in.elementSize == 0 || (in.count != 0 && in.pData == nullptr)) {
+            return fail(pError, "section " + std::to_string(i) + " has no element size or data");
+        }
+        table[i] = MeshSection { in.type, in.elementSize, in.attributes, 0, in.count, alignSection(end) };
+        data[i] = in.pData;
+        end = table[i].offset + in.count * in.elementSize;
+    }
+
+    MeshFileHeader h = {};
+    h.magic = kMeshFileMagic;
+    h.version = kMeshFileVersion;
+    h.sectionCount = sectionCount;
+    h.fileSize = end;
+    h.sourceHash = sourceHash;
+    h.contentHash = hashSections(table.data(), sectionCount, data.data());
+
+    const std::string temporaryPath = std::string(path) + ".tmp";
+    FILE* pFile = fopen(temporaryPath.c_str(), "wb");
+    if (!pFile) {
+        return fail(pError, std::string("cannot write ") + temporaryPath);
+    }
+
+    std::vector<uint8_t> zeros(kSectionAlignment, 0);
+    bool ok = fwrite(&h, 1, sizeof(h), pFile) == sizeof(h);
+    ok = ok && fwrite(table.data(), sizeof(MeshSection), sectionCount, pFile) == sectionCount;
+    uint64_t written = sizeof(MeshFileHeader) + uint64_t(sectionCount) * sizeof(MeshSection);
+    for (uint32_t i = 0; ok && i < sectionCount; ++i) {
+        const size_t padding = table[i].offset - written;
+        const size_t bytes = table[i].count * table[i].elementSize;
+        ok = fwrite(zeros.data(), 1, padding, pFile) == padding
+            && fwrite(data[i], 1, bytes, pFile) == bytes;
+        written = table[i].offset + bytes;
+    }
+
+    ok = fclose(pFile) == 0 && ok;
+    if (!ok || std::rename(temporaryPath.c_str(), path) != 0) {
+        std::remove(temporaryPath.c_str());
+        return fail(pError, std::string("cannot write ") + path);
+    }
+    return true;
+}
+
+uint64_t hashFile(const char* path) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return 0;
+    }
+    return hashing::fnv1a(file.data(), file.size());
+}
+
+uint64_t fileStamp(const char* path) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    const int64_t modified = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    const int64_t modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    const int64_t size = info.st_size;
+    return hashing::fnv1a(&modified, sizeof(modified), hashing::fnv1a(&size, sizeof(size)));
+}
+
+double benchmarkLoad(const std::vector<std::string>& paths, LoadMethod method, uint64_t* pBytesOut) {
+    using Clock = std::chrono::steady_clock;
+
+    const size_t page = pageSize();
+    volatile uint8_t sink = 0;
+    uint64_t bytes = 0;
+
+    const Clock::time_point start = Clock::now();
+    for (const std::string& path : paths) {
+        if (method == LoadMethod::ReadCopy) {
+            // read() into a staging allocation, then memcpy into the buffer, as buildBuffers does today.
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                continue;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                // Nothing to read, and nothing the mmap path would map either.
+                close(fd);
+                continue;
+            }
+            const size_t size = static_cast<size_t>(st.st_size);
+            uint8_t* pStaging = static_cast<uint8_t*>(malloc(size));
+            uint8_t* pBuffer = static_cast<uint8_t*>(malloc(size));
+            size_t offset = 0;
+            while (offset < size) {
+                ssize_t n = read(fd, pStaging + offset, size - offset);
+                if (n <= 0) {
+                    break;
+                }
+                offset += static_cast<size_t>(n);
+            }
+            close(fd);
+            memcpy(pBuffer, pStaging, offset);
+            if (offset > 0) {
+                sink = sink + pBuffer[offset / 2];
+            }
+            free(pStaging);
+            free(pBuffer);
+            bytes += offset;
+        } else {
+            // Map and fault in every page, which is the most the no-copy buffer path can cost.
+            MappedFile file;
+            if (!file.open(path.c_str())) {
+                continue;
+            }
+            const uint8_t* pData = static_cast<const uint8_t*>(file.data());
+            for (size_t i = 0; i < file.size(); i += page) {
+                sink = sink + pData[i];
+            }
+            bytes += file.size();
+        }
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (pBytesOut) {
+        *pBytesOut = bytes;
+    }
+    return seconds;
+}
+
+void printBenchmark(const std::vector<std::string>& paths, LoadMethod method) {
+    uint64_t bytes = 0;
+    const double seconds = benchmarkLoad(paths, method, &bytes);
+    const double gb = bytes / (1024.0 * 1024.0 * 1024.0);
+    __builtin_printf("%s: %.2f GB in %.3f s (%.2f GB/s)\n", method == LoadMethod::ReadCopy ? "read+memcpy" : "mmap", gb, seconds, seconds > 0.0 ? gb / seconds : 0.0);
+}
+}
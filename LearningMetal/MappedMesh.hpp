@@ -0,0 +1,135 @@
+//
+//  MappedMesh.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/21.
+//
+
+#ifndef MappedMesh_hpp
+#define MappedMesh_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mesh_io {
+    static constexpr uint32_t kMeshFileMagic = 0x48534d4c; // 'LMSH'
+    // 2: section table replaced the fixed vertex/index header of version 1.
+    static constexpr uint32_t kMeshFileVersion = 2;
+
+    enum class SectionType : uint32_t {
+        Vertices = 1,         // one per vertex stream; attributes holds mesh_import::AttributeBits
+        Indices = 2,          // elementSize 2 or 4
+        Meshlets = 3,         // meshlet_builder::Meshlet
+        MeshletVertices = 4,  // uint32 vertex indices
+        MeshletTriangles = 5, // bytes, three per triangle
+        Lods = 6,             // mesh_simplify::LodLevel, ranges of the Indices section
+        VertexFormats = 7     // one StreamFormat per Vertices section, in the same order
+    };
+
+    struct MeshSection {
+        SectionType type;
+        uint32_t elementSize;
+        uint32_t attributes;
+        uint32_t reserved;
+        uint64_t count;
+        uint64_t offset; // from the start of the file
+    };
+
+    struct StreamFormat {
+        uint32_t formats[3]; // MTL::VertexFormat of position, normal and texCoord; 0 if absent
+        uint32_t offsets[3];
+        float positionMin[3];
+        float positionExtent[3];
+    };
+
+    /**
+     * First page of a mesh file, followed by sectionCount MeshSection entries. Sections start on 16 KiB
+     * boundaries, a multiple of every Apple page size, so the whole mapping can be wrapped as a single no-copy
+     * buffer and bound at the section offsets. contentHash covers the section table and every section's bytes; sourceHash identifies
+     * whatever the file was built from, so a cache can tell when it is stale.
+     */
+    struct MeshFileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t sectionCount;
+        uint32_t reserved;
+        uint64_t fileSize;
+        uint64_t sourceHash;
+        uint64_t contentHash;
+    };
+
+    size_t pageSize();
+    size_t alignToPage(size_t size);
+
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const char* path);
+        void close();
+
+        bool isOpen() const { return _pData != nullptr; }
+        void* data() const { return _pData; }
+        size_t size() const { return _size; }
+        // Page-rounded length, as required by newBufferWithBytesNoCopy.
+        size_t mappedLength() const { return _mappedLength; }
+
+    private:
+        void* _pData = nullptr;
+        size_t _size = 0;
+        size_t _mappedLength = 0;
+    };
+
+    class MappedMesh {
+    public:
+        // Maps the file and checks the header and section bounds; section bytes are not touched.
+        bool load(const char* path);
+        void unload() { _file.close(); }
+        // Recomputes contentHash, which reads every page.
+        bool verify() const;
+
+        bool isLoaded() const { return _file.isOpen(); }
+        const MeshFileHeader& header() const { return *static_cast<const MeshFileHeader*>(_file.data()); }
+        const MeshSection* sections() const { return reinterpret_cast<const MeshSection*>(&header() + 1); }
+        // The index-th section of the given type, or nullptr.
+        const MeshSection* findSection(SectionType type, uint32_t index = 0) const;
+        const void* sectionData(const MeshSection& section) const { return static_cast<const uint8_t*>(_file.data()) + section.offset; }
+        const MappedFile& file() const { return _file; }
+
+    private:
+        MappedFile _file;
+    };
+
+    struct SectionData {
+        SectionType type;
+        uint32_t elementSize;
+        uint32_t attributes;
+        uint64_t count;
+        const void* pData;
+    };
+
+    // Writes to a temporary file and renames it over path, so a reader never maps a partial file.
+    bool writeMeshFile(const char* path, const std::vector<SectionData>& sections, uint64_t sourceHash, std::string* pError = nullptr);
+
+    // Hash of a file's bytes; 0 if it cannot be read.
+    uint64_t hashFile(const char* path);
+    // Hash of a file's size and modification time, for runtime caches that must not read the source; 0 if missing.
+    uint64_t fileStamp(const char* path);
+
+    enum class LoadMethod {
+        ReadCopy,
+        Mmap
+    };
+
+    // Returns the seconds taken to load every file with the given method. Run each method in a
+    // separate process on a cold page cache, otherwise the second run reads from memory.
+    double benchmarkLoad(const std::vector<std::string>& paths, LoadMethod method, uint64_t* pBytesOut = nullptr);
+    void printBenchmark(const std::vector<std::string>& paths, LoadMethod method);
+}
+
+#endif /* MappedMesh_hpp */
@@ -0,0 +1,156 @@
+//
+//  MaterialGraph.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+#include "MaterialGraph.hpp"
+#include "Hash.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace material_graph {
+NodeId MaterialGraph::input(uint32_t argumentIndex) {
+    for (NodeId i = 0; i < _nodes.size(); ++i) {
+        if (_nodes[i].kind == Node::Kind::Input && _nodes[i].argumentIndex == argumentIndex) {
+            return i;
+        }
+    }
+    _nodes.push_back(Node { Node::Kind::Input, argumentIndex, std::string(), {} });
+    return static_cast<NodeId>(_nodes.size() - 1);
+}
+
+NodeId MaterialGraph::call(const std::string& function, const std::vector<NodeId>& arguments) {
+    assert(std::all_of(arguments.begin(), arguments.end(), [&](NodeId argument) { return argument < _nodes.size(); }));
+    _nodes.push_back(Node { Node::Kind::Function, 0, function, arguments });
+    return static_cast<NodeId>(_nodes.size() - 1);
+}
+
+bool MaterialGraph::validate(std::string* pError) const {
+    auto fail = [pError](const std::string& message) {
+        if (pError) {
+            *pError = message;
+        }
+        return false;
+    };
+
+    if (_functionName.empty()) {
+        return fail("stitched function has no name");
+    }
+    if (_output >= _nodes.size() || _nodes[_output].kind != Node::Kind::Function) {
+        return fail("output must be a function node");
+    }
+    for (NodeId i = 0; i < _nodes.size(); ++i) {
+        const Node& node = _nodes[i];
+        if (node.kind == Node::Kind::Function && node.function.empty()) {
+            return fail("function node " + std::to_string(i) + " has no function");
+        }
+        for (NodeId argument : node.arguments) {
+            if (argument >= i) {
+                return fail("node " + std::to_string(i) + " uses a later node");
+            }
+        }
+    }
+
+    // Stitched function arguments are numbered by the input nodes, so they must be 0..n-1 without gaps.
+    std::vector<bool> used;
+    for (const Node& node : _nodes) {
+        if (node.kind == Node::Kind::Input) {
+            used.resize(std::max<size_t>(used.size(), node.argumentIndex + 1));
+            used[node.argumentIndex] = true;
+        }
+    }
+    for (size_t i = 0; i < used.size(); ++i) {
+        if (!used[i]) {
+            return fail("argument " + std::to_string(i) + " has no input node");
+        }
+    }
+    return true;
+}
+
+uint64_t MaterialGraph::hashNode(NodeId node, std::vector<uint64_t>& memo) const {
+    if (memo[node] != 0) {
+        return memo[node];
+    }
+    const Node& n = _nodes[node];
+    uint64_t h = hashing::fnv1a(&n.kind, sizeof(n.kind));
+    if (n.kind == Node::Kind::Input) {
+        h = hashing::fnv1a(&n.argumentIndex, sizeof(n.argumentIndex), h);
+    } else {
+        const uint32_t length = static_cast<uint32_t>(n.function.size());
+        h = hashing::fnv1a(&length, sizeof(length), h);
+        h = hashing::fnv1a(n.function.data(), n.function.size(), h);
+        const uint32_t argumentCount = static_cast<uint32_t>(n.arguments.size());
+        h = hashing::fnv1a(&argumentCount, sizeof(argumentCount), h);
+        for (NodeId argument : n.arguments) {
+            // A forward reference only exists in a graph validate() rejects; hashing it by index keeps a cycle finite.
+            const uint64_t argumentHash = argument < node ? hashNode(argument, memo) : argument;
+            h = hashing::fnv1a(&argumentHash, sizeof(argumentHash), h);
+        }
+    }
+    memo[node] = h == 0 ? 1 : h; // 0 marks "not computed yet"
+    return memo[node];
+}
+
+uint64_t MaterialGraph::hash() const {
+    uint64_t h = hashing::fnv1a(_functionName.data(), _functionName.size());
+    if (_output < _nodes.size()) {
+        std::vector<uint64_t> memo(_nodes.size(), 0);
+        const uint64_t outputHash = hashNode(_output, memo);
+        h = hashing::fnv1a(&outputHash, sizeof(outputHash), h);
+    }
+    return h;
+}
+
+std::vector<NodeId> MaterialGraph::reachableFunctionNodes() const {
+    std::vector<NodeId> order;
+    if (_output >= _nodes.size()) {
+        return order;
+    }
+    std::vector<bool> reachable(_nodes.size(), false);
+    reachable[_output] = true;
+    // Arguments always precede their users, so one backwards sweep marks everything the output depends on.
+    for (NodeId i = _output + 1; i-- > 0;) {
+        if (reachable[i]) {
+            for (NodeId argument : _nodes[i].arguments) {
+                reachable[argument] = true;
+            }
+        }
+    }
+    for (NodeId i = 0; i <= _output; ++i) {
+        if (reachable[i] && _nodes[i].kind == Node::Kind::Function) {
+            order.push_back(i);
+        }
+    }
+    return order;
+}
+
+std::vector<std::string> MaterialGraph::functionNames() const {
+    std::vector<std::string> names;
+    for (NodeId node : reachableFunctionNodes()) {
+        if (std::find(names.begin(), names.end(), _nodes[node].function) == names.end()) {
+            names.push_back(_nodes[node].function);
+        }
+    }
+    return names;
+}
+
+std::string MaterialGraph::describeNode(NodeId node) const {
+    const Node& n = _nodes[node];
+    if (n.kind == Node::Kind::Input) {
+        return "in" + std::to_string(n.argumentIndex);
+    }
+    std::string text = n.function + "(";
+    for (size_t i = 0; i < n.arguments.size(); ++i) {
+        const NodeId argument = n.arguments[i];
+        // Forward references, which validate() rejects, are shown rather than followed.
+        text += (i > 0 ? ", " : "") + (argument < node ? describeNode(argument) : "<node " + std::to_string(argument) + ">");
+    }
+    return text + ")";
+}
+
+std::string MaterialGraph::describe() const {
+    return _output < _nodes.size() ? _functionName + " = " + describeNode(_output) : _functionName + " = <no output>";
+}
+}
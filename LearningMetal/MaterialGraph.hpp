@@ -0,0 +1,151 @@
+//
+//  MaterialGraph.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+#ifndef MaterialGraph_hpp
+#define MaterialGraph_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace material_graph {
+    using NodeId = uint32_t;
+
+    struct Node {
+        enum class Kind : uint8_t {
+            Input,   // an argument of the stitched function
+            Function // a call to a [[stitchable]] function in the shader library
+        };
+
+        Kind kind;
+        uint32_t argumentIndex;
+        std::string function;
+        std::vector<NodeId> arguments;
+    };
+
+    /**
+     * A material as a graph of calls to precompiled [[stitchable]] building blocks, mirroring
+     * MTL::FunctionStitchingGraph. Nodes can only refer to nodes created before them, so the graph is acyclic by
+     * construction. The hash is structural: two graphs computing the same expression hash equal whatever order
+     * their nodes were added in. It is defined for invalid graphs too, so failures can be remembered by hash.
+     */
+    class MaterialGraph {
+    public:
+        explicit MaterialGraph(std::string functionName): _functionName(std::move(functionName)) {}
+
+        NodeId input(uint32_t argumentIndex);
+        NodeId call(const std::string& function, const std::vector<NodeId>& arguments);
+        void setOutput(NodeId node) { _output = node; }
+
+        // Checks what the stitching compiler would otherwise reject on device.
+        bool validate(std::string* pError = nullptr) const;
+        uint64_t hash() const;
+        // Function nodes reachable from the output, in an order where arguments come before their users.
+        std::vector<NodeId> reachableFunctionNodes() const;
+        // Distinct building blocks the graph calls, which the stitched library must be given.
+        std::vector<std::string> functionNames() const;
+        // The graph as an expression, e.g. "materialTint(materialGrayscale(in0), in2)".
+        std::string describe() const;
+
+        const std::string& functionName() const { return _functionName; }
+        const std::vector<Node>& nodes() const { return _nodes; }
+        NodeId output() const { return _output; }
+
+    private:
+        uint64_t hashNode(NodeId node, std::vector<uint64_t>& memo) const;
+        std::string describeNode(NodeId node) const;
+
+        std::string _functionName;
+        std::vector<Node> _nodes;
+        NodeId _output = UINT32_MAX;
+    };
+
+    struct MaterialCacheStats {
+        uint64_t hits = 0;
+        uint64_t builds = 0;
+        uint64_t failures = 0;       // distinct graphs that failed to validate or stitch
+        uint64_t failureHits = 0;    // requests for a graph that already failed, answered without trying again
+        double buildSeconds = 0.0;
+    };
+
+    /**
+     * Stitched functions keyed by graph hash, so each distinct material is stitched once. The stitcher is a callback,
+     * an MTL::Device stitched-library build on device and a stub elsewhere. The cache owns the returned functions.
+     * Failures are remembered too: a broken graph is reported and attempted once.
+     */
+    template <typename Function>
+    class MaterialCache {
+    public:
+        using Stitcher = std::function<Function*(const MaterialGraph& graph)>;
+        using Releaser = std::function<void(Function* pFunction)>;
+
+        MaterialCache(Stitcher stitch, Releaser release): _stitch(std::move(stitch)), _release(std::move(release)) {}
+
+        ~MaterialCache() {
+            for (auto& [hash, pFunction] : _functions) {
+                _release(pFunction);
+            }
+        }
+
+        MaterialCache(const MaterialCache&) = delete;
+        MaterialCache& operator=(const MaterialCache&) = delete;
+
+        Function* find(uint64_t hash) const {
+            auto it = _functions.find(hash);
+            return it == _functions.end() ? nullptr : it->second;
+        }
+
+        Function* getOrCreate(const MaterialGraph& graph) {
+            const uint64_t hash = graph.hash();
+            if (Function* pFunction = find(hash)) {
+                ++_stats.hits;
+                return pFunction;
+            }
+            if (_failed.count(hash) > 0) {
+                ++_stats.failureHits;
+                return nullptr;
+            }
+
+            std::string error;
+            if (!graph.validate(&error)) {
+                __builtin_printf("Material graph %s: %s\n", graph.describe().c_str(), error.c_str());
+                ++_stats.failures;
+                _failed.insert(hash);
+                return nullptr;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            Function* pFunction = _stitch(graph);
+            _stats.buildSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (pFunction == nullptr) {
+                ++_stats.failures;
+                _failed.insert(hash);
+                return nullptr;
+            }
+            ++_stats.builds;
+            _functions.emplace(hash, pFunction);
+            return pFunction;
+        }
+
+        size_t size() const { return _functions.size(); }
+        const MaterialCacheStats& stats() const { return _stats; }
+
+    private:
+        Stitcher _stitch;
+        Releaser _release;
+        // Keyed by hash alone: with 64 bits, collisions only become likely around 2^32 distinct materials.
+        std::unordered_map<uint64_t, Function*> _functions;
+        std::unordered_set<uint64_t> _failed;
+        MaterialCacheStats _stats;
+    };
+}
+
+#endif /* MaterialGraph_hpp */
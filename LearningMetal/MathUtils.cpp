@@ -84,4 +84,17 @@ simd::float4x4 makeScale(const simd::float3& v) {
                        (float4) { 0, 0, v.z, 0 },
                        (float4) { 0, 0, 0, 1.0 });
 }
+
+void makeFrustumPlanes(const simd::float4x4& viewProjection, simd::float4 planes[6]) {
+    const simd::float4x4 rows = simd_transpose(viewProjection);
+    planes[0] = rows.columns[3] + rows.columns[0];
+    planes[1] = rows.columns[3] - rows.columns[0];
+    planes[2] = rows.columns[3] + rows.columns[1];
+    planes[3] = rows.columns[3] - rows.columns[1];
+    planes[4] = rows.columns[2];
+    planes[5] = rows.columns[3] - rows.columns[2];
+    for (int i = 0; i < 6; ++i) {
+        planes[i] /= simd_length(planes[i].xyz);
+    }
+}
 }
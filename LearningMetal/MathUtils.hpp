@@ -19,6 +19,8 @@ namespace math_utils {
     simd::float4x4 makeZRotate(float angleRadians);
     simd::float4x4 makeTranslate(const simd::float3& v);
     simd::float4x4 makeScale(const simd::float3& v);
+    // Normalized planes facing into the clip volume of makePerspective (0 <= z <= w): left, right, bottom, top, near, far.
+    void makeFrustumPlanes(const simd::float4x4& viewProjection, simd::float4 planes[6]);
 }
 
 #endif /* MyMath_hpp */
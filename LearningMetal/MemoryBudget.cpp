@@ -0,0 +1,160 @@
+//
+//  MemoryBudget.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/20.
+//
+
+#include "MemoryBudget.hpp"
+#include <algorithm>
+
+namespace memory_budget {
+const char* categoryName(Category category) {
+    switch (category) {
+        case Category::VertexData: return "vertex";
+        case Category::IndexData: return "index";
+        case Category::Uniforms: return "uniforms";
+        case Category::Texture: return "texture";
+        case Category::Heap: return "heap";
+        case Category::Staging: return "staging";
+        case Category::Count: break;
+    }
+    return "unknown";
+}
+
+MemoryBudget::MemoryBudget(uint64_t budgetBytes, float highWatermark, float lowWatermark): _budget(budgetBytes), _highWatermark(highWatermark), _lowWatermark(std::min(lowWatermark, highWatermark)) {
+
+}
+
+void MemoryBudget::setBudget(uint64_t budgetBytes) {
+    _budget = budgetBytes;
+    _warned = false;
+}
+
+AllocationId MemoryBudget::track(Category category, uint64_t bytes, const char* label, int priority, EvictionHandler evict) {
+    AllocationId id = _nextId++;
+    _allocations.emplace(id, Allocation { category, bytes, label ? label : "", priority, 0, std::move(evict), false, false });
+    _total += bytes;
+    _perCategory[static_cast<size_t>(category)] += bytes;
+    return id;
+}
+
+void MemoryBudget::resize(AllocationId id, uint64_t bytes) {
+    auto it = _allocations.find(id);
+    if (it == _allocations.end()) {
+        return;
+    }
+    Allocation& allocation = it->second;
+    _total = _total - allocation.bytes + bytes;
+    _perCategory[static_cast<size_t>(allocation.category)] += bytes - allocation.bytes;
+    if (bytes > allocation.bytes) {
+        // The owner made the resource resident again, so it may be evicted again later.
+        allocation.purged = false;
+        allocation.lodDropped = false;
+    }
+    allocation.bytes = bytes;
+}
+
+void MemoryBudget::untrack(AllocationId id) {
+    auto it = _allocations.find(id);
+    if (it == _allocations.end()) {
+        return;
+    }
+    release(it->second, it->second.bytes);
+    _allocations.erase(it);
+}
+
+void MemoryBudget::touch(AllocationId id, uint64_t frameIndex) {
+    auto it = _allocations.find(id);
+    if (it == _allocations.end()) {
+        return;
+    }
+    it->second.lastUsedFrame = frameIndex;
+}
+
+void MemoryBudget::release(Allocation& allocation, uint64_t bytes) {
+    bytes = std::min(bytes, allocation.bytes);
+    allocation.bytes -= bytes;
+    _total -= bytes;
+    _perCategory[static_cast<size_t>(allocation.category)] -= bytes;
+}
+
+std::vector<AllocationId> MemoryBudget::evictionOrder(uint64_t frameIndex) const {
+    std::vector<AllocationId> order;
+    for (const auto& [id, allocation] : _allocations) {
+        if (allocation.evict && allocation.bytes > 0 && allocation.lastUsedFrame < frameIndex) {
+            order.push_back(id);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](AllocationId a, AllocationId b) {
+        const Allocation& lhs = _allocations.at(a);
+        const Allocation& rhs = _allocations.at(b);
+        if (lhs.priority != rhs.priority) {
+            return lhs.priority < rhs.priority;
+        }
+        if (lhs.lastUsedFrame != rhs.lastUsedFrame) {
+            return lhs.lastUsedFrame < rhs.lastUsedFrame;
+        }
+        return lhs.bytes > rhs.bytes;
+    });
+    return order;
+}
+
+EvictionReport MemoryBudget::enforce(uint64_t frameIndex) {
+    EvictionReport report;
+    report.bytesBefore = _total;
+    report.bytesAfter = _total;
+
+    if (!isOverBudget()) {
+        _warned = false;
+        return report;
+    }
+
+    if (!_warned) {
+        __builtin_printf("GPU memory over budget: %llu of %llu bytes\n", (unsigned long long)_total, (unsigned long long)_budget);
+        _warned = true;
+        report.warned = true;
+    }
+
+    const std::vector<AllocationId> order = evictionOrder(frameIndex);
+    const uint64_t target = lowWatermarkBytes();
+
+    for (EvictionAction action : { EvictionAction::MakePurgeable, EvictionAction::DropLod }) {
+        for (AllocationId id : order) {
+            if (_total <= target) {
+                break;
+            }
+            Allocation& allocation = _allocations.at(id);
+            if (action == EvictionAction::MakePurgeable && allocation.purged) {
+                continue;
+            }
+            if (action == EvictionAction::DropLod && allocation.lodDropped) {
+                continue;
+            }
+
+            const uint64_t reclaimed = allocation.evict(action);
+            if (reclaimed == 0) {
+                continue;
+            }
+            release(allocation, reclaimed);
+            if (action == EvictionAction::MakePurgeable) {
+                allocation.purged = true;
+                ++report.purgedCount;
+            } else {
+                allocation.lodDropped = true;
+                ++report.lodDropCount;
+            }
+        }
+    }
+
+    report.bytesAfter = _total;
+    return report;
+}
+
+void MemoryBudget::printReport() const {
+    __builtin_printf("GPU memory: %llu / %llu bytes\n", (unsigned long long)_total, (unsigned long long)_budget);
+    for (size_t i = 0; i < static_cast<size_t>(Category::Count); ++i) {
+        __builtin_printf("  %-10s %llu\n", categoryName(static_cast<Category>(i)), (unsigned long long)_perCategory[i]);
+    }
+}
+}
@@ -0,0 +1,108 @@
+//
+//  MemoryBudget.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/20.
+//
+
+#ifndef MemoryBudget_hpp
+#define MemoryBudget_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace memory_budget {
+    enum class Category : uint8_t {
+        VertexData,
+        IndexData,
+        Uniforms,
+        Texture,
+        Heap,
+        Staging,
+        Count
+    };
+
+    /**
+     * Eviction steps, cheapest first. Every allocation is offered MakePurgeable before any is asked to DropLod.
+     */
+    enum class EvictionAction : uint8_t {
+        MakePurgeable,
+        DropLod
+    };
+
+    using AllocationId = uint64_t;
+
+    // Returns the number of bytes the allocation no longer counts against the budget.
+    using EvictionHandler = std::function<uint64_t(EvictionAction action)>;
+
+    struct EvictionReport {
+        uint64_t bytesBefore = 0;
+        uint64_t bytesAfter = 0;
+        uint32_t purgedCount = 0;
+        uint32_t lodDropCount = 0;
+        bool warned = false; // this call printed the over-budget warning, once per excursion over the high watermark
+    };
+
+    const char* categoryName(Category category);
+
+    /**
+     * Tracks every GPU allocation by category and compares the total against a working-set budget,
+     * which on device comes from MTL::Device::recommendedMaxWorkingSetSize.
+     * Contains no Metal types so the policy can be driven with a simulated budget.
+     */
+    class MemoryBudget {
+    public:
+        explicit MemoryBudget(uint64_t budgetBytes, float highWatermark = 0.95f, float lowWatermark = 0.85f);
+
+        void setBudget(uint64_t budgetBytes);
+        uint64_t budget() const { return _budget; }
+
+        // Lower priority values are evicted first. Allocations without a handler are never evicted.
+        AllocationId track(Category category, uint64_t bytes, const char* label, int priority = 0, EvictionHandler evict = nullptr);
+        // Owners call this after restoring an evicted resource so it counts in full again.
+        void resize(AllocationId id, uint64_t bytes);
+        void untrack(AllocationId id);
+        void touch(AllocationId id, uint64_t frameIndex);
+
+        uint64_t allocatedBytes() const { return _total; }
+        uint64_t allocatedBytes(Category category) const { return _perCategory[static_cast<size_t>(category)]; }
+        bool isOverBudget() const { return _total > highWatermarkBytes(); }
+
+        // Runs once per frame. Evicts until usage is back under the low watermark; skips allocations used this frame.
+        EvictionReport enforce(uint64_t frameIndex);
+
+        void printReport() const;
+
+    private:
+        struct Allocation {
+            Category category;
+            uint64_t bytes;
+            std::string label;
+            int priority;
+            uint64_t lastUsedFrame;
+            EvictionHandler evict;
+            bool purged;
+            bool lodDropped;
+        };
+
+        uint64_t highWatermarkBytes() const { return static_cast<uint64_t>(_budget * _highWatermark); }
+        uint64_t lowWatermarkBytes() const { return static_cast<uint64_t>(_budget * _lowWatermark); }
+        void release(Allocation& allocation, uint64_t bytes);
+        std::vector<AllocationId> evictionOrder(uint64_t frameIndex) const;
+
+        uint64_t _budget;
+        float _highWatermark;
+        float _lowWatermark;
+        uint64_t _total = 0;
+        uint64_t _perCategory[static_cast<size_t>(Category::Count)] = {};
+        AllocationId _nextId = 1;
+        bool _warned = false;
+        std::unordered_map<AllocationId, Allocation> _allocations;
+    };
+}
+
+#endif /* MemoryBudget_hpp */
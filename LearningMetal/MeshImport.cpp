@@ -0,0 +1,1052 @@
+//
+//  MeshImport.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "MeshImport.hpp"
+#include "MappedMesh.hpp"
+#include "ParallelFor.hpp"
+#include "VertexQuantize.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+
+namespace mesh_import {
+void ImportedMesh::clear() {
+    positions.clear();
+    normals.clear();
+    texCoords.clear();
+    indices.clear();
+}
+
+static bool fail(std::string* pError, std::string message) {
+    if (pError) {
+        *pError = std::move(message);
+    }
+    return false;
+}
+
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* skipBlanks(const char* p, const char* end) {
+    while (p < end && isBlank(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Decimal numbers without locale lookups or a terminating NUL, which the mapped file does not have. Up to 19
+// significant digits are kept, enough for doubles read back from text and far beyond what float vertex data needs.
+static bool parseNumber(const char*& p, const char* end, double& out) {
+    static const double kPowersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        ++s;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; s < end && isDigit(*s); ++s) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*s - '0');
+            digits += mantissa != 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && isDigit(*s); ++s) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*s - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char* e = s + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            negativeExponent = *e == '-';
+            ++e;
+        }
+        if (e < end && isDigit(*e)) {
+            int value = 0;
+            for (; e < end && isDigit(*e); ++e) {
+                value = std::min(value * 10 + (*e - '0'), 100000);
+            }
+            exponent += negativeExponent ? -value : value;
+            s = e;
+        }
+    }
+
+    double value = static_cast<double>(mantissa);
+    if (mantissa != 0 && exponent != 0) {
+        if (exponent > 0) {
+            value *= exponent <= 22 ? kPowersOf10[exponent] : std::pow(10.0, exponent);
+        } else {
+            value /= -exponent <= 22 ? kPowersOf10[-exponent] : std::pow(10.0, -exponent);
+        }
+    }
+    out = negative ? -value : value;
+    p = s;
+    return true;
+}
+
+static bool parseFloat(const char*& p, const char* end, float& out) {
+    double value;
+    if (!parseNumber(p, end, value)) {
+        return false;
+    }
+    out = static_cast<float>(value);
+    return true;
+}
+
+static bool parseInteger(const char*& p, const char* end, int64_t& out) {
+    const char* s = p;
+    const bool negative = s < end && *s == '-';
+    if (negative || (s < end && *s == '+')) {
+        ++s;
+    }
+    if (s == end || !isDigit(*s)) {
+        return false;
+    }
+    int64_t value = 0;
+    for (; s < end && isDigit(*s); ++s) {
+        value = std::min<int64_t>(value * 10 + (*s - '0'), INT64_C(1) << 40);
+    }
+    out = negative ? -value : value;
+    p = s;
+    return true;
+}
+
+namespace {
+    // Face corners are stored as int32 triples before the chunks are stitched together. OBJ indices are 1-based and
+    // global, or negative and relative to the vertices read so far; a relative one can only be resolved once the
+    // chunk knows how many vertices came before it, so it is kept chunk-local, offset into the negative range.
+    constexpr int64_t kLocalBias = INT64_C(1) << 30;
+
+    struct ObjChunk {
+        std::vector<float> positions;
+        std::vector<float> normals;
+        std::vector<float> texCoords;
+        std::vector<int32_t> corners; // v, vt, vn per triangle corner; 0 when absent
+        bool usesTexCoords = false;
+        bool usesNormals = false;
+        std::string error;
+    };
+
+    struct ObjCorner {
+        int32_t v;
+        int32_t vt;
+        int32_t vn;
+    };
+}
+
+static bool encodeIndex(int64_t raw, size_t countInChunk, int32_t& out) {
+    if (raw > 0) {
+        if (raw > INT32_MAX) {
+            return false;
+        }
+        out = static_cast<int32_t>(raw);
+        return true;
+    }
+    const int64_t local = static_cast<int64_t>(countInChunk) + raw;
+    if (raw == 0 || local < -kLocalBias || local >= kLocalBias) {
+        return false;
+    }
+    out = static_cast<int32_t>(-(1 + local + kLocalBias));
+    return true;
+}
+
+// 0-based global index, or UINT32_MAX for an absent or out-of-range one.
+static uint32_t decodeIndex(int32_t encoded, size_t chunkBase, size_t total) {
+    int64_t index;
+    if (encoded > 0) {
+        index = encoded - 1;
+    } else if (encoded < 0) {
+        index = static_cast<int64_t>(chunkBase) + (-static_cast<int64_t>(encoded) - 1 - kLocalBias);
+    } else {
+        return UINT32_MAX;
+    }
+    return index >= 0 && static_cast<uint64_t>(index) < total && index < UINT32_MAX ? static_cast<uint32_t>(index) : UINT32_MAX;
+}
+
+static bool parseCorner(const char*& p, const char* end, const ObjChunk& chunk, ObjCorner& corner) {
+    int64_t raw;
+    corner = ObjCorner { 0, 0, 0 };
+    if (!parseInteger(p, end, raw) || !encodeIndex(raw, chunk.positions.size() / 3, corner.v)) {
+        return false;
+    }
+    if (p < end && *p == '/') {
+        ++p;
+        if (p < end && *p != '/') {
+            if (!parseInteger(p, end, raw) || !encodeIndex(raw, chunk.texCoords.size() / 2, corner.vt)) {
+                return false;
+            }
+        }
+        if (p < end && *p == '/') {
+            ++p;
+            if (!parseInteger(p, end, raw) || !encodeIndex(raw, chunk.normals.size() / 3, corner.vn)) {
+                return false;
+            }
+        }
+    }
+    return p == end || isBlank(*p);
+}
+
+static void parseObjChunk(const char* begin, const char* end, const char* fileStart, ObjChunk& chunk) {
+    for (const char* line = begin; line < end;) {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+        lineEnd = lineEnd ? lineEnd : end;
+        const char* p = skipBlanks(line, lineEnd);
+        bool ok = true;
+
+        if (p + 1 < lineEnd && p[0] == 'v' && isBlank(p[1])) {
+            float xyz[3] = {};
+            for (int i = 0; i < 3 && ok; ++i) {
+                p = skipBlanks(p + (i == 0 ? 1 : 0), lineEnd);
+                ok = parseFloat(p, lineEnd, xyz[i]);
+            }
+            chunk.positions.insert(chunk.positions.end(), xyz, xyz + 3); // a w or vertex colour after xyz is ignored
+        } else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])) {
+            float xyz[3] = {};
+            p += 2;
+            for (int i = 0; i < 3 && ok; ++i) {
+                p = skipBlanks(p, lineEnd);
+                ok = parseFloat(p, lineEnd, xyz[i]);
+            }
+            chunk.normals.insert(chunk.normals.end(), xyz, xyz + 3);
+        } else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+            float uv[2] = { 0.0f, 0.0f };
+            p = skipBlanks(p + 2, lineEnd);
+            ok = parseFloat(p, lineEnd, uv[0]);
+            p = skipBlanks(p, lineEnd);
+            if (ok && p < lineEnd) {
+                ok = parseFloat(p, lineEnd, uv[1]);
+            }
+            chunk.texCoords.insert(chunk.texCoords.end(), uv, uv + 2);
+        } else if (p + 1 < lineEnd && p[0] == 'f' && isBlank(p[1])) {
+            // Polygons are fanned from their first corner; only the first and previous corners need keeping.
+            ObjCorner first {};
+            ObjCorner previous {};
+            size_t count = 0;
+            for (p = skipBlanks(p + 1, lineEnd); p < lineEnd && ok; p = skipBlanks(p, lineEnd)) {
+                ObjCorner corner;
+                ok = parseCorner(p, lineEnd, chunk, corner);
+                if (!ok) {
+                    break;
+                }
+                chunk.usesTexCoords |= corner.vt != 0;
+                chunk.usesNormals |= corner.vn != 0;
+                if (count >= 2) {
+                    for (const ObjCorner& c : { first, previous, corner }) {
+                        chunk.corners.insert(chunk.corners.end(), { c.v, c.vt, c.vn });
+                    }
+                }
+                (count == 0 ? first : previous) = corner;
+                ++count;
+            }
+            ok = ok && count >= 3;
+        }
+
+        if (!ok) {
+            chunk.error = "malformed record at byte " + std::to_string(line - fileStart) + ": " + std::string(line, static_cast<size_t>(std::min<ptrdiff_t>(lineEnd - line, 80)));
+            return;
+        }
+        line = lineEnd < end ? lineEnd + 1 : end;
+    }
+}
+
+bool importObj(const char* text, size_t size, ImportedMesh& mesh, const ImportOptions& options, std::string* pError) {
+    mesh.clear();
+
+    // Every task starts just after the first newline at or past its split point, so the chunks tile the file
+    // along line boundaries.
+    auto lineStart = [text, size](size_t offset) -> size_t {
+        if (offset == 0 || offset >= size) {
+            return std::min(offset, size);
+        }
+        const void* pNewline = memchr(text + offset - 1, '\n', size - offset + 1);
+        return pNewline ? static_cast<size_t>(static_cast<const char*>(pNewline) - text) + 1 : size;
+    };
+    std::vector<ObjChunk> chunks(std::max<size_t>(1, parallel::taskCount(size, options.minBytesPerTask, options.threads)));
+    parallel::forRange(size, options.minBytesPerTask, options.threads, [&](size_t begin, size_t end, size_t task) {
+        parseObjChunk(text + lineStart(begin), text + lineStart(end), text, chunks[task]);
+    });
+
+    std::vector<size_t> positionBase(chunks.size() + 1, 0);
+    std::vector<size_t> normalBase(chunks.size() + 1, 0);
+    std::vector<size_t> texCoordBase(chunks.size() + 1, 0);
+    std::vector<size_t> cornerBase(chunks.size() + 1, 0);
+    bool usesTexCoords = false;
+    bool usesNormals = false;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (!chunks[i].error.empty()) {
+            return fail(pError, chunks[i].error);
+        }
+        positionBase[i + 1] = positionBase[i] + chunks[i].positions.size() / 3;
+        normalBase[i + 1] = normalBase[i] + chunks[i].normals.size() / 3;
+        texCoordBase[i + 1] = texCoordBase[i] + chunks[i].texCoords.size() / 2;
+        cornerBase[i + 1] = cornerBase[i] + chunks[i].corners.size() / 3;
+        usesTexCoords |= chunks[i].usesTexCoords;
+        usesNormals |= chunks[i].usesNormals;
+    }
+    const size_t positionCount = positionBase.back();
+    const size_t normalCount = normalBase.back();
+    const size_t texCoordCount = texCoordBase.back();
+    const size_t cornerCount = cornerBase.back();
+    if (cornerCount == 0) {
+        return fail(pError, "no faces");
+    }
+
+    // Resolve every corner to global indices, chunk by chunk in parallel.
+    std::vector<uint32_t> resolved(cornerCount * 3);
+    std::atomic<bool> outOfRange(false);
+    parallel::forRange(chunks.size(), 1, options.threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t c = begin; c < end; ++c) {
+            const std::vector<int32_t>& corners = chunks[c].corners;
+            uint32_t* pOut = resolved.data() + cornerBase[c] * 3;
+            for (size_t i = 0; i < corners.size(); i += 3) {
+                pOut[i] = decodeIndex(corners[i], positionBase[c], positionCount);
+                pOut[i + 1] = usesTexCoords ? decodeIndex(corners[i + 1], texCoordBase[c], texCoordCount) : UINT32_MAX;
+                pOut[i + 2] = usesNormals ? decodeIndex(corners[i + 2], normalBase[c], normalCount) : UINT32_MAX;
+                if (pOut[i] == UINT32_MAX || (corners[i + 1] != 0 && pOut[i + 1] == UINT32_MAX) || (corners[i + 2] != 0 && pOut[i + 2] == UINT32_MAX)) {
+                    outOfRange = true;
+                }
+            }
+        }
+    });
+    if (outOfRange) {
+        return fail(pError, "face index out of range");
+    }
+
+    auto gather = [&chunks](std::vector<float> ObjChunk::* source, size_t total, std::vector<float>& out) {
+        out.reserve(total);
+        for (const ObjChunk& chunk : chunks) {
+            out.insert(out.end(), (chunk.*source).begin(), (chunk.*source).end());
+        }
+    };
+
+    if (!usesTexCoords && !usesNormals) {
+        // Position-only faces index the positions directly.
+        gather(&ObjChunk::positions, positionCount * 3, mesh.positions);
+        mesh.indices.resize(cornerCount);
+        parallel::forRange(cornerCount, 1 << 16, options.threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; ++i) {
+                mesh.indices[i] = resolved[i * 3];
+            }
+        });
+        return true;
+    }
+
+    // Otherwise each distinct (v, vt, vn) triple becomes one vertex.
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texCoords;
+    gather(&ObjChunk::positions, positionCount * 3, positions);
+    gather(&ObjChunk::normals, normalCount * 3, normals);
+    gather(&ObjChunk::texCoords, texCoordCount * 2, texCoords);
+    chunks.clear();
+
+    struct Corner {
+        uint32_t v;
+        uint32_t vt;
+        uint32_t vn;
+        bool operator==(const Corner& other) const { return v == other.v && vt == other.vt && vn == other.vn; }
+    };
+    struct CornerHash {
+        size_t operator()(const Corner& c) const { return ((size_t(c.v) * 0x9e3779b97f4a7c15ull) ^ (size_t(c.vt) * 0xc2b2ae3d27d4eb4full) ^ c.vn) >> 7; }
+    };
+    std::unordered_map<Corner, uint32_t, CornerHash> vertices;
+    vertices.reserve(cornerCount / 2);
+    mesh.indices.resize(cornerCount);
+    const float zero[3] = { 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < cornerCount; ++i) {
+        const uint32_t v = resolved[i * 3];
+        const uint32_t vt = resolved[i * 3 + 1];
+        const uint32_t vn = resolved[i * 3 + 2];
+        auto [it, inserted] = vertices.try_emplace(Corner { v, vt, vn }, static_cast<uint32_t>(mesh.vertexCount()));
+        if (inserted) {
+            mesh.positions.insert(mesh.positions.end(), &positions[size_t(v) * 3], &positions[size_t(v) * 3] + 3);
+            if (usesNormals) {
+                const float* pNormal = vn == UINT32_MAX ? zero : &normals[size_t(vn) * 3];
+                mesh.normals.insert(mesh.normals.end(), pNormal, pNormal + 3);
+            }
+            if (usesTexCoords) {
+                const float* pTexCoord = vt == UINT32_MAX ? zero : &texCoords[size_t(vt) * 2];
+                mesh.texCoords.insert(mesh.texCoords.end(), pTexCoord, pTexCoord + 2);
+            }
+        }
+        mesh.indices[i] = it->second;
+    }
+    return true;
+}
+
+bool importObj(const char* path, ImportedMesh& mesh, const ImportOptions& options, std::string* pError) {
+    mesh_io::MappedFile file;
+    if (!file.open(path)) {
+        return fail(pError, std::string("cannot open ") + path);
+    }
+    return importObj(static_cast<const char*>(file.data()), file.size(), mesh, options, pError);
+}
+
+namespace {
+    /**
+     * Just enough JSON for a glTF header: values live in one flat array, containers refer to a contiguous run of
+     * child indices (key and value alternating for objects), and strings stay views into the source with their
+     * escapes left in, which glTF keys and accessor fields never use.
+     */
+    class Json {
+    public:
+        enum class Type : uint8_t {
+            Null,
+            Bool,
+            Number,
+            String,
+            Array,
+            Object
+        };
+
+        struct Value {
+            Type type;
+            double number;
+            std::string_view text;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        bool parse(std::string_view text) {
+            _text = text;
+            _position = 0;
+            _values.clear();
+            _children.clear();
+            uint32_t root;
+            if (!parseValue(0, root)) {
+                return false;
+            }
+            skipSpace();
+            return _position == _text.size() || _text[_position] == '\0';
+        }
+
+        const Value& root() const { return _values.front(); }
+
+        const Value* member(const Value* pObject, std::string_view key) const {
+            if (pObject == nullptr || pObject->type != Type::Object) {
+                return nullptr;
+            }
+            for (uint32_t i = 0; i < pObject->count; i += 2) {
+                if (_values[_children[pObject->first + i]].text == key) {
+                    return &_values[_children[pObject->first + i + 1]];
+                }
+            }
+            return nullptr;
+        }
+
+        const Value* element(const Value* pArray, size_t index) const {
+            if (pArray == nullptr || pArray->type != Type::Array || index >= pArray->count) {
+                return nullptr;
+            }
+            return &_values[_children[pArray->first + index]];
+        }
+
+        static size_t size(const Value* pArray) { return pArray && pArray->type == Type::Array ? pArray->count : 0; }
+
+        static int64_t integer(const Value* pValue, int64_t fallback) {
+            return pValue && pValue->type == Type::Number ? static_cast<int64_t>(pValue->number) : fallback;
+        }
+
+        static std::string_view string(const Value* pValue) {
+            return pValue && pValue->type == Type::String ? pValue->text : std::string_view();
+        }
+
+    private:
+        static constexpr uint32_t kMaxDepth = 64;
+
+        void skipSpace() {
+            while (_position < _text.size() && (_text[_position] == ' ' || _text[_position] == '\t' || _text[_position] == '\n' || _text[_position] == '\r')) {
+                ++_position;
+            }
+        }
+
+        uint32_t add(Value value) {
+            _values.push_back(value);
+            return static_cast<uint32_t>(_values.size() - 1);
+        }
+
+        bool parseString(uint32_t& index) {
+            const size_t start = ++_position;
+            while (_position < _text.size() && _text[_position] != '"') {
+                _position += _text[_position] == '\\' ? 2 : 1;
+            }
+            if (_position >= _text.size()) {
+                return false;
+            }
+            index = add(Value { Type::String, 0.0, _text.substr(start, _position - start), 0, 0 });
+            ++_position;
+            return true;
+        }
+
+        bool parseValue(uint32_t depth, uint32_t& index) {
+            skipSpace();
+            if (_position >= _text.size() || depth > kMaxDepth) {
+                return false;
+            }
+            const char c = _text[_position];
+            if (c == '{' || c == '[') {
+                const bool isObject = c == '{';
+                const char close = isObject ? '}' : ']';
+                index = add(Value { isObject ? Type::Object : Type::Array, 0.0, {}, 0, 0 });
+                std::vector<uint32_t> children;
+                ++_position;
+                skipSpace();
+                if (_position < _text.size() && _text[_position] == close) {
+                    ++_position;
+                    return true;
+                }
+                for (;;) {
+                    uint32_t child;
+                    if (isObject) {
+                        skipSpace();
+                        if (_position >= _text.size() || _text[_position] != '"' || !parseString(child)) {
+                            return false;
+                        }
+                        children.push_back(child);
+                        skipSpace();
+                        if (_position >= _text.size() || _text[_position++] != ':') {
+                            return false;
+                        }
+                    }
+                    if (!parseValue(depth + 1, child)) {
+                        return false;
+                    }
+                    children.push_back(child);
+                    skipSpace();
+                    if (_position >= _text.size()) {
+                        return false;
+                    }
+                    const char separator = _text[_position++];
+                    if (separator == close) {
+                        break;
+                    }
+                    if (separator != ',') {
+                        return false;
+                    }
+                }
+                _values[index].first = static_cast<uint32_t>(_children.size());
+                _values[index].count = static_cast<uint32_t>(children.size());
+                _children.insert(_children.end(), children.begin(), children.end());
+                return true;
+            }
+            if (c == '"') {
+                return parseString(index);
+            }
+            if (_text.compare(_position, 4, "true") == 0 || _text.compare(_position, 5, "false") == 0) {
+                const bool value = c == 't';
+                _position += value ? 4 : 5;
+                index = add(Value { Type::Bool, value ? 1.0 : 0.0, {}, 0, 0 });
+                return true;
+            }
+            if (_text.compare(_position, 4, "null") == 0) {
+                _position += 4;
+                index = add(Value { Type::Null, 0.0, {}, 0, 0 });
+                return true;
+            }
+            const char* p = _text.data() + _position;
+            double number;
+            if (!parseNumber(p, _text.data() + _text.size(), number)) {
+                return false;
+            }
+            _position = static_cast<size_t>(p - _text.data());
+            index = add(Value { Type::Number, number, {}, 0, 0 });
+            return true;
+        }
+
+        std::string_view _text;
+        size_t _position = 0;
+        std::vector<Value> _values;
+        std::vector<uint32_t> _children;
+    };
+
+    constexpr uint32_t kGlbMagic = 0x46546c67; // 'glTF'
+    constexpr uint32_t kGlbJsonChunk = 0x4e4f534a;
+    constexpr uint32_t kGlbBinChunk = 0x004e4942;
+    constexpr int64_t kModeTriangles = 4;
+
+    enum ComponentType : uint32_t {
+        kByte = 5120,
+        kUnsignedByte = 5121,
+        kShort = 5122,
+        kUnsignedShort = 5123,
+        kUnsignedInt = 5125,
+        kFloat = 5126
+    };
+
+    struct Accessor {
+        const uint8_t* pData;
+        size_t count;
+        size_t stride;
+        uint32_t components;
+        uint32_t componentType;
+        bool normalized;
+    };
+
+    struct Primitive {
+        Accessor positions;
+        Accessor normals;   // count 0 when absent
+        Accessor texCoords; // count 0 when absent
+        Accessor indices;   // count 0 for a non-indexed primitive
+    };
+}
+
+static uint32_t componentSize(uint32_t componentType) {
+    switch (componentType) {
+        case kByte:
+        case kUnsignedByte: return 1;
+        case kShort:
+        case kUnsignedShort: return 2;
+        case kUnsignedInt:
+        case kFloat: return 4;
+    }
+    return 0;
+}
+
+static uint32_t componentCount(std::string_view type) {
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+static bool readAccessor(const Json& json, int64_t index, const uint8_t* pBin, size_t binSize, Accessor& out, std::string* pError) {
+    const Json::Value* pAccessor = json.element(json.member(&json.root(), "accessors"), static_cast<size_t>(index));
+    if (pAccessor == nullptr) {
+        return fail(pError, "missing accessor " + std::to_string(index));
+    }
+    if (json.member(pAccessor, "sparse")) {
+        return fail(pError, "sparse accessors are not supported");
+    }
+    out.count = static_cast<size_t>(Json::integer(json.member(pAccessor, "count"), 0));
+    out.componentType = static_cast<uint32_t>(Json::integer(json.member(pAccessor, "componentType"), 0));
+    out.components = componentCount(Json::string(json.member(pAccessor, "type")));
+    const Json::Value* pNormalized = json.member(pAccessor, "normalized");
+    out.normalized = pNormalized && pNormalized->type == Json::Type::Bool && pNormalized->number != 0.0;
+    const size_t elementSize = size_t(componentSize(out.componentType)) * out.components;
+    if (elementSize == 0) {
+        return fail(pError, "accessor " + std::to_string(index) + " has an unknown type");
+    }
+
+    const Json::Value* pView = json.element(json.member(&json.root(), "bufferViews"), static_cast<size_t>(Json::integer(json.member(pAccessor, "bufferView"), -1)));
+    if (pView == nullptr) {
+        return fail(pError, "accessor " + std::to_string(index) + " has no buffer view");
+    }
+    if (Json::integer(json.member(pView, "buffer"), 0) != 0 || pBin == nullptr) {
+        return fail(pError, "only the GLB binary chunk is supported as a buffer");
+    }
+    const int64_t viewOffset = Json::integer(json.member(pView, "byteOffset"), 0);
+    const int64_t viewLength = Json::integer(json.member(pView, "byteLength"), 0);
+    const int64_t accessorOffset = Json::integer(json.member(pAccessor, "byteOffset"), 0);
+    const int64_t stride = Json::integer(json.member(pView, "byteStride"), 0);
+    out.stride = stride > 0 ? static_cast<size_t>(stride) : elementSize;
+    if (viewOffset < 0 || viewLength < 0 || accessorOffset < 0 || static_cast<uint64_t>(viewOffset + viewLength) > binSize) {
+        return fail(pError, "buffer view out of range");
+    }
+    const uint64_t end = out.count == 0 ? 0 : uint64_t(accessorOffset) + uint64_t(out.stride) * (out.count - 1) + elementSize;
+    if (end > uint64_t(viewLength)) {
+        return fail(pError, "accessor " + std::to_string(index) + " runs past its buffer view");
+    }
+    out.pData = pBin + viewOffset + accessorOffset;
+    return true;
+}
+
+static float readComponent(const uint8_t* p, uint32_t componentType, bool normalized) {
+    switch (componentType) {
+        case kFloat: { float v; memcpy(&v, p, 4); return v; }
+        case kUnsignedByte: return normalized ? *p / 255.0f : *p;
+        case kByte: { const int8_t v = static_cast<int8_t>(*p); return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+        case kUnsignedShort: { uint16_t v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : v; }
+        case kShort: { int16_t v; memcpy(&v, p, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+        case kUnsignedInt: { uint32_t v; memcpy(&v, p, 4); return static_cast<float>(v); }
+    }
+    return 0.0f;
+}
+
+static uint32_t readIndex(const uint8_t* p, uint32_t componentType) {
+    switch (componentType) {
+        case kUnsignedByte: return *p;
+        case kUnsignedShort: { uint16_t v; memcpy(&v, p, 2); return v; }
+        case kUnsignedInt: { uint32_t v; memcpy(&v, p, 4); return v; }
+    }
+    return UINT32_MAX;
+}
+
+// Copies the first `components` components of each element into a tightly packed float array, in parallel ranges.
+static void copyAttribute(const Accessor& accessor, uint32_t components, float* pOut, uint32_t threads) {
+    const uint32_t size = componentSize(accessor.componentType);
+    parallel::forRange(accessor.count, 1 << 15, threads, [&](size_t begin, size_t end, size_t) {
+        if (accessor.componentType == kFloat && accessor.components == components && accessor.stride == size_t(components) * 4) {
+            memcpy(pOut + begin * components, accessor.pData + begin * accessor.stride, (end - begin) * accessor.stride);
+            return;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            const uint8_t* pElement = accessor.pData + i * accessor.stride;
+            for (uint32_t c = 0; c < components; ++c) {
+                pOut[i * components + c] = c < accessor.components ? readComponent(pElement + c * size, accessor.componentType, accessor.normalized) : 0.0f;
+            }
+        }
+    });
+}
+
+bool importGlb(const uint8_t* data, size_t size, ImportedMesh& mesh, const ImportOptions& options, std::string* pError) {
+    mesh.clear();
+
+    uint32_t header[3];
+    if (size < sizeof(header)) {
+        return fail(pError, "file too small for a GLB header");
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[0] != kGlbMagic || header[1] != 2 || header[2] > size) {
+        return fail(pError, "not a glTF 2.0 binary");
+    }
+
+    std::string_view jsonText;
+    const uint8_t* pBin = nullptr;
+    size_t binSize = 0;
+    for (size_t offset = sizeof(header); offset + 8 <= header[2];) {
+        uint32_t chunk[2];
+        memcpy(chunk, data + offset, sizeof(chunk));
+        if (offset + 8 + chunk[0] > header[2]) {
+            return fail(pError, "truncated GLB chunk");
+        }
+        if (chunk[1] == kGlbJsonChunk && jsonText.empty()) {
+            jsonText = std::string_view(reinterpret_cast<const char*>(data + offset + 8), chunk[0]);
+        } else if (chunk[1] == kGlbBinChunk && pBin == nullptr) {
+            pBin = data + offset + 8;
+            binSize = chunk[0];
+        }
+        offset += 8 + ((size_t(chunk[0]) + 3) & ~size_t(3));
+    }
+
+    Json json;
+    if (!json.parse(jsonText)) {
+        return fail(pError, "malformed glTF JSON");
+    }
+    const Json::Value* pRequired = json.member(&json.root(), "extensionsRequired");
+    if (Json::size(pRequired) > 0) {
+        return fail(pError, "required extension " + std::string(Json::string(json.element(pRequired, 0))) + " is not supported");
+    }
+
+    std::vector<Primitive> primitives;
+    const Json::Value* pMeshes = json.member(&json.root(), "meshes");
+    for (size_t m = 0; m < Json::size(pMeshes); ++m) {
+        const Json::Value* pPrimitives = json.member(json.element(pMeshes, m), "primitives");
+        for (size_t p = 0; p < Json::size(pPrimitives); ++p) {
+            const Json::Value* pPrimitive = json.element(pPrimitives, p);
+            if (Json::integer(json.member(pPrimitive, "mode"), kModeTriangles) != kModeTriangles) {
+                continue; // points and lines have no place in a triangle mesh
+            }
+            const Json::Value* pAttributes = json.member(pPrimitive, "attributes");
+            Primitive primitive {};
+            const int64_t positions = Json::integer(json.member(pAttributes, "POSITION"), -1);
+            if (positions < 0 || !readAccessor(json, positions, pBin, binSize, primitive.positions, pError)) {
+                return positions < 0 ? fail(pError, "primitive without positions") : false;
+            }
+            if (primitive.positions.components != 3 || primitive.positions.componentType != kFloat) {
+                return fail(pError, "positions must be float VEC3");
+            }
+            const int64_t normals = Json::integer(json.member(pAttributes, "NORMAL"), -1);
+            if (normals >= 0 && !readAccessor(json, normals, pBin, binSize, primitive.normals, pError)) {
+                return false;
+            }
+            const int64_t texCoords = Json::integer(json.member(pAttributes, "TEXCOORD_0"), -1);
+            if (texCoords >= 0 && !readAccessor(json, texCoords, pBin, binSize, primitive.texCoords, pError)) {
+                return false;
+            }
+            const int64_t indices = Json::integer(json.member(pPrimitive, "indices"), -1);
+            if (indices >= 0) {
+                if (!readAccessor(json, indices, pBin, binSize, primitive.indices, pError)) {
+                    return false;
+                }
+                if (primitive.indices.components != 1 || readIndex(primitive.indices.pData, primitive.indices.componentType) == UINT32_MAX) {
+                    return fail(pError, "indices must be unsigned SCALAR");
+                }
+            }
+            if ((primitive.normals.count && primitive.normals.count != primitive.positions.count) || (primitive.texCoords.count && primitive.texCoords.count != primitive.positions.count)) {
+                return fail(pError, "attribute counts differ within a primitive");
+            }
+            primitives.push_back(primitive);
+        }
+    }
+    if (primitives.empty()) {
+        return fail(pError, "no triangle primitives");
+    }
+
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    bool hasNormals = false;
+    bool hasTexCoords = false;
+    for (const Primitive& primitive : primitives) {
+        vertexCount += primitive.positions.count;
+        indexCount += primitive.indices.count ? primitive.indices.count : primitive.positions.count;
+        hasNormals |= primitive.normals.count != 0;
+        hasTexCoords |= primitive.texCoords.count != 0;
+    }
+    if (vertexCount >= UINT32_MAX) {
+        return fail(pError, "too many vertices");
+    }
+    mesh.positions.resize(vertexCount * 3);
+    mesh.normals.resize(hasNormals ? vertexCount * 3 : 0); // zero-filled for primitives without them
+    mesh.texCoords.resize(hasTexCoords ? vertexCount * 2 : 0);
+    mesh.indices.resize(indexCount - indexCount % 3);
+
+    std::atomic<bool> outOfRange(false);
+    size_t vertexBase = 0;
+    size_t indexBase = 0;
+    for (const Primitive& primitive : primitives) {
+        copyAttribute(primitive.positions, 3, mesh.positions.data() + vertexBase * 3, options.threads);
+        if (primitive.normals.count) {
+            copyAttribute(primitive.normals, 3, mesh.normals.data() + vertexBase * 3, options.threads);
+        }
+        if (primitive.texCoords.count) {
+            copyAttribute(primitive.texCoords, 2, mesh.texCoords.data() + vertexBase * 2, options.threads);
+        }
+        const size_t count = std::min(primitive.indices.count ? primitive.indices.count : primitive.positions.count, mesh.indices.size() - indexBase);
+        parallel::forRange(count, 1 << 16, options.threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t index = primitive.indices.count ? readIndex(primitive.indices.pData + i * primitive.indices.stride, primitive.indices.componentType) : static_cast<uint32_t>(i);
+                if (index >= primitive.positions.count) {
+                    outOfRange = true;
+                }
+                mesh.indices[indexBase + i] = static_cast<uint32_t>(vertexBase + index);
+            }
+        });
+        vertexBase += primitive.positions.count;
+        indexBase += count;
+    }
+    if (outOfRange) {
+        mesh.clear();
+        return fail(pError, "index out of range");
+    }
+    return true;
+}
+
+bool importGlb(const char* path, ImportedMesh& mesh, const ImportOptions& options, std::string* pError) {
+    mesh_io::MappedFile file;
+    if (!file.open(path)) {
+        return fail(pError, std::string("cannot open ") + path);
+    }
+    return importGlb(static_cast<const uint8_t*>(file.data()), file.size(), mesh, options, pError);
+}
+
+bool importMesh(const char* path, ImportedMesh& mesh, const ImportOptions& options, std::string* pError) {
+    const std::string_view name(path);
+    auto hasExtension = [&name](std::string_view extension) {
+        if (name.size() < extension.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < extension.size(); ++i) {
+            const char c = name[name.size() - extension.size() + i];
+            if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != extension[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (hasExtension(".obj")) {
+        return importObj(path, mesh, options, pError);
+    }
+    if (hasExtension(".glb")) {
+        return importGlb(path, mesh, options, pError);
+    }
+    return fail(pError, std::string("unknown mesh format: ") + path);
+}
+
+uint32_t chooseIndexSize(size_t vertexCount) {
+    // 0xFFFF is the primitive restart index for 16-bit indices, so it cannot name a vertex.
+    return vertexCount <= 0xFFFF ? 2 : 4;
+}
+
+static void buildFloatStreams(const ImportedMesh& mesh, GpuMesh& gpu, uint32_t threads) {
+    const std::vector<float>* sources[3] = { &mesh.positions, &mesh.normals, &mesh.texCoords };
+    const uint32_t components[3] = { 3, 3, 2 };
+    // Interleaved: MSL struct rules, float3 is 16 bytes and 16-aligned, float2 8; the stride rounds up to 16.
+    // Split: packed_float3 and float2, 12 and 8 bytes, no padding.
+    const uint32_t interleavedSizes[3] = { 16, 16, 8 };
+    const uint32_t splitSizes[3] = { 12, 12, 8 };
+    const uint32_t formats[3] = { vertex_quantize::kFormatFloat3, vertex_quantize::kFormatFloat3, vertex_quantize::kFormatFloat2 };
+    if (gpu.layout == StreamLayout::Interleaved) {
+        VertexStream stream { gpu.attributes, 0, { UINT32_MAX, UINT32_MAX, UINT32_MAX }, {}, {} };
+        for (uint32_t a = 0; a < 3; ++a) {
+            if (gpu.attributes & (1u << a)) {
+                stream.stride = (stream.stride + interleavedSizes[a] - 1) / interleavedSizes[a] * interleavedSizes[a];
+                stream.offsets[a] = stream.stride;
+                stream.formats[a] = formats[a];
+                stream.stride += interleavedSizes[a];
+            }
+        }
+        stream.stride = (stream.stride + 15) / 16 * 16;
+        gpu.streams.push_back(std::move(stream));
+    } else {
+        for (uint32_t a = 0; a < 3; ++a) {
+            if (gpu.attributes & (1u << a)) {
+                gpu.streams.push_back(VertexStream { 1u << a, splitSizes[a], { UINT32_MAX, UINT32_MAX, UINT32_MAX }, {}, {} });
+                gpu.streams.back().offsets[a] = 0;
+                gpu.streams.back().formats[a] = formats[a];
+            }
+        }
+    }
+
+    for (VertexStream& stream : gpu.streams) {
+        stream.bytes.assign(gpu.vertexCount * stream.stride, 0);
+        parallel::forRange(gpu.vertexCount, 1 << 15, threads, [&](size_t begin, size_t end, size_t) {
+            for (uint32_t a = 0; a < 3; ++a) {
+                if (!(stream.attributes & (1u << a))) {
+                    continue;
+                }
+                const float* pSource = sources[a]->data();
+                const size_t bytes = components[a] * sizeof(float);
+                for (size_t v = begin; v < end; ++v) {
+                    memcpy(stream.bytes.data() + v * stream.stride + stream.offsets[a], pSource + v * components[a], bytes);
+                }
+            }
+        });
+    }
+}
+
+static void buildQuantizedStream(const ImportedMesh& mesh, GpuMesh& gpu, uint32_t threads) {
+    for (uint32_t i = 0; i < 3; ++i) {
+        gpu.positionMin[i] = gpu.vertexCount ? std::numeric_limits<float>::max() : 0.0f;
+        float maximum = gpu.vertexCount ? -std::numeric_limits<float>::max() : 0.0f;
+        for (size_t v = 0; v < gpu.vertexCount; ++v) {
+            gpu.positionMin[i] = std::min(gpu.positionMin[i], mesh.positions[v * 3 + i]);
+            maximum = std::max(maximum, mesh.positions[v * 3 + i]);
+        }
+        gpu.positionExtent[i] = maximum - gpu.positionMin[i];
+    }
+
+    const uint32_t formats[3] = { vertex_quantize::kFormatUShort4Normalized, vertex_quantize::kFormatInt1010102Normalized, vertex_quantize::kFormatHalf2 };
+    VertexStream stream { gpu.attributes, 0, { UINT32_MAX, UINT32_MAX, UINT32_MAX }, {}, {} };
+    for (uint32_t a = 0; a < 3; ++a) {
+        if (gpu.attributes & (1u << a)) {
+            stream.offsets[a] = stream.stride;
+            stream.formats[a] = formats[a];
+            stream.stride += vertex_quantize::formatSize(formats[a]);
+        }
+    }
+
+    stream.bytes.assign(gpu.vertexCount * stream.stride, 0);
+    parallel::forRange(gpu.vertexCount, 1 << 15, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t v = begin; v < end; ++v) {
+            uint8_t* pVertex = stream.bytes.data() + v * stream.stride;
+            const uint64_t position = vertex_quantize::encodePosition(&mesh.positions[v * 3], gpu.positionMin, gpu.positionExtent);
+            memcpy(pVertex + stream.offsets[0], &position, sizeof(position));
+            if (stream.attributes & kNormalBit) {
+                const uint32_t normal = vertex_quantize::encodeOctahedral(&mesh.normals[v * 3]);
+                memcpy(pVertex + stream.offsets[1], &normal, sizeof(normal));
+            }
+            if (stream.attributes & kTexCoordBit) {
+                const uint32_t texCoord = vertex_quantize::encodeTexCoord(&mesh.texCoords[v * 2]);
+                memcpy(pVertex + stream.offsets[2], &texCoord, sizeof(texCoord));
+            }
+        }
+    });
+    gpu.streams.push_back(std::move(stream));
+}
+
+static void encodeIndices(const std::vector<uint32_t>& indices, GpuMesh& gpu, uint32_t threads) {
+    gpu.indexCount = indices.size();
+    gpu.indices.resize(gpu.indexCount * gpu.indexSize);
+    parallel::forRange(gpu.indexCount, 1 << 16, threads, [&](size_t begin, size_t end, size_t) {
+        if (gpu.indexSize == 4) {
+            memcpy(gpu.indices.data() + begin * 4, indices.data() + begin, (end - begin) * 4);
+            return;
+        }
+        uint16_t* pOut = reinterpret_cast<uint16_t*>(gpu.indices.data());
+        for (size_t i = begin; i < end; ++i) {
+            pOut[i] = static_cast<uint16_t>(indices[i]);
+        }
+    });
+}
+
+GpuMesh buildGpuMesh(const ImportedMesh& mesh, StreamLayout layout, uint32_t attributes, uint32_t threads) {
+    GpuMesh gpu {};
+    gpu.layout = layout;
+    gpu.vertexCount = mesh.vertexCount();
+    gpu.attributes = kPositionBit;
+    if ((attributes & kNormalBit) && !mesh.normals.empty()) {
+        gpu.attributes |= kNormalBit;
+    }
+    if ((attributes & kTexCoordBit) && !mesh.texCoords.empty()) {
+        gpu.attributes |= kTexCoordBit;
+    }
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        gpu.positionMin[i] = 0.0f;
+        gpu.positionExtent[i] = 1.0f;
+    }
+    if (layout == StreamLayout::Quantized) {
+        buildQuantizedStream(mesh, gpu, threads);
+    } else {
+        buildFloatStreams(mesh, gpu, threads);
+    }
+
+    gpu.indexSize = chooseIndexSize(gpu.vertexCount);
+    encodeIndices(mesh.indices, gpu, threads);
+    return gpu;
+}
+
+void setLodChain(GpuMesh& gpu, const mesh_simplify::LodChain& chain, uint32_t threads) {
+    encodeIndices(chain.indices, gpu, threads);
+    gpu.lods = chain.levels;
+}
+
+bool writeMeshFile(const char* path, const GpuMesh& mesh, uint64_t sourceHash, std::string* pError) {
+    std::vector<mesh_io::SectionData> sections;
+    std::vector<mesh_io::StreamFormat> formats;
+    for (const VertexStream& stream : mesh.streams) {
+        sections.push_back({ mesh_io::SectionType::Vertices, stream.stride, stream.attributes, mesh.vertexCount, stream.bytes.data() });
+        mesh_io::StreamFormat format;
+        for (uint32_t i = 0; i < 3; ++i) {
+            format.formats[i] = stream.formats[i];
+            format.offsets[i] = stream.offsets[i];
+            format.positionMin[i] = mesh.positionMin[i];
+            format.positionExtent[i] = mesh.positionExtent[i];
+        }
+        formats.push_back(format);
+    }
+    sections.push_back({ mesh_io::SectionType::VertexFormats, sizeof(mesh_io::StreamFormat), 0, formats.size(), formats.data() });
+    sections.push_back({ mesh_io::SectionType::Indices, mesh.indexSize, 0, mesh.indexCount, mesh.indices.data() });
+    const meshlet_builder::MeshletSet& meshlets = mesh.meshlets;
+    if (!meshlets.meshlets.empty()) {
+        sections.push_back({ mesh_io::SectionType::Meshlets, sizeof(meshlet_builder::Meshlet), 0, meshlets.meshlets.size(), meshlets.meshlets.data() });
+        sections.push_back({ mesh_io::SectionType::MeshletVertices, sizeof(uint32_t), 0, meshlets.vertices.size(), meshlets.vertices.data() });
+        sections.push_back({ mesh_io::SectionType::MeshletTriangles, 1, 0, meshlets.triangles.size(), meshlets.triangles.data() });
+    }
+    if (!mesh.lods.empty()) {
+        sections.push_back({ mesh_io::SectionType::Lods, sizeof(mesh_simplify::LodLevel), 0, mesh.lods.size(), mesh.lods.data() });
+    }
+    return mesh_io::writeMeshFile(path, sections, sourceHash, pError);
+}
+}
@@ -0,0 +1,103 @@
+//
+//  MeshImport.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef MeshImport_hpp
+#define MeshImport_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MeshletBuilder.hpp"
+#include "MeshSimplify.hpp"
+
+namespace mesh_import {
+    // Triangles with one index per corner into de-duplicated vertices. normals and texCoords are empty when the
+    // source has none.
+    struct ImportedMesh {
+        std::vector<float> positions; // xyz per vertex
+        std::vector<float> normals;   // xyz per vertex
+        std::vector<float> texCoords; // uv per vertex
+        std::vector<uint32_t> indices;
+
+        size_t vertexCount() const { return positions.size() / 3; }
+        size_t triangleCount() const { return indices.size() / 3; }
+        void clear();
+    };
+
+    struct ImportOptions {
+        uint32_t threads = 0;            // 0: one per hardware thread
+        size_t minBytesPerTask = 1 << 20; // smaller files are parsed on the calling thread
+    };
+
+    /**
+     * Wavefront OBJ (v, vt, vn and polygonal f records; everything else is skipped) and binary glTF 2.0 (every
+     * triangle primitive of every mesh, merged, in mesh space). Files are memory-mapped and parsed in place: OBJ in
+     * line-aligned chunks, one per thread, glTF by copying accessors in parallel ranges. Returns false with a reason
+     * in pError for malformed input or features this importer leaves out (sparse accessors, compressed geometry).
+     */
+    bool importObj(const char* path, ImportedMesh& mesh, const ImportOptions& options = {}, std::string* pError = nullptr);
+    bool importObj(const char* text, size_t size, ImportedMesh& mesh, const ImportOptions& options = {}, std::string* pError = nullptr);
+    bool importGlb(const char* path, ImportedMesh& mesh, const ImportOptions& options = {}, std::string* pError = nullptr);
+    bool importGlb(const uint8_t* data, size_t size, ImportedMesh& mesh, const ImportOptions& options = {}, std::string* pError = nullptr);
+    // Picks the format from the extension (.obj or .glb).
+    bool importMesh(const char* path, ImportedMesh& mesh, const ImportOptions& options = {}, std::string* pError = nullptr);
+
+    enum AttributeBits : uint32_t {
+        kPositionBit = 1,
+        kNormalBit = 2,
+        kTexCoordBit = 4
+    };
+
+    enum class StreamLayout : uint8_t {
+        // One buffer read as an array of structs in the shader: float3 members take 16 bytes, as in MSL, so a
+        // position-only stream has the layout of shader_types::VertexData.
+        Interleaved,
+        // One tightly packed buffer per attribute (packed float3, float2), for a vertex descriptor.
+        Split,
+        // One buffer for a vertex descriptor: 16-bit unorm positions within the mesh bounds, octahedral 10-10-10-2
+        // normals and half texture coordinates, 8 to 16 bytes a vertex. See VertexQuantize.hpp.
+        Quantized
+    };
+
+    struct VertexStream {
+        uint32_t attributes; // AttributeBits stored in this stream
+        uint32_t stride;
+        uint32_t offsets[3]; // byte offset of position, normal, texCoord within a vertex; UINT32_MAX if absent
+        uint32_t formats[3]; // vertex_quantize::VertexFormat of each, kFormatInvalid if absent
+        std::vector<uint8_t> bytes;
+    };
+
+    struct GpuMesh {
+        StreamLayout layout;
+        uint32_t attributes;
+        size_t vertexCount;
+        // Quantized positions decode to positionMin + unorm * positionExtent; identity for float layouts.
+        float positionMin[3];
+        float positionExtent[3];
+        std::vector<VertexStream> streams;
+        uint32_t indexSize; // 2 or 4
+        size_t indexCount;
+        std::vector<uint8_t> indices;
+        // Left empty by buildGpuMesh; callers that want mesh shader rendering fill it from the same indices.
+        meshlet_builder::MeshletSet meshlets;
+        // Empty unless setLodChain was called; then indices hold every level back to back.
+        std::vector<mesh_simplify::LodLevel> lods;
+    };
+
+    // 16-bit when every index fits below the primitive restart value, 32-bit otherwise.
+    uint32_t chooseIndexSize(size_t vertexCount);
+    // Attributes the mesh lacks are left out even if requested.
+    GpuMesh buildGpuMesh(const ImportedMesh& mesh, StreamLayout layout, uint32_t attributes, uint32_t threads = 0);
+    // Replaces the indices with every level of a chain built over the same vertices, keeping the index size.
+    void setLodChain(GpuMesh& gpu, const mesh_simplify::LodChain& chain, uint32_t threads = 0);
+    // One Vertices section per stream, their VertexFormats, then the Indices section and, if the mesh has them, the
+    // three meshlet sections and the Lods section, in a mesh_io file that MappedMesh can map.
+    bool writeMeshFile(const char* path, const GpuMesh& mesh, uint64_t sourceHash, std::string* pError = nullptr);
+}
+
+#endif /* MeshImport_hpp */
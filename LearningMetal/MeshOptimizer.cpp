@@ -0,0 +1,469 @@
+//
+//  MeshOptimizer.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "MeshOptimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace mesh_optimize {
+namespace {
+    // Triangles grouped by vertex; the first liveCounts[v] entries after offsets[v] are the ones not yet emitted.
+    struct Adjacency {
+        std::vector<uint32_t> liveCounts;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        Adjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount): liveCounts(vertexCount, 0), offsets(vertexCount, 0), triangles(indexCount) {
+            for (size_t i = 0; i < indexCount; ++i) {
+                ++liveCounts[indices[i]];
+            }
+            uint32_t offset = 0;
+            for (size_t v = 0; v < vertexCount; ++v) {
+                offsets[v] = offset;
+                offset += liveCounts[v];
+            }
+            std::vector<uint32_t> filled(vertexCount, 0);
+            for (size_t i = 0; i < indexCount; ++i) {
+                const uint32_t v = indices[i];
+                triangles[offsets[v] + filled[v]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        void remove(uint32_t vertex, uint32_t triangle) {
+            uint32_t* begin = triangles.data() + offsets[vertex];
+            uint32_t* end = begin + liveCounts[vertex];
+            uint32_t* found = std::find(begin, end, triangle);
+            *found = end[-1];
+            --liveCounts[vertex];
+        }
+    };
+
+    // Forsyth's constants, from "Linear-Speed Vertex Cache Optimisation".
+    constexpr float kCacheDecayPower = 1.5f;
+    constexpr float kLastTriangleScore = 0.75f;
+    constexpr float kValenceBoostScale = 2.0f;
+    constexpr float kValenceBoostPower = 0.5f;
+    constexpr uint32_t kMaxValence = 32;
+
+    struct ScoreTables {
+        float cache[kVertexCacheSize];
+        float valence[kMaxValence + 1];
+
+        ScoreTables() {
+            for (uint32_t i = 0; i < kVertexCacheSize; ++i) {
+                // The last triangle's three vertices score the same so its winding order does not matter.
+                cache[i] = i < 3 ? kLastTriangleScore : std::pow(1.0f - float(i - 3) / float(kVertexCacheSize - 3), kCacheDecayPower);
+            }
+            valence[0] = 0.0f;
+            for (uint32_t i = 1; i <= kMaxValence; ++i) {
+                valence[i] = kValenceBoostScale * std::pow(float(i), -kValenceBoostPower);
+            }
+        }
+
+        float score(int32_t cachePosition, uint32_t liveTriangles) const {
+            if (liveTriangles == 0) {
+                return -1.0f;
+            }
+            const float cacheScore = cachePosition < 0 ? 0.0f : cache[cachePosition];
+            return cacheScore + valence[std::min(liveTriangles, kMaxValence)];
+        }
+    };
+
+    struct Vec3 {
+        float x, y, z;
+    };
+
+    inline Vec3 position(const float* positions, size_t stride, uint32_t vertex) {
+        const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + vertex * stride);
+        return Vec3 { p[0], p[1], p[2] };
+    }
+
+    inline Vec3 operator-(Vec3 a, Vec3 b) { return Vec3 { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Vec3 operator+(Vec3 a, Vec3 b) { return Vec3 { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Vec3 operator*(Vec3 a, float s) { return Vec3 { a.x * s, a.y * s, a.z * s }; }
+    inline float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Vec3 cross(Vec3 a, Vec3 b) { return Vec3 { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+    // FIFO post-transform cache by timestamps: a vertex is resident while fewer than cacheSize misses followed its own.
+    class FifoCache {
+    public:
+        FifoCache(size_t vertexCount, uint32_t cacheSize): _timestamps(vertexCount, 0), _cacheSize(cacheSize) {}
+
+        // Starts from an empty cache without clearing the table.
+        void reset() { _time += _cacheSize + 1; }
+
+        bool access(uint32_t vertex) {
+            if (_time - _timestamps[vertex] <= _cacheSize && _timestamps[vertex] != 0) {
+                return true;
+            }
+            _timestamps[vertex] = ++_time;
+            return false;
+        }
+
+    private:
+        std::vector<uint64_t> _timestamps;
+        uint64_t _cacheSize;
+        uint64_t _time = 0;
+    };
+}
+
+void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    static const ScoreTables tables;
+
+    std::vector<uint32_t> input(indices, indices + indexCount);
+    const size_t triangleCount = indexCount / 3;
+    Adjacency adjacency(input.data(), indexCount, vertexCount);
+
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScores[v] = tables.score(-1, adjacency.liveCounts[v]);
+    }
+
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    uint32_t current = UINT32_MAX;
+    float bestScore = -std::numeric_limits<float>::max();
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScores[t] = vertexScores[input[t * 3]] + vertexScores[input[t * 3 + 1]] + vertexScores[input[t * 3 + 2]];
+        if (triangleScores[t] > bestScore) {
+            bestScore = triangleScores[t];
+            current = static_cast<uint32_t>(t);
+        }
+    }
+
+    uint32_t cache[kVertexCacheSize + 3];
+    uint32_t cacheCount = 0;
+    size_t inputCursor = 0;
+    size_t output = 0;
+    while (current != UINT32_MAX) {
+        const uint32_t* triangle = &input[current * 3];
+        destination[output++] = triangle[0];
+        destination[output++] = triangle[1];
+        destination[output++] = triangle[2];
+        emitted[current] = 1;
+
+        // Most recently used first: the triangle's vertices, then the rest of the cache in order.
+        uint32_t next[kVertexCacheSize + 3] = { triangle[0], triangle[1], triangle[2] };
+        uint32_t nextCount = 3;
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            const uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                next[nextCount++] = v;
+            }
+        }
+        for (uint32_t i = 0; i < 3; ++i) {
+            adjacency.remove(triangle[i], current);
+        }
+
+        // Rescore every vertex whose position or live count changed, including those pushed out of the cache.
+        for (uint32_t i = 0; i < nextCount; ++i) {
+            const uint32_t v = next[i];
+            const int32_t cachePosition = i < kVertexCacheSize ? static_cast<int32_t>(i) : -1;
+            const float score = tables.score(cachePosition, adjacency.liveCounts[v]);
+            const float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            const uint32_t* live = &adjacency.triangles[adjacency.offsets[v]];
+            for (uint32_t j = 0; j < adjacency.liveCounts[v]; ++j) {
+                triangleScores[live[j]] += delta;
+            }
+        }
+
+        cacheCount = std::min(nextCount, kVertexCacheSize);
+        std::copy(next, next + cacheCount, cache);
+
+        current = UINT32_MAX;
+        bestScore = -std::numeric_limits<float>::max();
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            const uint32_t v = cache[i];
+            const uint32_t* live = &adjacency.triangles[adjacency.offsets[v]];
+            for (uint32_t j = 0; j < adjacency.liveCounts[v]; ++j) {
+                if (triangleScores[live[j]] > bestScore) {
+                    bestScore = triangleScores[live[j]];
+                    current = live[j];
+                }
+            }
+        }
+
+        // Dead end: nothing in the cache has triangles left, so resume with the next unemitted one in input order
+        // rather than rescanning every score.
+        if (current == UINT32_MAX) {
+            while (inputCursor < triangleCount && emitted[inputCursor]) {
+                ++inputCursor;
+            }
+            if (inputCursor < triangleCount) {
+                current = static_cast<uint32_t>(inputCursor);
+            }
+        }
+    }
+}
+
+void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride, float threshold) {
+    const std::vector<uint32_t> input(indices, indices + indexCount);
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Hard boundaries: triangles that miss the cache on all three vertices start over anyway.
+    FifoCache cache(vertexCount, 16);
+    std::vector<size_t> hardBoundaries;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        uint32_t misses = 0;
+        for (uint32_t i = 0; i < 3; ++i) {
+            misses += cache.access(input[t * 3 + i]) ? 0 : 1;
+        }
+        if (misses == 3 || t == 0) {
+            hardBoundaries.push_back(t);
+        }
+    }
+    hardBoundaries.push_back(triangleCount);
+
+    // Soft boundaries: split a hard cluster wherever the ACMR from the last split is already within threshold of
+    // the whole cluster's, so restarting the cache there costs at most that much.
+    std::vector<size_t> boundaries;
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); ++h) {
+        const size_t begin = hardBoundaries[h];
+        const size_t end = hardBoundaries[h + 1];
+
+        cache.reset();
+        size_t clusterMisses = 0;
+        for (size_t t = begin; t < end; ++t) {
+            for (uint32_t i = 0; i < 3; ++i) {
+                clusterMisses += cache.access(input[t * 3 + i]) ? 0 : 1;
+            }
+        }
+        const float clusterAcmr = float(clusterMisses) / float(end - begin);
+
+        cache.reset();
+        boundaries.push_back(begin);
+        size_t misses = 0;
+        size_t start = begin;
+        for (size_t t = begin; t < end; ++t) {
+            for (uint32_t i = 0; i < 3; ++i) {
+                misses += cache.access(input[t * 3 + i]) ? 0 : 1;
+            }
+            const float acmr = float(misses) / float(t + 1 - start);
+            if (t + 1 < end && acmr <= clusterAcmr * threshold) {
+                boundaries.push_back(t + 1);
+                cache.reset();
+                misses = 0;
+                start = t + 1;
+            }
+        }
+    }
+    boundaries.push_back(triangleCount);
+
+    // Clusters far out along their own normal are likely on the outside of the mesh and occlude the rest.
+    Vec3 meshCentroid = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+    const size_t clusterCount = boundaries.size() - 1;
+    std::vector<Vec3> clusterCentroids(clusterCount);
+    std::vector<Vec3> clusterNormals(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        Vec3 centroid = { 0.0f, 0.0f, 0.0f };
+        Vec3 normal = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+        for (size_t t = boundaries[c]; t < boundaries[c + 1]; ++t) {
+            const Vec3 a = position(positions, stride, input[t * 3]);
+            const Vec3 b = position(positions, stride, input[t * 3 + 1]);
+            const Vec3 d = position(positions, stride, input[t * 3 + 2]);
+            const Vec3 n = cross(b - a, d - a);
+            const float triangleArea = std::sqrt(dot(n, n));
+            centroid = centroid + (a + b + d) * (triangleArea / 3.0f);
+            normal = normal + n;
+            area += triangleArea;
+        }
+        meshCentroid = meshCentroid + centroid;
+        meshArea += area;
+        clusterCentroids[c] = area > 0.0f ? centroid * (1.0f / area) : position(positions, stride, input[boundaries[c] * 3]);
+        const float length = std::sqrt(dot(normal, normal));
+        clusterNormals[c] = length > 0.0f ? normal * (1.0f / length) : normal;
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid = meshCentroid * (1.0f / meshArea);
+    }
+
+    std::vector<float> sortKeys(clusterCount);
+    std::vector<uint32_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        sortKeys[c] = dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+        order[c] = static_cast<uint32_t>(c);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    size_t output = 0;
+    for (uint32_t c : order) {
+        const size_t begin = boundaries[c] * 3;
+        const size_t end = boundaries[c + 1] * 3;
+        std::copy(input.begin() + begin, input.begin() + end, destination + output);
+        output += end - begin;
+    }
+}
+
+size_t optimizeVertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    std::fill(remap, remap + vertexCount, UINT32_MAX);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        if (remap[indices[i]] == UINT32_MAX) {
+            remap[indices[i]] = next++;
+        }
+    }
+    return next;
+}
+
+template <size_t Components>
+static void remapAttribute(std::vector<float>& values, const std::vector<uint32_t>& remap, size_t usedCount) {
+    if (values.empty()) {
+        return;
+    }
+    std::vector<float> remapped(usedCount * Components);
+    for (size_t v = 0; v < remap.size(); ++v) {
+        if (remap[v] != UINT32_MAX) {
+            std::copy_n(&values[v * Components], Components, &remapped[remap[v] * Components]);
+        }
+    }
+    values.swap(remapped);
+}
+
+void optimizeMesh(mesh_import::ImportedMesh& mesh, float overdrawThreshold) {
+    const size_t vertexCount = mesh.vertexCount();
+    uint32_t* indices = mesh.indices.data();
+    optimizeVertexCache(indices, indices, mesh.indices.size(), vertexCount);
+    optimizeOverdraw(indices, indices, mesh.indices.size(), mesh.positions.data(), vertexCount, 3 * sizeof(float), overdrawThreshold);
+
+    std::vector<uint32_t> remap(vertexCount);
+    const size_t usedCount = optimizeVertexFetchRemap(remap.data(), indices, mesh.indices.size(), vertexCount);
+    for (uint32_t& index : mesh.indices) {
+        index = remap[index];
+    }
+    remapAttribute<3>(mesh.positions, remap, usedCount);
+    remapAttribute<3>(mesh.normals, remap, usedCount);
+    remapAttribute<2>(mesh.texCoords, remap, usedCount);
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<uint8_t> used(vertexCount, 0);
+    size_t usedCount = 0;
+    VertexCacheStats stats = {};
+    for (size_t i = 0; i < indexCount; ++i) {
+        stats.verticesTransformed += cache.access(indices[i]) ? 0 : 1;
+        usedCount += used[indices[i]] ? 0 : 1;
+        used[indices[i]] = 1;
+    }
+    stats.acmr = indexCount ? float(stats.verticesTransformed) / float(indexCount / 3) : 0.0f;
+    stats.atvr = usedCount ? float(stats.verticesTransformed) / float(usedCount) : 0.0f;
+    return stats;
+}
+
+OverdrawStats analyzeOverdraw(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride) {
+    constexpr int kResolution = 256;
+
+    Vec3 minimum = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    Vec3 maximum = minimum * -1.0f;
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const Vec3 p = position(positions, stride, static_cast<uint32_t>(v));
+        minimum = Vec3 { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+        maximum = Vec3 { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+    }
+    const Vec3 extent = maximum - minimum;
+    const float scale = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-20f));
+
+    // Normalized to [0, 1] so every view covers the same grid.
+    std::vector<Vec3> normalized(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        normalized[v] = (position(positions, stride, static_cast<uint32_t>(v)) - minimum) * (1.0f / scale);
+    }
+
+    OverdrawStats stats = {};
+    std::vector<float> depth(kResolution * kResolution);
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int side = 0; side < 2; ++side) {
+            std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+            // (u, v, axis) is a cyclic permutation of (x, y, z), so looking down -axis keeps counter-clockwise
+            // front faces counter-clockwise; the opposite side mirrors u and depth.
+            auto project = [&](const Vec3& p, float& x, float& y, float& z) {
+                const float c[3] = { p.x, p.y, p.z };
+                const float u = c[(axis + 1) % 3];
+                x = (side == 0 ? u : 1.0f - u) * kResolution;
+                y = c[(axis + 2) % 3] * kResolution;
+                z = side == 0 ? 1.0f - c[axis] : c[axis];
+            };
+
+            for (size_t i = 0; i + 2 < indexCount; i += 3) {
+                float x[3], y[3], z[3];
+                for (int k = 0; k < 3; ++k) {
+                    project(normalized[indices[i + k]], x[k], y[k], z[k]);
+                }
+                const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+                if (area <= 0.0f) {
+                    continue;
+                }
+
+                const int minX = std::max(0, static_cast<int>(std::floor(std::min({ x[0], x[1], x[2] }))));
+                const int maxX = std::min(kResolution - 1, static_cast<int>(std::ceil(std::max({ x[0], x[1], x[2] }))));
+                const int minY = std::max(0, static_cast<int>(std::floor(std::min({ y[0], y[1], y[2] }))));
+                const int maxY = std::min(kResolution - 1, static_cast<int>(std::ceil(std::max({ y[0], y[1], y[2] }))));
+                for (int py = minY; py <= maxY; ++py) {
+                    for (int px = minX; px <= maxX; ++px) {
+                        const float sx = px + 0.5f;
+                        const float sy = py + 0.5f;
+                        const float w0 = (x[2] - x[1]) * (sy - y[1]) - (y[2] - y[1]) * (sx - x[1]);
+                        const float w1 = (x[0] - x[2]) * (sy - y[2]) - (y[0] - y[2]) * (sx - x[2]);
+                        const float w2 = area - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                            continue;
+                        }
+                        const float pz = (w0 * z[0] + w1 * z[1] + w2 * z[2]) / area;
+                        float& stored = depth[py * kResolution + px];
+                        if (pz < stored) {
+                            stored = pz;
+                            ++stats.pixelsShaded;
+                        }
+                    }
+                }
+            }
+
+            for (float d : depth) {
+                stats.pixelsCovered += d != std::numeric_limits<float>::max() ? 1 : 0;
+            }
+        }
+    }
+    stats.overdraw = stats.pixelsCovered ? float(stats.pixelsShaded) / float(stats.pixelsCovered) : 0.0f;
+    return stats;
+}
+
+VertexFetchStats analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize) {
+    constexpr size_t kLineSize = 64;
+    constexpr uint32_t kLineCount = 16 * 1024 / kLineSize;
+
+    const size_t lineCount = (vertexCount * vertexSize + kLineSize - 1) / kLineSize;
+    FifoCache vertexCache(vertexCount, 16);
+    FifoCache cache(lineCount, kLineCount);
+    std::vector<uint8_t> used(vertexCount, 0);
+    size_t usedCount = 0;
+    VertexFetchStats stats = {};
+    for (size_t i = 0; i < indexCount; ++i) {
+        const uint32_t v = indices[i];
+        usedCount += used[v] ? 0 : 1;
+        used[v] = 1;
+        // Only vertices that miss the post-transform cache are shaded and fetch their attributes.
+        if (vertexCache.access(v)) {
+            continue;
+        }
+        const size_t first = v * vertexSize / kLineSize;
+        const size_t last = (v * vertexSize + vertexSize - 1) / kLineSize;
+        for (size_t line = first; line <= last; ++line) {
+            stats.bytesFetched += cache.access(static_cast<uint32_t>(line)) ? 0 : kLineSize;
+        }
+    }
+    stats.overfetch = usedCount ? float(stats.bytesFetched) / float(usedCount * vertexSize) : 0.0f;
+    return stats;
+}
+}
@@ -0,0 +1,75 @@
+//
+//  MeshOptimizer.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include "MeshImport.hpp"
+
+namespace mesh_optimize {
+    // Post-transform cache size the reordering targets; larger real caches only do better.
+    static constexpr uint32_t kVertexCacheSize = 32;
+
+    /**
+     * Reorders triangles for the post-transform vertex cache with Forsyth's linear-speed algorithm: vertices score
+     * by their position in a simulated LRU cache plus a bonus for having few triangles left, and the next triangle
+     * is the best-scoring one touching the cache. destination may equal indices.
+     */
+    void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    /**
+     * Reorders clusters of a cache-optimized index list so that triangles likely to occlude others are drawn first
+     * (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"). Clusters are split
+     * where the FIFO cache would miss anyway, and also where their ACMR stays within threshold times that of the
+     * enclosing cluster, so threshold bounds the cache cost: 1.0 keeps the ACMR, 1.05 allows 5% more.
+     * positions are float xyz at stride bytes. destination may equal indices.
+     */
+    void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride, float threshold = 1.05f);
+
+    /**
+     * Fills remap with each vertex's new position in first-use order, so vertex fetches walk memory forward; unused
+     * vertices get UINT32_MAX. Returns the number of vertices used.
+     */
+    size_t optimizeVertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    // Cache, overdraw and fetch order in that sequence, dropping unused vertices.
+    void optimizeMesh(mesh_import::ImportedMesh& mesh, float overdrawThreshold = 1.05f);
+
+    struct VertexCacheStats {
+        size_t verticesTransformed;
+        float acmr; // vertices transformed per triangle: 0.5 is ideal for a regular grid, 3 is no reuse
+        float atvr; // vertices transformed per vertex: 1 is ideal
+    };
+
+    // Simulates a FIFO post-transform cache, the usual model of the hardware.
+    VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize);
+
+    struct OverdrawStats {
+        uint64_t pixelsCovered;
+        uint64_t pixelsShaded;
+        float overdraw; // shaded per covered: 1 is ideal
+    };
+
+    /**
+     * Rasterizes the mesh with back-face culling and an early depth test from the six axis directions at a fixed
+     * resolution, in index order. Apple GPUs remove most opaque overdraw with hidden surface removal, so this
+     * measures what the order costs on immediate-mode GPUs and for passes that disable it.
+     */
+    OverdrawStats analyzeOverdraw(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride);
+
+    struct VertexFetchStats {
+        uint64_t bytesFetched;
+        float overfetch; // bytes fetched per byte of referenced vertex data: 1 is ideal
+    };
+
+    // Simulates a 16 KiB cache of 64-byte lines in front of the vertex buffer, read on post-transform cache misses.
+    VertexFetchStats analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize);
+}
+
+#endif /* MeshOptimizer_hpp */
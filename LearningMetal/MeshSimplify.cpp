@@ -0,0 +1,538 @@
+//
+//  MeshSimplify.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "MeshSimplify.hpp"
+#include "MeshOptimizer.hpp"
+#include "ParallelFor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace mesh_simplify {
+namespace {
+    struct Vec3 {
+        float x, y, z;
+    };
+
+    Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    Vec3 cross(Vec3 a, Vec3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+    float length(Vec3 a) { return std::sqrt(dot(a, a)); }
+
+    // Sum of squared distances to weighted planes: p'Ap + 2b'p + c, with w the total weight.
+    // Doubles: in flat regions p'Ap + 2b'p + c cancels to almost nothing, and floats round that to zero.
+    struct Quadric {
+        double a00, a11, a22, a01, a12, a02;
+        double b0, b1, b2;
+        double c;
+        double w;
+    };
+
+    void addPlane(Quadric& q, Vec3 n, double d, double w) {
+        q.a00 += w * n.x * n.x;
+        q.a11 += w * n.y * n.y;
+        q.a22 += w * n.z * n.z;
+        q.a01 += w * n.x * n.y;
+        q.a12 += w * n.y * n.z;
+        q.a02 += w * n.x * n.z;
+        q.b0 += w * n.x * d;
+        q.b1 += w * n.y * d;
+        q.b2 += w * n.z * d;
+        q.c += w * d * d;
+        q.w += w;
+    }
+
+    void add(Quadric& q, const Quadric& r) {
+        q.a00 += r.a00;
+        q.a11 += r.a11;
+        q.a22 += r.a22;
+        q.a01 += r.a01;
+        q.a12 += r.a12;
+        q.a02 += r.a02;
+        q.b0 += r.b0;
+        q.b1 += r.b1;
+        q.b2 += r.b2;
+        q.c += r.c;
+        q.w += r.w;
+    }
+
+    double evaluate(const Quadric& q, Vec3 p) {
+        const double rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z;
+        const double ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z;
+        const double rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z;
+        return rx * p.x + ry * p.y + rz * p.z + 2.0 * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+    }
+
+    // Borders weigh more than faces so that open edges keep their outline.
+    constexpr float kBorderWeight = 10.0f;
+
+    enum class Kind : uint8_t {
+        Manifold, // moves onto any neighbour
+        Border,   // on one open border, moves along it
+        Seam,     // one of two vertices sharing a position, moves along the seam with its sibling
+        Locked
+    };
+
+    struct Collapse {
+        uint32_t vertex;
+        uint32_t target;
+        float error;
+    };
+
+    class Simplifier {
+    public:
+        Simplifier(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride);
+
+        // Collapses until at most targetIndexCount indices remain, or no collapse under maxError (in unit box terms) is left.
+        void run(size_t targetIndexCount, float maxError);
+
+        const std::vector<uint32_t>& indices() const { return _indices; }
+        // In mesh units.
+        float error() const { return _error * _scale; }
+
+    private:
+        void buildAdjacency();
+        bool hasEdge(uint32_t a, uint32_t b) const;
+        bool flips(uint32_t vertex, uint32_t target) const;
+        size_t collapsedTriangles(uint32_t vertex, uint32_t target) const;
+        float collapseError(uint32_t vertex, uint32_t target) const;
+
+        std::vector<Vec3> _points; // positions scaled into the unit box
+        float _scale;
+        std::vector<uint32_t> _group;   // lowest vertex with the same position
+        std::vector<uint32_t> _sibling; // the other vertex of a seam pair, the vertex itself otherwise
+        std::vector<Kind> _kinds;
+        std::vector<Quadric> _quadrics; // per group
+        std::vector<uint32_t> _indices;
+        std::vector<uint32_t> _remap; // where this pass has moved each vertex so far
+        float _error;
+        // Triangles by vertex for the current indices.
+        std::vector<uint32_t> _offsets;
+        std::vector<uint32_t> _triangles;
+    };
+
+    Simplifier::Simplifier(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride): _scale(1.0f), _error(0.0f) {
+        _points.resize(vertexCount);
+        Vec3 minimum = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        Vec3 maximum = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+        for (size_t v = 0; v < vertexCount; ++v) {
+            float p[3];
+            memcpy(p, reinterpret_cast<const uint8_t*>(positions) + v * stride, sizeof(p));
+            _points[v] = { p[0], p[1], p[2] };
+            minimum = { std::min(minimum.x, p[0]), std::min(minimum.y, p[1]), std::min(minimum.z, p[2]) };
+            maximum = { std::max(maximum.x, p[0]), std::max(maximum.y, p[1]), std::max(maximum.z, p[2]) };
+        }
+        const Vec3 extent = maximum - minimum;
+        _scale = std::max(extent.x, std::max(extent.y, extent.z));
+        if (!(_scale > 0.0f)) {
+            _scale = 1.0f;
+        }
+        for (Vec3& p : _points) {
+            p = (p - minimum) * (1.0f / _scale);
+        }
+
+        // Group vertices by exact position; the importer has already merged vertices that agree on everything.
+        _group.resize(vertexCount);
+        std::vector<uint32_t> groupSizes(vertexCount, 0);
+        {
+            struct PositionHash {
+                size_t operator()(const Vec3& p) const {
+                    uint32_t bits[3];
+                    memcpy(bits, &p, sizeof(bits));
+                    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+                }
+            };
+            struct PositionEqual {
+                bool operator()(const Vec3& a, const Vec3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+            };
+            std::unordered_map<Vec3, uint32_t, PositionHash, PositionEqual> groups;
+            groups.reserve(vertexCount);
+            for (uint32_t v = 0; v < vertexCount; ++v) {
+                _group[v] = groups.emplace(_points[v], v).first->second;
+                ++groupSizes[_group[v]];
+            }
+        }
+        _sibling.resize(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            _sibling[v] = v;
+            const uint32_t g = _group[v];
+            if (groupSizes[g] == 2 && v != g) {
+                _sibling[v] = g;
+                _sibling[g] = v;
+            }
+        }
+
+        // Triangles that are already degenerate in position never come back.
+        _indices.reserve(indexCount);
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (_group[a] != _group[b] && _group[b] != _group[c] && _group[a] != _group[c]) {
+                _indices.insert(_indices.end(), { a, b, c });
+            }
+        }
+
+        // An edge without its opposite is open: by vertex, a seam or a border; by position, a border only.
+        buildAdjacency();
+        std::vector<uint32_t> groupOffsets(vertexCount + 1, 0);
+        for (uint32_t index : _indices) {
+            ++groupOffsets[_group[index] + 1];
+        }
+        for (size_t v = 0; v < vertexCount; ++v) {
+            groupOffsets[v + 1] += groupOffsets[v];
+        }
+        std::vector<uint32_t> groupTriangles(_indices.size());
+        {
+            std::vector<uint32_t> filled(groupOffsets.begin(), groupOffsets.end() - 1);
+            for (size_t i = 0; i < _indices.size(); ++i) {
+                groupTriangles[filled[_group[_indices[i]]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+        auto hasGroupEdge = [&](uint32_t a, uint32_t b) {
+            for (uint32_t k = groupOffsets[a]; k < groupOffsets[a + 1]; ++k) {
+                const uint32_t* triangle = &_indices[groupTriangles[k] * 3];
+                for (int e = 0; e < 3; ++e) {
+                    if (_group[triangle[e]] == a && _group[triangle[(e + 1) % 3]] == b) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        _quadrics.assign(vertexCount, Quadric {});
+        std::vector<uint8_t> openOut(vertexCount, 0), openIn(vertexCount, 0);
+        std::vector<uint8_t> borderOut(vertexCount, 0), borderIn(vertexCount, 0);
+        auto bump = [](uint8_t& count) { count = count < 255 ? count + 1 : count; };
+        for (size_t i = 0; i < _indices.size(); i += 3) {
+            const Vec3 p0 = _points[_indices[i]], p1 = _points[_indices[i + 1]], p2 = _points[_indices[i + 2]];
+            Vec3 normal = cross(p1 - p0, p2 - p0);
+            const float doubleArea = length(normal);
+            if (doubleArea > 0.0f) {
+                normal = normal * (1.0f / doubleArea);
+                for (int corner = 0; corner < 3; ++corner) {
+                    addPlane(_quadrics[_group[_indices[i + corner]]], normal, -dot(normal, p0), doubleArea * 0.5f);
+                }
+            }
+
+            for (int e = 0; e < 3; ++e) {
+                const uint32_t a = _indices[i + e], b = _indices[i + (e + 1) % 3];
+                if (!hasEdge(b, a)) {
+                    bump(openOut[a]);
+                    bump(openIn[b]);
+                }
+                if (!hasGroupEdge(_group[b], _group[a])) {
+                    bump(borderOut[_group[a]]);
+                    bump(borderIn[_group[b]]);
+                    // A plane through the border edge, perpendicular to the face, holds the outline in place.
+                    const Vec3 edge = _points[b] - _points[a];
+                    Vec3 edgeNormal = cross(edge, normal);
+                    const float edgeNormalLength = length(edgeNormal);
+                    if (doubleArea > 0.0f && edgeNormalLength > 0.0f) {
+                        edgeNormal = edgeNormal * (1.0f / edgeNormalLength);
+                        const float weight = dot(edge, edge) * kBorderWeight;
+                        addPlane(_quadrics[_group[a]], edgeNormal, -dot(edgeNormal, _points[a]), weight);
+                        addPlane(_quadrics[_group[b]], edgeNormal, -dot(edgeNormal, _points[a]), weight);
+                    }
+                }
+            }
+        }
+
+        _kinds.resize(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            const uint32_t g = _group[v];
+            const bool onBorder = borderOut[g] != 0 || borderIn[g] != 0;
+            const bool simpleBorder = borderOut[g] == 1 && borderIn[g] == 1;
+            const bool open = openOut[v] != 0 || openIn[v] != 0;
+            if (groupSizes[g] == 1) {
+                // Open edges that are not a border mean a seam ends here: moving the vertex would drag one side's
+                // attributes across to the other.
+                _kinds[v] = !onBorder ? (open ? Kind::Locked : Kind::Manifold) : simpleBorder ? Kind::Border : Kind::Locked;
+            } else if (groupSizes[g] == 2 && !onBorder) {
+                const uint32_t s = _sibling[v];
+                const bool simpleSeam = openOut[v] == 1 && openIn[v] == 1 && openOut[s] == 1 && openIn[s] == 1;
+                _kinds[v] = simpleSeam ? Kind::Seam : Kind::Locked;
+            } else {
+                _kinds[v] = Kind::Locked;
+            }
+        }
+    }
+
+    void Simplifier::buildAdjacency() {
+        const size_t vertexCount = _points.size();
+        _offsets.assign(vertexCount + 1, 0);
+        for (uint32_t index : _indices) {
+            ++_offsets[index + 1];
+        }
+        for (size_t v = 0; v < vertexCount; ++v) {
+            _offsets[v + 1] += _offsets[v];
+        }
+        _triangles.resize(_indices.size());
+        std::vector<uint32_t> filled(_offsets.begin(), _offsets.end() - 1);
+        for (size_t i = 0; i < _indices.size(); ++i) {
+            _triangles[filled[_indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    bool Simplifier::hasEdge(uint32_t a, uint32_t b) const {
+        for (uint32_t k = _offsets[a]; k < _offsets[a + 1]; ++k) {
+            const uint32_t* triangle = &_indices[_triangles[k] * 3];
+            for (int e = 0; e < 3; ++e) {
+                if (triangle[e] == a && triangle[(e + 1) % 3] == b) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Whether moving vertex onto target turns any surviving triangle around it over, given the moves made so far this
+    // pass. Targets never move in the pass they are collapsed onto, so one remap lookup finds where a corner is now.
+    bool Simplifier::flips(uint32_t vertex, uint32_t target) const {
+        const Vec3 from = _points[vertex];
+        const Vec3 to = _points[target];
+        for (uint32_t k = _offsets[vertex]; k < _offsets[vertex + 1]; ++k) {
+            const uint32_t* triangle = &_indices[_triangles[k] * 3];
+            const int corner = triangle[0] == vertex ? 0 : triangle[1] == vertex ? 1 : 2;
+            const uint32_t b0 = triangle[(corner + 1) % 3], c0 = triangle[(corner + 2) % 3];
+            const uint32_t b = _remap[b0], c = _remap[c0];
+            if (_group[b] == _group[target] || _group[c] == _group[target] || _group[b] == _group[c]) {
+                continue; // collapses with the edge, or already has
+            }
+            // Measured against the triangle as the pass found it, so several collapses around it cannot add up to a
+            // flip; turning it more than about 75 degrees counts as one.
+            const Vec3 before = cross(_points[b0] - from, _points[c0] - from);
+            const Vec3 after = cross(_points[b] - to, _points[c] - to);
+            if (dot(before, after) <= 0.25f * length(before) * length(after)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t Simplifier::collapsedTriangles(uint32_t vertex, uint32_t target) const {
+        size_t count = 0;
+        for (uint32_t k = _offsets[vertex]; k < _offsets[vertex + 1]; ++k) {
+            const uint32_t* triangle = &_indices[_triangles[k] * 3];
+            const uint32_t a = _group[_remap[triangle[0]]], b = _group[_remap[triangle[1]]], c = _group[_remap[triangle[2]]];
+            const uint32_t g = _group[target];
+            // Skips triangles an earlier collapse this pass has already removed.
+            count += (a != b && b != c && a != c) && (a == g || b == g || c == g);
+        }
+        return count;
+    }
+
+    // Distance, as an RMS over the planes gathered so far, of the merged vertex from the surface it stands for.
+    float Simplifier::collapseError(uint32_t vertex, uint32_t target) const {
+        const Quadric& q0 = _quadrics[_group[vertex]];
+        const Quadric& q1 = _quadrics[_group[target]];
+        const double weight = q0.w + q1.w;
+        if (!(weight > 0.0)) {
+            return 0.0f;
+        }
+        const double squared = evaluate(q0, _points[target]) + evaluate(q1, _points[target]);
+        return static_cast<float>(std::sqrt(std::max(squared, 0.0) / weight));
+    }
+
+    void Simplifier::run(size_t targetIndexCount, float maxError) {
+        const size_t vertexCount = _points.size();
+        std::vector<Collapse> collapses;
+        std::vector<uint8_t> locked(vertexCount);
+        _remap.resize(vertexCount);
+
+        while (_indices.size() > targetIndexCount) {
+            buildAdjacency();
+
+            // Each edge once: from the triangle where it runs from the lower index, or the only one if it is open.
+            collapses.clear();
+            for (size_t i = 0; i < _indices.size(); i += 3) {
+                for (int e = 0; e < 3; ++e) {
+                    const uint32_t a = _indices[i + e], b = _indices[i + (e + 1) % 3];
+                    // Open edges only ever join border or seam vertices, so most edges need no lookup.
+                    const bool open = _kinds[a] != Kind::Manifold && _kinds[b] != Kind::Manifold && !hasEdge(b, a);
+                    if (a > b && !open) {
+                        continue;
+                    }
+                    Collapse best = { 0, 0, std::numeric_limits<float>::max() };
+                    for (const auto& [vertex, target] : { std::pair<uint32_t, uint32_t>(a, b), std::pair<uint32_t, uint32_t>(b, a) }) {
+                        bool allowed = false;
+                        switch (_kinds[vertex]) {
+                            case Kind::Manifold:
+                                allowed = true;
+                                break;
+                            case Kind::Border:
+                                allowed = _kinds[target] == Kind::Border && open;
+                                break;
+                            case Kind::Seam: {
+                                // The sibling has to be able to follow along the other side of the seam.
+                                const uint32_t vertexSibling = _sibling[vertex];
+                                const uint32_t targetSibling = _sibling[target];
+                                allowed = _kinds[target] == Kind::Seam && open && (hasEdge(vertexSibling, targetSibling) != hasEdge(targetSibling, vertexSibling));
+                                break;
+                            }
+                            case Kind::Locked:
+                                break;
+                        }
+                        if (!allowed) {
+                            continue;
+                        }
+                        const float error = collapseError(vertex, target);
+                        if (error < best.error) {
+                            best = { vertex, target, error };
+                        }
+                    }
+                    if (best.error <= maxError) {
+                        collapses.push_back(best);
+                    }
+                }
+            }
+            if (collapses.empty()) {
+                break;
+            }
+            // Each interior collapse removes two triangles. Past the collapse that would reach the target on its own,
+            // accept only a little more error than it, so one pass does not eat into what later passes would do
+            // better after the neighbourhood has changed. Only the candidates under that limit need sorting.
+            auto byError = [](const Collapse& a, const Collapse& b) { return a.error < b.error; };
+            const size_t trianglesToRemove = (_indices.size() - targetIndexCount + 2) / 3;
+            const size_t goal = std::min(collapses.size() - 1, trianglesToRemove / 2);
+            std::nth_element(collapses.begin(), collapses.begin() + goal, collapses.end(), byError);
+            const float errorLimit = collapses[goal].error * 1.5f;
+            auto sorted = std::partition(collapses.begin() + goal + 1, collapses.end(), [&](const Collapse& c) { return c.error <= errorLimit; });
+            std::sort(collapses.begin(), sorted, byError);
+
+            std::fill(locked.begin(), locked.end(), 0);
+            for (uint32_t v = 0; v < vertexCount; ++v) {
+                _remap[v] = v;
+            }
+            size_t removed = 0;
+            size_t applied = 0;
+            for (auto it = collapses.begin(); it != collapses.end() && removed < trianglesToRemove; ++it) {
+                if (it == sorted) {
+                    if (applied > 0) {
+                        break;
+                    }
+                    // Nothing under the limit could go; carry on with the rest, cheapest first.
+                    std::sort(sorted, collapses.end(), byError);
+                    sorted = collapses.end();
+                }
+                const Collapse& collapse = *it;
+                const uint32_t vertex = collapse.vertex;
+                const uint32_t target = collapse.target;
+                const bool seam = _kinds[vertex] == Kind::Seam;
+                const uint32_t vertexSibling = _sibling[vertex];
+                const uint32_t targetSibling = _sibling[target];
+                if (locked[vertex] || locked[target] || (seam && (locked[vertexSibling] || locked[targetSibling]))) {
+                    continue;
+                }
+                if (flips(vertex, target) || (seam && flips(vertexSibling, targetSibling))) {
+                    continue;
+                }
+
+                removed += collapsedTriangles(vertex, target) + (seam ? collapsedTriangles(vertexSibling, targetSibling) : 0);
+                _remap[vertex] = target;
+                if (seam) {
+                    _remap[vertexSibling] = targetSibling;
+                }
+                add(_quadrics[_group[target]], _quadrics[_group[vertex]]);
+                _error = std::max(_error, collapse.error);
+                ++applied;
+
+                // A vertex moves at most once per pass and never after being collapsed onto; the flip test sees the
+                // rest of the pass's moves through the remap, so neighbours need not wait for the next pass.
+                locked[vertex] = locked[target] = locked[vertexSibling] = locked[targetSibling] = 1;
+            }
+            if (applied == 0) {
+                break;
+            }
+
+            size_t written = 0;
+            for (size_t i = 0; i < _indices.size(); i += 3) {
+                const uint32_t a = _remap[_indices[i]], b = _remap[_indices[i + 1]], c = _remap[_indices[i + 2]];
+                if (_group[a] != _group[b] && _group[b] != _group[c] && _group[a] != _group[c]) {
+                    _indices[written++] = a;
+                    _indices[written++] = b;
+                    _indices[written++] = c;
+                }
+            }
+            _indices.resize(written);
+        }
+    }
+}
+
+size_t simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride,
+                size_t targetIndexCount, float maxError, float* pError) {
+    Simplifier simplifier(indices, indexCount, positions, vertexCount, stride);
+    simplifier.run(targetIndexCount, maxError);
+    const std::vector<uint32_t>& result = simplifier.indices();
+    std::copy(result.begin(), result.end(), destination);
+    if (pError) {
+        *pError = simplifier.error();
+    }
+    return result.size();
+}
+
+LodChain buildLodChain(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride, const LodOptions& options) {
+    LodChain chain;
+    chain.indices.assign(indices, indices + indexCount);
+    chain.levels.push_back({ 0, static_cast<uint32_t>(indexCount), 0.0f, 0 });
+    if (options.maxLevels <= 1 || indexCount / 3 <= options.minTriangles) {
+        return chain;
+    }
+
+    Simplifier simplifier(indices, indexCount, positions, vertexCount, stride);
+    size_t previous = indexCount / 3;
+    while (chain.levels.size() < options.maxLevels) {
+        const size_t target = std::max(options.minTriangles, static_cast<size_t>(static_cast<float>(previous) * options.reduction));
+        if (target >= previous) {
+            break;
+        }
+        simplifier.run(target * 3, options.maxError);
+        const std::vector<uint32_t>& level = simplifier.indices();
+        const size_t triangles = level.size() / 3;
+        if (triangles == 0 || triangles * 10 > previous * 9) {
+            break;
+        }
+
+        const size_t first = chain.indices.size();
+        chain.indices.resize(first + level.size());
+        if (options.optimizeCache) {
+            mesh_optimize::optimizeVertexCache(chain.indices.data() + first, level.data(), level.size(), vertexCount);
+        } else {
+            std::copy(level.begin(), level.end(), chain.indices.begin() + first);
+        }
+        chain.levels.push_back({ static_cast<uint32_t>(first), static_cast<uint32_t>(level.size()), simplifier.error(), 0 });
+        previous = triangles;
+    }
+    return chain;
+}
+
+std::vector<LodChain> buildLodChains(const std::vector<LodSource>& sources, const LodOptions& options, uint32_t threads) {
+    std::vector<LodChain> chains(sources.size());
+    std::atomic<size_t> next(0);
+    const size_t workers = std::min<size_t>(parallel::workerCount(threads), sources.size());
+    parallel::forRange(workers, 1, static_cast<uint32_t>(workers), [&](size_t, size_t, size_t) {
+        for (size_t i = next++; i < sources.size(); i = next++) {
+            const LodSource& source = sources[i];
+            chains[i] = buildLodChain(source.indices, source.indexCount, source.positions, source.vertexCount, source.stride, options);
+        }
+    });
+    return chains;
+}
+
+size_t selectLod(const LodLevel* levels, size_t levelCount, float distance, float pixelsPerUnit, float maxPixels) {
+    const float scale = pixelsPerUnit / std::max(distance, 1e-6f);
+    for (size_t i = levelCount; i > 1; --i) {
+        if (levels[i - 1].error * scale <= maxPixels) {
+            return i - 1;
+        }
+    }
+    return 0;
+}
+}
@@ -0,0 +1,80 @@
+//
+//  MeshSimplify.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef MeshSimplify_hpp
+#define MeshSimplify_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Level-of-detail generation by edge collapse with quadric error metrics (Garland and Heckbert, "Surface
+ * Simplification Using Quadric Error Metrics"). Vertices only ever move onto a neighbour, so no new vertices or
+ * attributes are made and every LOD indexes the original vertex buffer. Plain C++, independent of Metal.
+ *
+ * Vertices that share a position but not their attributes form a seam. Seam vertices collapse only along the seam,
+ * both sides together, so the seam keeps its shape and neither side's attributes bleed into the other; open borders
+ * collapse only along themselves; anything more tangled is locked.
+ */
+namespace mesh_simplify {
+    /**
+     * Collapses edges until at most targetIndexCount indices remain or the next collapse would move the surface by
+     * more than maxError, a fraction of the mesh's largest bounding box extent. positions are float xyz at stride
+     * bytes. Writes the result to destination, which may equal indices, and returns its index count; pError receives
+     * the largest collapse error, the quadrics' estimate of how far the surface moved, in mesh units.
+     */
+    size_t simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride,
+                    size_t targetIndexCount, float maxError = 1.0f, float* pError = nullptr);
+
+    struct LodLevel {
+        uint32_t firstIndex; // into LodChain::indices
+        uint32_t indexCount;
+        float error;         // estimated distance from the source surface, in mesh units; 0 for level 0
+        uint32_t reserved;
+    };
+
+    struct LodChain {
+        std::vector<uint32_t> indices; // every level's triangles, level 0 (the source) first
+        std::vector<LodLevel> levels;  // finest first, with error increasing
+    };
+
+    struct LodOptions {
+        float reduction = 0.5f;      // each level targets this fraction of the previous level's triangles
+        uint32_t maxLevels = 8;      // including level 0
+        size_t minTriangles = 64;    // no level targets fewer
+        float maxError = 0.05f;      // as for simplify(): levels stop where the error would exceed this
+        bool optimizeCache = true;   // reorder each simplified level for the post-transform cache
+    };
+
+    /**
+     * Simplifies the source level by level, each continuing from the last, so errors accumulate against the source
+     * and never decrease. Stops early once a level no longer removes a tenth of the previous one's triangles.
+     */
+    LodChain buildLodChain(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride,
+                           const LodOptions& options = {});
+
+    struct LodSource {
+        const uint32_t* indices;
+        size_t indexCount;
+        const float* positions;
+        size_t vertexCount;
+        size_t stride;
+    };
+
+    // One chain per source, built in parallel: workers take the next unbuilt mesh, so large meshes balance. 0 threads: one per hardware thread.
+    std::vector<LodChain> buildLodChains(const std::vector<LodSource>& sources, const LodOptions& options = {}, uint32_t threads = 0);
+
+    /**
+     * Screen-space error selection: the coarsest level whose error, seen from distance, projects to at most
+     * maxPixels. pixelsPerUnit is the viewport height over 2 tan(fovY / 2), the size in pixels of one unit at
+     * distance 1.
+     */
+    size_t selectLod(const LodLevel* levels, size_t levelCount, float distance, float pixelsPerUnit, float maxPixels = 1.0f);
+}
+
+#endif /* MeshSimplify_hpp */
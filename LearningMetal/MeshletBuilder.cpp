@@ -0,0 +1,338 @@
+//
+//  MeshletBuilder.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "MeshletBuilder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace meshlet_builder {
+namespace {
+    struct Vec3 {
+        float x, y, z;
+    };
+
+    Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    Vec3 cross(Vec3 a, Vec3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+    float length(Vec3 a) { return std::sqrt(dot(a, a)); }
+    float component(Vec3 a, int axis) { return axis == 0 ? a.x : axis == 1 ? a.y : a.z; }
+
+    Vec3 load(const float* positions, size_t stride, uint32_t vertex) {
+        float p[3];
+        memcpy(p, reinterpret_cast<const uint8_t*>(positions) + vertex * stride, sizeof(p));
+        return { p[0], p[1], p[2] };
+    }
+
+    void store(float destination[3], Vec3 v) {
+        destination[0] = v.x;
+        destination[1] = v.y;
+        destination[2] = v.z;
+    }
+
+    // Spreads the low 10 bits of v so two zero bits follow each.
+    uint32_t spreadBits(uint32_t v) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    // Triangles grouped by vertex: those using v are triangles[offsets[v]] up to triangles[offsets[v + 1]].
+    struct Adjacency {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        Adjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount): offsets(vertexCount + 1, 0), triangles(indexCount) {
+            for (size_t i = 0; i < indexCount; ++i) {
+                ++offsets[indices[i] + 1];
+            }
+            for (size_t v = 0; v < vertexCount; ++v) {
+                offsets[v + 1] += offsets[v];
+            }
+            std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indexCount; ++i) {
+                triangles[filled[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+    };
+
+    constexpr uint8_t kNotInMeshlet = 0xff;
+    constexpr uint32_t kMaxBoundsTriangles = 512;
+
+    // Ritter's sphere: start from the most distant pair of axis extremes, then grow to enclose every point.
+    void boundingSphere(const Vec3* points, size_t count, Vec3& center, float& radius) {
+        uint32_t minimum[3] = { 0, 0, 0 };
+        uint32_t maximum[3] = { 0, 0, 0 };
+        for (uint32_t i = 0; i < count; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                minimum[axis] = component(points[i], axis) < component(points[minimum[axis]], axis) ? i : minimum[axis];
+                maximum[axis] = component(points[i], axis) > component(points[maximum[axis]], axis) ? i : maximum[axis];
+            }
+        }
+        int widest = 0;
+        float widestDistance = -1.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+            const Vec3 d = points[maximum[axis]] - points[minimum[axis]];
+            if (dot(d, d) > widestDistance) {
+                widestDistance = dot(d, d);
+                widest = axis;
+            }
+        }
+        center = (points[minimum[widest]] + points[maximum[widest]]) * 0.5f;
+        radius = std::sqrt(widestDistance) * 0.5f;
+        for (size_t i = 0; i < count; ++i) {
+            const float distance = length(points[i] - center);
+            if (distance > radius) {
+                const float grown = (radius + distance) * 0.5f;
+                center = center + (points[i] - center) * ((grown - radius) / distance);
+                radius = grown;
+            }
+        }
+    }
+}
+
+void computeBounds(Meshlet& meshlet, const MeshletSet& set, const float* positions, size_t stride) {
+    Vec3 points[256];
+    const uint32_t* vertices = set.vertices.data() + meshlet.vertexOffset;
+    const uint32_t vertexCount = std::min(meshlet.vertexCount, 256u);
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        points[i] = load(positions, stride, vertices[i]);
+    }
+    Vec3 center;
+    float radius;
+    boundingSphere(points, vertexCount, center, radius);
+    store(meshlet.center, center);
+    meshlet.radius = radius;
+
+    // The cone axis is the average face normal; every face must lie within 90 degrees of it for a cone to exist.
+    // Degenerate faces keep a zero normal and are left out.
+    const uint8_t* triangles = set.triangles.data() + meshlet.triangleOffset;
+    Vec3 normals[kMaxBoundsTriangles];
+    const uint32_t triangleCount = std::min(meshlet.triangleCount, kMaxBoundsTriangles);
+    Vec3 axis = { 0.0f, 0.0f, 0.0f };
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        const Vec3 a = points[triangles[t * 3]];
+        const Vec3 n = cross(points[triangles[t * 3 + 1]] - a, points[triangles[t * 3 + 2]] - a);
+        const float area = length(n);
+        normals[t] = area > 0.0f ? n * (1.0f / area) : Vec3 { 0.0f, 0.0f, 0.0f };
+        axis = axis + normals[t];
+    }
+
+    store(meshlet.coneApex, center);
+    store(meshlet.coneAxis, { 0.0f, 0.0f, 0.0f });
+    meshlet.coneCutoff = 2.0f;
+    const float axisLength = length(axis);
+    if (axisLength == 0.0f) {
+        return;
+    }
+    axis = axis * (1.0f / axisLength);
+    store(meshlet.coneAxis, axis);
+    float minimumDot = 1.0f;
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        if (dot(normals[t], normals[t]) > 0.0f) {
+            minimumDot = std::min(minimumDot, dot(normals[t], axis));
+        }
+    }
+    if (minimumDot <= 0.0f) {
+        return;
+    }
+
+    // The apex sits behind the meshlet along the axis, far enough that every face plane passes in front of it, so
+    // a camera inside the widened cone sees all faces from behind.
+    float apexDistance = 0.0f;
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        if (dot(normals[t], normals[t]) > 0.0f) {
+            apexDistance = std::max(apexDistance, dot(center - points[triangles[t * 3]], normals[t]) / dot(axis, normals[t]));
+        }
+    }
+    store(meshlet.coneApex, center - axis * apexDistance);
+    // The normal cone's half angle is acos(minimumDot); viewing directions within 90 degrees beyond it see only
+    // back faces, so the cutoff is cos(90 - angle) = sin(angle).
+    meshlet.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+}
+
+MeshletSet buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride,
+                         uint32_t maxVertices, uint32_t maxTriangles) {
+    maxVertices = std::clamp(maxVertices, 3u, 255u);
+    maxTriangles = std::clamp(maxTriangles, 1u, kMaxBoundsTriangles);
+    const size_t triangleCount = indexCount / 3;
+    MeshletSet set;
+    if (triangleCount == 0) {
+        return set;
+    }
+
+    std::vector<Vec3> centroids(triangleCount);
+    Vec3 minimum = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    Vec3 maximum = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const Vec3 sum = load(positions, stride, indices[t * 3]) + load(positions, stride, indices[t * 3 + 1]) + load(positions, stride, indices[t * 3 + 2]);
+        centroids[t] = sum * (1.0f / 3.0f);
+        minimum = { std::min(minimum.x, centroids[t].x), std::min(minimum.y, centroids[t].y), std::min(minimum.z, centroids[t].z) };
+        maximum = { std::max(maximum.x, centroids[t].x), std::max(maximum.y, centroids[t].y), std::max(maximum.z, centroids[t].z) };
+    }
+
+    // Morton order of the centroids on a 1024^3 grid over their bounds, for seeds and for the fallback when a
+    // meshlet has no neighbours left.
+    const Vec3 extent = maximum - minimum;
+    const float scale = 1023.0f / std::max({ extent.x, extent.y, extent.z, std::numeric_limits<float>::min() });
+    std::vector<uint64_t> order(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const Vec3 p = (centroids[t] - minimum) * scale;
+        const uint32_t code = spreadBits(uint32_t(p.x)) | spreadBits(uint32_t(p.y)) << 1 | spreadBits(uint32_t(p.z)) << 2;
+        order[t] = uint64_t(code) << 32 | t;
+    }
+    std::sort(order.begin(), order.end());
+
+    Adjacency adjacency(indices, triangleCount * 3, vertexCount);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint8_t> slots(vertexCount, kNotInMeshlet);
+    size_t orderCursor = 0;
+    // Unemitted triangles sharing a vertex with the current meshlet, each with its count of vertices not yet in the
+    // meshlet, kept current as vertices join, and a copy of its centroid, so the scan for the next triangle reads
+    // one array in order. candidateOf marks listed triangles with the meshlet's number, candidatePosition is their
+    // place in the list.
+    struct Candidate {
+        uint32_t triangle;
+        uint32_t added;
+        Vec3 centroid;
+    };
+    std::vector<Candidate> candidates;
+    std::vector<uint32_t> candidateOf(triangleCount, UINT32_MAX);
+    std::vector<uint32_t> candidatePosition(triangleCount, 0);
+
+    set.meshlets.reserve(triangleCount / maxTriangles + 1);
+    set.vertices.reserve(triangleCount);
+    set.triangles.reserve(triangleCount * 3 + triangleCount / maxTriangles * 4);
+
+    Meshlet meshlet {};
+    Vec3 centroidSum = { 0.0f, 0.0f, 0.0f };
+    auto finish = [&] {
+        if (meshlet.triangleCount == 0) {
+            return;
+        }
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            slots[set.vertices[meshlet.vertexOffset + i]] = kNotInMeshlet;
+        }
+        set.triangles.resize((set.triangles.size() + 3) & ~size_t(3));
+        computeBounds(meshlet, set, positions, stride);
+        set.meshlets.push_back(meshlet);
+        meshlet = Meshlet {};
+        meshlet.vertexOffset = static_cast<uint32_t>(set.vertices.size());
+        meshlet.triangleOffset = static_cast<uint32_t>(set.triangles.size());
+        centroidSum = { 0.0f, 0.0f, 0.0f };
+        candidates.clear();
+    };
+    auto newVertices = [&](const uint32_t* v) {
+        return uint32_t(slots[v[0]] == kNotInMeshlet) + uint32_t(slots[v[1]] == kNotInMeshlet && v[1] != v[0])
+             + uint32_t(slots[v[2]] == kNotInMeshlet && v[2] != v[0] && v[2] != v[1]);
+    };
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+        // Best neighbour: fewest new vertices, then nearest to the centroid, ranked by one key with the new vertices
+        // in the high word and the distance's bits in the low word (ordered like the distance, which is never
+        // negative). A neighbour that would overflow the vertex limit ends the meshlet rather than jumping away.
+        size_t bestCandidate = SIZE_MAX;
+        uint64_t bestKey = UINT64_MAX;
+        bool blocked = false;
+        const Vec3 center = centroidSum * (meshlet.triangleCount ? 1.0f / float(meshlet.triangleCount) : 0.0f);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const Vec3 d = candidates[i].centroid - center;
+            const float distance = dot(d, d);
+            uint32_t distanceBits;
+            memcpy(&distanceBits, &distance, sizeof(distanceBits));
+            const bool fits = meshlet.vertexCount + candidates[i].added <= maxVertices;
+            const uint64_t key = fits ? uint64_t(candidates[i].added) << 32 | distanceBits : UINT64_MAX;
+            blocked |= !fits;
+            bestCandidate = key < bestKey ? i : bestCandidate;
+            bestKey = key < bestKey ? key : bestKey;
+        }
+
+        uint32_t best;
+        if (bestCandidate != SIZE_MAX) {
+            best = candidates[bestCandidate].triangle;
+            candidates[bestCandidate] = candidates.back();
+            candidatePosition[candidates[bestCandidate].triangle] = static_cast<uint32_t>(bestCandidate);
+            candidates.pop_back();
+        } else {
+            // Every candidate is blocked, or there are none; either way best cannot already be listed.
+            while (emitted[uint32_t(order[orderCursor])]) {
+                ++orderCursor;
+            }
+            best = uint32_t(order[orderCursor]);
+            if (blocked || meshlet.vertexCount + newVertices(indices + best * 3) > maxVertices) {
+                finish();
+            }
+        }
+
+        const uint32_t* v = indices + best * 3;
+        uint32_t joined[3];
+        uint32_t joinedCount = 0;
+        for (int k = 0; k < 3; ++k) {
+            if (slots[v[k]] == kNotInMeshlet) {
+                slots[v[k]] = static_cast<uint8_t>(meshlet.vertexCount++);
+                set.vertices.push_back(v[k]);
+                joined[joinedCount++] = v[k];
+            }
+            set.triangles.push_back(slots[v[k]]);
+        }
+        emitted[best] = 1;
+        centroidSum = centroidSum + centroids[best];
+
+        // Only triangles around the vertices that just joined change their count or become candidates.
+        const uint32_t meshletNumber = static_cast<uint32_t>(set.meshlets.size());
+        for (uint32_t k = 0; k < joinedCount; ++k) {
+            for (uint32_t j = adjacency.offsets[joined[k]]; j < adjacency.offsets[joined[k] + 1]; ++j) {
+                const uint32_t triangle = adjacency.triangles[j];
+                if (emitted[triangle]) {
+                    continue;
+                }
+                const uint32_t added = newVertices(indices + triangle * 3);
+                if (candidateOf[triangle] == meshletNumber) {
+                    candidates[candidatePosition[triangle]].added = added;
+                } else {
+                    candidateOf[triangle] = meshletNumber;
+                    candidatePosition[triangle] = static_cast<uint32_t>(candidates.size());
+                    candidates.push_back({ triangle, added, centroids[triangle] });
+                }
+            }
+        }
+
+        if (++meshlet.triangleCount == maxTriangles) {
+            finish();
+        }
+    }
+    finish();
+    return set;
+}
+
+MeshletStats analyzeMeshlets(const MeshletSet& set) {
+    MeshletStats stats {};
+    stats.meshletCount = set.meshlets.size();
+    if (stats.meshletCount == 0) {
+        return stats;
+    }
+    size_t cullable = 0;
+    for (const Meshlet& meshlet : set.meshlets) {
+        stats.averageVertices += float(meshlet.vertexCount);
+        stats.averageTriangles += float(meshlet.triangleCount);
+        stats.averageRadius += meshlet.radius;
+        cullable += meshlet.coneCutoff <= 1.0f ? 1 : 0;
+    }
+    const float count = float(stats.meshletCount);
+    stats.averageVertices /= count;
+    stats.averageTriangles /= count;
+    stats.averageRadius /= count;
+    stats.coneCullable = float(cullable) / count;
+    return stats;
+}
+}
@@ -0,0 +1,71 @@
+//
+//  MeshletBuilder.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef MeshletBuilder_hpp
+#define MeshletBuilder_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Splits an index list into meshlets, small clusters of triangles that one mesh shader threadgroup turns into
+ * primitives, each with the bounds an object shader needs to cull it: a bounding sphere for the frustum and a normal
+ * cone for back faces. Plain C++, independent of Metal and of the importer.
+ */
+namespace meshlet_builder {
+    // Limits of the mesh function in Shaders.metal; 124 triangles keep a meshlet's index bytes under 512 with 64 vertices.
+    static constexpr uint32_t kMaxVertices = 64;
+    static constexpr uint32_t kMaxTriangles = 124;
+
+    /**
+     * Layout of shader_types::MeshletData, which is what the Meshlets section of a mesh file holds. The cone test
+     * culls the meshlet when dot(normalize(coneApex - camera), coneAxis) >= coneCutoff; a cutoff above 1 disables it.
+     */
+    struct Meshlet {
+        float center[3];
+        float radius;
+        float coneApex[3];
+        float coneCutoff;
+        float coneAxis[3];
+        uint32_t vertexOffset;   // first entry in MeshletSet::vertices
+        uint32_t triangleOffset; // first byte in MeshletSet::triangles, a multiple of 4
+        uint32_t vertexCount;
+        uint32_t triangleCount;
+    };
+
+    struct MeshletSet {
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> vertices; // indices into the mesh's vertices, per meshlet
+        std::vector<uint8_t> triangles; // three indices into the meshlet's vertices per triangle
+    };
+
+    /**
+     * Grows each meshlet from a seed triangle by adding the adjacent triangle that brings the fewest new vertices,
+     * nearest to the meshlet's centroid on ties, until either limit would be exceeded. Seeds, and triangles taken
+     * when a meshlet has no neighbours left, come in Morton order of their centroids, so meshlets stay spatially
+     * compact on disconnected geometry too. positions are float xyz at stride bytes. maxVertices is at most 255,
+     * maxTriangles at most 512.
+     */
+    MeshletSet buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride,
+                             uint32_t maxVertices = kMaxVertices, uint32_t maxTriangles = kMaxTriangles);
+
+    // Fills in the sphere and cone of a meshlet whose offsets and counts are set.
+    void computeBounds(Meshlet& meshlet, const MeshletSet& set, const float* positions, size_t stride);
+
+    struct MeshletStats {
+        size_t meshletCount;
+        float averageVertices;
+        float averageTriangles;
+        float averageRadius;
+        float coneCullable; // fraction of meshlets whose cone can ever cull them
+    };
+
+    MeshletStats analyzeMeshlets(const MeshletSet& set);
+}
+
+#endif /* MeshletBuilder_hpp */
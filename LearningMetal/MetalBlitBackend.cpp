@@ -0,0 +1,51 @@
+//
+//  MetalBlitBackend.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/22.
+//
+
+#include "MetalBlitBackend.hpp"
+
+MetalBlitBackend::MetalBlitBackend(MTL::Device* pDevice, MTL::CommandQueue* pCommandQueue, size_t stagingCapacity): _pCommandQueue(pCommandQueue->retain()), _pCommandBuffer(nullptr), _pEncoder(nullptr) {
+    _pStagingBuffer = pDevice->newBuffer(stagingCapacity, MTL::ResourceStorageModeShared | MTL::ResourceCPUCacheModeWriteCombined);
+}
+
+MetalBlitBackend::~MetalBlitBackend() {
+    _pStagingBuffer->release();
+    _pCommandQueue->release();
+}
+
+uint8_t* MetalBlitBackend::stagingContents() {
+    return static_cast<uint8_t*>(_pStagingBuffer->contents());
+}
+
+size_t MetalBlitBackend::stagingCapacity() const {
+    return _pStagingBuffer->length();
+}
+
+void MetalBlitBackend::beginBatch() {
+    _pCommandBuffer = _pCommandQueue->commandBuffer();
+    _pEncoder = _pCommandBuffer->blitCommandEncoder();
+}
+
+void MetalBlitBackend::copyToBuffer(size_t stagingOffset, void* pDestination, size_t destinationOffset, size_t size) {
+    _pEncoder->copyFromBuffer(_pStagingBuffer, stagingOffset, static_cast<MTL::Buffer*>(pDestination), destinationOffset, size);
+}
+
+void MetalBlitBackend::copyToTexture(size_t stagingOffset, void* pDestination, const upload::TextureRegion& region) {
+    _pEncoder->copyFromBuffer(_pStagingBuffer, stagingOffset, region.bytesPerRow, region.bytesPerImage,
+                              MTL::Size::Make(region.width, region.height, region.depth),
+                              static_cast<MTL::Texture*>(pDestination), region.slice, region.level,
+                              MTL::Origin::Make(region.x, region.y, region.z));
+}
+
+void MetalBlitBackend::commitBatch(std::function<void()> onCompleted) {
+    _pEncoder->endEncoding();
+    _pCommandBuffer->addCompletedHandler([onCompleted](MTL::CommandBuffer* pCmd) {
+        onCompleted();
+    });
+    _pCommandBuffer->commit();
+    _pEncoder = nullptr;
+    _pCommandBuffer = nullptr;
+}
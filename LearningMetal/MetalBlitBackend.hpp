@@ -0,0 +1,39 @@
+//
+//  MetalBlitBackend.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/22.
+//
+
+#ifndef MetalBlitBackend_hpp
+#define MetalBlitBackend_hpp
+
+#include <Metal/Metal.hpp>
+#include "UploadQueue.hpp"
+
+/**
+ * Upload queue backend that encodes each batch as one blit command buffer reading from a shared staging buffer.
+ * Destinations passed to the queue are MTL::Buffer* or MTL::Texture*.
+ */
+class MetalBlitBackend : public upload::BlitBackend {
+public:
+    MetalBlitBackend(MTL::Device* pDevice, MTL::CommandQueue* pCommandQueue, size_t stagingCapacity);
+    ~MetalBlitBackend() override;
+
+    uint8_t* stagingContents() override;
+    size_t stagingCapacity() const override;
+    void beginBatch() override;
+    void copyToBuffer(size_t stagingOffset, void* pDestination, size_t destinationOffset, size_t size) override;
+    void copyToTexture(size_t stagingOffset, void* pDestination, const upload::TextureRegion& region) override;
+    void commitBatch(std::function<void()> onCompleted) override;
+
+    MTL::Buffer* stagingBuffer() const { return _pStagingBuffer; }
+
+private:
+    MTL::CommandQueue* _pCommandQueue;
+    MTL::Buffer* _pStagingBuffer;
+    MTL::CommandBuffer* _pCommandBuffer;
+    MTL::BlitCommandEncoder* _pEncoder;
+};
+
+#endif /* MetalBlitBackend_hpp */
@@ -0,0 +1,117 @@
+//
+//  MetalComputeKernels.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "MetalComputeKernels.hpp"
+
+MetalComputeKernels::MetalComputeKernels(MetalPipelineCompiler* pCompiler, std::string tuningPath): _pCompiler(pCompiler), _tuningPath(std::move(tuningPath)) {
+    _tuner.load(_tuningPath.c_str());
+}
+
+MetalComputeKernels::~MetalComputeKernels() {
+    // Completion handlers of compiles still running, and of timed dispatches still on the GPU, refer to this object.
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _compiling == 0 && _timing == 0; });
+    for (auto& [name, kernel] : _kernels) {
+        if (kernel.pState) {
+            kernel.pState->release();
+        }
+    }
+}
+
+void MetalComputeKernels::prepare(const char* kernel) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_kernels.emplace(kernel, Kernel { nullptr, { 0, 0 } }).second) {
+            return;
+        }
+        ++_compiling;
+    }
+    const std::string name = kernel;
+    _pCompiler->newComputePipelineStateAsync(kernel, [this, name](MTL::ComputePipelineState* pPSO) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (pPSO) {
+                Kernel& entry = _kernels[name];
+                entry.limits = threadgroup_tuning::KernelLimits { static_cast<uint32_t>(pPSO->maxTotalThreadsPerThreadgroup()), static_cast<uint32_t>(pPSO->threadExecutionWidth()) };
+                entry.pState = pPSO;
+            }
+            --_compiling;
+            // Notified with the lock held: once it is dropped the destructor may return and free _idle.
+            _idle.notify_all();
+        }
+    });
+}
+
+MTL::ComputePipelineState* MetalComputeKernels::pipeline(const char* kernel) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _kernels.find(kernel);
+    return it == _kernels.end() ? nullptr : it->second.pState;
+}
+
+uint32_t MetalComputeKernels::dispatch(MTL::ComputeCommandEncoder* pEncoder, const char* kernel, uint32_t gridSize) {
+    MTL::ComputePipelineState* pState = nullptr;
+    threadgroup_tuning::KernelLimits limits;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _kernels.find(kernel);
+        if (it == _kernels.end() || it->second.pState == nullptr) {
+            return 0;
+        }
+        pState = it->second.pState;
+        limits = it->second.limits;
+    }
+    if (gridSize == 0) {
+        return 0;
+    }
+
+    const uint32_t width = _tuner.threadgroupWidth(kernel, limits, gridSize);
+    const threadgroup_tuning::DispatchSize size = threadgroup_tuning::dispatchSize(gridSize, width);
+    pEncoder->setComputePipelineState(pState);
+    pEncoder->dispatchThreadgroups(MTL::Size(size.threadgroups, 1, 1), MTL::Size(size.threadsPerThreadgroup, 1, 1));
+    return width;
+}
+
+void MetalComputeKernels::recordTime(const char* kernel, uint32_t gridSize, uint32_t width, double gpuMilliseconds) {
+    threadgroup_tuning::KernelLimits limits;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _kernels.find(kernel);
+        if (it == _kernels.end() || it->second.pState == nullptr) {
+            return;
+        }
+        limits = it->second.limits;
+    }
+    _tuner.recordTime(kernel, limits, gridSize, width, gpuMilliseconds);
+}
+
+void MetalComputeKernels::timeDispatch(MTL::CommandBuffer* pCmd, const char* kernel, uint32_t gridSize, uint32_t width) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_timing;
+    }
+    const std::string name = kernel;
+    pCmd->addCompletedHandler([this, name, gridSize, width](MTL::CommandBuffer* pCmd) {
+        if (pCmd->status() == MTL::CommandBufferStatusCompleted) {
+            recordTime(name.c_str(), gridSize, width, (pCmd->GPUEndTime() - pCmd->GPUStartTime()) * 1000.0);
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_timing;
+        _idle.notify_all();
+    });
+}
+
+bool MetalComputeKernels::isTuned(const char* kernel, uint32_t gridSize) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _kernels.find(kernel);
+    return it != _kernels.end() && it->second.pState && _tuner.isTuned(kernel, it->second.limits, gridSize);
+}
+
+void MetalComputeKernels::saveTuningIfChanged() {
+    if (!_tuner.saveIfChanged(_tuningPath.c_str())) {
+        __builtin_printf("Could not save threadgroup tuning to %s\n", _tuningPath.c_str());
+    }
+}
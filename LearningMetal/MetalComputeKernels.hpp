@@ -0,0 +1,62 @@
+//
+//  MetalComputeKernels.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef MetalComputeKernels_hpp
+#define MetalComputeKernels_hpp
+
+#include <Metal/Metal.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "MetalPipelineCompiler.hpp"
+#include "ThreadgroupTuner.hpp"
+
+/**
+ * Compute pipelines by kernel name, compiled in the background through MetalPipelineCompiler, plus dispatch with a
+ * threadgroup width the autotuner picks from the pipeline's own limits. Timings fed back through recordTime() should
+ * cover just the one dispatch, e.g. the GPU time of a command buffer holding nothing else.
+ */
+class MetalComputeKernels {
+public:
+    MetalComputeKernels(MetalPipelineCompiler* pCompiler, std::string tuningPath);
+    ~MetalComputeKernels();
+
+    // Starts compiling the kernel; pipeline() returns nullptr until it is ready, and for good if it failed.
+    void prepare(const char* kernel);
+    MTL::ComputePipelineState* pipeline(const char* kernel) const;
+
+    // Binds the kernel and dispatches gridSize threads in uniform threadgroups, so kernels must bounds-check.
+    // Returns the threadgroup width used, or 0 when the kernel is not ready and nothing was encoded.
+    uint32_t dispatch(MTL::ComputeCommandEncoder* pEncoder, const char* kernel, uint32_t gridSize);
+    // Safe to call from completion handlers.
+    void recordTime(const char* kernel, uint32_t gridSize, uint32_t width, double gpuMilliseconds);
+    // Records the GPU time of pCmd, which should hold just this dispatch, once it completes. Call before committing;
+    // the destructor waits for these handlers.
+    void timeDispatch(MTL::CommandBuffer* pCmd, const char* kernel, uint32_t gridSize, uint32_t width);
+
+    bool isTuned(const char* kernel, uint32_t gridSize) const;
+    void saveTuningIfChanged();
+    void printTuningReport() const { _tuner.printReport(); }
+
+private:
+    struct Kernel {
+        MTL::ComputePipelineState* pState;
+        threadgroup_tuning::KernelLimits limits;
+    };
+
+    MetalPipelineCompiler* _pCompiler;
+    threadgroup_tuning::Autotuner _tuner;
+    std::string _tuningPath;
+    mutable std::mutex _mutex;
+    std::condition_variable _idle;
+    uint32_t _compiling = 0;
+    uint32_t _timing = 0; // command buffers whose completion handler still has to record a time
+    std::unordered_map<std::string, Kernel> _kernels; // pState stays nullptr while compiling or after a failure
+};
+
+#endif /* MetalComputeKernels_hpp */
@@ -0,0 +1,58 @@
+//
+//  MetalGeometryBackend.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "MetalGeometryBackend.hpp"
+#include <algorithm>
+#include <cstring>
+
+MetalGeometryBackend::MetalGeometryBackend(MTL::Device* pDevice): _pDevice(pDevice->retain()), _pBuffers { nullptr, nullptr } {
+}
+
+MetalGeometryBackend::~MetalGeometryBackend() {
+    for (MTL::Buffer* pBuffer : _pBuffers) {
+        if (pBuffer) {
+            pBuffer->release();
+        }
+    }
+    _pDevice->release();
+}
+
+bool MetalGeometryBackend::resize(geometry_pool::Stream stream, size_t bytes) {
+    MTL::Buffer*& pBuffer = _pBuffers[static_cast<size_t>(stream)];
+    if (pBuffer && pBuffer->length() == bytes) {
+        return true;
+    }
+    MTL::Buffer* pResized = _pDevice->newBuffer(bytes, MTL::ResourceStorageModeShared);
+    if (!pResized) {
+        __builtin_printf("Geometry pool: cannot allocate %zu bytes\n", bytes);
+        return false;
+    }
+    if (pBuffer) {
+        memcpy(pResized->contents(), pBuffer->contents(), std::min<size_t>(pBuffer->length(), bytes));
+        pBuffer->release();
+    }
+    pBuffer = pResized;
+    return true;
+}
+
+void MetalGeometryBackend::write(geometry_pool::Stream stream, size_t offset, const void* pData, size_t size) {
+    memcpy(static_cast<uint8_t*>(_pBuffers[static_cast<size_t>(stream)]->contents()) + offset, pData, size);
+}
+
+// The pool only writes ranges no frame in flight reads, so a CPU copy into shared storage needs no blit.
+void MetalGeometryBackend::copy(geometry_pool::Stream stream, size_t sourceOffset, size_t destinationOffset, size_t size) {
+    uint8_t* pContents = static_cast<uint8_t*>(_pBuffers[static_cast<size_t>(stream)]->contents());
+    memcpy(pContents + destinationOffset, pContents + sourceOffset, size);
+}
+
+size_t MetalGeometryBackend::allocatedSize() const {
+    size_t size = 0;
+    for (MTL::Buffer* pBuffer : _pBuffers) {
+        size += pBuffer ? pBuffer->allocatedSize() : 0;
+    }
+    return size;
+}
@@ -0,0 +1,36 @@
+//
+//  MetalGeometryBackend.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef MetalGeometryBackend_hpp
+#define MetalGeometryBackend_hpp
+
+#include <Metal/Metal.hpp>
+#include "GeometryPool.hpp"
+
+/**
+ * Geometry pool backend with one shared buffer per stream. Growing or shrinking replaces the buffer with a resized
+ * copy; command buffers in flight keep their own reference to the old one, so it lives until they complete.
+ */
+class MetalGeometryBackend : public geometry_pool::PoolBackend {
+public:
+    explicit MetalGeometryBackend(MTL::Device* pDevice);
+    ~MetalGeometryBackend() override;
+
+    bool resize(geometry_pool::Stream stream, size_t bytes) override;
+    void write(geometry_pool::Stream stream, size_t offset, const void* pData, size_t size) override;
+    void copy(geometry_pool::Stream stream, size_t sourceOffset, size_t destinationOffset, size_t size) override;
+
+    MTL::Buffer* vertexBuffer() const { return _pBuffers[0]; }
+    MTL::Buffer* indexBuffer() const { return _pBuffers[1]; }
+    size_t allocatedSize() const;
+
+private:
+    MTL::Device* _pDevice;
+    MTL::Buffer* _pBuffers[2];
+};
+
+#endif /* MetalGeometryBackend_hpp */
@@ -0,0 +1,101 @@
+//
+//  MetalMaterialStitcher.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+#include "MetalMaterialStitcher.hpp"
+#include <vector>
+
+MetalMaterialStitcher::MetalMaterialStitcher(MTL::Device* pDevice, MTL::Library* pLibrary): _pDevice(pDevice->retain()), _pLibrary(pLibrary->retain()) {
+    
+}
+
+MetalMaterialStitcher::~MetalMaterialStitcher() {
+    for (auto& [name, pFunction] : _buildingBlocks) {
+        pFunction->release();
+    }
+    _pLibrary->release();
+    _pDevice->release();
+}
+
+MTL::Function* MetalMaterialStitcher::buildingBlock(const std::string& name) {
+    auto it = _buildingBlocks.find(name);
+    if (it != _buildingBlocks.end()) {
+        return it->second;
+    }
+    MTL::Function* pFunction = _pLibrary->newFunction(NS::String::string(name.c_str(), NS::StringEncoding::UTF8StringEncoding));
+    if (pFunction == nullptr) {
+        __builtin_printf("Material building block %s not found\n", name.c_str());
+        return nullptr;
+    }
+    _buildingBlocks.emplace(name, pFunction);
+    return pFunction;
+}
+
+MTL::Function* MetalMaterialStitcher::newStitchedFunction(const material_graph::MaterialGraph& graph) {
+    using NS::StringEncoding::UTF8StringEncoding;
+    using material_graph::Node;
+    using material_graph::NodeId;
+    
+    std::vector<NS::Object*> functions;
+    for (const std::string& name : graph.functionNames()) {
+        MTL::Function* pFunction = buildingBlock(name);
+        if (pFunction == nullptr) {
+            return nullptr;
+        }
+        functions.push_back(pFunction);
+    }
+    
+    // One stitching node per graph node; input nodes are only created when something reachable uses them.
+    const std::vector<Node>& nodes = graph.nodes();
+    std::vector<NS::Object*> stitchingNodes(nodes.size(), nullptr);
+    std::vector<NS::Object*> functionNodes;
+    for (NodeId id : graph.reachableFunctionNodes()) {
+        const Node& node = nodes[id];
+        std::vector<NS::Object*> arguments;
+        for (NodeId argument : node.arguments) {
+            if (stitchingNodes[argument] == nullptr) {
+                MTL::FunctionStitchingInputNode* pInput = MTL::FunctionStitchingInputNode::alloc()->init();
+                pInput->setArgumentIndex(nodes[argument].argumentIndex);
+                stitchingNodes[argument] = pInput;
+            }
+            arguments.push_back(stitchingNodes[argument]);
+        }
+        
+        MTL::FunctionStitchingFunctionNode* pFunctionNode = MTL::FunctionStitchingFunctionNode::alloc()->init();
+        pFunctionNode->setName(NS::String::string(node.function.c_str(), UTF8StringEncoding));
+        pFunctionNode->setArguments(NS::Array::array(arguments.data(), arguments.size()));
+        stitchingNodes[id] = pFunctionNode;
+        if (id != graph.output()) {
+            functionNodes.push_back(pFunctionNode);
+        }
+    }
+    
+    NS::String* pFunctionName = NS::String::string(graph.functionName().c_str(), UTF8StringEncoding);
+    MTL::FunctionStitchingGraph* pGraph = MTL::FunctionStitchingGraph::alloc()->init(pFunctionName, NS::Array::array(functionNodes.data(), functionNodes.size()), static_cast<MTL::FunctionStitchingFunctionNode*>(stitchingNodes[graph.output()]), nullptr);
+    
+    MTL::StitchedLibraryDescriptor* pDesc = MTL::StitchedLibraryDescriptor::alloc()->init();
+    pDesc->setFunctionGraphs(NS::Array::array(pGraph));
+    pDesc->setFunctions(NS::Array::array(functions.data(), functions.size()));
+    
+    NS::Error* pError = nullptr;
+    MTL::Library* pStitchedLibrary = _pDevice->newLibrary(pDesc, &pError);
+    MTL::Function* pStitched = nullptr;
+    if (pStitchedLibrary) {
+        pStitched = pStitchedLibrary->newFunction(pFunctionName);
+        pStitchedLibrary->release();
+    } else {
+        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+    }
+    
+    pDesc->release();
+    pGraph->release();
+    for (NS::Object* pNode : stitchingNodes) {
+        if (pNode) {
+            pNode->release();
+        }
+    }
+    return pStitched;
+}
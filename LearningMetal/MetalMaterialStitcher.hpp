@@ -0,0 +1,36 @@
+//
+//  MetalMaterialStitcher.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+#ifndef MetalMaterialStitcher_hpp
+#define MetalMaterialStitcher_hpp
+
+#include <Metal/Metal.hpp>
+#include <string>
+#include <unordered_map>
+#include "MaterialGraph.hpp"
+
+/**
+ * Builds a MaterialGraph into an MTL::FunctionStitchingGraph and stitches it from the [[stitchable]] building blocks
+ * already compiled into the shader library, which is much cheaper than compiling source for every combination.
+ */
+class MetalMaterialStitcher {
+public:
+    MetalMaterialStitcher(MTL::Device* pDevice, MTL::Library* pLibrary);
+    ~MetalMaterialStitcher();
+
+    // Caller releases the returned function.
+    MTL::Function* newStitchedFunction(const material_graph::MaterialGraph& graph);
+
+private:
+    MTL::Function* buildingBlock(const std::string& name);
+
+    MTL::Device* _pDevice;
+    MTL::Library* _pLibrary;
+    std::unordered_map<std::string, MTL::Function*> _buildingBlocks;
+};
+
+#endif /* MetalMaterialStitcher_hpp */
@@ -0,0 +1,368 @@
+//
+//  MetalPipelineCompiler.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/26.
+//
+
+#include "MetalPipelineCompiler.hpp"
+
+MetalPipelineCompiler::MetalPipelineCompiler(MTL::Device* pDevice, MTL::Library* pLibrary, const char* archivePath): _pDevice(pDevice->retain()), _libraries { pLibrary->retain() }, _pArchive(nullptr), _archivePath(archivePath), _dirty(false), _archiveHits(0), _archiveMisses(0) {
+    using NS::StringEncoding::UTF8StringEncoding;
+    
+    NS::Error* pError = nullptr;
+    MTL::BinaryArchiveDescriptor* pDesc = MTL::BinaryArchiveDescriptor::alloc()->init();
+    pDesc->setUrl(NS::URL::fileURLWithPath(NS::String::string(archivePath, UTF8StringEncoding)));
+    _pArchive = _pDevice->newBinaryArchive(pDesc, &pError);
+    
+    if (_pArchive == nullptr) {
+        // Missing on first launch, or invalidated by an OS or driver update: start from an empty archive.
+        pDesc->setUrl(nullptr);
+        _pArchive = _pDevice->newBinaryArchive(pDesc, &pError);
+    }
+    pDesc->release();
+    
+    if (_pArchive == nullptr) {
+        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+        assert(false);
+    }
+}
+
+MetalPipelineCompiler::~MetalPipelineCompiler() {
+    _pArchive->release();
+    for (auto& [hash, pFunction] : _stitchedFunctions) {
+        pFunction->release();
+    }
+    for (MTL::Library* pLibrary : _libraries) {
+        if (pLibrary) {
+            pLibrary->release();
+        }
+    }
+    _pDevice->release();
+}
+
+void MetalPipelineCompiler::setLibrary(MTL::Library* pLibrary, uint32_t profile) {
+    std::lock_guard<std::mutex> lock(_librariesMutex);
+    if (profile >= _libraries.size()) {
+        _libraries.resize(profile + 1, nullptr);
+    }
+    pLibrary->retain();
+    if (_libraries[profile]) {
+        _libraries[profile]->release();
+    }
+    _libraries[profile] = pLibrary;
+}
+
+void MetalPipelineCompiler::setStitchedFunction(uint64_t materialHash, MTL::Function* pFunction) {
+    pFunction->retain();
+    auto [it, inserted] = _stitchedFunctions.try_emplace(materialHash, pFunction);
+    if (!inserted) {
+        it->second->release();
+        it->second = pFunction;
+    }
+}
+
+// Retained, so a library swapped out mid-compile stays alive until the compile is done with it.
+MTL::Library* MetalPipelineCompiler::copyLibrary(uint32_t profile) const {
+    std::lock_guard<std::mutex> lock(_librariesMutex);
+    MTL::Library* pLibrary = profile < _libraries.size() ? _libraries[profile] : nullptr;
+    return pLibrary ? pLibrary->retain() : nullptr;
+}
+
+MTL::Function* MetalPipelineCompiler::newFunction(const std::string& name, const pipeline_cache::RenderPipelineKey& key) const {
+    using NS::StringEncoding::UTF8StringEncoding;
+    
+    MTL::Library* pLibrary = copyLibrary(key.compileProfile);
+    if (pLibrary == nullptr) {
+        __builtin_printf("No library for compile profile %u\n", key.compileProfile);
+        return nullptr;
+    }
+    
+    NS::String* pName = NS::String::string(name.c_str(), UTF8StringEncoding);
+    if (key.constants.empty()) {
+        MTL::Function* pFunction = pLibrary->newFunction(pName);
+        pLibrary->release();
+        return pFunction;
+    }
+    
+    MTL::FunctionConstantValues* pValues = MTL::FunctionConstantValues::alloc()->init();
+    for (const pipeline_cache::FunctionConstant& constant : key.constants) {
+        pValues->setConstantValue(&constant.value, static_cast<MTL::DataType>(constant.dataType), constant.index);
+    }
+    
+    NS::Error* pError = nullptr;
+    MTL::Function* pFunction = pLibrary->newFunction(pName, pValues, &pError);
+    if (pFunction == nullptr) {
+        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+    }
+    pValues->release();
+    pLibrary->release();
+    return pFunction;
+}
+
+static void setColorAttachments(MTL::RenderPipelineColorAttachmentDescriptorArray* pAttachments, const pipeline_cache::RenderPipelineKey& key) {
+    for (size_t i = 0; i < pipeline_cache::kMaxColorAttachments; ++i) {
+        const pipeline_cache::ColorAttachment& attachment = key.colorAttachments[i];
+        if (attachment.pixelFormat == MTL::PixelFormatInvalid) {
+            continue;
+        }
+        MTL::RenderPipelineColorAttachmentDescriptor* pAttachment = pAttachments->object(i);
+        pAttachment->setPixelFormat(static_cast<MTL::PixelFormat>(attachment.pixelFormat));
+        pAttachment->setBlendingEnabled(attachment.blendingEnabled);
+        pAttachment->setRgbBlendOperation(static_cast<MTL::BlendOperation>(attachment.rgbBlendOperation));
+        pAttachment->setAlphaBlendOperation(static_cast<MTL::BlendOperation>(attachment.alphaBlendOperation));
+        pAttachment->setSourceRGBBlendFactor(static_cast<MTL::BlendFactor>(attachment.sourceRGBBlendFactor));
+        pAttachment->setDestinationRGBBlendFactor(static_cast<MTL::BlendFactor>(attachment.destinationRGBBlendFactor));
+        pAttachment->setSourceAlphaBlendFactor(static_cast<MTL::BlendFactor>(attachment.sourceAlphaBlendFactor));
+        pAttachment->setDestinationAlphaBlendFactor(static_cast<MTL::BlendFactor>(attachment.destinationAlphaBlendFactor));
+        pAttachment->setWriteMask(static_cast<MTL::ColorWriteMask>(attachment.writeMask));
+    }
+}
+
+MTL::LinkedFunctions* MetalPipelineCompiler::newFragmentLinkedFunctions(const pipeline_cache::RenderPipelineKey& key) const {
+    if (key.stitchedMaterial == 0) {
+        return nullptr;
+    }
+    auto it = _stitchedFunctions.find(key.stitchedMaterial);
+    if (it == _stitchedFunctions.end()) {
+        __builtin_printf("No stitched function for material %016llx\n", (unsigned long long)key.stitchedMaterial);
+        return nullptr;
+    }
+    // Private: only this pipeline calls it, so the compiler may inline it into the fragment function.
+    MTL::LinkedFunctions* pLinked = MTL::LinkedFunctions::alloc()->init();
+    pLinked->setPrivateFunctions(NS::Array::array(it->second));
+    return pLinked;
+}
+
+MTL::RenderPipelineDescriptor* MetalPipelineCompiler::newDescriptor(const pipeline_cache::RenderPipelineKey& key) const {
+    MTL::RenderPipelineDescriptor* pDesc = MTL::RenderPipelineDescriptor::alloc()->init();
+    
+    MTL::Function* pVertexFn = newFunction(key.vertexFunction, key);
+    pDesc->setVertexFunction(pVertexFn);
+    if (pVertexFn) {
+        pVertexFn->release();
+    }
+    if (!key.fragmentFunction.empty()) {
+        MTL::Function* pFragmentFn = newFunction(key.fragmentFunction, key);
+        pDesc->setFragmentFunction(pFragmentFn);
+        if (pFragmentFn) {
+            pFragmentFn->release();
+        }
+    }
+    
+    setColorAttachments(pDesc->colorAttachments(), key);
+    
+    if (MTL::LinkedFunctions* pLinked = newFragmentLinkedFunctions(key)) {
+        pDesc->setFragmentLinkedFunctions(pLinked);
+        pLinked->release();
+    }
+    
+    pDesc->setDepthAttachmentPixelFormat(static_cast<MTL::PixelFormat>(key.depthPixelFormat));
+    pDesc->setStencilAttachmentPixelFormat(static_cast<MTL::PixelFormat>(key.stencilPixelFormat));
+    pDesc->setSampleCount(key.sampleCount);
+    
+    // Factors come from a buffer written per patch, see computeTessellationFactors; patches have no control points.
+    if (key.maxTessellationFactor != 0) {
+        pDesc->setMaxTessellationFactor(key.maxTessellationFactor);
+        pDesc->setTessellationPartitionMode(MTL::TessellationPartitionModeFractionalEven);
+        pDesc->setTessellationFactorFormat(MTL::TessellationFactorFormatHalf);
+        pDesc->setTessellationFactorStepFunction(MTL::TessellationFactorStepFunctionPerPatch);
+        pDesc->setTessellationControlPointIndexType(MTL::TessellationControlPointIndexTypeNone);
+    }
+    
+    if (!key.vertexAttributes.empty()) {
+        MTL::VertexDescriptor* pVertexDesc = MTL::VertexDescriptor::vertexDescriptor();
+        for (size_t i = 0; i < key.vertexAttributes.size(); ++i) {
+            const pipeline_cache::VertexAttribute& attribute = key.vertexAttributes[i];
+            MTL::VertexAttributeDescriptor* pAttribute = pVertexDesc->attributes()->object(i);
+            pAttribute->setFormat(static_cast<MTL::VertexFormat>(attribute.format));
+            pAttribute->setOffset(attribute.offset);
+            pAttribute->setBufferIndex(attribute.bufferIndex);
+        }
+        for (size_t i = 0; i < key.vertexLayouts.size(); ++i) {
+            const pipeline_cache::VertexLayout& layout = key.vertexLayouts[i];
+            if (layout.stride == 0) {
+                continue;
+            }
+            MTL::VertexBufferLayoutDescriptor* pLayout = pVertexDesc->layouts()->object(i);
+            pLayout->setStride(layout.stride);
+            pLayout->setStepFunction(static_cast<MTL::VertexStepFunction>(layout.stepFunction));
+            pLayout->setStepRate(layout.stepRate);
+        }
+        pDesc->setVertexDescriptor(pVertexDesc);
+    }
+    
+    return pDesc;
+}
+
+MTL::MeshRenderPipelineDescriptor* MetalPipelineCompiler::newMeshDescriptor(const pipeline_cache::RenderPipelineKey& key) const {
+    MTL::MeshRenderPipelineDescriptor* pDesc = MTL::MeshRenderPipelineDescriptor::alloc()->init();
+    
+    const std::string* names[] = { &key.objectFunction, &key.meshFunction, &key.fragmentFunction };
+    MTL::Function* pFunctions[3] = {};
+    for (size_t i = 0; i < 3; ++i) {
+        if (!names[i]->empty()) {
+            pFunctions[i] = newFunction(*names[i], key);
+        }
+    }
+    pDesc->setObjectFunction(pFunctions[0]);
+    pDesc->setMeshFunction(pFunctions[1]);
+    pDesc->setFragmentFunction(pFunctions[2]);
+    for (MTL::Function* pFunction : pFunctions) {
+        if (pFunction) {
+            pFunction->release();
+        }
+    }
+    
+    setColorAttachments(pDesc->colorAttachments(), key);
+    
+    if (MTL::LinkedFunctions* pLinked = newFragmentLinkedFunctions(key)) {
+        pDesc->setFragmentLinkedFunctions(pLinked);
+        pLinked->release();
+    }
+    
+    pDesc->setDepthAttachmentPixelFormat(static_cast<MTL::PixelFormat>(key.depthPixelFormat));
+    pDesc->setStencilAttachmentPixelFormat(static_cast<MTL::PixelFormat>(key.stencilPixelFormat));
+    pDesc->setRasterSampleCount(key.sampleCount);
+    return pDesc;
+}
+
+// BinaryArchive has no way to add mesh pipelines in this metal-cpp, so they always compile from the library.
+MTL::RenderPipelineState* MetalPipelineCompiler::newMeshPipelineState(const pipeline_cache::RenderPipelineKey& key) {
+    MTL::MeshRenderPipelineDescriptor* pDesc = newMeshDescriptor(key);
+    NS::Error* pError = nullptr;
+    MTL::RenderPipelineState* pPSO = _pDevice->newRenderPipelineState(pDesc, MTL::PipelineOptionNone, nullptr, &pError);
+    if (pPSO == nullptr) {
+        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+    }
+    pDesc->release();
+    return pPSO;
+}
+
+MTL::RenderPipelineState* MetalPipelineCompiler::newPipelineState(const pipeline_cache::RenderPipelineKey& key) {
+    if (!key.meshFunction.empty()) {
+        return newMeshPipelineState(key);
+    }
+    
+    MTL::RenderPipelineDescriptor* pDesc = newDescriptor(key);
+    pDesc->setBinaryArchives(NS::Array::array(_pArchive));
+    
+    NS::Error* pError = nullptr;
+    MTL::RenderPipelineState* pPSO = _pDevice->newRenderPipelineState(pDesc, MTL::PipelineOptionFailOnBinaryArchiveMiss, nullptr, &pError);
+    if (pPSO) {
+        ++_archiveHits;
+    } else {
+        ++_archiveMisses;
+        pPSO = _pDevice->newRenderPipelineState(pDesc, &pError);
+        if (pPSO && _pArchive->addRenderPipelineFunctions(pDesc, &pError)) {
+            _dirty = true;
+        }
+    }
+    
+    if (pPSO == nullptr) {
+        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+    }
+    
+    pDesc->release();
+    return pPSO;
+}
+
+void MetalPipelineCompiler::newPipelineStateAsync(const pipeline_cache::RenderPipelineKey& key, std::function<void(MTL::RenderPipelineState* pPSO)> done) {
+    if (!key.meshFunction.empty()) {
+        // Mesh descriptors only take a block handler; no archive step, as in newMeshPipelineState.
+        MTL::MeshRenderPipelineDescriptor* pMeshDesc = newMeshDescriptor(key);
+        __block std::function<void(MTL::RenderPipelineState* pPSO)> blockDone = done;
+        _pDevice->newRenderPipelineState(pMeshDesc, MTL::PipelineOptionNone, ^(MTL::RenderPipelineState* pPSO, MTL::RenderPipelineReflection*, NS::Error* pError) {
+            if (pPSO == nullptr) {
+                __builtin_printf("%s", pError->localizedDescription()->utf8String());
+            }
+            blockDone(pPSO ? pPSO->retain() : nullptr);
+        });
+        pMeshDesc->release();
+        return;
+    }
+    
+    MTL::RenderPipelineDescriptor* pDesc = newDescriptor(key);
+    pDesc->setBinaryArchives(NS::Array::array(_pArchive));
+    
+    // Same two steps as newPipelineState: try the archive alone, and only on a miss compile and record the functions.
+    // The descriptor is released by whichever handler finishes last.
+    _pDevice->newRenderPipelineState(pDesc, MTL::PipelineOptionFailOnBinaryArchiveMiss, [this, pDesc, done](MTL::RenderPipelineState* pPSO, MTL::RenderPipelineReflection*, NS::Error*) {
+        if (pPSO) {
+            ++_archiveHits;
+            pDesc->release();
+            done(pPSO->retain());
+            return;
+        }
+        
+        ++_archiveMisses;
+        _pDevice->newRenderPipelineState(pDesc, [this, pDesc, done](MTL::RenderPipelineState* pPSO, NS::Error* pError) {
+            if (pPSO == nullptr) {
+                __builtin_printf("%s", pError->localizedDescription()->utf8String());
+            } else if (_pArchive->addRenderPipelineFunctions(pDesc, nullptr)) {
+                _dirty = true;
+            }
+            pDesc->release();
+            done(pPSO ? pPSO->retain() : nullptr);
+        });
+    });
+}
+
+void MetalPipelineCompiler::newComputePipelineStateAsync(const char* functionName, std::function<void(MTL::ComputePipelineState* pPSO)> done) {
+    using NS::StringEncoding::UTF8StringEncoding;
+    
+    MTL::Library* pLibrary = copyLibrary(0);
+    MTL::Function* pFunction = pLibrary->newFunction(NS::String::string(functionName, UTF8StringEncoding));
+    pLibrary->release();
+    if (pFunction == nullptr) {
+        __builtin_printf("Missing compute function %s\n", functionName);
+        done(nullptr);
+        return;
+    }
+    
+    MTL::ComputePipelineDescriptor* pDesc = MTL::ComputePipelineDescriptor::alloc()->init();
+    pDesc->setLabel(NS::String::string(functionName, UTF8StringEncoding));
+    pDesc->setComputeFunction(pFunction);
+    pFunction->release();
+    // Threadgroup widths come from threadgroup_tuning::candidateWidths, which only hands out whole SIMD groups.
+    pDesc->setThreadGroupSizeIsMultipleOfThreadExecutionWidth(true);
+    pDesc->setBinaryArchives(NS::Array::array(_pArchive));
+    
+    // The same archive-first sequence as newPipelineStateAsync.
+    _pDevice->newComputePipelineState(pDesc, MTL::PipelineOptionFailOnBinaryArchiveMiss, [this, pDesc, done](MTL::ComputePipelineState* pPSO, MTL::ComputePipelineReflection*, NS::Error*) {
+        if (pPSO) {
+            ++_archiveHits;
+            pDesc->release();
+            done(pPSO->retain());
+            return;
+        }
+        
+        ++_archiveMisses;
+        _pDevice->newComputePipelineState(pDesc, MTL::PipelineOptionNone, [this, pDesc, done](MTL::ComputePipelineState* pPSO, MTL::ComputePipelineReflection*, NS::Error* pError) {
+            if (pPSO == nullptr) {
+                __builtin_printf("%s", pError->localizedDescription()->utf8String());
+            } else if (_pArchive->addComputePipelineFunctions(pDesc, nullptr)) {
+                _dirty = true;
+            }
+            pDesc->release();
+            done(pPSO ? pPSO->retain() : nullptr);
+        });
+    });
+}
+
+bool MetalPipelineCompiler::serialize() {
+    using NS::StringEncoding::UTF8StringEncoding;
+    
+    if (!_dirty) {
+        return true;
+    }
+    
+    NS::Error* pError = nullptr;
+    NS::URL* pURL = NS::URL::fileURLWithPath(NS::String::string(_archivePath.c_str(), UTF8StringEncoding));
+    if (!_pArchive->serializeToURL(pURL, &pError)) {
+        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+        return false;
+    }
+    _dirty = false;
+    return true;
+}
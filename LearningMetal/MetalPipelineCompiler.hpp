@@ -0,0 +1,71 @@
+//
+//  MetalPipelineCompiler.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/26.
+//
+
+#ifndef MetalPipelineCompiler_hpp
+#define MetalPipelineCompiler_hpp
+
+#include <Metal/Metal.hpp>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PipelineCache.hpp"
+
+/**
+ * Turns pipeline keys into render pipeline states, backed by an MTL::BinaryArchive on disk. Pipelines found in the
+ * archive skip backend compilation; misses are compiled and added, and serialize() writes them out for the next launch.
+ * Mesh pipelines are compiled without the archive.
+ */
+class MetalPipelineCompiler {
+public:
+    MetalPipelineCompiler(MTL::Device* pDevice, MTL::Library* pLibrary, const char* archivePath);
+    ~MetalPipelineCompiler();
+
+    // Caller releases the returned descriptor.
+    MTL::RenderPipelineDescriptor* newDescriptor(const pipeline_cache::RenderPipelineKey& key) const;
+    // For keys with a meshFunction. Caller releases the returned descriptor.
+    MTL::MeshRenderPipelineDescriptor* newMeshDescriptor(const pipeline_cache::RenderPipelineKey& key) const;
+    MTL::RenderPipelineState* newPipelineState(const pipeline_cache::RenderPipelineKey& key);
+    // Non-blocking variants. done runs on a Metal-owned thread with a retained state, or nullptr on failure.
+    void newPipelineStateAsync(const pipeline_cache::RenderPipelineKey& key, std::function<void(MTL::RenderPipelineState* pPSO)> done);
+    void newComputePipelineStateAsync(const char* functionName, std::function<void(MTL::ComputePipelineState* pPSO)> done);
+
+    // Functions for keys with the given compileProfile come from this library; profile 0 is the one passed in at construction.
+    // Safe to call while compiles are running, which then use whichever library was set when they started.
+    void setLibrary(MTL::Library* pLibrary, uint32_t profile = 0);
+    // Keys with this stitchedMaterial hash link pFunction into their fragment function.
+    void setStitchedFunction(uint64_t materialHash, MTL::Function* pFunction);
+    bool hasStitchedFunction(uint64_t materialHash) const { return _stitchedFunctions.count(materialHash) > 0; }
+    bool serialize();
+
+    uint64_t archiveHits() const { return _archiveHits; }
+    uint64_t archiveMisses() const { return _archiveMisses; }
+
+private:
+    MTL::Function* newFunction(const std::string& name, const pipeline_cache::RenderPipelineKey& key) const;
+    // nullptr when the key links no stitched material.
+    MTL::LinkedFunctions* newFragmentLinkedFunctions(const pipeline_cache::RenderPipelineKey& key) const;
+    MTL::RenderPipelineState* newMeshPipelineState(const pipeline_cache::RenderPipelineKey& key);
+
+    MTL::Library* copyLibrary(uint32_t profile) const;
+
+    MTL::Device* _pDevice;
+    // Swapped by hot reload on the main thread while compiles read it from Metal-owned threads.
+    mutable std::mutex _librariesMutex;
+    std::vector<MTL::Library*> _libraries;
+    std::unordered_map<uint64_t, MTL::Function*> _stitchedFunctions;
+    MTL::BinaryArchive* _pArchive;
+    std::string _archivePath;
+    // Written from completion handlers as well as the main thread.
+    std::atomic<bool> _dirty;
+    std::atomic<uint64_t> _archiveHits;
+    std::atomic<uint64_t> _archiveMisses;
+};
+
+#endif /* MetalPipelineCompiler_hpp */
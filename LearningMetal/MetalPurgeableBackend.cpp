@@ -0,0 +1,25 @@
+//
+//  MetalPurgeableBackend.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/24.
+//
+
+#include "MetalPurgeableBackend.hpp"
+
+void MetalPurgeableBackend::makeVolatile(void* pResource) {
+    static_cast<MTL::Resource*>(pResource)->setPurgeableState(MTL::PurgeableStateVolatile);
+}
+
+bool MetalPurgeableBackend::makeNonVolatile(void* pResource) {
+    // setPurgeableState returns the state before the change, so Empty means the contents are gone.
+    return static_cast<MTL::Resource*>(pResource)->setPurgeableState(MTL::PurgeableStateNonVolatile) != MTL::PurgeableStateEmpty;
+}
+
+void MetalPurgeableBackend::destroy(void* pResource) {
+    static_cast<MTL::Resource*>(pResource)->release();
+}
+
+uint64_t MetalPurgeableBackend::size(void* pResource) const {
+    return static_cast<MTL::Resource*>(pResource)->allocatedSize();
+}
@@ -0,0 +1,25 @@
+//
+//  MetalPurgeableBackend.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/24.
+//
+
+#ifndef MetalPurgeableBackend_hpp
+#define MetalPurgeableBackend_hpp
+
+#include <Metal/Metal.hpp>
+#include "ResourceCache.hpp"
+
+/**
+ * Resource cache backend for MTL::Resource objects (buffers, textures, heaps). The cache owns one reference to each resource.
+ */
+class MetalPurgeableBackend : public resource_cache::CacheBackend {
+public:
+    void makeVolatile(void* pResource) override;
+    bool makeNonVolatile(void* pResource) override;
+    void destroy(void* pResource) override;
+    uint64_t size(void* pResource) const override;
+};
+
+#endif /* MetalPurgeableBackend_hpp */
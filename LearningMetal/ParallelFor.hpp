@@ -0,0 +1,58 @@
+//
+//  ParallelFor.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef ParallelFor_hpp
+#define ParallelFor_hpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+    // 0 means one worker per hardware thread.
+    inline uint32_t workerCount(uint32_t requested) {
+        return requested != 0 ? requested : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // How many ranges forRange() will split count items into, for sizing per-task outputs up front.
+    inline size_t taskCount(size_t count, size_t minPerTask, uint32_t workers) {
+        if (count == 0) {
+            return 0;
+        }
+        const size_t byWork = count / std::max<size_t>(1, minPerTask);
+        return std::max<size_t>(1, std::min<size_t>(byWork, workerCount(workers)));
+    }
+
+    /**
+     * Splits [0, count) into contiguous ranges of at least minPerTask items, at most one per worker, and runs
+     * fn(begin, end, task) on each; the calling thread takes the first range. Returns the number of tasks.
+     */
+    template <typename Fn>
+    size_t forRange(size_t count, size_t minPerTask, uint32_t workers, Fn&& fn) {
+        const size_t tasks = taskCount(count, minPerTask, workers);
+        if (tasks <= 1) {
+            if (tasks == 1) {
+                fn(size_t(0), count, size_t(0));
+            }
+            return tasks;
+        }
+        std::vector<std::thread> threads;
+        threads.reserve(tasks - 1);
+        for (size_t task = 1; task < tasks; ++task) {
+            threads.emplace_back([&fn, task, tasks, count] { fn(count * task / tasks, count * (task + 1) / tasks, task); });
+        }
+        fn(size_t(0), count / tasks, size_t(0));
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        return tasks;
+    }
+}
+
+#endif /* ParallelFor_hpp */
@@ -0,0 +1,120 @@
+//
+//  PipelineCache.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/26.
+//
+
+#include "PipelineCache.hpp"
+#include "Hash.hpp"
+
+namespace pipeline_cache {
+using hashing::fnv1a;
+
+static uint64_t hashValue(uint64_t hash, uint32_t value) {
+    return fnv1a(&value, sizeof(value), hash);
+}
+
+static uint64_t hashString(uint64_t hash, const std::string& value) {
+    // Length first so that ("ab", "c") and ("a", "bc") differ.
+    hash = hashValue(hash, static_cast<uint32_t>(value.size()));
+    return fnv1a(value.data(), value.size(), hash);
+}
+
+// Fields are hashed one by one rather than as raw structs so padding never leaks into the hash.
+uint64_t RenderPipelineKey::hash() const {
+    uint64_t h = fnv1a(nullptr, 0);
+    h = hashString(h, vertexFunction);
+    h = hashString(h, fragmentFunction);
+
+    h = hashValue(h, static_cast<uint32_t>(constants.size()));
+    for (const FunctionConstant& c : constants) {
+        h = hashValue(h, c.index);
+        h = hashValue(h, c.dataType);
+        h = hashValue(h, c.value);
+    }
+
+    for (const ColorAttachment& a : colorAttachments) {
+        h = hashValue(h, a.pixelFormat);
+        h = hashValue(h, a.blendingEnabled);
+        h = hashValue(h, a.rgbBlendOperation);
+        h = hashValue(h, a.alphaBlendOperation);
+        h = hashValue(h, a.sourceRGBBlendFactor);
+        h = hashValue(h, a.destinationRGBBlendFactor);
+        h = hashValue(h, a.sourceAlphaBlendFactor);
+        h = hashValue(h, a.destinationAlphaBlendFactor);
+        h = hashValue(h, a.writeMask);
+    }
+
+    h = hashValue(h, depthPixelFormat);
+    h = hashValue(h, stencilPixelFormat);
+    h = hashValue(h, sampleCount);
+
+    h = hashValue(h, static_cast<uint32_t>(vertexAttributes.size()));
+    for (const VertexAttribute& a : vertexAttributes) {
+        h = hashValue(h, a.format);
+        h = hashValue(h, a.offset);
+        h = hashValue(h, a.bufferIndex);
+    }
+
+    h = hashValue(h, static_cast<uint32_t>(vertexLayouts.size()));
+    for (const VertexLayout& l : vertexLayouts) {
+        h = hashValue(h, l.stride);
+        h = hashValue(h, l.stepFunction);
+        h = hashValue(h, l.stepRate);
+    }
+    h = hashValue(h, compileProfile);
+    h = fnv1a(&stitchedMaterial, sizeof(stitchedMaterial), h);
+    h = hashString(h, objectFunction);
+    h = hashString(h, meshFunction);
+    return hashValue(h, maxTessellationFactor);
+}
+
+bool RenderPipelineKey::operator==(const RenderPipelineKey& other) const {
+    if (vertexFunction != other.vertexFunction || fragmentFunction != other.fragmentFunction
+        || depthPixelFormat != other.depthPixelFormat || stencilPixelFormat != other.stencilPixelFormat
+        || sampleCount != other.sampleCount || compileProfile != other.compileProfile
+        || stitchedMaterial != other.stitchedMaterial || objectFunction != other.objectFunction
+        || meshFunction != other.meshFunction || maxTessellationFactor != other.maxTessellationFactor || constants.size() != other.constants.size()
+        || vertexAttributes.size() != other.vertexAttributes.size() || vertexLayouts.size() != other.vertexLayouts.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < constants.size(); ++i) {
+        const FunctionConstant& a = constants[i];
+        const FunctionConstant& b = other.constants[i];
+        if (a.index != b.index || a.dataType != b.dataType || a.value != b.value) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < kMaxColorAttachments; ++i) {
+        const ColorAttachment& a = colorAttachments[i];
+        const ColorAttachment& b = other.colorAttachments[i];
+        if (a.pixelFormat != b.pixelFormat || a.blendingEnabled != b.blendingEnabled
+            || a.rgbBlendOperation != b.rgbBlendOperation || a.alphaBlendOperation != b.alphaBlendOperation
+            || a.sourceRGBBlendFactor != b.sourceRGBBlendFactor || a.destinationRGBBlendFactor != b.destinationRGBBlendFactor
+            || a.sourceAlphaBlendFactor != b.sourceAlphaBlendFactor || a.destinationAlphaBlendFactor != b.destinationAlphaBlendFactor
+            || a.writeMask != b.writeMask) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < vertexAttributes.size(); ++i) {
+        const VertexAttribute& a = vertexAttributes[i];
+        const VertexAttribute& b = other.vertexAttributes[i];
+        if (a.format != b.format || a.offset != b.offset || a.bufferIndex != b.bufferIndex) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < vertexLayouts.size(); ++i) {
+        const VertexLayout& a = vertexLayouts[i];
+        const VertexLayout& b = other.vertexLayouts[i];
+        if (a.stride != b.stride || a.stepFunction != b.stepFunction || a.stepRate != b.stepRate) {
+            return false;
+        }
+    }
+    return true;
+}
+}
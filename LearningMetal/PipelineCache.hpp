@@ -0,0 +1,162 @@
+//
+//  PipelineCache.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/26.
+//
+
+#ifndef PipelineCache_hpp
+#define PipelineCache_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pipeline_cache {
+    static constexpr size_t kMaxColorAttachments = 8;
+
+    // Enum fields hold the raw values of the matching MTL:: enums so keys can be built and hashed without Metal.
+    struct FunctionConstant {
+        uint32_t index;
+        uint32_t dataType; // MTL::DataType
+        uint32_t value;    // bit pattern of a bool, uint or float constant
+    };
+
+    struct ColorAttachment {
+        uint32_t pixelFormat = 0;
+        bool blendingEnabled = false;
+        uint32_t rgbBlendOperation = 0;
+        uint32_t alphaBlendOperation = 0;
+        uint32_t sourceRGBBlendFactor = 1;
+        uint32_t destinationRGBBlendFactor = 0;
+        uint32_t sourceAlphaBlendFactor = 1;
+        uint32_t destinationAlphaBlendFactor = 0;
+        uint32_t writeMask = 0xF;
+    };
+
+    struct VertexAttribute {
+        uint32_t format;
+        uint32_t offset;
+        uint32_t bufferIndex;
+    };
+
+    struct VertexLayout {
+        uint32_t stride;
+        uint32_t stepFunction;
+        uint32_t stepRate;
+    };
+
+    /**
+     * Everything that goes into a RenderPipelineDescriptor. Two keys that compare equal produce the same pipeline.
+     */
+    struct RenderPipelineKey {
+        std::string vertexFunction;
+        std::string fragmentFunction;
+        std::vector<FunctionConstant> constants;
+        ColorAttachment colorAttachments[kMaxColorAttachments];
+        uint32_t depthPixelFormat = 0;
+        uint32_t stencilPixelFormat = 0;
+        uint32_t sampleCount = 1;
+        std::vector<VertexAttribute> vertexAttributes; // indexed by attribute slot
+        std::vector<VertexLayout> vertexLayouts;       // indexed by buffer slot
+        uint32_t compileProfile = 0;                   // which library the functions come from, see CompileProfile.hpp
+        uint64_t stitchedMaterial = 0;                 // MaterialGraph hash linked into the fragment function, 0 for none
+        // A mesh function makes this a mesh pipeline: vertexFunction and the vertex layout are ignored.
+        std::string objectFunction;
+        std::string meshFunction;
+        // Non-zero makes vertexFunction a post-tessellation function over quad patches with per patch half factors.
+        uint32_t maxTessellationFactor = 0;
+
+        uint64_t hash() const;
+        bool operator==(const RenderPipelineKey& other) const;
+    };
+
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t compiles = 0;
+        uint64_t failures = 0;
+    };
+
+    /**
+     * In-process pipeline deduplication. Compilation is delegated to a compiler callback, so the cache works with
+     * real pipeline states on device and with a stub compiler elsewhere. The cache owns the returned states.
+     */
+    template <typename State>
+    class PipelineCache {
+    public:
+        using Compiler = std::function<State*(const RenderPipelineKey& key)>;
+        using Releaser = std::function<void(State* pState)>;
+
+        PipelineCache(Compiler compile, Releaser release): _compile(std::move(compile)), _release(std::move(release)) {}
+
+        ~PipelineCache() {
+            for (auto& [hash, entries] : _entries) {
+                for (Entry& entry : entries) {
+                    if (entry.pState) {
+                        _release(entry.pState);
+                    }
+                }
+            }
+        }
+
+        PipelineCache(const PipelineCache&) = delete;
+        PipelineCache& operator=(const PipelineCache&) = delete;
+
+        State* find(const RenderPipelineKey& key, uint64_t hash) const {
+            auto it = _entries.find(hash);
+            if (it == _entries.end()) {
+                return nullptr;
+            }
+            for (const Entry& entry : it->second) {
+                if (entry.key == key) {
+                    return entry.pState;
+                }
+            }
+            return nullptr;
+        }
+
+        State* getOrCreate(const RenderPipelineKey& key) {
+            const uint64_t hash = key.hash();
+            if (State* pState = find(key, hash)) {
+                ++_stats.hits;
+                return pState;
+            }
+
+            State* pState = _compile(key);
+            if (pState == nullptr) {
+                ++_stats.failures;
+                return nullptr;
+            }
+            ++_stats.compiles;
+            _entries[hash].push_back(Entry { key, pState });
+            return pState;
+        }
+
+        size_t size() const {
+            size_t count = 0;
+            for (const auto& [hash, entries] : _entries) {
+                count += entries.size();
+            }
+            return count;
+        }
+
+        const CacheStats& stats() const { return _stats; }
+
+    private:
+        struct Entry {
+            RenderPipelineKey key;
+            State* pState;
+        };
+
+        Compiler _compile;
+        Releaser _release;
+        // Keys sharing a hash are kept side by side and told apart by full comparison.
+        std::unordered_map<uint64_t, std::vector<Entry>> _entries;
+        CacheStats _stats;
+    };
+}
+
+#endif /* PipelineCache_hpp */
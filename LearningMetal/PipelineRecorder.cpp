@@ -0,0 +1,385 @@
+//
+//  PipelineRecorder.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/28.
+//
+
+#include "PipelineRecorder.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+namespace pipeline_record {
+using pipeline_cache::ColorAttachment;
+using pipeline_cache::FunctionConstant;
+using pipeline_cache::RenderPipelineKey;
+using pipeline_cache::VertexAttribute;
+using pipeline_cache::VertexLayout;
+
+class Writer {
+public:
+    void u32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            _bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            _bytes.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        _bytes.push_back(static_cast<uint8_t>(value));
+    }
+
+    void string(const std::string& value) {
+        varint(value.size());
+        _bytes.insert(_bytes.end(), value.begin(), value.end());
+    }
+
+    const std::vector<uint8_t>& bytes() const { return _bytes; }
+
+private:
+    std::vector<uint8_t> _bytes;
+};
+
+// Every read is bounds-checked; a truncated or corrupt file clears ok instead of reading past the end.
+class Reader {
+public:
+    Reader(const uint8_t* pData, size_t size): _p(pData), _end(pData + size) {}
+
+    uint32_t u32() {
+        if (_end - _p < 4) {
+            ok = false;
+            return 0;
+        }
+        uint32_t value = _p[0] | (_p[1] << 8) | (_p[2] << 16) | (static_cast<uint32_t>(_p[3]) << 24);
+        _p += 4;
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (_p == _end) {
+                break;
+            }
+            const uint8_t byte = *_p++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    uint32_t varint32() {
+        const uint64_t value = varint();
+        if (value > UINT32_MAX) {
+            ok = false;
+        }
+        return static_cast<uint32_t>(value);
+    }
+
+    std::string string() {
+        const uint64_t size = varint();
+        if (!ok || size > static_cast<uint64_t>(_end - _p)) {
+            ok = false;
+            return std::string();
+        }
+        std::string value(reinterpret_cast<const char*>(_p), size);
+        _p += size;
+        return value;
+    }
+
+    bool atEnd() const { return _p == _end; }
+
+    bool ok = true;
+
+private:
+    const uint8_t* _p;
+    const uint8_t* _end;
+};
+
+static bool isDefault(const ColorAttachment& a) {
+    const ColorAttachment d;
+    return a.pixelFormat == d.pixelFormat && a.blendingEnabled == d.blendingEnabled
+        && a.rgbBlendOperation == d.rgbBlendOperation && a.alphaBlendOperation == d.alphaBlendOperation
+        && a.sourceRGBBlendFactor == d.sourceRGBBlendFactor && a.destinationRGBBlendFactor == d.destinationRGBBlendFactor
+        && a.sourceAlphaBlendFactor == d.sourceAlphaBlendFactor && a.destinationAlphaBlendFactor == d.destinationAlphaBlendFactor
+        && a.writeMask == d.writeMask;
+}
+
+static uint32_t nameIndex(std::vector<std::string>& names, std::unordered_map<std::string, uint32_t>& indices, const std::string& name) {
+    auto [it, inserted] = indices.try_emplace(name, static_cast<uint32_t>(names.size()));
+    if (inserted) {
+        names.push_back(name);
+    }
+    return it->second;
+}
+
+bool Recording::save(const char* path) const {
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> indices;
+    Writer records;
+    records.varint(_pipelines.size());
+    for (const RecordedPipeline& pipeline : _pipelines) {
+        const RenderPipelineKey& key = pipeline.key;
+        records.varint(pipeline.sessions);
+        records.varint(pipeline.firstFrame);
+        records.varint(nameIndex(names, indices, key.vertexFunction));
+        records.varint(nameIndex(names, indices, key.fragmentFunction));
+
+        records.varint(key.constants.size());
+        for (const FunctionConstant& c : key.constants) {
+            records.varint(c.index);
+            records.varint(c.dataType);
+            records.varint(c.value);
+        }
+
+        uint32_t attachmentMask = 0;
+        for (size_t i = 0; i < pipeline_cache::kMaxColorAttachments; ++i) {
+            if (!isDefault(key.colorAttachments[i])) {
+                attachmentMask |= 1u << i;
+            }
+        }
+        records.varint(attachmentMask);
+        for (size_t i = 0; i < pipeline_cache::kMaxColorAttachments; ++i) {
+            if (attachmentMask & (1u << i)) {
+                const ColorAttachment& a = key.colorAttachments[i];
+                records.varint(a.pixelFormat);
+                records.varint(a.blendingEnabled);
+                records.varint(a.rgbBlendOperation);
+                records.varint(a.alphaBlendOperation);
+                records.varint(a.sourceRGBBlendFactor);
+                records.varint(a.destinationRGBBlendFactor);
+                records.varint(a.sourceAlphaBlendFactor);
+                records.varint(a.destinationAlphaBlendFactor);
+                records.varint(a.writeMask);
+            }
+        }
+
+        records.varint(key.depthPixelFormat);
+        records.varint(key.stencilPixelFormat);
+        records.varint(key.sampleCount);
+
+        records.varint(key.vertexAttributes.size());
+        for (const VertexAttribute& a : key.vertexAttributes) {
+            records.varint(a.format);
+            records.varint(a.offset);
+            records.varint(a.bufferIndex);
+        }
+        records.varint(key.vertexLayouts.size());
+        for (const VertexLayout& l : key.vertexLayouts) {
+            records.varint(l.stride);
+            records.varint(l.stepFunction);
+            records.varint(l.stepRate);
+        }
+        records.varint(key.compileProfile);
+        records.varint(key.stitchedMaterial);
+        records.varint(nameIndex(names, indices, key.objectFunction));
+        records.varint(nameIndex(names, indices, key.meshFunction));
+        records.varint(key.maxTessellationFactor);
+    }
+
+    Writer file;
+    file.u32(kRecordFileMagic);
+    file.u32(kRecordFileVersion);
+    file.varint(names.size());
+    for (const std::string& name : names) {
+        file.string(name);
+    }
+
+    // Write to a temporary and rename, so a crash mid-write never leaves a truncated list behind.
+    const std::string tempPath = std::string(path) + ".tmp";
+    FILE* pFile = fopen(tempPath.c_str(), "wb");
+    if (pFile == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(file.bytes().data(), 1, file.bytes().size(), pFile) == file.bytes().size();
+    ok = ok && fwrite(records.bytes().data(), 1, records.bytes().size(), pFile) == records.bytes().size();
+    ok = fclose(pFile) == 0 && ok;
+    return ok && rename(tempPath.c_str(), path) == 0;
+}
+
+bool Recording::load(const char* path) {
+    FILE* pFile = fopen(path, "rb");
+    if (pFile == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[16 * 1024];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + count);
+    }
+    fclose(pFile);
+
+    Reader reader(bytes.data(), bytes.size());
+    if (reader.u32() != kRecordFileMagic || reader.u32() != kRecordFileVersion) {
+        return false;
+    }
+
+    // Each name takes at least one byte, which bounds the count before anything is allocated.
+    const uint32_t nameCount = reader.varint32();
+    if (nameCount > bytes.size()) {
+        return false;
+    }
+    std::vector<std::string> names(nameCount);
+    for (std::string& name : names) {
+        name = reader.string();
+    }
+    auto readName = [&]() {
+        const uint32_t index = reader.varint32();
+        if (index >= names.size()) {
+            reader.ok = false;
+            return std::string();
+        }
+        return names[index];
+    };
+
+    Recording loaded;
+    const uint64_t pipelineCount = reader.varint();
+    for (uint64_t p = 0; p < pipelineCount && reader.ok; ++p) {
+        RecordedPipeline pipeline;
+        RenderPipelineKey& key = pipeline.key;
+        pipeline.sessions = reader.varint32();
+        pipeline.firstFrame = reader.varint();
+        key.vertexFunction = readName();
+        key.fragmentFunction = readName();
+
+        const uint32_t constantCount = reader.varint32();
+        for (uint32_t i = 0; i < constantCount && reader.ok; ++i) {
+            FunctionConstant c;
+            c.index = reader.varint32();
+            c.dataType = reader.varint32();
+            c.value = reader.varint32();
+            key.constants.push_back(c);
+        }
+
+        const uint32_t attachmentMask = reader.varint32();
+        for (size_t i = 0; i < pipeline_cache::kMaxColorAttachments; ++i) {
+            if (attachmentMask & (1u << i)) {
+                ColorAttachment& a = key.colorAttachments[i];
+                a.pixelFormat = reader.varint32();
+                a.blendingEnabled = reader.varint32() != 0;
+                a.rgbBlendOperation = reader.varint32();
+                a.alphaBlendOperation = reader.varint32();
+                a.sourceRGBBlendFactor = reader.varint32();
+                a.destinationRGBBlendFactor = reader.varint32();
+                a.sourceAlphaBlendFactor = reader.varint32();
+                a.destinationAlphaBlendFactor = reader.varint32();
+                a.writeMask = reader.varint32();
+            }
+        }
+
+        key.depthPixelFormat = reader.varint32();
+        key.stencilPixelFormat = reader.varint32();
+        key.sampleCount = reader.varint32();
+
+        const uint32_t attributeCount = reader.varint32();
+        for (uint32_t i = 0; i < attributeCount && reader.ok; ++i) {
+            VertexAttribute a;
+            a.format = reader.varint32();
+            a.offset = reader.varint32();
+            a.bufferIndex = reader.varint32();
+            key.vertexAttributes.push_back(a);
+        }
+        const uint32_t layoutCount = reader.varint32();
+        for (uint32_t i = 0; i < layoutCount && reader.ok; ++i) {
+            VertexLayout l;
+            l.stride = reader.varint32();
+            l.stepFunction = reader.varint32();
+            l.stepRate = reader.varint32();
+            key.vertexLayouts.push_back(l);
+        }
+        key.compileProfile = reader.varint32();
+        key.stitchedMaterial = reader.varint();
+        key.objectFunction = readName();
+        key.meshFunction = readName();
+        key.maxTessellationFactor = reader.varint32();
+
+        if (reader.ok) {
+            loaded.add(pipeline);
+        }
+    }
+
+    if (!reader.ok || !reader.atEnd()) {
+        return false;
+    }
+    *this = std::move(loaded);
+    return true;
+}
+
+RecordedPipeline* Recording::find(const RenderPipelineKey& key, uint64_t hash) {
+    auto it = _indices.find(hash);
+    if (it == _indices.end()) {
+        return nullptr;
+    }
+    for (size_t index : it->second) {
+        if (_pipelines[index].key == key) {
+            return &_pipelines[index];
+        }
+    }
+    return nullptr;
+}
+
+void Recording::add(const RecordedPipeline& pipeline) {
+    const uint64_t hash = pipeline.key.hash();
+    if (RecordedPipeline* pExisting = find(pipeline.key, hash)) {
+        pExisting->sessions += pipeline.sessions;
+        pExisting->firstFrame = std::min(pExisting->firstFrame, pipeline.firstFrame);
+        return;
+    }
+    _indices[hash].push_back(_pipelines.size());
+    _pipelines.push_back(pipeline);
+}
+
+void Recording::merge(const Recording& other) {
+    for (const RecordedPipeline& pipeline : other._pipelines) {
+        add(pipeline);
+    }
+}
+
+std::vector<const RecordedPipeline*> Recording::prewarmOrder() const {
+    std::vector<const RecordedPipeline*> order;
+    order.reserve(_pipelines.size());
+    for (const RecordedPipeline& pipeline : _pipelines) {
+        order.push_back(&pipeline);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const RecordedPipeline* a, const RecordedPipeline* b) {
+        return a->firstFrame != b->firstFrame ? a->firstFrame < b->firstFrame : a->sessions > b->sessions;
+    });
+    return order;
+}
+
+Recorder::Recorder(Recording previous): _recording(std::move(previous)) {
+
+}
+
+void Recorder::record(const RenderPipelineKey& key, uint64_t frameIndex) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<RenderPipelineKey>& seen = _seen[key.hash()];
+    if (std::find(seen.begin(), seen.end(), key) != seen.end()) {
+        return;
+    }
+    seen.push_back(key);
+    _recording.add(RecordedPipeline { key, 1, frameIndex });
+    _dirty = true;
+}
+
+bool Recorder::saveIfChanged(const char* path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_dirty) {
+        return true;
+    }
+    if (!_recording.save(path)) {
+        __builtin_printf("Failed to write pipeline recording %s\n", path);
+        return false;
+    }
+    _dirty = false;
+    return true;
+}
+}
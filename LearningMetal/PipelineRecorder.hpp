@@ -0,0 +1,70 @@
+//
+//  PipelineRecorder.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/28.
+//
+
+#ifndef PipelineRecorder_hpp
+#define PipelineRecorder_hpp
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "PipelineCache.hpp"
+
+namespace pipeline_record {
+    static constexpr uint32_t kRecordFileMagic = 0x4352504c; // 'LPRC'
+    static constexpr uint32_t kRecordFileVersion = 5;
+
+    struct RecordedPipeline {
+        pipeline_cache::RenderPipelineKey key;
+        uint32_t sessions;    // number of recorded sessions that used the pipeline
+        uint64_t firstFrame;  // earliest frame it was first requested in
+    };
+
+    /**
+     * Pipeline keys seen across sessions. On disk: a header, a table of function names, then one record per key with
+     * every field as a LEB128 varint and only non-default colour attachments stored, so a key is a few dozen bytes.
+     */
+    class Recording {
+    public:
+        bool load(const char* path);
+        bool save(const char* path) const;
+
+        // A key already present adds up the session counts and keeps the earlier first frame.
+        void add(const RecordedPipeline& pipeline);
+        void merge(const Recording& other);
+
+        const std::vector<RecordedPipeline>& pipelines() const { return _pipelines; }
+        // Earliest-needed first, then most used.
+        std::vector<const RecordedPipeline*> prewarmOrder() const;
+
+    private:
+        RecordedPipeline* find(const pipeline_cache::RenderPipelineKey& key, uint64_t hash);
+
+        std::vector<RecordedPipeline> _pipelines;
+        std::unordered_map<uint64_t, std::vector<size_t>> _indices;
+    };
+
+    /**
+     * Records each distinct pipeline requested in this session on top of the recordings from earlier sessions.
+     * record() may be called from any thread; save() writes only when something new was seen.
+     */
+    class Recorder {
+    public:
+        explicit Recorder(Recording previous = Recording());
+
+        void record(const pipeline_cache::RenderPipelineKey& key, uint64_t frameIndex);
+        bool saveIfChanged(const char* path);
+
+    private:
+        std::mutex _mutex;
+        Recording _recording;
+        std::unordered_map<uint64_t, std::vector<pipeline_cache::RenderPipelineKey>> _seen;
+        bool _dirty = false;
+    };
+}
+
+#endif /* PipelineRecorder_hpp */
@@ -0,0 +1,461 @@
+//
+//  ProceduralMesh.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "ProceduralMesh.hpp"
+#include "ParallelFor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+namespace procedural {
+static constexpr float kPi = 3.14159265358979f;
+// Below these a row range is not worth a thread.
+static constexpr size_t kMinVerticesPerTask = 1 << 14;
+static constexpr size_t kMinIndicesPerTask = 1 << 16;
+
+static uint32_t detail(uint32_t value, uint32_t lod, uint32_t minimum) {
+    return std::max(minimum, lod >= 32 ? 0u : value >> lod);
+}
+
+static MeshCounts makeCounts(uint64_t vertexCount, uint64_t indexCount) {
+    return { static_cast<uint32_t>(vertexCount), static_cast<uint32_t>(indexCount), vertexCount < 0xFFFF ? 2u : 4u };
+}
+
+static size_t minRowsPerTask(size_t rowLength, size_t minPerTask) {
+    return std::max<size_t>(1, minPerTask / std::max<size_t>(1, rowLength));
+}
+
+// One row of vertices as separate arrays, so each attribute is computed by a plain loop over the row.
+struct RowAttributes {
+    explicit RowAttributes(size_t capacity): _storage(capacity * 8) {
+        px = _storage.data();
+        py = px + capacity;
+        pz = py + capacity;
+        nx = pz + capacity;
+        ny = nx + capacity;
+        nz = ny + capacity;
+        u = nz + capacity;
+        v = u + capacity;
+    }
+
+    float *px, *py, *pz, *nx, *ny, *nz, *u, *v;
+
+private:
+    std::vector<float> _storage;
+};
+
+// Row helpers, one output array a loop so the compiler vectorizes each without alias checks between outputs.
+static void fillRow(float* pDst, size_t count, float value) {
+    std::fill(pDst, pDst + count, value);
+}
+
+// pDst[i] = start + i * step
+static void rampRow(float* pDst, size_t count, float start, float step) {
+    for (size_t i = 0; i < count; ++i) {
+        pDst[i] = start + static_cast<float>(i) * step;
+    }
+}
+
+// pDst[i] = offset + scale * pSrc[i]
+static void affineRow(float* pDst, const float* pSrc, size_t count, float offset, float scale) {
+    for (size_t i = 0; i < count; ++i) {
+        pDst[i] = offset + scale * pSrc[i];
+    }
+}
+
+static void writeRow(const VertexLayout& layout, uint8_t* pVertices, size_t firstVertex, size_t count, const RowAttributes& row) {
+    uint8_t* pFirst = pVertices + firstVertex * layout.stride;
+    if (layout.positionOffset != kAbsent) {
+        for (size_t i = 0; i < count; ++i) {
+            const float position[3] = { row.px[i], row.py[i], row.pz[i] };
+            memcpy(pFirst + i * layout.stride + layout.positionOffset, position, sizeof(position));
+        }
+    }
+    if (layout.normalOffset != kAbsent) {
+        for (size_t i = 0; i < count; ++i) {
+            const float normal[3] = { row.nx[i], row.ny[i], row.nz[i] };
+            memcpy(pFirst + i * layout.stride + layout.normalOffset, normal, sizeof(normal));
+        }
+    }
+    if (layout.texCoordOffset != kAbsent) {
+        for (size_t i = 0; i < count; ++i) {
+            const float texCoord[2] = { row.u[i], row.v[i] };
+            memcpy(pFirst + i * layout.stride + layout.texCoordOffset, texCoord, sizeof(texCoord));
+        }
+    }
+}
+
+// Vertex rows go to the workers in contiguous ranges; fn(row, attributes) fills and writes one.
+template <typename Fn>
+static void forEachVertexRow(size_t rowCount, size_t rowLength, uint32_t threads, Fn&& fn) {
+    parallel::forRange(rowCount, minRowsPerTask(rowLength, kMinVerticesPerTask), threads, [&](size_t begin, size_t end, size_t) {
+        RowAttributes row(rowLength);
+        for (size_t r = begin; r < end; ++r) {
+            fn(r, row);
+        }
+    });
+}
+
+// Index rows likewise, with fn(row, pIndices) called on uint16_t or uint32_t indices as the mesh needs.
+template <typename Fn>
+static void forEachIndexRow(const MeshCounts& counts, void* pIndices, size_t rowCount, size_t rowLength, uint32_t threads, Fn&& fn) {
+    auto run = [&](auto* pTyped) {
+        parallel::forRange(rowCount, minRowsPerTask(rowLength, kMinIndicesPerTask), threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t r = begin; r < end; ++r) {
+                fn(r, pTyped);
+            }
+        });
+    };
+    if (counts.indexSize == 2) {
+        run(static_cast<uint16_t*>(pIndices));
+    } else {
+        run(static_cast<uint32_t*>(pIndices));
+    }
+}
+
+// Quads between two rows of vertices, as (top j, bottom j, bottom j + 1) and (top j, bottom j + 1, top j + 1).
+template <typename Index>
+static void quadRow(Index* pIndices, uint32_t top, uint32_t bottom, uint32_t quads) {
+    for (uint32_t j = 0; j < quads; ++j, pIndices += 6) {
+        pIndices[0] = static_cast<Index>(top + j);
+        pIndices[1] = static_cast<Index>(bottom + j);
+        pIndices[2] = static_cast<Index>(bottom + j + 1);
+        pIndices[3] = static_cast<Index>(top + j);
+        pIndices[4] = static_cast<Index>(bottom + j + 1);
+        pIndices[5] = static_cast<Index>(top + j + 1);
+    }
+}
+
+// segments + 1 points counter-clockwise seen from +y, starting on +x; the last repeats the first exactly.
+static void unitCircle(uint32_t segments, std::vector<float>& x, std::vector<float>& z) {
+    x.resize(segments + 1);
+    z.resize(segments + 1);
+    for (uint32_t j = 0; j < segments; ++j) {
+        const float angle = 2.0f * kPi * static_cast<float>(j) / static_cast<float>(segments);
+        x[j] = cosf(angle);
+        z[j] = -sinf(angle);
+    }
+    x[segments] = x[0];
+    z[segments] = z[0];
+}
+
+MeshCounts measure(const BoxDesc& desc) {
+    const uint64_t cells = detail(desc.cells, desc.lod, 1);
+    return makeCounts(6 * (cells + 1) * (cells + 1), 36 * cells * cells);
+}
+
+MeshCounts measure(const SphereDesc& desc) {
+    const uint64_t segments = detail(desc.segments, desc.lod, 3);
+    const uint64_t rings = detail(desc.rings, desc.lod, 2);
+    // The bands at the poles are one triangle a segment.
+    return makeCounts((rings + 1) * (segments + 1), 6 * segments * (rings - 1));
+}
+
+MeshCounts measure(const CylinderDesc& desc) {
+    const uint64_t segments = detail(desc.segments, desc.lod, 3);
+    const uint64_t stacks = detail(desc.stacks, desc.lod, 1);
+    const uint64_t caps = desc.caps ? 2 : 0;
+    return makeCounts((stacks + 1) * (segments + 1) + caps * (segments + 2), 6 * segments * stacks + caps * 3 * segments);
+}
+
+MeshCounts measure(const GridDesc& desc) {
+    const uint64_t cellsX = detail(desc.cells[0], desc.lod, 1);
+    const uint64_t cellsZ = detail(desc.cells[1], desc.lod, 1);
+    return makeCounts((cellsX + 1) * (cellsZ + 1), 6 * cellsX * cellsZ);
+}
+
+void generate(const BoxDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads) {
+    struct Face {
+        float normal[3];
+        float right[3];
+        float up[3]; // right x up = normal, so rows running down the face wind counter-clockwise
+    };
+    static constexpr Face kFaces[6] = {
+        { { 1, 0, 0 }, { 0, 0, -1 }, { 0, 1, 0 } },
+        { { -1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } },
+        { { 0, 1, 0 }, { 1, 0, 0 }, { 0, 0, -1 } },
+        { { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+        { { 0, 0, 1 }, { 1, 0, 0 }, { 0, 1, 0 } },
+        { { 0, 0, -1 }, { -1, 0, 0 }, { 0, 1, 0 } },
+    };
+    const MeshCounts counts = measure(desc);
+    const uint32_t cells = detail(desc.cells, desc.lod, 1);
+    const uint32_t columns = cells + 1;
+    const float step = 1.0f / static_cast<float>(cells);
+    uint8_t* pBytes = static_cast<uint8_t*>(pVertices);
+
+    forEachVertexRow(6 * columns, columns, threads, [&](size_t r, RowAttributes& row) {
+        const Face& face = kFaces[r / columns];
+        const float t = static_cast<float>(r % columns) * step;
+        rampRow(row.u, columns, 0.0f, step);
+        fillRow(row.v, columns, t);
+        // Each position component is affine in u: extent * (normal / 2 + (1/2 - t) * up + (u - 1/2) * right).
+        float* const pPositions[3] = { row.px, row.py, row.pz };
+        float* const pNormals[3] = { row.nx, row.ny, row.nz };
+        for (int c = 0; c < 3; ++c) {
+            const float base = 0.5f * face.normal[c] + (0.5f - t) * face.up[c] - 0.5f * face.right[c];
+            affineRow(pPositions[c], row.u, columns, desc.extent[c] * base, desc.extent[c] * face.right[c]);
+            fillRow(pNormals[c], columns, face.normal[c]);
+        }
+        writeRow(layout, pBytes, r * columns, columns, row);
+    });
+
+    forEachIndexRow(counts, pIndices, 6 * cells, 6 * cells, threads, [&](size_t r, auto* pTyped) {
+        const uint32_t face = static_cast<uint32_t>(r / cells);
+        const uint32_t t = static_cast<uint32_t>(r % cells);
+        const uint32_t top = face * columns * columns + t * columns;
+        quadRow(pTyped + r * 6 * cells, top, top + columns, cells);
+    });
+}
+
+void generate(const SphereDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads) {
+    const MeshCounts counts = measure(desc);
+    const uint32_t segments = detail(desc.segments, desc.lod, 3);
+    const uint32_t rings = detail(desc.rings, desc.lod, 2);
+    const uint32_t columns = segments + 1;
+    std::vector<float> circleX, circleZ;
+    unitCircle(segments, circleX, circleZ);
+    uint8_t* pBytes = static_cast<uint8_t*>(pVertices);
+
+    // Rows run from the north pole down, where the poles are exact.
+    forEachVertexRow(rings + 1, columns, threads, [&](size_t i, RowAttributes& row) {
+        const float polar = kPi * static_cast<float>(i) / static_cast<float>(rings);
+        const float ringRadius = i == 0 || i == rings ? 0.0f : sinf(polar);
+        const float y = i == 0 ? 1.0f : i == rings ? -1.0f : cosf(polar);
+        const float v = static_cast<float>(i) / static_cast<float>(rings);
+        affineRow(row.nx, circleX.data(), columns, 0.0f, ringRadius);
+        fillRow(row.ny, columns, y);
+        affineRow(row.nz, circleZ.data(), columns, 0.0f, ringRadius);
+        affineRow(row.px, row.nx, columns, 0.0f, desc.radius);
+        fillRow(row.py, columns, desc.radius * y);
+        affineRow(row.pz, row.nz, columns, 0.0f, desc.radius);
+        rampRow(row.u, columns, 0.0f, 1.0f / static_cast<float>(segments));
+        fillRow(row.v, columns, v);
+        writeRow(layout, pBytes, i * columns, columns, row);
+    });
+
+    forEachIndexRow(counts, pIndices, rings, 6 * segments, threads, [&](size_t i, auto* pTyped) {
+        const uint32_t top = static_cast<uint32_t>(i) * columns;
+        const uint32_t bottom = top + columns;
+        using Index = std::remove_pointer_t<decltype(pTyped)>;
+        if (i == 0) {
+            // Each quad's second triangle would be degenerate at the pole.
+            for (uint32_t j = 0; j < segments; ++j) {
+                Index* pTriangle = pTyped + 3 * j;
+                pTriangle[0] = static_cast<Index>(top + j);
+                pTriangle[1] = static_cast<Index>(bottom + j);
+                pTriangle[2] = static_cast<Index>(bottom + j + 1);
+            }
+        } else if (i == rings - 1) {
+            Index* pBand = pTyped + 3 * segments + 6 * segments * (i - 1);
+            for (uint32_t j = 0; j < segments; ++j) {
+                Index* pTriangle = pBand + 3 * j;
+                pTriangle[0] = static_cast<Index>(top + j);
+                pTriangle[1] = static_cast<Index>(bottom + j + 1);
+                pTriangle[2] = static_cast<Index>(top + j + 1);
+            }
+        } else {
+            quadRow(pTyped + 3 * segments + 6 * segments * (i - 1), top, bottom, segments);
+        }
+    });
+}
+
+void generate(const CylinderDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads) {
+    const MeshCounts counts = measure(desc);
+    const uint32_t segments = detail(desc.segments, desc.lod, 3);
+    const uint32_t stacks = detail(desc.stacks, desc.lod, 1);
+    const uint32_t columns = segments + 1;
+    const uint32_t capCount = desc.caps ? 2 : 0;
+    const uint32_t firstCapVertex = (stacks + 1) * columns;
+    std::vector<float> circleX, circleZ;
+    unitCircle(segments, circleX, circleZ);
+    uint8_t* pBytes = static_cast<uint8_t*>(pVertices);
+
+    // The side's rows from the top down, then a row per cap: its centre and its rim.
+    forEachVertexRow(stacks + 1 + capCount, columns + 1, threads, [&](size_t i, RowAttributes& row) {
+        if (i <= stacks) {
+            const float v = static_cast<float>(i) / static_cast<float>(stacks);
+            const float y = desc.height * (0.5f - v);
+            affineRow(row.px, circleX.data(), columns, 0.0f, desc.radius);
+            fillRow(row.py, columns, y);
+            affineRow(row.pz, circleZ.data(), columns, 0.0f, desc.radius);
+            affineRow(row.nx, circleX.data(), columns, 0.0f, 1.0f);
+            fillRow(row.ny, columns, 0.0f);
+            affineRow(row.nz, circleZ.data(), columns, 0.0f, 1.0f);
+            rampRow(row.u, columns, 0.0f, 1.0f / static_cast<float>(segments));
+            fillRow(row.v, columns, v);
+            writeRow(layout, pBytes, i * columns, columns, row);
+            return;
+        }
+        const float side = i == stacks + 1 ? 1.0f : -1.0f;
+        row.px[0] = 0.0f;
+        row.py[0] = 0.5f * side * desc.height;
+        row.pz[0] = 0.0f;
+        row.u[0] = 0.5f;
+        row.v[0] = 0.5f;
+        affineRow(row.px + 1, circleX.data(), columns, 0.0f, desc.radius);
+        fillRow(row.py + 1, columns, row.py[0]);
+        affineRow(row.pz + 1, circleZ.data(), columns, 0.0f, desc.radius);
+        affineRow(row.u + 1, circleX.data(), columns, 0.5f, 0.5f);
+        affineRow(row.v + 1, circleZ.data(), columns, 0.5f, 0.5f * side);
+        fillRow(row.nx, columns + 1, 0.0f);
+        fillRow(row.ny, columns + 1, side);
+        fillRow(row.nz, columns + 1, 0.0f);
+        writeRow(layout, pBytes, firstCapVertex + (i - stacks - 1) * (columns + 1), columns + 1, row);
+    });
+
+    forEachIndexRow(counts, pIndices, stacks + capCount, 6 * segments, threads, [&](size_t i, auto* pTyped) {
+        using Index = std::remove_pointer_t<decltype(pTyped)>;
+        if (i < stacks) {
+            const uint32_t top = static_cast<uint32_t>(i) * columns;
+            quadRow(pTyped + 6 * segments * i, top, top + columns, segments);
+            return;
+        }
+        // Fans: the bottom cap faces down, so its rim runs the other way.
+        const bool bottomCap = i == stacks + 1;
+        const uint32_t centre = firstCapVertex + (bottomCap ? columns + 1 : 0);
+        Index* pFan = pTyped + 6 * segments * stacks + (bottomCap ? 3 * segments : 0);
+        for (uint32_t j = 0; j < segments; ++j) {
+            pFan[3 * j] = static_cast<Index>(centre);
+            pFan[3 * j + 1] = static_cast<Index>(centre + 1 + (bottomCap ? j + 1 : j));
+            pFan[3 * j + 2] = static_cast<Index>(centre + 1 + (bottomCap ? j : j + 1));
+        }
+    });
+}
+
+static uint32_t hashLattice(int32_t x, int32_t z, uint32_t seed) {
+    uint32_t h = seed * 0x9E3779B9u + static_cast<uint32_t>(x) * 0x85EBCA6Bu + static_cast<uint32_t>(z) * 0xC2B2AE35u;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// In [-1, 1).
+static float latticeValue(int32_t x, int32_t z, uint32_t seed) {
+    return static_cast<float>(hashLattice(x, z, seed) >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+// Branch-free so the loop over a row vectorizes: the floor is a truncation corrected for negative values.
+static float valueNoise(float x, float z, uint32_t seed) {
+    int32_t x0 = static_cast<int32_t>(x);
+    int32_t z0 = static_cast<int32_t>(z);
+    x0 -= x < static_cast<float>(x0) ? 1 : 0;
+    z0 -= z < static_cast<float>(z0) ? 1 : 0;
+    float tx = x - static_cast<float>(x0);
+    float tz = z - static_cast<float>(z0);
+    tx = tx * tx * (3.0f - 2.0f * tx);
+    tz = tz * tz * (3.0f - 2.0f * tz);
+    const float v00 = latticeValue(x0, z0, seed);
+    const float v10 = latticeValue(x0 + 1, z0, seed);
+    const float v01 = latticeValue(x0, z0 + 1, seed);
+    const float v11 = latticeValue(x0 + 1, z0 + 1, seed);
+    const float near = v00 + (v10 - v00) * tx;
+    const float far = v01 + (v11 - v01) * tx;
+    return near + (far - near) * tz;
+}
+
+// Heights along one row of the grid, octave by octave over the whole row.
+static void heightRow(const GridDesc& desc, const float* xs, float z, size_t count, float* heights) {
+    const float invExtentX = 1.0f / desc.extent[0];
+    const float noiseZ = z / desc.extent[1] + 0.5f;
+    float amplitude = 1.0f;
+    float amplitudeSum = 0.0f;
+    float frequency = desc.frequency;
+    std::fill(heights, heights + count, 0.0f);
+    for (uint32_t octave = 0; octave < desc.octaves; ++octave) {
+        const uint32_t seed = desc.seed + octave;
+        const float sampleZ = noiseZ * frequency;
+        for (size_t j = 0; j < count; ++j) {
+            heights[j] += amplitude * valueNoise((xs[j] * invExtentX + 0.5f) * frequency, sampleZ, seed);
+        }
+        amplitudeSum += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    const float scale = amplitudeSum > 0.0f ? desc.heightScale / amplitudeSum : 0.0f;
+    for (size_t j = 0; j < count; ++j) {
+        heights[j] *= scale;
+    }
+}
+
+float heightAt(const GridDesc& desc, float x, float z) {
+    float height;
+    heightRow(desc, &x, z, 1, &height);
+    return height;
+}
+
+void generate(const GridDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads) {
+    const MeshCounts counts = measure(desc);
+    const uint32_t cellsX = detail(desc.cells[0], desc.lod, 1);
+    const uint32_t cellsZ = detail(desc.cells[1], desc.lod, 1);
+    const uint32_t columns = cellsX + 1;
+    const uint32_t rows = cellsZ + 1;
+    const float stepX = 1.0f / static_cast<float>(cellsX);
+    const float stepZ = 1.0f / static_cast<float>(cellsZ);
+    const float cellX = desc.extent[0] * stepX;
+    const float cellZ = desc.extent[1] * stepZ;
+    std::vector<float> xs(columns);
+    for (uint32_t j = 0; j < columns; ++j) {
+        xs[j] = (static_cast<float>(j) * stepX - 0.5f) * desc.extent[0];
+    }
+    uint8_t* pBytes = static_cast<uint8_t*>(pVertices);
+
+    // Normals are central differences of the heights, so each task also computes the rows bordering its range.
+    parallel::forRange(rows, minRowsPerTask(columns, kMinVerticesPerTask), threads, [&](size_t begin, size_t end, size_t) {
+        const size_t firstRow = begin > 0 ? begin - 1 : 0;
+        const size_t lastRow = std::min<size_t>(end, rows - 1);
+        std::vector<float> heights((lastRow - firstRow + 1) * columns);
+        for (size_t i = firstRow; i <= lastRow; ++i) {
+            const float z = (static_cast<float>(i) * stepZ - 0.5f) * desc.extent[1];
+            heightRow(desc, xs.data(), z, columns, heights.data() + (i - firstRow) * columns);
+        }
+
+        RowAttributes row(columns);
+        for (size_t i = begin; i < end; ++i) {
+            const float* pHeights = heights.data() + (i - firstRow) * columns;
+            const size_t above = i > 0 ? i - 1 : i;
+            const size_t below = i + 1 < rows ? i + 1 : i;
+            const float* pAbove = heights.data() + (above - firstRow) * columns;
+            const float* pBelow = heights.data() + (below - firstRow) * columns;
+            const float z = (static_cast<float>(i) * stepZ - 0.5f) * desc.extent[1];
+            const float slopeZScale = 1.0f / (static_cast<float>(below - above) * cellZ);
+            const float v = static_cast<float>(i) * stepZ;
+
+            // The slope along x into nx for now: interior columns in one loop, the borders one-sided.
+            row.nx[0] = (pHeights[1] - pHeights[0]) / cellX;
+            for (uint32_t j = 1; j + 1 < columns; ++j) {
+                row.nx[j] = (pHeights[j + 1] - pHeights[j - 1]) * (0.5f / cellX);
+            }
+            row.nx[columns - 1] = (pHeights[columns - 1] - pHeights[columns - 2]) / cellX;
+            for (uint32_t j = 0; j < columns; ++j) {
+                const float slopeX = row.nx[j];
+                const float slopeZ = (pBelow[j] - pAbove[j]) * slopeZScale;
+                const float invLength = 1.0f / sqrtf(slopeX * slopeX + 1.0f + slopeZ * slopeZ);
+                row.px[j] = xs[j];
+                row.py[j] = pHeights[j];
+                row.pz[j] = z;
+                row.nx[j] = -slopeX * invLength;
+                row.ny[j] = invLength;
+                row.nz[j] = -slopeZ * invLength;
+                row.u[j] = static_cast<float>(j) * stepX;
+                row.v[j] = v;
+            }
+            writeRow(layout, pBytes, i * columns, columns, row);
+        }
+    });
+
+    // Rows run along +z, so the quads face +y.
+    forEachIndexRow(counts, pIndices, cellsZ, 6 * cellsX, threads, [&](size_t i, auto* pTyped) {
+        const uint32_t top = static_cast<uint32_t>(i) * columns;
+        quadRow(pTyped + 6 * cellsX * i, top, top + columns, cellsX);
+    });
+}
+}
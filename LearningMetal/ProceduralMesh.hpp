@@ -0,0 +1,115 @@
+//
+//  ProceduralMesh.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef ProceduralMesh_hpp
+#define ProceduralMesh_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Runtime generators for boxes, UV spheres, cylinders and heightfield terrain grids. Each writes its vertices and
+ * indices straight into caller memory, typically a mapped shared MTL::Buffer, with rows split across threads. A row's
+ * attributes are computed a whole row at a time into separate float arrays, loops the compiler vectorizes, and then
+ * interleaved into the caller's layout. Triangles are counter-clockwise seen from outside, or from above for grids.
+ * Plain C++, independent of Metal.
+ */
+namespace procedural {
+    static constexpr uint32_t kAbsent = UINT32_MAX;
+
+    // Byte offsets within a vertex: position and normal are 3 floats, texCoord 2.
+    struct VertexLayout {
+        uint32_t stride;
+        uint32_t positionOffset;
+        uint32_t normalOffset;   // kAbsent to leave out
+        uint32_t texCoordOffset; // kAbsent to leave out
+    };
+
+    // VertexData in ShaderTypes.hpp, read by vertexMain: a float3 position padded to 16 bytes.
+    static constexpr VertexLayout kVertexDataLayout = { 16, 0, kAbsent, kAbsent };
+    static constexpr VertexLayout kPositionNormalTexCoordLayout = { 32, 0, 12, 24 };
+
+    struct MeshCounts {
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t indexSize; // 2 while every index fits below the primitive restart value, 4 otherwise
+
+        size_t vertexBytes(const VertexLayout& layout) const { return size_t(vertexCount) * layout.stride; }
+        size_t indexBytes() const { return size_t(indexCount) * indexSize; }
+    };
+
+    // In every description, each lod level halves the tessellation, down to the shape's minimum.
+    struct BoxDesc {
+        float extent[3] = { 1.0f, 1.0f, 1.0f };
+        uint32_t cells = 1; // per side of each face
+        uint32_t lod = 0;
+    };
+
+    // Poles and the seam have a vertex per column, so texture coordinates stay continuous.
+    struct SphereDesc {
+        float radius = 0.5f;
+        uint32_t segments = 32; // around y, at least 3
+        uint32_t rings = 16;    // pole to pole, at least 2
+        uint32_t lod = 0;
+    };
+
+    struct CylinderDesc {
+        float radius = 0.5f;
+        float height = 1.0f; // along y, centred on the origin
+        uint32_t segments = 32;
+        uint32_t stacks = 1;
+        bool caps = true;
+        uint32_t lod = 0;
+    };
+
+    /**
+     * A grid on the xz plane, centred on the origin, displaced along y by fractal value noise. Heights are a function
+     * of position alone, so every lod level samples the same surface: while the cell counts stay divisible by
+     * 2^lod, a coarser level's vertices lie exactly on the finer one's.
+     */
+    struct GridDesc {
+        float extent[2] = { 16.0f, 16.0f }; // x, z
+        uint32_t cells[2] = { 256, 256 };
+        float heightScale = 2.0f;           // heights lie within +-heightScale
+        float frequency = 4.0f;             // noise features across the extent at the first octave
+        uint32_t octaves = 5;
+        uint32_t seed = 1;
+        uint32_t lod = 0;
+    };
+
+    MeshCounts measure(const BoxDesc& desc);
+    MeshCounts measure(const SphereDesc& desc);
+    MeshCounts measure(const CylinderDesc& desc);
+    MeshCounts measure(const GridDesc& desc);
+
+    // pVertices and pIndices hold measure(desc)'s vertexBytes(layout) and indexBytes(). 0 threads: one per hardware thread.
+    void generate(const BoxDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads = 0);
+    void generate(const SphereDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads = 0);
+    void generate(const CylinderDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads = 0);
+    void generate(const GridDesc& desc, const VertexLayout& layout, void* pVertices, void* pIndices, uint32_t threads = 0);
+
+    // The grid's height at a point of the xz plane, inside the extent or not.
+    float heightAt(const GridDesc& desc, float x, float z);
+
+    // CPU-side storage that regeneration reuses: it reallocates only when a mesh outgrows every earlier one.
+    struct MeshBuffers {
+        MeshCounts counts = {};
+        std::vector<uint8_t> vertices;
+        std::vector<uint8_t> indices;
+    };
+
+    template <typename Desc>
+    void regenerate(const Desc& desc, const VertexLayout& layout, MeshBuffers& buffers, uint32_t threads = 0) {
+        buffers.counts = measure(desc);
+        buffers.vertices.resize(buffers.counts.vertexBytes(layout));
+        buffers.indices.resize(buffers.counts.indexBytes());
+        generate(desc, layout, buffers.vertices.data(), buffers.indices.data(), threads);
+    }
+}
+
+#endif /* ProceduralMesh_hpp */
@@ -6,21 +6,58 @@
 //
 
 #include "MathUtils.hpp"
+#include "ProceduralMesh.hpp"
 #include "Renderer.hpp"
+#include "StartupProbe.hpp"
+#include "VertexQuantize.hpp"
+#include <TargetConditionals.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <simd/simd.h>
+#include <sstream>
+#include <thread>
+#include <utility>
 
 #pragma mark - Renderer
 #pragma region Renderer {
 
 const int Renderer::kMaxFramesInFlight = 3;
 
-Renderer::Renderer(MTL::Device* pDevice): _pDevice(pDevice->retain()), _angle(0.f), _frame(0) {
+Renderer::Renderer(MTL::Device* pDevice): _pDevice(pDevice->retain()), _memoryBudget(pDevice->recommendedMaxWorkingSetSize()), _transientWidth(0), _transientHeight(0), _meshletCount(0), _pGeometryBackend(nullptr), _pGeometryPool(nullptr), _geometryShrinkPending(false), _terrainMode(0), _pTerrain(nullptr), _terrainBandsPending(0), _angle(0.f), _frame(0), _frameIndex(0), _firstFrameDrawn(false) {
+    startup_probe::mark("renderer-init");
+#if DEBUG
+    _periodicReports = true;
+#else
+    // LM_REPORTS=1 prints the periodic reports in release builds too.
+    const char* pReports = getenv("LM_REPORTS");
+    _periodicReports = pReports && pReports[0] == '1';
+#endif
     _pCommandQueue = _pDevice->newCommandQueue();
+    _pBlitBackend = new MetalBlitBackend(_pDevice, _pCommandQueue, kStagingRingSize);
+    _pUploadQueue = new upload::UploadQueue(_pBlitBackend, kUploadBytesPerFrame);
+    trackResource(_pBlitBackend->stagingBuffer(), memory_budget::Category::Staging, "staging");
+    
+    // Regenerable resources are the first thing given up when over budget.
+    // Idle for as many frames as can be in flight before going volatile, so the GPU never reads a volatile resource.
+    _pResourceCache = new resource_cache::ResourceCache(&_cacheBackend, kResourceCacheSize, kMaxFramesInFlight);
+    resource_cache::ResourceCache* pResourceCache = _pResourceCache;
+    _resourceCacheAllocation = _memoryBudget.track(memory_budget::Category::Texture, 0, "resource cache", -1, [pResourceCache](memory_budget::EvictionAction action) -> uint64_t {
+        return action == memory_budget::EvictionAction::MakePurgeable ? pResourceCache->makeIdleVolatile() : 0;
+    });
+    
+    // The mesh's vertex format picks the variant buildShaders prewarms; a cached mesh loads in a few mmap calls.
+    buildBuffers();
     buildShaders();
     buildDepthStencilStates();
-    buildBuffers();
+    _pTransientHeap = new TransientHeap(_pDevice);
+    _transientAllocation = _memoryBudget.track(memory_budget::Category::Heap, 0, "transient heap");
+    buildTerrain();
     
     _semaphore = dispatch_semaphore_create(Renderer::kMaxFramesInFlight);
+    
+    _memoryBudget.printReport();
+    startup_probe::mark("renderer-ready");
 }
 
 Renderer::~Renderer() {
@@ -33,81 +70,403 @@ Renderer::~Renderer() {
         _pCameraDataBuffer[i]->release();
     }
     _pIndexBuffer->release();
-    _pPSO->release();
+    if (_terrainMode != 0) {
+        _pTerrainHeightmap->release();
+    }
+    if (_pTerrain) {
+        for (int i = 0; i < kMaxFramesInFlight; ++i) {
+            _pTerrainTileBuffer[i]->release();
+        }
+        delete _pTerrain;
+    }
+    if (_terrainMode == 2) {
+        _pPatchBoundsBuffer->release();
+        for (int i = 0; i < kMaxFramesInFlight; ++i) {
+            _pTessellationFactorBuffer[i]->release();
+        }
+    }
+    delete _pGeometryPool;
+    delete _pGeometryBackend;
+    delete _pShaderReload; // joins the reload thread before the compiler it feeds goes away
+    delete _pComputeKernels;
+    delete _pTransientHeap;
+    delete _pProfileBenchmark;
+    delete _pVariantPipelines;
+    delete _pPipelineCache;
+    delete _pPipelineRecorder;
+    delete _pMaterialCache;
+    delete _pMaterialStitcher;
+    delete _pPipelineCompiler;
+    delete _pResourceCache;
+    delete _pUploadQueue;
+    delete _pBlitBackend;
     _pCommandQueue->release();
     _pDevice->release();
 }
 
-void Renderer::buildShaders() {
+memory_budget::AllocationId Renderer::trackResource(MTL::Resource* pResource, memory_budget::Category category, const char* label) {
+    return _memoryBudget.track(category, pResource->allocatedSize(), label);
+}
+
+#if DEBUG
+static MTL::CompileOptions* newCompileOptions(const compile_profile::CompileProfile& profile) {
     using NS::StringEncoding::UTF8StringEncoding;
     
-    const char* shaderSrc = R"(
-        #include <metal_stdlib>
-        using namespace metal;
-        
-        struct v2f {
-            float4 position [[position]];
-            half3 color;
-        };
-    
-        struct VertexData {
-            float3 position;
-        };
-    
-        struct InstanceData {
-            float4x4 instanceTransform;
-            float4 instanceColor;
-        };
-    
-        struct CameraData {
-            float4x4 perspectiveTransform;
-            float4x4 worldTransform;
-        };
-    
-        v2f vertex vertexMain(device const VertexData* vertexData [[buffer(0)]], device const InstanceData* instanceData [[buffer(1)]], device const CameraData& cameraData [[buffer(2)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]]) {
-            v2f o;
-            float4 pos = float4(vertexData[vertexId].position, 1.0);
-            pos = instanceData[instanceId].instanceTransform * pos;
-            pos = cameraData.perspectiveTransform * cameraData.worldTransform * pos;
-            o.position = pos;
-            o.color = half3(instanceData[instanceId].instanceColor.rgb);
-            return o;
+    MTL::CompileOptions* pOptions = MTL::CompileOptions::alloc()->init();
+    pOptions->setFastMathEnabled(profile.fastMath);
+    pOptions->setOptimizationLevel(static_cast<MTL::LibraryOptimizationLevel>(profile.optimizationLevel));
+    pOptions->setPreserveInvariance(profile.preserveInvariance);
+    if (!profile.macros.empty()) {
+        std::vector<NS::Object*> names;
+        std::vector<NS::Object*> values;
+        for (const auto& [name, value] : profile.macros) {
+            names.push_back(NS::String::string(name.c_str(), UTF8StringEncoding));
+            values.push_back(NS::String::string(value.c_str(), UTF8StringEncoding));
         }
+        pOptions->setPreprocessorMacros(NS::Dictionary::dictionary(values.data(), names.data(), names.size()));
+    }
+    return pOptions;
+}
+
+// Debug builds copy Shaders.metal into the bundle, so it is there on device as well as on the Simulator.
+static std::string bundledShaderSource() {
+    return std::string(NS::Bundle::mainBundle()->resourcePath()->utf8String()) + "/Shaders.metal";
+}
+
+/**
+ * Development path: compile Shaders.metal at runtime, either as the fallback for when the app was built without its
+ * metallib or, with a profile, to try compile options that the build-time metallib cannot change.
+ */
+static MTL::Library* newLibraryFromSource(MTL::Device* pDevice, const std::string& path, const compile_profile::CompileProfile* pProfile, NS::Error** pError) {
+    std::ifstream file(path);
+    if (!file) {
+        __builtin_printf("Shader source not found at %s\n", path.c_str());
+        return nullptr;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
     
-        half4 fragment fragmentMain(v2f in [[stage_in]]) {
-            return half4(in.color, 1.0);
-        }
-    )";
+    // Runtime compiles cannot resolve includes from the source tree, so the shared declarations are inlined from the
+    // same tables the generated header came from.
+    std::string source = stream.str();
+    const std::string include = "#include \"ShaderTypesGenerated.h\"";
+    const size_t includeAt = source.find(include);
+    if (includeAt != std::string::npos) {
+        source.replace(includeAt, include.size(), shader_types::generateMsl());
+    }
     
+    MTL::CompileOptions* pOptions = pProfile ? newCompileOptions(*pProfile) : nullptr;
+    MTL::Library* pLibrary = pDevice->newLibrary(NS::String::string(source.c_str(), NS::StringEncoding::UTF8StringEncoding), pOptions, pError);
+    if (pOptions) {
+        pOptions->release();
+    }
+    return pLibrary;
+}
+#endif
+
+void Renderer::buildShaders() {
     NS::Error* pError = nullptr;
-    MTL::Library* pLibrary = _pDevice->newLibrary(NS::String::string(shaderSrc, UTF8StringEncoding), nullptr, &pError);
+    // Shaders.metal is compiled into default.metallib at build time.
+    MTL::Library* pLibrary = _pDevice->newDefaultLibrary();
+#if DEBUG
+    if (pLibrary == nullptr) {
+        pLibrary = newLibraryFromSource(_pDevice, bundledShaderSource(), nullptr, &pError);
+    }
+#endif
     
     if (pLibrary == nullptr) {
-        __builtin_printf("%s", pError->localizedDescription()->utf8String());
+        __builtin_printf("%s", pError ? pError->localizedDescription()->utf8String() : "Default shader library not found\n");
         assert(false);
     }
+    startup_probe::mark("shader-library");
     
-    MTL::Function* pVertexFn = pLibrary->newFunction(NS::String::string("vertexMain", UTF8StringEncoding));
-    MTL::Function* pFragmentFn = pLibrary->newFunction(NS::String::string("fragmentMain", UTF8StringEncoding));
+    std::string archivePath = std::string(getenv("HOME")) + "/Library/Caches/pipelines.binarchive";
+    _pPipelineCompiler = new MetalPipelineCompiler(_pDevice, pLibrary, archivePath.c_str());
+    MetalPipelineCompiler* pCompiler = _pPipelineCompiler;
+    const uint32_t maxCompilesInFlight = std::max(2u, std::thread::hardware_concurrency());
+    _pPipelineCache = new pipeline_cache::AsyncPipelineCache<MTL::RenderPipelineState>(
+        [pCompiler](const pipeline_cache::RenderPipelineKey& key, std::function<void(MTL::RenderPipelineState*)> done) {
+            pCompiler->newPipelineStateAsync(key, [done](MTL::RenderPipelineState* pPSO) {
+                startup_probe::mark("pipeline");
+                done(pPSO);
+            });
+        },
+        [](MTL::RenderPipelineState* pPSO) { pPSO->release(); }, maxCompilesInFlight);
     
-    MTL::RenderPipelineDescriptor* pDesc = MTL::RenderPipelineDescriptor::alloc()->init();
-    pDesc->setVertexFunction(pVertexFn);
-    pDesc->setFragmentFunction(pFragmentFn);
-    pDesc->colorAttachments()->object(0)->setPixelFormat(MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB);
-    pDesc->setDepthAttachmentPixelFormat(MTL::PixelFormat::PixelFormatDepth16Unorm);
+    pipeline_cache::RenderPipelineKey baseKey;
+    baseKey.vertexFunction = "vertexMain";
+    baseKey.fragmentFunction = "fragmentMain";
+    baseKey.colorAttachments[0].pixelFormat = MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB;
+    baseKey.depthPixelFormat = MTL::PixelFormat::PixelFormatDepth16Unorm;
     
-    _pPSO = _pDevice->newRenderPipelineState(pDesc, &pError);
-    if (_pPSO == nullptr) {
-        __builtin_printf("%s", pError->localizedDescription()->utf8String());
-        assert(false);
-    }
+    // Indices match the function constants in Shaders.metal.
+    _instanceFormatFeature = _variantSpace.addFeature("instanceFormat", 0, MTL::DataTypeUInt, 2);
+    const shader_variants::FeatureId colorMode = _variantSpace.addFeature("colorMode", 1, MTL::DataTypeUInt, 3);
+    const shader_variants::FeatureId cullInstances = _variantSpace.addFeature("cullInstances", 2, MTL::DataTypeBool, 2);
+    _vertexFormatFeature = _variantSpace.addFeature("vertexFormat", 3, MTL::DataTypeUInt, 3);
+    _geometryFeature = _variantSpace.addFeature("geometry", 4, MTL::DataTypeUInt, 3);
+    _pVariantPipelines = new shader_variants::VariantPipelines<MTL::RenderPipelineState>(_variantSpace, baseKey, _pPipelineCache);
+    
+    // Quantized vertices go through a vertex descriptor, which converts the packed formats on fetch. Meshlets replace
+    // the vertex stage altogether; the mesh function decodes vertices itself.
+    _pVariantPipelines->setKeyCustomizer([this](shader_variants::VariantKey variant, pipeline_cache::RenderPipelineKey& key) {
+        if (_variantSpace.value(variant, _vertexFormatFeature) != 0) {
+            key.vertexFunction = "vertexQuantized";
+            key.vertexAttributes = _vertexAttributes;
+            key.vertexLayouts = { { _vertexStride, MTL::VertexStepFunctionPerVertex, 1 } };
+        }
+        if (_variantSpace.value(variant, _geometryFeature) != 0) {
+            key.vertexFunction.clear();
+            key.vertexAttributes.clear();
+            key.vertexLayouts.clear();
+            key.objectFunction = "objectMeshlets";
+            key.meshFunction = "meshMeshlets";
+        }
+    });
+    
+    _variant = _variantSpace.with(0, _instanceFormatFeature, 1);
+    _variant = _variantSpace.with(_variant, colorMode, 0);
+    _variant = _variantSpace.with(_variant, cullInstances, 1);
+    _variant = _variantSpace.with(_variant, _vertexFormatFeature, _vertexFormat);
+    // Meshlets culled on the GPU where mesh shaders exist and the mesh file has meshlets, the index buffer otherwise.
+    const bool meshShaders = _pDevice->supportsFamily(MTL::GPUFamilyApple7) || _pDevice->supportsFamily(MTL::GPUFamilyMac2);
+    _variant = _variantSpace.with(_variant, _geometryFeature, meshShaders && _meshletCount > 0 ? 2 : 0);
+    
+    // Compiles in the background; draw() skips the mesh until it is ready instead of blocking startup.
+    _pVariantPipelines->prewarm(_variant, pipeline_cache::CompilePriority::High);
+    buildCompileProfiles(pLibrary);
+    buildMaterials(pLibrary);
+    prewarmRecordedPipelines();
+    startShaderHotReload();
+    
+    // Instance animation moves to the GPU once its kernel is compiled; until then draw() fills the buffer itself.
+    _pComputeKernels = new MetalComputeKernels(_pPipelineCompiler, std::string(getenv("HOME")) + "/Library/Caches/threadgroups.txt");
+    _pComputeKernels->prepare(kAnimateInstancesKernel);
     
-    pVertexFn->release();
-    pFragmentFn->release();
-    pDesc->release();
     _pShaderLibrary = pLibrary;
 }
 
+/**
+ * Simulator only: the watched file is Shaders.metal in the source tree on the Mac, which the Simulator shares with the
+ * host and a device cannot see. The bundled copy a device has never changes, so there is nothing to watch there.
+ */
+void Renderer::startShaderHotReload() {
+    _pShaderReload = nullptr;
+#if DEBUG && TARGET_OS_SIMULATOR
+    // One library per compile profile, all built from Shaders.metal; ids line up with profile indices. The generated
+    // header is not watched because runtime compiles inline the declarations from ShaderTypes.hpp instead.
+    MTL::Device* pDevice = _pDevice;
+    const std::vector<compile_profile::CompileProfile> profiles = _compileProfiles;
+    _pShaderReload = new hot_reload::HotReloadService<MTL::Library>(
+        [pDevice, profiles](uint32_t profile) -> MTL::Library* {
+            NS::AutoreleasePool* pPool = NS::AutoreleasePool::alloc()->init();
+            NS::Error* pError = nullptr;
+            // Profile 0 stands for the build-time metallib, which is rebuilt with default options.
+            MTL::Library* pLibrary = newLibraryFromSource(pDevice, SHADER_SOURCE_DIR "/Shaders.metal", profile == compile_profile::kBuildTimeProfile ? nullptr : &profiles[profile], &pError);
+            if (pLibrary == nullptr && pError) {
+                __builtin_printf("Hot reload (%s): %s\n", profiles[profile].name.c_str(), pError->localizedDescription()->utf8String());
+            }
+            pPool->release();
+            return pLibrary;
+        },
+        [](MTL::Library* pLibrary) { pLibrary->release(); });
+    for (size_t i = 0; i < _compileProfiles.size(); ++i) {
+        // Profiles that were never built have nothing to rebuild, but still take an id so ids match profile indices.
+        _pShaderReload->watch(_profileLibraries[i] ? std::vector<std::string> { SHADER_SOURCE_DIR "/Shaders.metal" } : std::vector<std::string>());
+    }
+    _pShaderReload->start();
+#endif
+}
+
+// Between frames: swap in rebuilt libraries and rebuild the pipelines compiled from them. Until a replacement is
+// ready the old pipeline keeps drawing, so an edit never blanks the screen, and a shader that fails to compile
+// leaves the last good one in place. Stitched materials keep the building blocks they were stitched from.
+void Renderer::applyShaderReloads() {
+    if (_pShaderReload == nullptr) {
+        return;
+    }
+    MetalPipelineCompiler* pCompiler = _pPipelineCompiler;
+    pipeline_cache::AsyncPipelineCache<MTL::RenderPipelineState>* pCache = _pPipelineCache;
+    const std::vector<compile_profile::CompileProfile>& profiles = _compileProfiles;
+    _pShaderReload->applyPending([pCompiler, pCache, &profiles](uint32_t profile, MTL::Library* pLibrary) {
+        pCompiler->setLibrary(pLibrary, profile);
+        const size_t count = pCache->recompile([profile](const pipeline_cache::RenderPipelineKey& key) {
+            return key.compileProfile == profile;
+        });
+        __builtin_printf("Hot reload (%s): rebuilding %zu pipelines\n", profiles[profile].name.c_str(), count);
+    });
+}
+
+void Renderer::buildCompileProfiles(MTL::Library* pLibrary) {
+    using compile_profile::CompileProfile;
+    
+    // Index 0 is the build-time metallib and always exists; the others are runtime compiles of the same source.
+    _compileProfiles.push_back(CompileProfile { "metallib" });
+    _compileProfiles.push_back(CompileProfile { "fast-math", true, MTL::LibraryOptimizationLevelDefault, false });
+    _compileProfiles.push_back(CompileProfile { "precise", false, MTL::LibraryOptimizationLevelDefault, false });
+    _compileProfiles.push_back(CompileProfile { "size", true, MTL::LibraryOptimizationLevelSize, false });
+    _compileProfiles.push_back(CompileProfile { "invariant", true, MTL::LibraryOptimizationLevelDefault, true });
+    _pProfileBenchmark = nullptr;
+    _profileBenchmarkRunning = false;
+    _frameProfile = compile_profile::kBuildTimeProfile;
+    _profileLibraries.assign(_compileProfiles.size(), false);
+    _profileLibraries[compile_profile::kBuildTimeProfile] = true;
+    
+    // Per-shader and per-variant choices go in _profileRules, e.g. _profileRules.add("vertexQuantized", mask, value, profile),
+    // or "meshMeshlets" for the meshlet pipelines. While a benchmark runs it overrides them for the whole frame.
+    
+#if DEBUG
+    // Only development builds carry the shader source, so only they can compile the other profiles. Each is a full
+    // library compile at startup, so only the ones a rule or the benchmark uses are built.
+    // LM_PROFILE_BENCHMARK=1 renders the scene under every profile in turn and prints the frame times.
+    const char* pBenchmark = getenv("LM_PROFILE_BENCHMARK");
+    const bool benchmark = pBenchmark && pBenchmark[0] == '1';
+    uint32_t available = 1;
+    const std::string source = bundledShaderSource();
+    for (uint32_t i = 1; i < _compileProfiles.size(); ++i) {
+        if (!benchmark && !_profileRules.uses(i)) {
+            continue;
+        }
+        NS::Error* pError = nullptr;
+        MTL::Library* pProfileLibrary = newLibraryFromSource(_pDevice, source, &_compileProfiles[i], &pError);
+        if (pProfileLibrary == nullptr) {
+            __builtin_printf("Compile profile %s: %s", _compileProfiles[i].name.c_str(), pError ? pError->localizedDescription()->utf8String() : "no source\n");
+            continue;
+        }
+        _pPipelineCompiler->setLibrary(pProfileLibrary, i);
+        pProfileLibrary->release();
+        _profileLibraries[i] = true;
+        ++available;
+    }
+    
+    // The benchmark compares every profile, so it only runs if they all compiled.
+    if (benchmark && available != _compileProfiles.size()) {
+        __builtin_printf("Profile benchmark not run: %u of %zu compile profiles available\n", available, _compileProfiles.size());
+    } else if (benchmark) {
+        _pProfileBenchmark = new compile_profile::FrameTimeBenchmark(available);
+        _profileBenchmarkRunning = true;
+        for (uint32_t i = 0; i < available; ++i) {
+            _pVariantPipelines->prewarm(_variant, i, pipeline_cache::CompilePriority::High);
+        }
+    }
+#endif
+    
+    // Rules pick by the variant's own function, so one naming vertexQuantized or meshMeshlets applies to exactly those
+    // variants. A profile whose library is missing falls back to the build-time one.
+    Renderer* pRenderer = this;
+    _pVariantPipelines->setProfileSelector([pRenderer](shader_variants::VariantKey variant, const pipeline_cache::RenderPipelineKey& key) {
+        if (pRenderer->_profileBenchmarkRunning) {
+            return pRenderer->_frameProfile;
+        }
+        const uint32_t profile = pRenderer->_profileRules.profileFor(key.meshFunction.empty() ? key.vertexFunction : key.meshFunction, variant);
+        return profile < pRenderer->_profileLibraries.size() && pRenderer->_profileLibraries[profile] ? profile : compile_profile::kBuildTimeProfile;
+    });
+}
+
+void Renderer::buildMaterials(MTL::Library* pLibrary) {
+    using material_graph::MaterialGraph;
+    using material_graph::NodeId;
+    
+    _pMaterialStitcher = new MetalMaterialStitcher(_pDevice, pLibrary);
+    MetalMaterialStitcher* pStitcher = _pMaterialStitcher;
+    _pMaterialCache = new material_graph::MaterialCache<MTL::Function>(
+        [pStitcher](const MaterialGraph& graph) { return pStitcher->newStitchedFunction(graph); },
+        [](MTL::Function* pFunction) { pFunction->release(); });
+    
+    // Arguments of stitchedMaterial, see fragmentMaterial in Shaders.metal.
+    std::vector<MaterialGraph> graphs;
+    {
+        MaterialGraph graph("stitchedMaterial");
+        NodeId color = graph.input(0);
+        graph.input(1);
+        NodeId tint = graph.input(2);
+        graph.setOutput(graph.call("materialTint", { color, tint }));
+        graphs.push_back(std::move(graph));
+    }
+    {
+        MaterialGraph graph("stitchedMaterial");
+        NodeId color = graph.input(0);
+        NodeId depth = graph.input(1);
+        NodeId tint = graph.input(2);
+        NodeId gray = graph.call("materialGrayscale", { color });
+        graph.setOutput(graph.call("materialDepthFade", { graph.call("materialTint", { gray, tint }), depth }));
+        graphs.push_back(std::move(graph));
+    }
+    {
+        MaterialGraph graph("stitchedMaterial");
+        NodeId color = graph.input(0);
+        NodeId depth = graph.input(1);
+        NodeId tint = graph.input(2);
+        graph.setOutput(graph.call("materialMix", { color, tint, depth }));
+        graphs.push_back(std::move(graph));
+    }
+    
+    const pipeline_cache::RenderPipelineKey& variantKey = _pVariantPipelines->keyFor(_variant);
+    for (const MaterialGraph& graph : graphs) {
+        MTL::Function* pStitched = _pMaterialCache->getOrCreate(graph);
+        if (pStitched == nullptr) {
+            continue;
+        }
+        _pPipelineCompiler->setStitchedFunction(graph.hash(), pStitched);
+        
+        pipeline_cache::RenderPipelineKey key = variantKey;
+        key.fragmentFunction = "fragmentMaterial";
+        key.stitchedMaterial = graph.hash();
+        _pPipelineCache->request(key, pipeline_cache::CompilePriority::Background);
+        _materialKeys.push_back(std::move(key));
+#if DEBUG
+        __builtin_printf("Material %zu: %s\n", _materialKeys.size() - 1, graph.describe().c_str());
+#endif
+    }
+#if DEBUG
+    __builtin_printf("Materials stitched in %.2f ms\n", _pMaterialCache->stats().buildSeconds * 1000.0);
+#endif
+    
+    // LM_MATERIAL=<n> shades the scene with a stitched material instead of fragmentMain.
+    const char* pMaterial = getenv("LM_MATERIAL");
+    _materialIndex = pMaterial ? atoi(pMaterial) : -1;
+    if (_materialIndex >= static_cast<int>(_materialKeys.size())) {
+        _materialIndex = -1;
+    }
+}
+
+void Renderer::prewarmRecordedPipelines() {
+    // This device's own sessions, extended as new pipelines are drawn, plus the list merged offline from test
+    // sessions and shipped in the bundle (see Tools/PipelineMerge.cpp).
+    _pipelineRecordingPath = std::string(getenv("HOME")) + "/Library/Caches/pipelines.lprc";
+    pipeline_record::Recording deviceRecording;
+    deviceRecording.load(_pipelineRecordingPath.c_str());
+    
+    pipeline_record::Recording prewarmList;
+    std::string bundlePath = std::string(NS::Bundle::mainBundle()->resourcePath()->utf8String()) + "/pipelines.lprc";
+    prewarmList.load(bundlePath.c_str());
+    prewarmList.merge(deviceRecording);
+    
+    size_t blockingCount = 0;
+    for (const pipeline_record::RecordedPipeline* pPipeline : prewarmList.prewarmOrder()) {
+        if (pPipeline->key.stitchedMaterial != 0 && !_pPipelineCompiler->hasStitchedFunction(pPipeline->key.stitchedMaterial)) {
+            continue; // a material this build no longer stitches
+        }
+        const bool isEarly = pPipeline->firstFrame < kPrewarmBlockingFrames;
+        blockingCount += isEarly;
+        _pPipelineCache->request(pPipeline->key, isEarly ? pipeline_cache::CompilePriority::High : pipeline_cache::CompilePriority::Background);
+    }
+    // Early pipelines compile in parallel up to the in-flight limit; waiting here trades a longer launch for no
+    // pop-in on the first frames. Everything else keeps compiling while the app runs.
+    if (blockingCount > 0) {
+        _pPipelineCache->waitFor(pipeline_cache::CompilePriority::High);
+    }
+    __builtin_printf("Pipeline prewarm: %zu recorded, %zu before first frame\n", prewarmList.pipelines().size(), blockingCount);
+    startup_probe::mark("pipeline-prewarm");
+    
+    // Record from here on, so prewarm requests are not mistaken for draws.
+    _pPipelineRecorder = new pipeline_record::Recorder(std::move(deviceRecording));
+    Renderer* pRenderer = this;
+    _pPipelineCache->setDrawObserver([pRenderer](const pipeline_cache::RenderPipelineKey& key) {
+        pRenderer->_pPipelineRecorder->record(key, pRenderer->_frameIndex);
+    });
+}
+
 void Renderer::buildDepthStencilStates() {
     MTL::DepthStencilDescriptor* pDsDesc = MTL::DepthStencilDescriptor::alloc()->init();
     pDsDesc->setDepthCompareFunction(MTL::CompareFunction::CompareFunctionLess);
@@ -118,65 +477,632 @@ void Renderer::buildDepthStencilStates() {
     pDsDesc->release();
 }
 
-void Renderer::buildBuffers() {
-    using simd::float3;
-    
-    const float s = 0.5f;
+/**
+ * The depth buffer is only ever an attachment of the main pass, so the planner makes it memoryless: it lives in tile
+ * memory and needs no allocation, where the view's own depth texture would be a full private one. Where memoryless is
+ * unsupported, it is a private texture in the heap. Replanned when the drawable changes size, which is never zero.
+ */
+void Renderer::buildTransientTargets(uint32_t width, uint32_t height) {
+    _pTransientHeap->reset();
+    MTL::TextureDescriptor* pDepthDesc = MTL::TextureDescriptor::texture2DDescriptor(MTL::PixelFormat::PixelFormatDepth16Unorm, width, height, false);
+    pDepthDesc->setUsage(MTL::TextureUsageRenderTarget);
+    _depthTarget = _pTransientHeap->declareTexture("depth", pDepthDesc);
     
-    float3 verts[] = {
-        { -s, -s, +s },
-        { +s, -s, +s },
-        { +s, +s, +s },
-        { -s, +s, +s },
+    transient::TransientPlanner& planner = _pTransientHeap->planner();
+    planner.use(planner.addPass("main"), _depthTarget, transient::Usage::AttachmentWrite);
+    _pTransientHeap->build();
+    _memoryBudget.resize(_transientAllocation, _pTransientHeap->heap() ? _pTransientHeap->heap()->size() : 0);
+    _transientWidth = width;
+    _transientHeight = height;
+#if DEBUG
+    planner.printReport();
+#endif
+}
 
-        { -s, -s, -s },
-        { -s, +s, -s },
-        { +s, +s, -s },
-        { +s, -s, -s }
-    };
+/**
+ * Picks the vertex function for a stream: float positions are read as VertexData by vertexMain, quantized ones
+ * through a vertex descriptor by vertexQuantized, lit when the stream has octahedral normals.
+ */
+bool Renderer::setVertexFormat(const mesh_io::StreamFormat& format, uint32_t stride, const char* path) {
+    if (format.formats[0] == vertex_quantize::kFormatFloat3 && stride == sizeof(shader_types::VertexData)) {
+        _vertexFormat = 0;
+        _vertexAttributes.clear();
+        _vertexStride = stride;
+        _vertexNormalOffset = 0;
+        _vertexQuantization = {};
+        return true;
+    }
     
-    uint16_t indices[] = {
-        0, 1, 2, /* front */
-        2, 3, 0,
+    if (format.formats[0] != vertex_quantize::kFormatUShort4Normalized) {
+        __builtin_printf("Unsupported vertex format %u, stride %u in %s\n", format.formats[0], stride, path);
+        return false;
+    }
+    
+    const bool lit = format.formats[1] == vertex_quantize::kFormatInt1010102Normalized;
+    _vertexAttributes = { { format.formats[0], format.offsets[0], 0 } };
+    if (lit) {
+        _vertexAttributes.push_back({ format.formats[1], format.offsets[1], 0 });
+    }
+    _vertexStride = stride;
+    _vertexNormalOffset = lit ? format.offsets[1] : 0;
+    _vertexFormat = lit ? 2 : 1;
+    _vertexQuantization.positionMin = simd_make_float3(format.positionMin[0], format.positionMin[1], format.positionMin[2]);
+    _vertexQuantization.positionExtent = simd_make_float3(format.positionExtent[0], format.positionExtent[1], format.positionExtent[2]);
+    return true;
+}
 
-        1, 7, 6, /* right */
-        6, 2, 1,
+/**
+ * Wraps a mapped mesh file as a single no-copy buffer; vertices and indices are bound at their section offsets.
+ * A nonzero sourceHash rejects files built from a different source.
+ */
+bool Renderer::buildMappedMeshBuffers(const char* path, uint64_t sourceHash) {
+    if (!_mappedMesh.load(path)) {
+        return false;
+    }
+    
+    if (sourceHash != 0 && _mappedMesh.header().sourceHash != sourceHash) {
+        _mappedMesh.unload();
+        return false;
+    }
+    
+    const mesh_io::MeshSection* pVertices = _mappedMesh.findSection(mesh_io::SectionType::Vertices);
+    const mesh_io::MeshSection* pIndices = _mappedMesh.findSection(mesh_io::SectionType::Indices);
+    if (!pVertices || !pIndices || !(pVertices->attributes & mesh_import::kPositionBit)) {
+        __builtin_printf("Unsupported vertex layout in %s\n", path);
+        _mappedMesh.unload();
+        return false;
+    }
+    
+    // Files without formats hold float positions first.
+    mesh_io::StreamFormat format = { { vertex_quantize::kFormatFloat3 }, {}, {}, {} };
+    const mesh_io::MeshSection* pFormats = _mappedMesh.findSection(mesh_io::SectionType::VertexFormats);
+    if (pFormats && pFormats->elementSize == sizeof(format) && pFormats->count > 0) {
+        format = *static_cast<const mesh_io::StreamFormat*>(_mappedMesh.sectionData(*pFormats));
+    }
+    if (!setVertexFormat(format, pVertices->elementSize, path)) {
+        _mappedMesh.unload();
+        return false;
+    }
+    
+    const mesh_io::MappedFile& file = _mappedMesh.file();
+    // No deallocator: the mapping is owned by _mappedMesh, which outlives the buffer.
+    _pVertexDataBuffer = _pDevice->newBuffer(file.data(), file.mappedLength(), MTL::ResourceStorageModeShared, nullptr);
+    _pIndexBuffer = _pVertexDataBuffer->retain();
+    
+    _vertexBufferOffset = pVertices->offset;
+    _indexBufferOffset = pIndices->offset;
+    _indexCount = pIndices->count;
+    _indexType = pIndices->elementSize == 2 ? MTL::IndexType::IndexTypeUInt16 : MTL::IndexType::IndexTypeUInt32;
+    
+    // Optional: without them the mesh is drawn from the index buffer.
+    static_assert(sizeof(shader_types::MeshletData) == sizeof(meshlet_builder::Meshlet), "MeshletData must match meshlet_builder::Meshlet");
+    const mesh_io::MeshSection* pMeshlets = _mappedMesh.findSection(mesh_io::SectionType::Meshlets);
+    const mesh_io::MeshSection* pMeshletVertices = _mappedMesh.findSection(mesh_io::SectionType::MeshletVertices);
+    const mesh_io::MeshSection* pMeshletTriangles = _mappedMesh.findSection(mesh_io::SectionType::MeshletTriangles);
+    _meshletCount = 0;
+    if (pMeshlets && pMeshletVertices && pMeshletTriangles && pMeshlets->elementSize == sizeof(shader_types::MeshletData)) {
+        _meshletCount = static_cast<uint32_t>(pMeshlets->count);
+        _meshletBufferOffsets[0] = pMeshlets->offset;
+        _meshletBufferOffsets[1] = pMeshletVertices->offset;
+        _meshletBufferOffsets[2] = pMeshletTriangles->offset;
+    }
+    
+    // Optional too: levels past what the Indices section holds would read off its end.
+    _lods.clear();
+    const mesh_io::MeshSection* pLods = _mappedMesh.findSection(mesh_io::SectionType::Lods);
+    if (pLods && pLods->elementSize == sizeof(mesh_simplify::LodLevel)) {
+        const mesh_simplify::LodLevel* pLevels = static_cast<const mesh_simplify::LodLevel*>(_mappedMesh.sectionData(*pLods));
+        for (uint64_t i = 0; i < pLods->count; ++i) {
+            if (uint64_t(pLevels[i].firstIndex) + pLevels[i].indexCount <= pIndices->count) {
+                _lods.push_back(pLevels[i]);
+            }
+        }
+    }
+    return true;
+}
 
-        7, 4, 5, /* back */
-        5, 6, 7,
+// A procedural shape as an ImportedMesh, so that buildGpuMesh lays it out like any other mesh.
+template <typename Desc>
+static mesh_import::ImportedMesh generateShape(const Desc& desc) {
+    const procedural::VertexLayout& layout = procedural::kPositionNormalTexCoordLayout;
+    procedural::MeshBuffers buffers;
+    procedural::regenerate(desc, layout, buffers);
+    
+    mesh_import::ImportedMesh mesh;
+    const uint32_t vertexCount = buffers.counts.vertexCount;
+    mesh.positions.resize(size_t(vertexCount) * 3);
+    mesh.normals.resize(size_t(vertexCount) * 3);
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        const uint8_t* pVertex = buffers.vertices.data() + size_t(i) * layout.stride;
+        memcpy(&mesh.positions[size_t(i) * 3], pVertex + layout.positionOffset, 3 * sizeof(float));
+        memcpy(&mesh.normals[size_t(i) * 3], pVertex + layout.normalOffset, 3 * sizeof(float));
+    }
+    mesh.indices.resize(buffers.counts.indexCount);
+    for (uint32_t i = 0; i < buffers.counts.indexCount; ++i) {
+        mesh.indices[i] = buffers.counts.indexSize == 2 ? reinterpret_cast<const uint16_t*>(buffers.indices.data())[i]
+                                                        : reinterpret_cast<const uint32_t*>(buffers.indices.data())[i];
+    }
+    return mesh;
+}
 
-        4, 0, 3, /* left */
-        3, 5, 4,
+static mesh_io::StreamFormat streamFormat(const mesh_import::GpuMesh& gpu) {
+    const mesh_import::VertexStream& stream = gpu.streams.front();
+    mesh_io::StreamFormat format;
+    for (uint32_t i = 0; i < 3; ++i) {
+        format.formats[i] = stream.formats[i];
+        format.offsets[i] = stream.offsets[i];
+        format.positionMin[i] = gpu.positionMin[i];
+        format.positionExtent[i] = gpu.positionExtent[i];
+    }
+    return format;
+}
 
-        3, 2, 6, /* top */
-        6, 5, 3,
+/**
+ * Puts gpu and a sphere and a cylinder laid out the same way into one geometry pool. They all draw from its two
+ * buffers, each at its own baseVertex and first index, so switching meshes between draws binds nothing. Quantized
+ * shapes keep their own bounds, which go with each draw.
+ */
+bool Renderer::buildPoolMeshBuffers(const mesh_import::GpuMesh& gpu, const char* name) {
+    std::vector<mesh_import::GpuMesh> meshes;
+    meshes.push_back(gpu);
+    for (const mesh_import::ImportedMesh& shape : { generateShape(procedural::SphereDesc()), generateShape(procedural::CylinderDesc()) }) {
+        mesh_import::GpuMesh shapeGpu = mesh_import::buildGpuMesh(shape, gpu.layout, gpu.attributes);
+        if (shapeGpu.streams.front().stride != gpu.streams.front().stride || shapeGpu.indexSize > gpu.indexSize) {
+            continue;
+        }
+        if (shapeGpu.indexSize < gpu.indexSize) {
+            // The pool has one index size; widen to the 32 bits its first mesh needed.
+            shapeGpu.indexSize = gpu.indexSize;
+            shapeGpu.indices.resize(shape.indices.size() * sizeof(uint32_t));
+            memcpy(shapeGpu.indices.data(), shape.indices.data(), shapeGpu.indices.size());
+        }
+        meshes.push_back(std::move(shapeGpu));
+    }
+    
+    size_t vertexCapacity = 0;
+    size_t indexCapacity = 0;
+    for (const mesh_import::GpuMesh& mesh : meshes) {
+        vertexCapacity += mesh.vertexCount;
+        indexCapacity += mesh.indexCount;
+    }
+    _pGeometryBackend = new MetalGeometryBackend(_pDevice);
+    _pGeometryPool = new geometry_pool::GeometryPool(_pGeometryBackend, gpu.streams.front().stride, gpu.indexSize, static_cast<uint32_t>(vertexCapacity),
+                                                     static_cast<uint32_t>(indexCapacity), kMaxFramesInFlight);
+    // Added last, the first mesh sits on top of the streams: if it drops its finest LOD, compaction can move the rest of
+    // it down into the hole and the pool shrinks.
+    for (auto it = meshes.rbegin(); it != meshes.rend(); ++it) {
+        const mesh_import::GpuMesh& mesh = *it;
+        const geometry_pool::MeshHandle handle = _pGeometryPool->addMesh(mesh.streams.front().bytes.data(), static_cast<uint32_t>(mesh.vertexCount),
+                                                                         mesh.indices.data(), static_cast<uint32_t>(mesh.indexCount));
+        if (handle == geometry_pool::kInvalidMesh) {
+            __builtin_printf("Geometry pool has no room for %s\n", name);
+            _poolMeshes.clear();
+            delete _pGeometryPool;
+            delete _pGeometryBackend;
+            _pGeometryPool = nullptr;
+            _pGeometryBackend = nullptr;
+            return false;
+        }
+        shader_types::VertexQuantization quantization;
+        quantization.positionMin = simd_make_float3(mesh.positionMin[0], mesh.positionMin[1], mesh.positionMin[2]);
+        quantization.positionExtent = simd_make_float3(mesh.positionExtent[0], mesh.positionExtent[1], mesh.positionExtent[2]);
+        _poolMeshes.insert(_poolMeshes.begin(), { handle, quantization });
+    }
+    
+    _pVertexDataBuffer = _pGeometryBackend->vertexBuffer()->retain();
+    _pIndexBuffer = _pGeometryBackend->indexBuffer()->retain();
+    _vertexBufferOffset = 0;
+    _indexBufferOffset = 0;
+    _indexCount = gpu.indexCount;
+    _indexType = gpu.indexSize == 2 ? MTL::IndexType::IndexTypeUInt16 : MTL::IndexType::IndexTypeUInt32;
+    _lods = gpu.lods;
+    return true;
+}
 
-        4, 7, 1, /* bottom */
-        1, 0, 4
-    };
+/**
+ * Imports a source mesh into the geometry pool and writes it to cachePath, so later launches only map the cache.
+ */
+bool Renderer::buildImportedMeshBuffers(const char* path, const char* cachePath, uint64_t sourceHash) {
+    mesh_import::ImportedMesh mesh;
+    std::string error;
+    if (!mesh_import::importMesh(path, mesh, {}, &error)) {
+        __builtin_printf("Mesh import failed for %s: %s\n", path, error.c_str());
+        return false;
+    }
+    
+    // Paid once: the result goes into the cache.
+    mesh_optimize::optimizeMesh(mesh);
     
-    const size_t vertexDataSize = sizeof(verts);
-    const size_t indexDataSize = sizeof(indices);
+    // 8 bytes of position and 4 of normal a vertex instead of VertexData's 16, and lit; a mesh without normals
+    // keeps only the position.
+    mesh_import::GpuMesh gpu = mesh_import::buildGpuMesh(mesh, mesh_import::StreamLayout::Quantized, mesh_import::kPositionBit | mesh_import::kNormalBit);
+    gpu.meshlets = meshlet_builder::buildMeshlets(mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float));
+    mesh_import::setLodChain(gpu, mesh_simplify::buildLodChain(mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float)));
     
-    MTL::Buffer* pVertexBuffer = _pDevice->newBuffer(vertexDataSize, MTL::ResourceStorageModeShared);
-    MTL::Buffer* pIndexBuffer = _pDevice->newBuffer(indexDataSize, MTL::ResourceStorageModeShared);
+    if (!mesh_import::writeMeshFile(cachePath, gpu, sourceHash, &error)) {
+        __builtin_printf("Mesh cache not written: %s\n", error.c_str());
+    }
     
-    _pVertexDataBuffer = pVertexBuffer;
-    _pIndexBuffer = pIndexBuffer;
+    return setVertexFormat(streamFormat(gpu), gpu.streams.front().stride, path) && buildPoolMeshBuffers(gpu, path);
+}
+
+/**
+ * The last resort, a unit cube with a vertex per face corner, read as VertexData by vertexMain.
+ */
+bool Renderer::buildCubeBuffers() {
+    const mesh_import::GpuMesh gpu = mesh_import::buildGpuMesh(generateShape(procedural::BoxDesc()), mesh_import::StreamLayout::Interleaved, mesh_import::kPositionBit);
+    return setVertexFormat(streamFormat(gpu), gpu.streams.front().stride, "cube") && buildPoolMeshBuffers(gpu, "cube");
+}
+
+/**
+ * A mesh file in the bundle maps straight into a buffer. Otherwise a source mesh is imported once and cached,
+ * keyed by its size and modification time; the cube is the last resort.
+ */
+bool Renderer::buildSourceMeshBuffers(const std::string& resources) {
+    if (buildMappedMeshBuffers((resources + "/mesh.lmsh").c_str())) {
+        return true;
+    }
+    
+    const std::string cachePath = std::string(getenv("HOME")) + "/Library/Caches/mesh.lmsh";
+    for (const char* name : { "/mesh.glb", "/mesh.obj" }) {
+        const std::string sourcePath = resources + name;
+        const uint64_t stamp = mesh_io::fileStamp(sourcePath.c_str());
+        if (stamp == 0) {
+            continue;
+        }
+        if (buildMappedMeshBuffers(cachePath.c_str(), stamp) || buildImportedMeshBuffers(sourcePath.c_str(), cachePath.c_str(), stamp)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Renderer::buildBuffers() {
+    if (!buildSourceMeshBuffers(NS::Bundle::mainBundle()->resourcePath()->utf8String()) && !buildCubeBuffers()) {
+        __builtin_printf("No mesh to draw\n");
+        assert(false);
+    }
     
-    memcpy(_pVertexDataBuffer->contents(), verts, vertexDataSize);
-    memcpy(_pIndexBuffer->contents(), indices, indexDataSize);
+    _indexAllocation = 0;
+    if (_pGeometryPool) {
+        // The second eviction tier: the mesh gives up its finest LOD level.
+        _geometryAllocation = _memoryBudget.track(memory_budget::Category::VertexData, _pGeometryBackend->allocatedSize(), "geometry pool", 0,
+                                                  [this](memory_budget::EvictionAction action) -> uint64_t {
+            return action == memory_budget::EvictionAction::DropLod ? dropFinestLod() : 0;
+        });
+    } else {
+        _geometryAllocation = trackResource(_pVertexDataBuffer, memory_budget::Category::VertexData, "vertices");
+        if (_pIndexBuffer != _pVertexDataBuffer) {
+            _indexAllocation = trackResource(_pIndexBuffer, memory_budget::Category::IndexData, "indices");
+        }
+    }
     
     const size_t instanceDataSize = kMaxFramesInFlight * kNumInstances * sizeof(shader_types::InstanceData);
     
     for (size_t i = 0; i < kMaxFramesInFlight; ++i) {
         _pInstanceDataBuffer[i] = _pDevice->newBuffer(instanceDataSize, MTL::ResourceStorageModeShared);
+        _instanceAllocations[i] = trackResource(_pInstanceDataBuffer[i], memory_budget::Category::Uniforms, "instances");
     }
     
     const size_t cameraDataSize = kMaxFramesInFlight * sizeof(shader_types::CameraData);
     for (size_t i = 0; i < kMaxFramesInFlight; ++i) {
         _pCameraDataBuffer[i] = _pDevice->newBuffer(cameraDataSize, MTL::ResourceStorageModeShared);
+        _cameraAllocations[i] = trackResource(_pCameraDataBuffer[i], memory_budget::Category::Uniforms, "camera");
+    }
+}
+
+/**
+ * Releases ranges no frame in flight can read any more and compacts a little. Growing or shrinking replaces the
+ * buffers, so the bindings are refreshed afterwards; the ones they replace stay alive while frames in flight use
+ * them. Moves change the meshes' ranges, which draw() looks up.
+ */
+void Renderer::updateGeometryPool() {
+    _pGeometryPool->advanceFrame();
+    const size_t moved = _pGeometryPool->compact(kGeometryCompactBytesPerFrame);
+    if (_geometryShrinkPending && moved == 0) {
+        const geometry_pool::PoolStats stats = _pGeometryPool->stats();
+        if (stats.pending[0] == 0 && stats.pending[1] == 0) {
+            _pGeometryPool->shrinkToFit();
+            _geometryShrinkPending = false;
+        }
+    }
+    bool replaced = false;
+    if (_pVertexDataBuffer != _pGeometryBackend->vertexBuffer()) {
+        _pVertexDataBuffer->release();
+        _pVertexDataBuffer = _pGeometryBackend->vertexBuffer()->retain();
+        replaced = true;
+    }
+    if (_pIndexBuffer != _pGeometryBackend->indexBuffer()) {
+        _pIndexBuffer->release();
+        _pIndexBuffer = _pGeometryBackend->indexBuffer()->retain();
+        replaced = true;
+    }
+    // Only when the size really changed: a dropped LOD already counts as released until the shrink catches up.
+    if (replaced) {
+        _memoryBudget.resize(_geometryAllocation, _pGeometryBackend->allocatedSize());
+    }
+}
+
+/**
+ * Eviction: the first pooled mesh stops drawing its finest LOD level, which leads its indices, and the pool retires
+ * them. They count as released at once; the memory itself goes back when updateGeometryPool shrinks the pool, after
+ * the frames in flight that may still draw them and once compaction has moved the rest of the mesh down.
+ */
+uint64_t Renderer::dropFinestLod() {
+    if (_lods.size() < 2 || _poolMeshes.empty()) {
+        return 0;
+    }
+    const geometry_pool::MeshRange& range = _pGeometryPool->range(_poolMeshes.front().handle);
+    const uint32_t dropped = _lods[1].firstIndex;
+    _pGeometryPool->trimIndices(_poolMeshes.front().handle, dropped, range.indexCount - dropped);
+    _lods.erase(_lods.begin());
+    for (mesh_simplify::LodLevel& level : _lods) {
+        level.firstIndex -= dropped;
+    }
+    _geometryShrinkPending = true;
+#if DEBUG
+    __builtin_printf("Over budget: dropped the finest mesh LOD, %u indices\n", dropped);
+#endif
+    return uint64_t(dropped) * _pGeometryPool->indexSize();
+}
+
+/**
+ * LM_TERRAIN=1 adds a quadtree terrain in front of and below the instances, LM_TERRAIN=2 the same terrain as tessellated
+ * patches. Its heightmap goes up through the upload queue a band of rows at a time, within the per frame budget; the
+ * terrain is drawn once every band has completed.
+ */
+void Renderer::buildTerrain() {
+    const char* pTerrain = getenv("LM_TERRAIN");
+    _terrainMode = pTerrain ? static_cast<uint32_t>(atoi(pTerrain)) : 0;
+    if (_terrainMode != 1 && _terrainMode != 2) {
+        _terrainMode = 0;
+        return;
+    }
+    
+    terrain::TerrainDesc desc;
+    desc.tileCells = kTerrainTileCells;
+    desc.levels = kTerrainLevels;
+    desc.spacing = 0.25f;
+    const uint32_t resolution = terrain::heightmapResolution(desc);
+    const float size = static_cast<float>(resolution - 1) * desc.spacing;
+    desc.origin[0] = -0.5f * size;
+    desc.origin[1] = -6.0f;
+    desc.origin[2] = -size - 2.0f;
+    
+    // The procedural grids' noise, sampled once per heightmap texel.
+    procedural::GridDesc grid;
+    grid.extent[0] = grid.extent[1] = size;
+    grid.heightScale = 4.0f;
+    grid.frequency = 6.0f;
+    std::vector<float> heights(size_t(resolution) * resolution);
+    for (uint32_t row = 0; row < resolution; ++row) {
+        for (uint32_t column = 0; column < resolution; ++column) {
+            heights[size_t(row) * resolution + column] = procedural::heightAt(grid, column * desc.spacing - 0.5f * size, row * desc.spacing - 0.5f * size);
+        }
+    }
+    
+    MTL::TextureDescriptor* pTextureDesc = MTL::TextureDescriptor::alloc()->init();
+    pTextureDesc->setPixelFormat(MTL::PixelFormatR32Float);
+    pTextureDesc->setWidth(resolution);
+    pTextureDesc->setHeight(resolution);
+    pTextureDesc->setStorageMode(MTL::StorageModePrivate);
+    pTextureDesc->setUsage(MTL::TextureUsageShaderRead);
+    _pTerrainHeightmap = _pDevice->newTexture(pTextureDesc);
+    pTextureDesc->release();
+    _terrainHeightmapAllocation = trackResource(_pTerrainHeightmap, memory_budget::Category::Texture, "terrain heightmap");
+    
+    const uint32_t bytesPerRow = resolution * sizeof(float);
+    const uint32_t rowsPerBand = std::max<uint32_t>(1, static_cast<uint32_t>(kUploadBytesPerFrame / bytesPerRow));
+    std::atomic<uint32_t>* pPending = &_terrainBandsPending;
+    _terrainBandsPending = (resolution + rowsPerBand - 1) / rowsPerBand;
+    for (uint32_t row = 0; row < resolution; row += rowsPerBand) {
+        upload::TextureRegion region;
+        region.y = row;
+        region.width = resolution;
+        region.height = std::min(rowsPerBand, resolution - row);
+        region.bytesPerRow = bytesPerRow;
+        region.bytesPerImage = bytesPerRow * region.height;
+        const uint8_t* pBand = reinterpret_cast<const uint8_t*>(heights.data() + size_t(row) * resolution);
+        _pUploadQueue->uploadTexture(_pTerrainHeightmap, region, std::vector<uint8_t>(pBand, pBand + region.bytesPerImage), upload::Priority::Normal,
+                                     [pPending](upload::UploadId) { pPending->fetch_sub(1); });
+    }
+    
+    _terrainKey.fragmentFunction = "fragmentMain";
+    _terrainKey.colorAttachments[0].pixelFormat = MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB;
+    _terrainKey.depthPixelFormat = MTL::PixelFormat::PixelFormatDepth16Unorm;
+    if (_terrainMode == 2) {
+        buildTessellatedTerrain(desc, heights);
+    } else {
+        _pTerrain = new terrain::Quadtree(desc, std::move(heights));
+        
+        const terrain::TileMesh mesh = terrain::buildTileMesh(desc.tileCells);
+        std::copy(std::begin(mesh.variants), std::end(mesh.variants), _terrainVariants);
+        _terrainIndexOffset = (mesh.vertices.size() * sizeof(uint16_t) + 255) / 256 * 256;
+        
+        // A frame selects at most every leaf.
+        const size_t tileBufferSize = (size_t(1) << (2 * (desc.levels - 1))) * sizeof(shader_types::TerrainTile);
+        for (size_t i = 0; i < kMaxFramesInFlight; ++i) {
+            _pTerrainTileBuffer[i] = _pDevice->newBuffer(tileBufferSize, MTL::ResourceStorageModeShared);
+            trackResource(_pTerrainTileBuffer[i], memory_budget::Category::Uniforms, "terrain tiles");
+        }
+        _terrainKey.vertexFunction = "vertexTerrain";
+        __builtin_printf("Terrain %ux%u, %zu quadtree nodes, %u uploads\n", resolution, resolution, _pTerrain->nodeCount(), _terrainBandsPending.load());
+    }
+    _pPipelineCache->request(_terrainKey, pipeline_cache::CompilePriority::Background);
+}
+
+/**
+ * The tessellated terrain keeps no vertices: vertexTessellatedTerrain displaces the tessellator's output by the
+ * heightmap, and computeTessellationFactors decides every frame how finely each patch is cut, culling with the patch
+ * height bounds computed here.
+ */
+void Renderer::buildTessellatedTerrain(const terrain::TerrainDesc& desc, const std::vector<float>& heights) {
+    _terrainPatches.samplesPerPatch = kTerrainPatchCells;
+    _terrainPatches.patchesPerSide = (terrain::heightmapResolution(desc) - 1) / kTerrainPatchCells;
+    _terrainPatches.spacing = desc.spacing;
+    std::copy(std::begin(desc.origin), std::end(desc.origin), _terrainPatches.origin);
+    const size_t patchCount = size_t(_terrainPatches.patchesPerSide) * _terrainPatches.patchesPerSide;
+    
+    _pPatchBoundsBuffer = _pDevice->newBuffer(patchCount * 2 * sizeof(float), MTL::ResourceStorageModeShared);
+    tessellation::computeHeightBounds(_terrainPatches, heights.data(), reinterpret_cast<float*>(_pPatchBoundsBuffer->contents()));
+    trackResource(_pPatchBoundsBuffer, memory_budget::Category::VertexData, "terrain patch bounds");
+    for (size_t i = 0; i < kMaxFramesInFlight; ++i) {
+        _pTessellationFactorBuffer[i] = _pDevice->newBuffer(patchCount * sizeof(MTL::QuadTessellationFactorsHalf), MTL::ResourceStorageModePrivate);
+        trackResource(_pTessellationFactorBuffer[i], memory_budget::Category::Uniforms, "tessellation factors");
+    }
+    
+    _tessellationParams.origin = { desc.origin[0], desc.origin[1], desc.origin[2] };
+    _tessellationParams.edgePixels = kTerrainEdgePixels;
+    _tessellationParams.maxFactor = static_cast<float>(kTerrainMaxTessellationFactor);
+    _tessellationParams.spacing = desc.spacing;
+    _tessellationParams.patchesPerSide = _terrainPatches.patchesPerSide;
+    _tessellationParams.samplesPerPatch = _terrainPatches.samplesPerPatch;
+    
+    _pComputeKernels->prepare(kTessellationFactorsKernel);
+    _terrainKey.vertexFunction = "vertexTessellatedTerrain";
+    _terrainKey.maxTessellationFactor = kTerrainMaxTessellationFactor;
+    __builtin_printf("Terrain %ux%u, %zu tessellated patches, %u uploads\n", terrain::heightmapResolution(desc), terrain::heightmapResolution(desc), patchCount,
+                     _terrainBandsPending.load());
+}
+
+/**
+ * The tile mesh lives in the resource cache, counted in its budget allocation: while no terrain is drawn it goes
+ * volatile, and if the system reclaims it, it is rebuilt here, vertices then indices in one shared buffer.
+ */
+void* Renderer::generateTerrainMesh(void* pExisting) {
+    const terrain::TileMesh mesh = terrain::buildTileMesh(kTerrainTileCells);
+    MTL::Buffer* pBuffer = static_cast<MTL::Buffer*>(pExisting);
+    if (pBuffer == nullptr) {
+        pBuffer = _pDevice->newBuffer(_terrainIndexOffset + mesh.indices.size() * sizeof(uint16_t), MTL::ResourceStorageModeShared);
+    }
+    uint8_t* pContents = static_cast<uint8_t*>(pBuffer->contents());
+    memcpy(pContents, mesh.vertices.data(), mesh.vertices.size() * sizeof(uint16_t));
+    memcpy(pContents + _terrainIndexOffset, mesh.indices.data(), mesh.indices.size() * sizeof(uint16_t));
+    return pBuffer;
+}
+
+/**
+ * Selects this frame's tiles from the camera and draws them with one instanced draw per stitch variant. The tiles go
+ * into this frame's tile buffer grouped by variant, so each draw's base instance is its group's first tile.
+ */
+void Renderer::encodeTerrain(MTL::RenderCommandEncoder* pEnc, MTL::RenderPipelineState* pPSO, MTL::Buffer* pCameraDataBuffer, float viewportHeight) {
+    const shader_types::CameraData* pCameraData = reinterpret_cast<const shader_types::CameraData*>(pCameraDataBuffer->contents());
+    simd::float4 planes[6];
+    math_utils::makeFrustumPlanes(pCameraData->perspectiveTransform * pCameraData->worldTransform, planes);
+    const simd::float3 cameraPosition = simd_inverse(pCameraData->worldTransform).columns[3].xyz;
+    terrain::View view;
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            view.frustumPlanes[i][j] = planes[i][j];
+        }
+    }
+    for (int i = 0; i < 3; ++i) {
+        view.cameraPosition[i] = cameraPosition[i];
+    }
+    view.pixelsPerUnit = viewportHeight / (2.0f * tanf(45.f * M_PI / 360.f));
+    view.maxPixelError = kTerrainMaxPixelError;
+    _pTerrain->select(view, _terrainSelection);
+    
+    const terrain::TerrainDesc& desc = _pTerrain->desc();
+    const std::vector<terrain::Tile>& tiles = _terrainSelection.tiles();
+    shader_types::TerrainTile* pTiles = reinterpret_cast<shader_types::TerrainTile*>(_pTerrainTileBuffer[_frame]->contents());
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const uint32_t step = 1u << (desc.levels - 1 - tiles[i].level);
+        const uint32_t span = desc.tileCells * step;
+        pTiles[i] = { { tiles[i].x * span, tiles[i].z * span }, step, tiles[i].level };
+    }
+    const shader_types::TerrainDraw terrainDraw = { { desc.origin[0], desc.origin[1], desc.origin[2] }, desc.spacing, desc.levels };
+    
+    pEnc->setRenderPipelineState(pPSO);
+    pEnc->setDepthStencilState(_pDepthStencilState);
+    pEnc->setCullMode(MTL::CullModeBack);
+    pEnc->setFrontFacingWinding(MTL::Winding::WindingCounterClockwise);
+    // Released once encoded: the cache keeps it resident for the frames in flight that may still read it.
+    MTL::Buffer* pMesh = static_cast<MTL::Buffer*>(_pResourceCache->acquire(kTerrainMeshKey, [this](void* pExisting) { return generateTerrainMesh(pExisting); }));
+    _memoryBudget.touch(_resourceCacheAllocation, _frameIndex);
+    pEnc->setVertexBuffer(pMesh, 0, 0);
+    pEnc->setVertexBuffer(_pTerrainTileBuffer[_frame], 0, 1);
+    pEnc->setVertexBuffer(pCameraDataBuffer, 0, 2);
+    pEnc->setVertexBytes(&terrainDraw, sizeof(terrainDraw), 3);
+    pEnc->setVertexTexture(_pTerrainHeightmap, 0);
+    for (uint32_t mask = 0; mask < terrain::kStitchVariants; ++mask) {
+        const terrain::TileGroup& group = _terrainSelection.group(mask);
+        if (group.tileCount > 0) {
+            const terrain::IndexRange& range = _terrainVariants[mask];
+            pEnc->drawIndexedPrimitives(MTL::PrimitiveType::PrimitiveTypeTriangle, range.indexCount, MTL::IndexType::IndexTypeUInt16, pMesh,
+                                        _terrainIndexOffset + range.firstIndex * sizeof(uint16_t), group.tileCount, 0, group.firstTile);
+        }
+    }
+    _pResourceCache->release(kTerrainMeshKey);
+}
+
+/**
+ * Writes this frame's tessellation factors on the GPU, in a command buffer of its own committed ahead of the render
+ * pass that tessellates with them, and timed for the threadgroup tuner like the instance animation. Returns false,
+ * having encoded nothing, while the kernel is still compiling.
+ */
+bool Renderer::encodeTessellationFactors(MTL::Buffer* pCameraDataBuffer, float viewportHeight) {
+    if (_pComputeKernels->pipeline(kTessellationFactorsKernel) == nullptr) {
+        return false;
+    }
+    
+    const shader_types::CameraData* pCameraData = reinterpret_cast<const shader_types::CameraData*>(pCameraDataBuffer->contents());
+    math_utils::makeFrustumPlanes(pCameraData->perspectiveTransform * pCameraData->worldTransform, _tessellationParams.frustumPlanes);
+    _tessellationParams.cameraPosition = simd_inverse(pCameraData->worldTransform).columns[3].xyz;
+    _tessellationParams.pixelsPerUnit = viewportHeight / (2.0f * tanf(45.f * M_PI / 360.f));
+    
+    MTL::CommandBuffer* pCmd = _pCommandQueue->commandBuffer();
+    MTL::ComputeCommandEncoder* pEnc = pCmd->computeCommandEncoder();
+    pEnc->setBuffer(_pTessellationFactorBuffer[_frame], 0, 0);
+    pEnc->setBuffer(_pPatchBoundsBuffer, 0, 1);
+    pEnc->setBytes(&_tessellationParams, sizeof(_tessellationParams), 2);
+    pEnc->setTexture(_pTerrainHeightmap, 0);
+    const uint32_t gridSize = _terrainPatches.patchesPerSide * _terrainPatches.patchesPerSide;
+    const uint32_t width = _pComputeKernels->dispatch(pEnc, kTessellationFactorsKernel, gridSize);
+    pEnc->endEncoding();
+    
+    _pComputeKernels->timeDispatch(pCmd, kTessellationFactorsKernel, gridSize, width);
+    pCmd->commit();
+    return true;
+}
+
+/**
+ * One patch per heightmap patch, without control points; patches the factor pass culled have zero factors and
+ * produce nothing.
+ */
+void Renderer::encodeTessellatedTerrain(MTL::RenderCommandEncoder* pEnc, MTL::RenderPipelineState* pPSO, MTL::Buffer* pCameraDataBuffer) {
+    pEnc->setRenderPipelineState(pPSO);
+    pEnc->setDepthStencilState(_pDepthStencilState);
+    // The tessellator's winding follows the patch's u and v, not the surface's facing.
+    pEnc->setCullMode(MTL::CullModeNone);
+    pEnc->setTessellationFactorBuffer(_pTessellationFactorBuffer[_frame], 0, 0);
+    pEnc->setVertexBuffer(pCameraDataBuffer, 0, 2);
+    pEnc->setVertexBytes(&_tessellationParams, sizeof(_tessellationParams), 3);
+    pEnc->setVertexTexture(_pTerrainHeightmap, 0);
+    pEnc->drawPatches(0, 0, _terrainPatches.patchesPerSide * _terrainPatches.patchesPerSide, nullptr, 0, 1, 0);
+}
+
+/**
+ * Writes this frame's packed instance data on the GPU, in a command buffer of its own: it is committed ahead of the
+ * frame's render commands, so the queue orders it before the draw, and its GPU time is the dispatch alone, which is
+ * what the threadgroup tuner needs. Returns false, having encoded nothing, while the kernel is still compiling.
+ */
+bool Renderer::encodeInstanceAnimation(MTL::Buffer* pInstanceDataBuffer) {
+    if (_pComputeKernels->pipeline(kAnimateInstancesKernel) == nullptr) {
+        return false;
     }
+    
+    const shader_types::InstanceAnimation animation = { { 0.0f, 0.0f, -5.0f }, _angle, 0.1f, static_cast<uint32_t>(kNumInstances) };
+    MTL::CommandBuffer* pCmd = _pCommandQueue->commandBuffer();
+    MTL::ComputeCommandEncoder* pEnc = pCmd->computeCommandEncoder();
+    pEnc->setBuffer(pInstanceDataBuffer, 0, 0);
+    pEnc->setBytes(&animation, sizeof(animation), 1);
+    const uint32_t width = _pComputeKernels->dispatch(pEnc, kAnimateInstancesKernel, animation.instanceCount);
+    pEnc->endEncoding();
+    
+    _pComputeKernels->timeDispatch(pCmd, kAnimateInstancesKernel, animation.instanceCount, width);
+    pCmd->commit();
+    return true;
 }
 
 void Renderer::draw(MTK::View *pView) {
@@ -186,14 +1112,76 @@ void Renderer::draw(MTK::View *pView) {
     
     NS::AutoreleasePool* pPool = NS::AutoreleasePool::alloc()->init();
     
+    // A zero-sized drawable, e.g. mid-layout, has nothing to plan or draw into; skipped before the frame slot advances,
+    // so the slots stay in step with the semaphore.
+    MTL::RenderPassDescriptor* pRpd = pView->currentRenderPassDescriptor();
+    const uint32_t width = static_cast<uint32_t>(pView->drawableSize().width);
+    const uint32_t height = static_cast<uint32_t>(pView->drawableSize().height);
+    if (pRpd == nullptr || width == 0 || height == 0) {
+        pPool->release();
+        return;
+    }
+    
     _frame = (_frame + 1) % Renderer::kMaxFramesInFlight;
+    _pResourceCache->tick(++_frameIndex);
+    _memoryBudget.resize(_resourceCacheAllocation, _pResourceCache->residentBytes());
+    _memoryBudget.enforce(_frameIndex);
+    _pUploadQueue->flush();
+    if (_pGeometryPool) {
+        updateGeometryPool();
+    }
+    applyShaderReloads();
+    _pPipelineCache->beginFrame();
+    if (_pPipelineCache->pendingCount() == 0) {
+        _pPipelineCompiler->serialize(); // no-op unless a compile added to the archive
+        _pPipelineRecorder->saveIfChanged(_pipelineRecordingPath.c_str());
+        _pComputeKernels->saveTuningIfChanged();
+    }
+    if (_periodicReports && _frameIndex % kVariantReportInterval == 0) {
+        _pVariantPipelines->stats().printReport(_variantSpace, _frameIndex, kVariantReportInterval);
+        _pComputeKernels->printTuningReport();
+        _pResourceCache->printStats();
+    }
     MTL::Buffer* pInstanceDataBuffer = _pInstanceDataBuffer[_frame];
     
+    const std::chrono::steady_clock::time_point drawTime = std::chrono::steady_clock::now();
+    const double frameMilliseconds = std::chrono::duration<double, std::milli>(drawTime - _lastDrawTime).count();
+    _lastDrawTime = drawTime;
+    if (_profileBenchmarkRunning) {
+        _frameProfile = _pProfileBenchmark->activeProfile();
+        if (_pProfileBenchmark->isFinished()) {
+            // The benchmark may still be referenced by frames in flight, so it is freed with the renderer.
+            _pProfileBenchmark->printReport(_compileProfiles);
+            _profileBenchmarkRunning = false;
+        }
+    }
+    // No fallback pipeline fits this vertex layout, so until the PSO is ready the pass only clears.
+    MTL::RenderPipelineState* pPSO = _pVariantPipelines->resolve(_variant, _frameIndex);
+    if (pPSO && _materialIndex >= 0) {
+        // The plain pipeline stands in while the material pipeline compiles.
+        pPSO = _pPipelineCache->resolve(_materialKeys[_materialIndex], pPSO);
+    }
     
     MTL::CommandBuffer* pCmd = _pCommandQueue->commandBuffer(); // encode commands for execution by the GPU
     dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER); // Force CPU to wait if the GPU hasn't finished reading from the next buffer in the cycle
     Renderer* pRenderer = this;
-    pCmd->addCompletedHandler([pRenderer](MTL::CommandBuffer* pCmd) {
+    // The first frame may only clear while the pipeline compiles; startup is measured to the first one that draws.
+    const bool isFirstClear = _frameIndex == 1;
+    const bool isFirstFrame = pPSO && !_firstFrameDrawn;
+    _firstFrameDrawn = _firstFrameDrawn || pPSO;
+    compile_profile::FrameTimeBenchmark* pBenchmark = pPSO && _profileBenchmarkRunning ? _pProfileBenchmark : nullptr;
+    const uint32_t frameProfile = _frameProfile;
+    pCmd->addCompletedHandler([pRenderer, isFirstClear, isFirstFrame, pBenchmark, frameProfile, frameMilliseconds](MTL::CommandBuffer* pCmd) {
+        if (isFirstClear) {
+            startup_probe::mark("first-clear");
+        }
+        if (isFirstFrame) {
+            startup_probe::mark("first-frame");
+            startup_probe::report();
+        }
+        if (pBenchmark) {
+            pBenchmark->recordFrame(frameProfile, (pCmd->GPUEndTime() - pCmd->GPUStartTime()) * 1000.0, frameMilliseconds);
+        }
         dispatch_semaphore_signal(pRenderer->_semaphore);
     });
     
@@ -201,6 +1189,10 @@ void Renderer::draw(MTK::View *pView) {
     
     const float scl = 0.1f;
     shader_types::InstanceData* pInstanceData = reinterpret_cast<shader_types::InstanceData *>(pInstanceDataBuffer->contents());
+    shader_types::PackedInstanceData* pPackedData = reinterpret_cast<shader_types::PackedInstanceData *>(pInstanceDataBuffer->contents());
+    const bool isPacked = _variantSpace.value(_variant, _instanceFormatFeature) == 1;
+    // The kernel only writes the packed layout.
+    const bool animatedOnGpu = isPacked && encodeInstanceAnimation(pInstanceDataBuffer);
     
     float3 objectPosition = { 0.0f, 0.0f, -5.0f };
     
@@ -210,7 +1202,7 @@ void Renderer::draw(MTK::View *pView) {
     float4x4 rtInv = math_utils::makeTranslate({ -objectPosition.x, -objectPosition.y, -objectPosition.z });
     float4x4 fullObjectRot = rt * rr * rtInv;
     
-    for (size_t i = 0; i < kNumInstances; ++i) {
+    for (size_t i = 0; i < kNumInstances && !animatedOnGpu; ++i) {
         float iDivNumInstances = i / static_cast<float>(kNumInstances);
         float xoff = (iDivNumInstances * 2.0f - 1.0f) + (1.f / kNumInstances);
         float yoff = sin((iDivNumInstances + _angle) * 2.0f * M_PI);
@@ -221,11 +1213,19 @@ void Renderer::draw(MTK::View *pView) {
         float4x4 yrot = math_utils::makeYRotate(_angle);
         float4x4 translate = math_utils::makeTranslate(math_utils::add(objectPosition, { xoff, yoff, 0.f }));
         
-        pInstanceData[i].instanceTransform = fullObjectRot * translate * yrot * zrot * scale;
+        float4x4 instanceTransform = fullObjectRot * translate * yrot * zrot * scale;
         float r = iDivNumInstances;
         float g = 1.0f - r;
         float b = sinf(M_PI * 2.0f * iDivNumInstances);
-        pInstanceData[i].instanceColor = { r, g, b, 1.0f };
+        if (isPacked) {
+            for (int row = 0; row < 3; ++row) {
+                pPackedData[i].transformRows[row] = { instanceTransform.columns[0][row], instanceTransform.columns[1][row], instanceTransform.columns[2][row], instanceTransform.columns[3][row] };
+            }
+            pPackedData[i].instanceColor = { r, g, b, 1.0f };
+        } else {
+            pInstanceData[i].instanceTransform = instanceTransform;
+            pInstanceData[i].instanceColor = { r, g, b, 1.0f };
+        }
     }
     
     // Update camera state
@@ -234,21 +1234,112 @@ void Renderer::draw(MTK::View *pView) {
     pCameraData->perspectiveTransform = math_utils::makePerspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f);
     pCameraData->worldTransform = math_utils::makeIdentity();
     
+    // The terrain waits for its heightmap and pipeline; tessellated, also for this frame's factors, which have to be
+    // committed before the render pass that reads them.
+    MTL::RenderPipelineState* pTerrainPSO = nullptr;
+    if (_terrainMode != 0 && _terrainBandsPending.load() == 0) {
+        pTerrainPSO = _pPipelineCache->resolve(_terrainKey, nullptr);
+        if (pTerrainPSO && _terrainMode == 2 && !encodeTessellationFactors(pCameraDataBuffer, pView->drawableSize().height)) {
+            pTerrainPSO = nullptr;
+        }
+    }
+    
     // Begin render pass
-    MTL::RenderPassDescriptor* pRpd = pView->currentRenderPassDescriptor();
+    if (width != _transientWidth || height != _transientHeight) {
+        buildTransientTargets(width, height);
+    }
+    MTL::RenderPassDepthAttachmentDescriptor* pDepthAttachment = pRpd->depthAttachment();
+    pDepthAttachment->setTexture(_pTransientHeap->texture(_depthTarget));
+    pDepthAttachment->setLoadAction(MTL::LoadActionClear);
+    pDepthAttachment->setStoreAction(MTL::StoreActionDontCare);
+    pDepthAttachment->setClearDepth(1.0);
     MTL::RenderCommandEncoder* pEnc = pCmd->renderCommandEncoder(pRpd);
     
-    pEnc->setRenderPipelineState(_pPSO); // Bind pipeline info
-    pEnc->setDepthStencilState(_pDepthStencilState);
-    
-    pEnc->setVertexBuffer(_pVertexDataBuffer, 0, 0);
-    pEnc->setVertexBuffer(pInstanceDataBuffer, 0, 1);
-    pEnc->setVertexBuffer(pCameraDataBuffer, 0, 2);
-    
-    pEnc->setCullMode(MTL::CullModeBack);
-    pEnc->setFrontFacingWinding(MTL::Winding::WindingCounterClockwise);
+    if (pPSO || pTerrainPSO) {
+        _memoryBudget.touch(_cameraAllocations[_frame], _frameIndex);
+    }
+    if (pPSO) {
+        _memoryBudget.touch(_geometryAllocation, _frameIndex);
+        _memoryBudget.touch(_indexAllocation, _frameIndex);
+        _memoryBudget.touch(_instanceAllocations[_frame], _frameIndex);
+        pEnc->setRenderPipelineState(pPSO); // Bind pipeline info
+        pEnc->setDepthStencilState(_pDepthStencilState);
+        
+        pEnc->setFragmentBytes(&kMaterialTint, sizeof(kMaterialTint), 0);
+        
+        pEnc->setCullMode(MTL::CullModeBack);
+        pEnc->setFrontFacingWinding(MTL::Winding::WindingCounterClockwise);
+        
+        if (_variantSpace.value(_variant, _geometryFeature) != 0) {
+            // One object threadgroup per 32 meshlets of an instance; the survivors each get a mesh threadgroup.
+            shader_types::MeshletDraw meshletDraw;
+            math_utils::makeFrustumPlanes(pCameraData->perspectiveTransform * pCameraData->worldTransform, meshletDraw.frustumPlanes);
+            meshletDraw.cameraPosition = simd_inverse(pCameraData->worldTransform).columns[3].xyz;
+            meshletDraw.meshletCount = _meshletCount;
+            meshletDraw.vertexStride = _vertexStride;
+            meshletDraw.normalOffset = _vertexNormalOffset;
+            
+            pEnc->setObjectBuffer(pInstanceDataBuffer, 0, 1);
+            pEnc->setObjectBuffer(_pVertexDataBuffer, _meshletBufferOffsets[0], 4);
+            pEnc->setObjectBytes(&meshletDraw, sizeof(meshletDraw), 7);
+            pEnc->setMeshBuffer(_pVertexDataBuffer, _vertexBufferOffset, 0);
+            pEnc->setMeshBuffer(pInstanceDataBuffer, 0, 1);
+            pEnc->setMeshBuffer(pCameraDataBuffer, 0, 2);
+            pEnc->setMeshBytes(&_vertexQuantization, sizeof(_vertexQuantization), 3);
+            for (NS::UInteger i = 0; i < 3; ++i) {
+                pEnc->setMeshBuffer(_pVertexDataBuffer, _meshletBufferOffsets[i], 4 + i);
+            }
+            pEnc->setMeshBytes(&meshletDraw, sizeof(meshletDraw), 7);
+            
+            const MTL::Size grid((_meshletCount + kMeshletsPerObjectThreadgroup - 1) / kMeshletsPerObjectThreadgroup, kNumInstances, 1);
+            pEnc->drawMeshThreadgroups(grid, MTL::Size(kMeshletsPerObjectThreadgroup, 1, 1), MTL::Size(kMeshletThreads, 1, 1));
+        } else {
+            pEnc->setVertexBuffer(_pVertexDataBuffer, _vertexBufferOffset, 0);
+            pEnc->setVertexBuffer(pInstanceDataBuffer, 0, 1);
+            pEnc->setVertexBuffer(pCameraDataBuffer, 0, 2);
+            
+            // The coarsest level whose error stays under a pixel at the instances' distance; their scale shrinks it.
+            const NS::UInteger indexSize = _indexType == MTL::IndexType::IndexTypeUInt16 ? 2 : 4;
+            const mesh_simplify::LodLevel* pLevel = nullptr;
+            if (!_lods.empty()) {
+                const float pixelsPerUnit = pView->drawableSize().height / (2.0f * tanf(45.f * M_PI / 360.f));
+                const float distance = simd_length(objectPosition) / scl;
+                pLevel = &_lods[mesh_simplify::selectLod(_lods.data(), _lods.size(), distance, pixelsPerUnit)];
+            }
+            if (_poolMeshes.empty()) {
+                if (_vertexFormat != 0) {
+                    pEnc->setVertexBytes(&_vertexQuantization, sizeof(_vertexQuantization), 3);
+                }
+                const NS::UInteger indexOffset = _indexBufferOffset + (pLevel ? pLevel->firstIndex * indexSize : 0);
+                pEnc->drawIndexedPrimitives(MTL::PrimitiveType::PrimitiveTypeTriangle, pLevel ? pLevel->indexCount : _indexCount, _indexType, _pIndexBuffer,
+                                            indexOffset, kNumInstances);
+            } else {
+                // Each pooled mesh draws a run of the instances from the same bindings; baseVertex is its place in the
+                // pool, so its indices stay relative to its first vertex. The lods are the first mesh's.
+                for (size_t i = 0; i < _poolMeshes.size(); ++i) {
+                    const geometry_pool::MeshRange& range = _pGeometryPool->range(_poolMeshes[i].handle);
+                    const bool lod = i == 0 && pLevel;
+                    const NS::UInteger firstIndex = range.firstIndex + (lod ? pLevel->firstIndex : 0);
+                    const NS::UInteger firstInstance = kNumInstances * i / _poolMeshes.size();
+                    const NS::UInteger instanceCount = kNumInstances * (i + 1) / _poolMeshes.size() - firstInstance;
+                    if (_vertexFormat != 0) {
+                        pEnc->setVertexBytes(&_poolMeshes[i].quantization, sizeof(_poolMeshes[i].quantization), 3);
+                    }
+                    pEnc->drawIndexedPrimitives(MTL::PrimitiveType::PrimitiveTypeTriangle, lod ? pLevel->indexCount : range.indexCount, _indexType, _pIndexBuffer,
+                                                firstIndex * indexSize, instanceCount, range.baseVertex, firstInstance);
+                }
+            }
+        }
+    }
     
-    pEnc->drawIndexedPrimitives(MTL::PrimitiveType::PrimitiveTypeTriangle, 6 * 6, MTL::IndexType::IndexTypeUInt16, _pIndexBuffer, 0, kNumInstances);
+    if (pTerrainPSO) {
+        _memoryBudget.touch(_terrainHeightmapAllocation, _frameIndex);
+    }
+    if (pTerrainPSO && _terrainMode == 1) {
+        encodeTerrain(pEnc, pTerrainPSO, pCameraDataBuffer, pView->drawableSize().height);
+    } else if (pTerrainPSO) {
+        encodeTessellatedTerrain(pEnc, pTerrainPSO, pCameraDataBuffer);
+    }
     
     pEnc->endEncoding();
     pCmd->presentDrawable(pView->currentDrawable()); // Present the current drawable
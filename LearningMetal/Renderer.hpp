@@ -11,9 +11,57 @@
 #include <Metal/Metal.hpp>
 #include <MetalKit/MetalKit.hpp>
 #include <simd/simd.h>
+#include <atomic>
+#include <chrono>
+#include "AsyncPipelineCache.hpp"
+#include "CompileProfile.hpp"
+#include "GeometryPool.hpp"
+#include "MappedMesh.hpp"
+#include "MaterialGraph.hpp"
+#include "MemoryBudget.hpp"
+#include "MeshImport.hpp"
+#include "MeshOptimizer.hpp"
+#include "MetalBlitBackend.hpp"
+#include "MetalComputeKernels.hpp"
+#include "MetalGeometryBackend.hpp"
+#include "MetalMaterialStitcher.hpp"
+#include "MetalPipelineCompiler.hpp"
+#include "MetalPurgeableBackend.hpp"
+#include "PipelineCache.hpp"
+#include "PipelineRecorder.hpp"
+#include "ResourceCache.hpp"
+#include "ShaderHotReload.hpp"
+#include "ShaderTypes.hpp"
+#include "ShaderVariants.hpp"
+#include "TerrainQuadtree.hpp"
+#include "TessellationFactors.hpp"
+#include "TransientHeap.hpp"
+#include "UploadQueue.hpp"
 
 static constexpr size_t kNumInstances = 32;
 static constexpr size_t kMaxFramesInFlight = 3;
+static constexpr size_t kStagingRingSize = 4 * 1024 * 1024;
+static constexpr size_t kUploadBytesPerFrame = 1024 * 1024;
+static constexpr size_t kResourceCacheSize = 64 * 1024 * 1024;
+static constexpr size_t kGeometryCompactBytesPerFrame = 256 * 1024;
+static constexpr uint64_t kVariantReportInterval = 3600;
+// Recorded pipelines first drawn before this frame are compiled before the first frame; the rest in the background.
+static constexpr uint64_t kPrewarmBlockingFrames = 2;
+static constexpr const char* kAnimateInstancesKernel = "animateInstances";
+static constexpr simd::float4 kMaterialTint = { 1.0f, 0.8f, 0.6f, 1.0f };
+// Threadgroup sizes of objectMeshlets and meshMeshlets in Shaders.metal.
+static constexpr NS::UInteger kMeshletsPerObjectThreadgroup = 32;
+static constexpr NS::UInteger kMeshletThreads = 128;
+// LM_TERRAIN=1 terrain: a 1025x1025 heightmap, tiles of 32x32 cells over 6 levels.
+static constexpr uint32_t kTerrainTileCells = 32;
+static constexpr uint32_t kTerrainLevels = 6;
+static constexpr float kTerrainMaxPixelError = 1.0f;
+static constexpr resource_cache::Key kTerrainMeshKey = 1;
+// LM_TERRAIN=2 tessellates the same heightmap as 64x64 patches of 16x16 cells instead.
+static constexpr uint32_t kTerrainPatchCells = 16;
+static constexpr uint32_t kTerrainMaxTessellationFactor = 16;
+static constexpr float kTerrainEdgePixels = 8.0f;
+static constexpr const char* kTessellationFactorsKernel = "computeTessellationFactors";
 
 class Renderer {
 public:
@@ -25,17 +73,126 @@ public:
     void draw(MTK::View *pView);
 
 private:
+    memory_budget::AllocationId trackResource(MTL::Resource* pResource, memory_budget::Category category, const char* label);
+    bool setVertexFormat(const mesh_io::StreamFormat& format, uint32_t stride, const char* path);
+    bool buildMappedMeshBuffers(const char* path, uint64_t sourceHash = 0);
+    bool buildImportedMeshBuffers(const char* path, const char* cachePath, uint64_t sourceHash);
+    bool buildSourceMeshBuffers(const std::string& resources);
+    bool buildPoolMeshBuffers(const mesh_import::GpuMesh& gpu, const char* name);
+    bool buildCubeBuffers();
+    void updateGeometryPool();
+    uint64_t dropFinestLod();
+    void buildTransientTargets(uint32_t width, uint32_t height);
+    void buildTerrain();
+    void buildTessellatedTerrain(const terrain::TerrainDesc& desc, const std::vector<float>& heights);
+    void* generateTerrainMesh(void* pExisting);
+    void encodeTerrain(MTL::RenderCommandEncoder* pEnc, MTL::RenderPipelineState* pPSO, MTL::Buffer* pCameraDataBuffer, float viewportHeight);
+    bool encodeTessellationFactors(MTL::Buffer* pCameraDataBuffer, float viewportHeight);
+    void encodeTessellatedTerrain(MTL::RenderCommandEncoder* pEnc, MTL::RenderPipelineState* pPSO, MTL::Buffer* pCameraDataBuffer);
+    void prewarmRecordedPipelines();
+    void buildCompileProfiles(MTL::Library* pLibrary);
+    void buildMaterials(MTL::Library* pLibrary);
+    void startShaderHotReload();
+    void applyShaderReloads();
+    bool encodeInstanceAnimation(MTL::Buffer* pInstanceDataBuffer);
+
     MTL::Device* _pDevice;
+    // Declared early: it sizes itself from the device and everything built after it is tracked in it.
+    memory_budget::MemoryBudget _memoryBudget;
     MTL::CommandQueue* _pCommandQueue;
+    MetalBlitBackend* _pBlitBackend;
+    upload::UploadQueue* _pUploadQueue;
+    MetalPurgeableBackend _cacheBackend;
+    resource_cache::ResourceCache* _pResourceCache;
+    memory_budget::AllocationId _resourceCacheAllocation;
     MTL::Library* _pShaderLibrary;
-    MTL::RenderPipelineState *_pPSO;
+    MetalPipelineCompiler* _pPipelineCompiler;
+    pipeline_cache::AsyncPipelineCache<MTL::RenderPipelineState>* _pPipelineCache;
+    shader_variants::VariantSpace _variantSpace;
+    shader_variants::FeatureId _instanceFormatFeature;
+    shader_variants::FeatureId _vertexFormatFeature;
+    shader_variants::FeatureId _geometryFeature;
+    shader_variants::VariantPipelines<MTL::RenderPipelineState>* _pVariantPipelines;
+    shader_variants::VariantKey _variant;
+    std::vector<compile_profile::CompileProfile> _compileProfiles;
+    compile_profile::ProfileRules _profileRules;
+    std::vector<bool> _profileLibraries; // which compile profiles have a library; only those built on demand do
+    compile_profile::FrameTimeBenchmark* _pProfileBenchmark;
+    bool _profileBenchmarkRunning;
+    uint32_t _frameProfile;
+    std::chrono::steady_clock::time_point _lastDrawTime;
+    MetalMaterialStitcher* _pMaterialStitcher;
+    material_graph::MaterialCache<MTL::Function>* _pMaterialCache;
+    std::vector<pipeline_cache::RenderPipelineKey> _materialKeys;
+    int _materialIndex;
+    pipeline_record::Recorder* _pPipelineRecorder;
+    std::string _pipelineRecordingPath;
+    hot_reload::HotReloadService<MTL::Library>* _pShaderReload;
+    MetalComputeKernels* _pComputeKernels;
     MTL::DepthStencilState* _pDepthStencilState;
+    // Render targets that live within a frame, planned for the current drawable size.
+    TransientHeap* _pTransientHeap;
+    transient::ResourceHandle _depthTarget;
+    memory_budget::AllocationId _transientAllocation;
+    uint32_t _transientWidth;
+    uint32_t _transientHeight;
     MTL::Buffer* _pVertexDataBuffer;
     MTL::Buffer* _pIndexBuffer;
+    NS::UInteger _vertexBufferOffset;
+    NS::UInteger _indexBufferOffset;
+    NS::UInteger _indexCount;
+    MTL::IndexType _indexType;
+    uint32_t _vertexFormat; // kVertexFormat in Shaders.metal
+    std::vector<pipeline_cache::VertexAttribute> _vertexAttributes;
+    uint32_t _vertexStride;
+    uint32_t _vertexNormalOffset;
+    shader_types::VertexQuantization _vertexQuantization;
+    mesh_io::MappedMesh _mappedMesh;
+    // Meshlets, MeshletVertices and MeshletTriangles sections of the mapped mesh, all in _pVertexDataBuffer.
+    uint32_t _meshletCount;
+    NS::UInteger _meshletBufferOffsets[3];
+    // Lods section of the mapped mesh or the imported mesh's chain, ranges of its indices; empty draws all of them.
+    std::vector<mesh_simplify::LodLevel> _lods;
+    // Meshes built at runtime, the imported one or the cube and then procedural shapes in the same layout, live in the
+    // pool; _pVertexDataBuffer and _pIndexBuffer are its buffers. Each draws a run of the instances with those bindings.
+    struct PoolMesh {
+        geometry_pool::MeshHandle handle;
+        shader_types::VertexQuantization quantization;
+    };
+    MetalGeometryBackend* _pGeometryBackend;
+    geometry_pool::GeometryPool* _pGeometryPool;
+    std::vector<PoolMesh> _poolMeshes;
+    bool _geometryShrinkPending; // a LOD level was dropped; shrink the pool once compaction settles
+    // The pool, or the vertices of a mapped mesh and its indices when they are a buffer of their own (0 otherwise).
+    memory_budget::AllocationId _geometryAllocation;
+    memory_budget::AllocationId _indexAllocation;
+    // LM_TERRAIN: 0 none, 1 quadtree tiles, 2 tessellated patches. Both draw _pTerrainHeightmap with _terrainKey.
+    uint32_t _terrainMode;
+    // Quadtree terrain, null unless LM_TERRAIN=1. Every tile draws the same vertices with one of 16 index ranges.
+    terrain::Quadtree* _pTerrain;
+    terrain::Selection _terrainSelection;
+    terrain::IndexRange _terrainVariants[terrain::kStitchVariants];
+    NS::UInteger _terrainIndexOffset; // indices follow the vertices in the cached tile mesh buffer
+    MTL::Texture* _pTerrainHeightmap;
+    memory_budget::AllocationId _terrainHeightmapAllocation;
+    MTL::Buffer* _pTerrainTileBuffer[kMaxFramesInFlight];
+    // Tessellated terrain, LM_TERRAIN=2: per patch height bounds for culling and per frame factors the GPU writes.
+    tessellation::PatchGrid _terrainPatches;
+    MTL::Buffer* _pPatchBoundsBuffer;
+    MTL::Buffer* _pTessellationFactorBuffer[kMaxFramesInFlight];
+    shader_types::TessellationParams _tessellationParams;
+    pipeline_cache::RenderPipelineKey _terrainKey;
+    std::atomic<uint32_t> _terrainBandsPending; // heightmap uploads not yet completed
     MTL::Buffer* _pInstanceDataBuffer[kMaxFramesInFlight];
     MTL::Buffer* _pCameraDataBuffer[kMaxFramesInFlight];
+    // Touched each frame the buffers are drawn from, so the budget evicts least recently used first.
+    memory_budget::AllocationId _instanceAllocations[kMaxFramesInFlight];
+    memory_budget::AllocationId _cameraAllocations[kMaxFramesInFlight];
     float _angle;
     int _frame;
+    uint64_t _frameIndex;
+    bool _firstFrameDrawn; // a frame has drawn the mesh, not just cleared while its pipeline compiles
+    bool _periodicReports; // variant, tuning and resource cache reports every kVariantReportInterval frames
     dispatch_semaphore_t _semaphore;
     static const int kMaxFramesInFlight;
 };
@@ -44,16 +201,4 @@ struct FrameData {
     float angle;
 };
 
-namespace shader_types {
-    struct InstanceData {
-        simd::float4x4 instanceTransform;
-        simd::float4 instanceColor;
-    };
-
-    struct CameraData {
-        simd::float4x4 perspectiveTransform;
-        simd::float4x4 worldTransform;
-    };
-}
-
 #endif /* Renderer_hpp */
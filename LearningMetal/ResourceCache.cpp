@@ -0,0 +1,134 @@
+//
+//  ResourceCache.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/24.
+//
+
+#include "ResourceCache.hpp"
+#include <cassert>
+#include <chrono>
+
+namespace resource_cache {
+using Clock = std::chrono::steady_clock;
+
+ResourceCache::ResourceCache(CacheBackend* pBackend, uint64_t capacityBytes, uint32_t idleFramesBeforeVolatile): _pBackend(pBackend), _capacity(capacityBytes), _idleFrames(idleFramesBeforeVolatile) {
+
+}
+
+ResourceCache::~ResourceCache() {
+    for (Entry& entry : _lru) {
+        _pBackend->destroy(entry.pResource);
+    }
+}
+
+void* ResourceCache::acquire(Key key, const Generator& generate) {
+    auto found = _entries.find(key);
+    if (found == _entries.end()) {
+        const Clock::time_point start = Clock::now();
+        void* pResource = generate(nullptr);
+        _stats.missSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+        ++_stats.misses;
+
+        const uint64_t size = _pBackend->size(pResource);
+        _lru.push_front(Entry { key, pResource, size, 1, _frameIndex, false });
+        _entries[key] = _lru.begin();
+        _totalBytes += size;
+        _residentBytes += size;
+        return pResource;
+    }
+
+    List::iterator it = found->second;
+    _lru.splice(_lru.begin(), _lru, it);
+    Entry& entry = *it;
+    entry.lastUsedFrame = _frameIndex;
+    ++entry.useCount;
+
+    if (entry.isVolatile) {
+        entry.isVolatile = false;
+        _residentBytes += entry.size;
+        if (!_pBackend->makeNonVolatile(entry.pResource)) {
+            const Clock::time_point start = Clock::now();
+            void* pRegenerated = generate(entry.pResource);
+            _stats.regenerationSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+            ++_stats.regenerations;
+            assert(pRegenerated == entry.pResource && "a generator must refill the resource it is given");
+            if (pRegenerated != entry.pResource) {
+                // Keep the books right even so: the old resource goes, the new one is counted at its own size.
+                const uint64_t size = _pBackend->size(pRegenerated);
+                _pBackend->destroy(entry.pResource);
+                _totalBytes = _totalBytes - entry.size + size;
+                _residentBytes = _residentBytes - entry.size + size;
+                entry.pResource = pRegenerated;
+                entry.size = size;
+            }
+            return entry.pResource;
+        }
+    }
+
+    ++_stats.hits;
+    return entry.pResource;
+}
+
+void ResourceCache::release(Key key) {
+    auto found = _entries.find(key);
+    assert(found != _entries.end() && found->second->useCount > 0);
+    Entry& entry = *found->second;
+    --entry.useCount;
+    entry.lastUsedFrame = _frameIndex;
+}
+
+void ResourceCache::evict(List::iterator it) {
+    _pBackend->destroy(it->pResource);
+    _totalBytes -= it->size;
+    if (!it->isVolatile) {
+        _residentBytes -= it->size;
+    }
+    _entries.erase(it->key);
+    _lru.erase(it);
+    ++_stats.evictions;
+}
+
+void ResourceCache::tick(uint64_t frameIndex) {
+    _frameIndex = frameIndex;
+
+    for (Entry& entry : _lru) {
+        if (entry.useCount == 0 && !entry.isVolatile && entry.lastUsedFrame + _idleFrames <= frameIndex) {
+            _pBackend->makeVolatile(entry.pResource);
+            entry.isVolatile = true;
+            _residentBytes -= entry.size;
+        }
+    }
+
+    // Trim from the least recently used end, skipping anything still in use.
+    auto it = _lru.end();
+    while (_totalBytes > _capacity && it != _lru.begin()) {
+        --it;
+        if (it->useCount == 0) {
+            evict(it++);
+        }
+    }
+}
+
+uint64_t ResourceCache::makeIdleVolatile() {
+    uint64_t bytes = 0;
+    for (Entry& entry : _lru) {
+        if (entry.useCount == 0 && !entry.isVolatile) {
+            _pBackend->makeVolatile(entry.pResource);
+            entry.isVolatile = true;
+            _residentBytes -= entry.size;
+            bytes += entry.size;
+        }
+    }
+    return bytes;
+}
+
+void ResourceCache::printStats() const {
+    const uint64_t lookups = _stats.hits + _stats.misses + _stats.regenerations;
+    __builtin_printf("Resource cache: %zu entries, %llu bytes (%llu resident)\n", _lru.size(), (unsigned long long)_totalBytes, (unsigned long long)_residentBytes);
+    __builtin_printf("  hits %llu  misses %llu (%.3f ms)  regenerations %llu (%.3f ms)  evictions %llu  hit rate %.1f%%\n",
+                     (unsigned long long)_stats.hits, (unsigned long long)_stats.misses, _stats.missSeconds * 1000.0,
+                     (unsigned long long)_stats.regenerations, _stats.regenerationSeconds * 1000.0,
+                     (unsigned long long)_stats.evictions, lookups > 0 ? 100.0 * _stats.hits / lookups : 0.0);
+}
+}
@@ -0,0 +1,95 @@
+//
+//  ResourceCache.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/24.
+//
+
+#ifndef ResourceCache_hpp
+#define ResourceCache_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+namespace resource_cache {
+    using Key = uint64_t;
+
+    /**
+     * Purgeable-state operations on an opaque resource. On device this is MTL::Resource::setPurgeableState.
+     */
+    class CacheBackend {
+    public:
+        virtual ~CacheBackend() = default;
+        virtual void makeVolatile(void* pResource) = 0;
+        // Returns false if the system discarded the contents while the resource was volatile.
+        virtual bool makeNonVolatile(void* pResource) = 0;
+        virtual void destroy(void* pResource) = 0;
+        virtual uint64_t size(void* pResource) const = 0;
+    };
+
+    // Fills pExisting if it is non-null and returns it, otherwise creates and fills a new resource.
+    using Generator = std::function<void*(void* pExisting)>;
+
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t regenerations = 0;
+        uint64_t evictions = 0;
+        double missSeconds = 0.0;
+        double regenerationSeconds = 0.0;
+    };
+
+    /**
+     * LRU cache of regenerable resources. Released resources stay cached; once idle for a few frames they are
+     * marked volatile so the OS may reclaim them under pressure, and on reuse they are made non-volatile again
+     * and lazily regenerated if their contents were discarded. Idle entries beyond the byte capacity are destroyed.
+     */
+    class ResourceCache {
+    public:
+        ResourceCache(CacheBackend* pBackend, uint64_t capacityBytes, uint32_t idleFramesBeforeVolatile = 2);
+        ~ResourceCache();
+
+        void* acquire(Key key, const Generator& generate);
+        void release(Key key);
+
+        // Runs once per frame: marks idle entries volatile and trims to capacity.
+        void tick(uint64_t frameIndex);
+        // Marks every idle entry volatile now; returns the bytes made reclaimable.
+        uint64_t makeIdleVolatile();
+
+        uint64_t residentBytes() const { return _residentBytes; }
+        const CacheStats& stats() const { return _stats; }
+        void printStats() const;
+
+    private:
+        struct Entry {
+            Key key;
+            void* pResource;
+            uint64_t size;
+            uint32_t useCount;
+            uint64_t lastUsedFrame;
+            bool isVolatile;
+        };
+
+        using List = std::list<Entry>;
+
+        void evict(List::iterator it);
+
+        CacheBackend* _pBackend;
+        uint64_t _capacity;
+        uint32_t _idleFrames;
+        uint64_t _frameIndex = 0;
+        uint64_t _totalBytes = 0;
+        uint64_t _residentBytes = 0;
+
+        // Most recently used at the front.
+        List _lru;
+        std::unordered_map<Key, List::iterator> _entries;
+        CacheStats _stats;
+    };
+}
+
+#endif /* ResourceCache_hpp */
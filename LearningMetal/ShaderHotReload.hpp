@@ -0,0 +1,197 @@
+//
+//  ShaderHotReload.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef ShaderHotReload_hpp
+#define ShaderHotReload_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FileWatcher.hpp"
+
+namespace hot_reload {
+    struct ReloadStats {
+        uint64_t changes = 0;   // library rebuilds triggered by a file change
+        uint64_t compiled = 0;
+        uint64_t failed = 0;
+        uint64_t swapped = 0;
+        double compileSeconds = 0.0;
+    };
+
+    /**
+     * Watches the sources of each shader library and rebuilds only the libraries whose files changed, on a
+     * background thread. Rebuilt libraries are never handed over from that thread: the render loop calls
+     * applyPending() between frames, which is the only place a library is swapped in, so a frame always sees one
+     * consistent set. A library that fails to build is dropped and the previous one stays in use.
+     */
+    template <typename Library>
+    class HotReloadService {
+    public:
+        using LibraryId = uint32_t;
+        // Runs on the reload thread; returns a +1 library, or nullptr after reporting the error.
+        using Compiler = std::function<Library*(LibraryId library)>;
+        using Releaser = std::function<void(Library* pLibrary)>;
+        // Runs on the thread calling applyPending(); retains the library if it keeps it.
+        using Swap = std::function<void(LibraryId library, Library* pLibrary)>;
+
+        static constexpr auto kPollInterval = std::chrono::milliseconds(100);
+        // Editors often write a file in several steps; changes within this window are built once.
+        static constexpr auto kSettleInterval = std::chrono::milliseconds(50);
+
+        HotReloadService(Compiler compile, Releaser release): _compile(std::move(compile)), _release(std::move(release)) {}
+
+        ~HotReloadService() {
+            stop();
+            for (const Ready& ready : _ready) {
+                _release(ready.pLibrary);
+            }
+        }
+
+        HotReloadService(const HotReloadService&) = delete;
+        HotReloadService& operator=(const HotReloadService&) = delete;
+
+        // Must be called before start(). Returns the id the compiler and swap callbacks are given.
+        LibraryId watch(const std::vector<std::string>& paths) {
+            const LibraryId library = static_cast<LibraryId>(_sources.size());
+            _sources.push_back(paths);
+            for (const std::string& path : paths) {
+                if (!_watcher.add(path)) {
+                    __builtin_printf("Hot reload: cannot watch %s\n", path.c_str());
+                }
+            }
+            return library;
+        }
+
+        void start() {
+            if (!_thread.joinable()) {
+                _stopping = false;
+                _thread = std::thread([this] { run(); });
+            }
+        }
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+        }
+
+        // Hands every library rebuilt since the last call to swap, oldest first. Returns how many were applied.
+        size_t applyPending(const Swap& swap) {
+            std::vector<Ready> ready;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                ready.swap(_ready);
+                _stats.swapped += ready.size();
+            }
+            for (const Ready& entry : ready) {
+                swap(entry.library, entry.pLibrary);
+                _release(entry.pLibrary);
+            }
+            return ready.size();
+        }
+
+        // For tests and tools: runs one watch-and-rebuild pass on the calling thread instead of the reload thread.
+        size_t pollOnce() {
+            return rebuild(changedLibraries());
+        }
+
+        ReloadStats stats() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _stats;
+        }
+
+    private:
+        struct Ready {
+            LibraryId library;
+            Library* pLibrary;
+        };
+
+        void run() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_stopping) {
+                lock.unlock();
+                std::vector<LibraryId> libraries = changedLibraries();
+                if (!libraries.empty()) {
+                    std::this_thread::sleep_for(kSettleInterval);
+                    for (LibraryId library : changedLibraries()) {
+                        if (std::find(libraries.begin(), libraries.end(), library) == libraries.end()) {
+                            libraries.push_back(library);
+                        }
+                    }
+                    rebuild(libraries);
+                }
+                lock.lock();
+                _wake.wait_for(lock, kPollInterval, [this] { return _stopping; });
+            }
+        }
+
+        std::vector<LibraryId> changedLibraries() {
+            std::vector<LibraryId> libraries;
+            for (const std::string& path : _watcher.poll()) {
+                for (LibraryId library = 0; library < _sources.size(); ++library) {
+                    const std::vector<std::string>& sources = _sources[library];
+                    if (std::find(sources.begin(), sources.end(), path) != sources.end() && std::find(libraries.begin(), libraries.end(), library) == libraries.end()) {
+                        libraries.push_back(library);
+                    }
+                }
+            }
+            return libraries;
+        }
+
+        size_t rebuild(const std::vector<LibraryId>& libraries) {
+            size_t built = 0;
+            for (LibraryId library : libraries) {
+                const auto start = std::chrono::steady_clock::now();
+                Library* pLibrary = _compile(library);
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                ++_stats.changes;
+                _stats.compileSeconds += seconds;
+                if (pLibrary == nullptr) {
+                    ++_stats.failed;
+                    continue;
+                }
+                ++_stats.compiled;
+                ++built;
+                // A newer build of the same library supersedes one the render loop has not picked up yet.
+                auto stale = std::find_if(_ready.begin(), _ready.end(), [library](const Ready& ready) { return ready.library == library; });
+                if (stale != _ready.end()) {
+                    _release(stale->pLibrary);
+                    _ready.erase(stale);
+                }
+                _ready.push_back(Ready { library, pLibrary });
+            }
+            return built;
+        }
+
+        Compiler _compile;
+        Releaser _release;
+        FileWatcher _watcher; // only touched by the reload thread once started
+        std::vector<std::vector<std::string>> _sources;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _wake;
+        std::thread _thread;
+        bool _stopping = false;
+        std::vector<Ready> _ready;
+        ReloadStats _stats;
+    };
+}
+
+#endif /* ShaderHotReload_hpp */
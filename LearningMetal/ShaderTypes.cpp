@@ -0,0 +1,50 @@
+//
+//  ShaderTypes.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+#include "ShaderTypes.hpp"
+
+namespace shader_types {
+const char* mslName(MslType type) {
+    switch (type) {
+        case MslType::Float: return "float";
+        case MslType::Float2: return "float2";
+        case MslType::Float3: return "float3";
+        case MslType::Float4: return "float4";
+        case MslType::Float4x4: return "float4x4";
+        case MslType::PackedFloat3: return "packed_float3";
+        case MslType::Half: return "half";
+        case MslType::Half2: return "half2";
+        case MslType::Half4: return "half4";
+        case MslType::UInt: return "uint";
+        case MslType::UInt2: return "uint2";
+        case MslType::UInt4: return "uint4";
+        case MslType::UShort: return "ushort";
+        case MslType::UChar4: return "uchar4";
+    }
+    return "";
+}
+
+std::string generateMsl() {
+    std::string text = "// Generated from ShaderTypes.hpp by Tools/GenerateShaderTypes.cpp. Do not edit.\n\n";
+    text += "#ifndef ShaderTypesGenerated_h\n#define ShaderTypesGenerated_h\n";
+    for (const StructLayout& layout : kShaderStructs) {
+        text += "\nstruct " + std::string(layout.name) + " {\n";
+        for (size_t i = 0; i < layout.fieldCount; ++i) {
+            const FieldLayout& field = layout.fields[i];
+            text += "    " + std::string(mslName(field.type)) + " " + field.name;
+            if (field.count > 1) {
+                text += "[" + std::to_string(field.count) + "]";
+            }
+            text += "; // offset " + std::to_string(field.offset) + "\n";
+        }
+        text += "};\n";
+        text += "static_assert(sizeof(" + std::string(layout.name) + ") == " + std::to_string(layout.size) + ", \"" + layout.name + " differs from the host layout\");\n";
+    }
+    text += "\n#endif /* ShaderTypesGenerated_h */\n";
+    return text;
+}
+}
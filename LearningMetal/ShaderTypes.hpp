@@ -0,0 +1,301 @@
+//
+//  ShaderTypes.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+#ifndef ShaderTypes_hpp
+#define ShaderTypes_hpp
+
+#include <simd/simd.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * The one definition of every struct the host writes into a buffer and a shader reads. Each struct has a field table
+ * giving the MSL type of every member; static_asserts check the host layout against MSL's layout rules, and
+ * generateMsl() turns the same tables into ShaderTypesGenerated.h for Shaders.metal. Change a struct here, regenerate
+ * with Tools/GenerateShaderTypes.cpp, and a layout the shader would read differently fails to compile.
+ */
+namespace shader_types {
+    struct VertexData {
+        simd::float3 position;
+    };
+
+    struct InstanceData {
+        simd::float4x4 instanceTransform;
+        simd::float4 instanceColor;
+    };
+
+    // Three rows of an affine transform; 16 bytes per instance smaller than InstanceData.
+    struct PackedInstanceData {
+        simd::float4 transformRows[3];
+        simd::float4 instanceColor;
+    };
+
+    struct CameraData {
+        simd::float4x4 perspectiveTransform;
+        simd::float4x4 worldTransform;
+    };
+
+    // Parameters of the animateInstances kernel, which writes PackedInstanceData on the GPU.
+    struct InstanceAnimation {
+        simd::float3 objectPosition;
+        float angle;
+        float scale;
+        uint32_t instanceCount;
+    };
+
+    // Decodes vertexQuantized's 16-bit unorm positions: positionMin + position * positionExtent.
+    struct VertexQuantization {
+        simd::float3 positionMin;
+        simd::float3 positionExtent;
+    };
+
+    // One meshlet of the Meshlets mesh file section; the same layout as meshlet_builder::Meshlet.
+    struct MeshletData {
+        float center[3];
+        float radius;
+        float coneApex[3];
+        float coneCutoff;
+        float coneAxis[3];
+        uint32_t vertexOffset;
+        uint32_t triangleOffset;
+        uint32_t vertexCount;
+        uint32_t triangleCount;
+    };
+
+    // Per draw parameters of objectMeshlets and meshMeshlets. Planes face inwards and are normalized, in world space.
+    struct MeshletDraw {
+        simd::float4 frustumPlanes[6];
+        simd::float3 cameraPosition;
+        uint32_t meshletCount;
+        uint32_t vertexStride;
+        uint32_t normalOffset; // byte offset of the normal in a vertex, for lit formats
+    };
+
+    // One selected tile of the terrain quadtree, per instance of vertexTerrain. Its vertex (column, row) samples the
+    // heightmap at origin + (column, row) * step.
+    struct TerrainTile {
+        simd::uint2 origin;
+        uint32_t step;
+        uint32_t level;
+    };
+
+    // Per draw parameters of vertexTerrain: where heightmap sample (0, 0) at height 0 lies, and the sample spacing.
+    struct TerrainDraw {
+        simd::float3 origin;
+        float spacing;
+        uint32_t levels;
+    };
+
+    // Per frame parameters of computeTessellationFactors and vertexTessellatedTerrain, see TessellationFactors.hpp.
+    // Patches are samplesPerPatch heightmap cells square, row-major from heightmap sample (0, 0).
+    struct TessellationParams {
+        simd::float4 frustumPlanes[6];
+        simd::float3 cameraPosition;
+        simd::float3 origin;
+        float pixelsPerUnit;
+        float edgePixels;
+        float maxFactor;
+        float spacing;
+        uint32_t patchesPerSide;
+        uint32_t samplesPerPatch;
+    };
+
+    enum class MslType : uint8_t {
+        Float,
+        Float2,
+        Float3,
+        Float4,
+        Float4x4,
+        PackedFloat3, // float[3] on the host
+        Half,
+        Half2,
+        Half4,
+        UInt,
+        UInt2,
+        UInt4,
+        UShort,
+        UChar4
+    };
+
+    // Size and alignment in MSL's device and constant address spaces.
+    constexpr uint32_t mslSize(MslType type) {
+        switch (type) {
+            case MslType::Float: return 4;
+            case MslType::Float2: return 8;
+            case MslType::Float3: return 16;
+            case MslType::Float4: return 16;
+            case MslType::Float4x4: return 64;
+            case MslType::PackedFloat3: return 12;
+            case MslType::Half: return 2;
+            case MslType::Half2: return 4;
+            case MslType::Half4: return 8;
+            case MslType::UInt: return 4;
+            case MslType::UInt2: return 8;
+            case MslType::UInt4: return 16;
+            case MslType::UShort: return 2;
+            case MslType::UChar4: return 4;
+        }
+        return 0;
+    }
+
+    constexpr uint32_t mslAlignment(MslType type) {
+        switch (type) {
+            case MslType::Float4x4: return 16;
+            case MslType::PackedFloat3: return 4;
+            default: return mslSize(type);
+        }
+    }
+
+    const char* mslName(MslType type);
+
+    struct FieldLayout {
+        const char* name;
+        MslType type;
+        uint32_t count; // array length, 1 for a plain member
+        uint32_t offset;
+    };
+
+    struct StructLayout {
+        const char* name;
+        const FieldLayout* fields;
+        size_t fieldCount;
+        uint32_t size;
+        uint32_t alignment;
+    };
+
+    // Lays the fields out the way the Metal compiler would and compares with what the host compiler did.
+    constexpr bool matchesMsl(const StructLayout& layout) {
+        uint32_t offset = 0;
+        uint32_t alignment = 1;
+        for (size_t i = 0; i < layout.fieldCount; ++i) {
+            const FieldLayout& field = layout.fields[i];
+            const uint32_t fieldAlignment = mslAlignment(field.type);
+            offset = (offset + fieldAlignment - 1) / fieldAlignment * fieldAlignment;
+            if (field.offset != offset) {
+                return false;
+            }
+            offset += mslSize(field.type) * field.count;
+            alignment = fieldAlignment > alignment ? fieldAlignment : alignment;
+        }
+        const uint32_t size = (offset + alignment - 1) / alignment * alignment;
+        return layout.size == size && layout.alignment == alignment;
+    }
+
+#define SHADER_FIELD(Struct, field, type, count) FieldLayout { #field, MslType::type, count, static_cast<uint32_t>(offsetof(Struct, field)) }
+#define SHADER_STRUCT(Struct, fields) StructLayout { #Struct, fields, sizeof(fields) / sizeof(fields[0]), sizeof(Struct), alignof(Struct) }
+
+    inline constexpr FieldLayout kVertexDataFields[] = {
+        SHADER_FIELD(VertexData, position, Float3, 1),
+    };
+
+    inline constexpr FieldLayout kInstanceDataFields[] = {
+        SHADER_FIELD(InstanceData, instanceTransform, Float4x4, 1),
+        SHADER_FIELD(InstanceData, instanceColor, Float4, 1),
+    };
+
+    inline constexpr FieldLayout kPackedInstanceDataFields[] = {
+        SHADER_FIELD(PackedInstanceData, transformRows, Float4, 3),
+        SHADER_FIELD(PackedInstanceData, instanceColor, Float4, 1),
+    };
+
+    inline constexpr FieldLayout kCameraDataFields[] = {
+        SHADER_FIELD(CameraData, perspectiveTransform, Float4x4, 1),
+        SHADER_FIELD(CameraData, worldTransform, Float4x4, 1),
+    };
+
+    inline constexpr FieldLayout kInstanceAnimationFields[] = {
+        SHADER_FIELD(InstanceAnimation, objectPosition, Float3, 1),
+        SHADER_FIELD(InstanceAnimation, angle, Float, 1),
+        SHADER_FIELD(InstanceAnimation, scale, Float, 1),
+        SHADER_FIELD(InstanceAnimation, instanceCount, UInt, 1),
+    };
+
+    inline constexpr FieldLayout kVertexQuantizationFields[] = {
+        SHADER_FIELD(VertexQuantization, positionMin, Float3, 1),
+        SHADER_FIELD(VertexQuantization, positionExtent, Float3, 1),
+    };
+
+    inline constexpr FieldLayout kMeshletDataFields[] = {
+        SHADER_FIELD(MeshletData, center, PackedFloat3, 1),
+        SHADER_FIELD(MeshletData, radius, Float, 1),
+        SHADER_FIELD(MeshletData, coneApex, PackedFloat3, 1),
+        SHADER_FIELD(MeshletData, coneCutoff, Float, 1),
+        SHADER_FIELD(MeshletData, coneAxis, PackedFloat3, 1),
+        SHADER_FIELD(MeshletData, vertexOffset, UInt, 1),
+        SHADER_FIELD(MeshletData, triangleOffset, UInt, 1),
+        SHADER_FIELD(MeshletData, vertexCount, UInt, 1),
+        SHADER_FIELD(MeshletData, triangleCount, UInt, 1),
+    };
+
+    inline constexpr FieldLayout kMeshletDrawFields[] = {
+        SHADER_FIELD(MeshletDraw, frustumPlanes, Float4, 6),
+        SHADER_FIELD(MeshletDraw, cameraPosition, Float3, 1),
+        SHADER_FIELD(MeshletDraw, meshletCount, UInt, 1),
+        SHADER_FIELD(MeshletDraw, vertexStride, UInt, 1),
+        SHADER_FIELD(MeshletDraw, normalOffset, UInt, 1),
+    };
+
+    inline constexpr FieldLayout kTerrainTileFields[] = {
+        SHADER_FIELD(TerrainTile, origin, UInt2, 1),
+        SHADER_FIELD(TerrainTile, step, UInt, 1),
+        SHADER_FIELD(TerrainTile, level, UInt, 1),
+    };
+
+    inline constexpr FieldLayout kTerrainDrawFields[] = {
+        SHADER_FIELD(TerrainDraw, origin, Float3, 1),
+        SHADER_FIELD(TerrainDraw, spacing, Float, 1),
+        SHADER_FIELD(TerrainDraw, levels, UInt, 1),
+    };
+
+    inline constexpr FieldLayout kTessellationParamsFields[] = {
+        SHADER_FIELD(TessellationParams, frustumPlanes, Float4, 6),
+        SHADER_FIELD(TessellationParams, cameraPosition, Float3, 1),
+        SHADER_FIELD(TessellationParams, origin, Float3, 1),
+        SHADER_FIELD(TessellationParams, pixelsPerUnit, Float, 1),
+        SHADER_FIELD(TessellationParams, edgePixels, Float, 1),
+        SHADER_FIELD(TessellationParams, maxFactor, Float, 1),
+        SHADER_FIELD(TessellationParams, spacing, Float, 1),
+        SHADER_FIELD(TessellationParams, patchesPerSide, UInt, 1),
+        SHADER_FIELD(TessellationParams, samplesPerPatch, UInt, 1),
+    };
+
+    // In declaration order; generateMsl() emits them in this order.
+    inline constexpr StructLayout kShaderStructs[] = {
+        SHADER_STRUCT(VertexData, kVertexDataFields),
+        SHADER_STRUCT(InstanceData, kInstanceDataFields),
+        SHADER_STRUCT(PackedInstanceData, kPackedInstanceDataFields),
+        SHADER_STRUCT(CameraData, kCameraDataFields),
+        SHADER_STRUCT(InstanceAnimation, kInstanceAnimationFields),
+        SHADER_STRUCT(VertexQuantization, kVertexQuantizationFields),
+        SHADER_STRUCT(MeshletData, kMeshletDataFields),
+        SHADER_STRUCT(MeshletDraw, kMeshletDrawFields),
+        SHADER_STRUCT(TerrainTile, kTerrainTileFields),
+        SHADER_STRUCT(TerrainDraw, kTerrainDrawFields),
+        SHADER_STRUCT(TessellationParams, kTessellationParamsFields),
+    };
+
+#undef SHADER_STRUCT
+#undef SHADER_FIELD
+
+    static_assert(matchesMsl(kShaderStructs[0]), "VertexData does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[1]), "InstanceData does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[2]), "PackedInstanceData does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[3]), "CameraData does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[4]), "InstanceAnimation does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[5]), "VertexQuantization does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[6]), "MeshletData does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[7]), "MeshletDraw does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[8]), "TerrainTile does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[9]), "TerrainDraw does not match its MSL layout");
+    static_assert(matchesMsl(kShaderStructs[10]), "TessellationParams does not match its MSL layout");
+
+    // MSL declarations for kShaderStructs, with a size check per struct on the shader side too.
+    std::string generateMsl();
+}
+
+#endif /* ShaderTypes_hpp */
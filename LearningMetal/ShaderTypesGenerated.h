@@ -0,0 +1,92 @@
+// Generated from ShaderTypes.hpp by Tools/GenerateShaderTypes.cpp. Do not edit.
+
+#ifndef ShaderTypesGenerated_h
+#define ShaderTypesGenerated_h
+
+struct VertexData {
+    float3 position; // offset 0
+};
+static_assert(sizeof(VertexData) == 16, "VertexData differs from the host layout");
+
+struct InstanceData {
+    float4x4 instanceTransform; // offset 0
+    float4 instanceColor; // offset 64
+};
+static_assert(sizeof(InstanceData) == 80, "InstanceData differs from the host layout");
+
+struct PackedInstanceData {
+    float4 transformRows[3]; // offset 0
+    float4 instanceColor; // offset 48
+};
+static_assert(sizeof(PackedInstanceData) == 64, "PackedInstanceData differs from the host layout");
+
+struct CameraData {
+    float4x4 perspectiveTransform; // offset 0
+    float4x4 worldTransform; // offset 64
+};
+static_assert(sizeof(CameraData) == 128, "CameraData differs from the host layout");
+
+struct InstanceAnimation {
+    float3 objectPosition; // offset 0
+    float angle; // offset 16
+    float scale; // offset 20
+    uint instanceCount; // offset 24
+};
+static_assert(sizeof(InstanceAnimation) == 32, "InstanceAnimation differs from the host layout");
+
+struct VertexQuantization {
+    float3 positionMin; // offset 0
+    float3 positionExtent; // offset 16
+};
+static_assert(sizeof(VertexQuantization) == 32, "VertexQuantization differs from the host layout");
+
+struct MeshletData {
+    packed_float3 center; // offset 0
+    float radius; // offset 12
+    packed_float3 coneApex; // offset 16
+    float coneCutoff; // offset 28
+    packed_float3 coneAxis; // offset 32
+    uint vertexOffset; // offset 44
+    uint triangleOffset; // offset 48
+    uint vertexCount; // offset 52
+    uint triangleCount; // offset 56
+};
+static_assert(sizeof(MeshletData) == 60, "MeshletData differs from the host layout");
+
+struct MeshletDraw {
+    float4 frustumPlanes[6]; // offset 0
+    float3 cameraPosition; // offset 96
+    uint meshletCount; // offset 112
+    uint vertexStride; // offset 116
+    uint normalOffset; // offset 120
+};
+static_assert(sizeof(MeshletDraw) == 128, "MeshletDraw differs from the host layout");
+
+struct TerrainTile {
+    uint2 origin; // offset 0
+    uint step; // offset 8
+    uint level; // offset 12
+};
+static_assert(sizeof(TerrainTile) == 16, "TerrainTile differs from the host layout");
+
+struct TerrainDraw {
+    float3 origin; // offset 0
+    float spacing; // offset 16
+    uint levels; // offset 20
+};
+static_assert(sizeof(TerrainDraw) == 32, "TerrainDraw differs from the host layout");
+
+struct TessellationParams {
+    float4 frustumPlanes[6]; // offset 0
+    float3 cameraPosition; // offset 96
+    float3 origin; // offset 112
+    float pixelsPerUnit; // offset 128
+    float edgePixels; // offset 132
+    float maxFactor; // offset 136
+    float spacing; // offset 140
+    uint patchesPerSide; // offset 144
+    uint samplesPerPatch; // offset 148
+};
+static_assert(sizeof(TessellationParams) == 160, "TessellationParams differs from the host layout");
+
+#endif /* ShaderTypesGenerated_h */
@@ -0,0 +1,106 @@
+//
+//  ShaderVariants.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/27.
+//
+
+#include "ShaderVariants.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace shader_variants {
+// Raw MTL::DataType values, so this file stays free of Metal headers.
+static constexpr uint32_t kDataTypeBool = 53;
+
+static uint32_t bitsFor(uint32_t valueCount) {
+    uint32_t bits = 0;
+    while ((1u << bits) < valueCount) {
+        ++bits;
+    }
+    return std::max(bits, 1u);
+}
+
+FeatureId VariantSpace::addFeature(const char* name, uint32_t constantIndex, uint32_t dataType, uint32_t valueCount) {
+    assert(valueCount >= 1 && (dataType != kDataTypeBool || valueCount <= 2));
+    const uint32_t bits = bitsFor(valueCount);
+    assert(_usedBits + bits <= 32);
+    _features.push_back(Feature { name, constantIndex, dataType, valueCount, _usedBits, (1u << bits) - 1 });
+    _usedBits += bits;
+    return static_cast<FeatureId>(_features.size() - 1);
+}
+
+VariantKey VariantSpace::with(VariantKey key, FeatureId feature, uint32_t value) const {
+    const Feature& f = _features[feature];
+    assert(value < f.valueCount);
+    return (key & ~(f.mask << f.shift)) | (value << f.shift);
+}
+
+uint32_t VariantSpace::value(VariantKey key, FeatureId feature) const {
+    const Feature& f = _features[feature];
+    return (key >> f.shift) & f.mask;
+}
+
+std::vector<pipeline_cache::FunctionConstant> VariantSpace::constants(VariantKey key) const {
+    std::vector<pipeline_cache::FunctionConstant> constants;
+    constants.reserve(_features.size());
+    for (FeatureId i = 0; i < _features.size(); ++i) {
+        // A bool constant reads only the first byte, so 0 and 1 work for both types.
+        constants.push_back(pipeline_cache::FunctionConstant { _features[i].constantIndex, _features[i].dataType, value(key, i) });
+    }
+    return constants;
+}
+
+uint64_t VariantSpace::combinationCount() const {
+    uint64_t count = 1;
+    for (const Feature& f : _features) {
+        count *= f.valueCount;
+    }
+    return count;
+}
+
+std::string VariantSpace::describe(VariantKey key) const {
+    std::string text;
+    for (FeatureId i = 0; i < _features.size(); ++i) {
+        if (!text.empty()) {
+            text += ' ';
+        }
+        text += _features[i].name + "=" + std::to_string(value(key, i));
+    }
+    return text;
+}
+
+bool VariantStats::recordDraw(VariantKey key, uint64_t frameIndex) {
+    auto [it, inserted] = _usage.try_emplace(key);
+    VariantUsage& usage = it->second;
+    if (inserted) {
+        usage.firstFrame = frameIndex;
+    }
+    ++usage.draws;
+    usage.lastFrame = frameIndex;
+
+    if (inserted && _usage.size() > _maxVariants && !_warned) {
+        _warned = true;
+        return false;
+    }
+    return true;
+}
+
+void VariantStats::printReport(const VariantSpace& space, uint64_t frameIndex, uint64_t staleFrames) const {
+    std::vector<std::pair<VariantKey, VariantUsage>> sorted(_usage.begin(), _usage.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.draws > b.second.draws; });
+
+    uint64_t totalDraws = 0;
+    for (const auto& [key, usage] : sorted) {
+        totalDraws += usage.draws;
+    }
+
+    __builtin_printf("Shader variants: %zu of %llu combinations used (limit %zu)\n", _usage.size(), (unsigned long long)space.combinationCount(), _maxVariants);
+    for (const auto& [key, usage] : sorted) {
+        const bool stale = usage.lastFrame + staleFrames < frameIndex;
+        __builtin_printf("  %08x  %-48s %10llu draws %5.1f%%  frames %llu-%llu%s\n", key, space.describe(key).c_str(),
+                         (unsigned long long)usage.draws, totalDraws > 0 ? 100.0 * usage.draws / totalDraws : 0.0,
+                         (unsigned long long)usage.firstFrame, (unsigned long long)usage.lastFrame, stale ? "  stale" : "");
+    }
+}
+}
@@ -0,0 +1,156 @@
+//
+//  ShaderVariants.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/27.
+//
+
+#ifndef ShaderVariants_hpp
+#define ShaderVariants_hpp
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AsyncPipelineCache.hpp"
+#include "PipelineCache.hpp"
+
+namespace shader_variants {
+    // One value per feature, packed into a few bits each.
+    using VariantKey = uint32_t;
+    using FeatureId = uint32_t;
+
+    struct Feature {
+        std::string name;
+        uint32_t constantIndex; // [[function_constant(n)]] in the shader
+        uint32_t dataType;      // MTL::DataType, Bool or UInt
+        uint32_t valueCount;
+        uint32_t shift;
+        uint32_t mask;
+    };
+
+    /**
+     * The function constants a shader source is specialized on. A variant key fixes every feature to a value and
+     * maps to the FunctionConstantValues the compiler uses to strip the branches that variant does not take.
+     */
+    class VariantSpace {
+    public:
+        FeatureId addFeature(const char* name, uint32_t constantIndex, uint32_t dataType, uint32_t valueCount);
+
+        VariantKey with(VariantKey key, FeatureId feature, uint32_t value) const;
+        uint32_t value(VariantKey key, FeatureId feature) const;
+
+        // Every constant is set, so no variant depends on a shader-side default.
+        std::vector<pipeline_cache::FunctionConstant> constants(VariantKey key) const;
+        uint64_t combinationCount() const;
+        std::string describe(VariantKey key) const;
+
+    private:
+        std::vector<Feature> _features;
+        uint32_t _usedBits = 0;
+    };
+
+    struct VariantUsage {
+        uint64_t draws = 0;
+        uint64_t firstFrame = 0;
+        uint64_t lastFrame = 0;
+    };
+
+    /**
+     * Per-variant draw counts. Variants that are created but rarely drawn are the ones worth folding into a
+     * neighbour with a runtime branch instead; the report lists them so the variant space can be trimmed.
+     */
+    class VariantStats {
+    public:
+        explicit VariantStats(size_t maxVariants): _maxVariants(maxVariants) {}
+
+        // Returns false the first time the number of distinct variants goes over the limit.
+        bool recordDraw(VariantKey key, uint64_t frameIndex);
+
+        size_t variantCount() const { return _usage.size(); }
+        const std::unordered_map<VariantKey, VariantUsage>& usage() const { return _usage; }
+        void printReport(const VariantSpace& space, uint64_t frameIndex, uint64_t staleFrames) const;
+
+    private:
+        size_t _maxVariants;
+        bool _warned = false;
+        std::unordered_map<VariantKey, VariantUsage> _usage;
+    };
+
+    /**
+     * Lazily created pipelines for each variant of one base key. The first draw of a variant requests its pipeline
+     * from the async cache; until it is ready the draw falls back like any other pipeline miss.
+     */
+    template <typename State>
+    class VariantPipelines {
+    public:
+        VariantPipelines(const VariantSpace& space, const pipeline_cache::RenderPipelineKey& baseKey, pipeline_cache::AsyncPipelineCache<State>* pCache, size_t maxVariants = 32): _space(space), _baseKey(baseKey), _pCache(pCache), _stats(maxVariants) {}
+
+        // Chooses the compile profile for each variant, given its key as customized for profile 0; without one every
+        // variant uses profile 0.
+        using ProfileSelector = std::function<uint32_t(VariantKey variant, const pipeline_cache::RenderPipelineKey& key)>;
+
+        void setProfileSelector(ProfileSelector selector) { _selectProfile = std::move(selector); }
+
+        // Adjusts a variant's key beyond its constants, such as the vertex function and descriptor a vertex format
+        // needs. Applies to keys built after it is set.
+        using KeyCustomizer = std::function<void(VariantKey variant, pipeline_cache::RenderPipelineKey& key)>;
+
+        void setKeyCustomizer(KeyCustomizer customizer) { _customizeKey = std::move(customizer); }
+
+        State* resolve(VariantKey variant, uint64_t frameIndex, State* pFallback = nullptr) {
+            if (!_stats.recordDraw(variant, frameIndex)) {
+                __builtin_printf("Shader variants: more than %zu in use, latest %s\n", _stats.variantCount() - 1, _space.describe(variant).c_str());
+            }
+            return _pCache->resolve(key(variant, profileFor(variant)), pFallback);
+        }
+
+        // Queues a variant ahead of its first draw so that draw does not have to wait.
+        void prewarm(VariantKey variant, pipeline_cache::CompilePriority priority = pipeline_cache::CompilePriority::Background) {
+            _pCache->request(key(variant, profileFor(variant)), priority);
+        }
+
+        void prewarm(VariantKey variant, uint32_t profile, pipeline_cache::CompilePriority priority) {
+            _pCache->request(key(variant, profile), priority);
+        }
+
+        // The key a draw of this variant would use now, for deriving related pipelines from it.
+        const pipeline_cache::RenderPipelineKey& keyFor(VariantKey variant) {
+            return key(variant, profileFor(variant));
+        }
+
+        const VariantStats& stats() const { return _stats; }
+
+    private:
+        uint32_t profileFor(VariantKey variant) {
+            return _selectProfile ? _selectProfile(variant, key(variant, 0)) : 0;
+        }
+
+        const pipeline_cache::RenderPipelineKey& key(VariantKey variant, uint32_t profile) {
+            const uint64_t id = static_cast<uint64_t>(profile) << 32 | variant;
+            auto it = _keys.find(id);
+            if (it == _keys.end()) {
+                pipeline_cache::RenderPipelineKey key = _baseKey;
+                key.constants = _space.constants(variant);
+                key.compileProfile = profile;
+                if (_customizeKey) {
+                    _customizeKey(variant, key);
+                }
+                it = _keys.emplace(id, std::move(key)).first;
+            }
+            return it->second;
+        }
+
+        const VariantSpace& _space;
+        pipeline_cache::RenderPipelineKey _baseKey;
+        pipeline_cache::AsyncPipelineCache<State>* _pCache;
+        ProfileSelector _selectProfile;
+        KeyCustomizer _customizeKey;
+        // Keyed by profile in the high word and variant in the low word.
+        std::unordered_map<uint64_t, pipeline_cache::RenderPipelineKey> _keys;
+        VariantStats _stats;
+    };
+}
+
+#endif /* ShaderVariants_hpp */
@@ -0,0 +1,367 @@
+//
+//  Shaders.metal
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/25.
+//
+
+#include <metal_stdlib>
+using namespace metal;
+
+struct v2f {
+    float4 position [[position]];
+    half3 color;
+};
+
+// VertexData, VertexQuantization, InstanceData, PackedInstanceData, CameraData, MeshletData, MeshletDraw, TerrainTile,
+// TerrainDraw and TessellationParams are shared with the host through ShaderTypes.hpp.
+#include "ShaderTypesGenerated.h"
+
+// Specialization constants, set for every pipeline by the variant space in Renderer::buildShaders.
+// Branches on them are resolved at pipeline compile time, so each variant only carries its own path.
+constant uint kInstanceFormat [[function_constant(0)]]; // 0: InstanceData, 1: PackedInstanceData
+constant uint kColorMode [[function_constant(1)]];      // 0: per instance, 1: flat, 2: depth
+constant bool kCullInstances [[function_constant(2)]];  // collapse instances whose origin is far off screen
+constant uint kVertexFormat [[function_constant(3)]];   // 0: VertexData, 1: quantized position, 2: quantized position and normal
+constant bool kLitVertices = kVertexFormat == 2;
+constant uint kGeometry [[function_constant(4)]];       // 0: vertex function, 1: meshlets, 2: meshlets culled in the object function
+constant bool kCullMeshlets = kGeometry == 2;
+
+// Everything after decoding the object-space position, shared by both vertex functions. normal is only read for
+// lit vertices.
+static v2f shadeVertex(float4 pos, float3 normal, device const uchar* instanceBytes, device const CameraData& cameraData, uint instanceId) {
+    v2f o;
+    float4 origin;
+    float4 instanceColor;
+    float3 worldNormal = normal;
+    if (kInstanceFormat == 1) {
+        device const PackedInstanceData& instance = ((device const PackedInstanceData*)instanceBytes)[instanceId];
+        pos = float4(dot(instance.transformRows[0], pos), dot(instance.transformRows[1], pos), dot(instance.transformRows[2], pos), 1.0);
+        origin = float4(instance.transformRows[0].w, instance.transformRows[1].w, instance.transformRows[2].w, 1.0);
+        instanceColor = instance.instanceColor;
+        if (kLitVertices) {
+            worldNormal = float3(dot(instance.transformRows[0].xyz, normal), dot(instance.transformRows[1].xyz, normal), dot(instance.transformRows[2].xyz, normal));
+        }
+    } else {
+        device const InstanceData& instance = ((device const InstanceData*)instanceBytes)[instanceId];
+        pos = instance.instanceTransform * pos;
+        origin = instance.instanceTransform[3];
+        instanceColor = instance.instanceColor;
+        if (kLitVertices) {
+            worldNormal = (instance.instanceTransform * float4(normal, 0.0)).xyz;
+        }
+    }
+    
+    float4x4 viewProjection = cameraData.perspectiveTransform * cameraData.worldTransform;
+    pos = viewProjection * pos;
+    if (kCullInstances) {
+        // Every vertex of a culled instance lands on the same point outside the clip volume, so its triangles have
+        // no area and are dropped before rasterization. The margin keeps instances straddling the edge.
+        float4 clip = viewProjection * origin;
+        if (clip.w <= 0.0 || any(abs(clip.xy) > 1.5 * clip.w)) {
+            pos = float4(2.0, 2.0, 2.0, 1.0);
+        }
+    }
+    o.position = pos;
+    
+    if (kColorMode == 2) {
+        o.color = half3(saturate(pos.z / pos.w));
+    } else if (kColorMode == 1) {
+        o.color = half3(1.0);
+    } else {
+        o.color = half3(instanceColor.rgb);
+    }
+    if (kLitVertices) {
+        const float3 lightDirection = normalize(float3(0.3, 0.6, 0.7));
+        o.color *= half(0.35 + 0.65 * saturate(dot(normalize(worldNormal), lightDirection)));
+    }
+    return o;
+}
+
+v2f vertex vertexMain(device const VertexData* vertexData [[buffer(0)]], device const uchar* instanceBytes [[buffer(1)]], device const CameraData& cameraData [[buffer(2)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]]) {
+    return shadeVertex(float4(vertexData[vertexId].position, 1.0), float3(0.0), instanceBytes, cameraData, instanceId);
+}
+
+// The vertex descriptor converts the packed formats, see VertexQuantize.hpp: positions arrive as unorm within the
+// mesh bounds, normals as the two octahedral components.
+struct QuantizedVertex {
+    float4 position [[attribute(0)]];                                   // UShort4Normalized, w = 1
+    float4 normal [[attribute(1), function_constant(kLitVertices)]];    // Int1010102Normalized
+};
+
+static float3 decodeOctahedral(float2 e) {
+    float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += select(float2(t), float2(-t), n.xy >= 0.0);
+    return normalize(n);
+}
+
+v2f vertex vertexQuantized(QuantizedVertex in [[stage_in]], device const uchar* instanceBytes [[buffer(1)]], device const CameraData& cameraData [[buffer(2)]], constant VertexQuantization& quantization [[buffer(3)]], uint instanceId [[instance_id]]) {
+    float4 pos = float4(quantization.positionMin + in.position.xyz * quantization.positionExtent, 1.0);
+    float3 normal = float3(0.0);
+    if (kLitVertices) {
+        normal = decodeOctahedral(in.normal.xy);
+    }
+    return shadeVertex(pos, normal, instanceBytes, cameraData, instanceId);
+}
+
+// Meshlets, see MeshletBuilder.hpp. One object threadgroup tests 32 meshlets of one instance and launches a mesh
+// threadgroup for each one that survives; buffer indices are shared between the two stages.
+constant uint kMeshletsPerObject = 32;
+constant uint kMeshletVertices = 64;
+constant uint kMeshletTriangles = 124;
+
+struct MeshletPayload {
+    uint meshletIndices[kMeshletsPerObject];
+    uint instanceId;
+};
+
+static float4x4 instanceTransform(device const uchar* instanceBytes, uint instanceId) {
+    if (kInstanceFormat == 1) {
+        device const PackedInstanceData& instance = ((device const PackedInstanceData*)instanceBytes)[instanceId];
+        return transpose(float4x4(instance.transformRows[0], instance.transformRows[1], instance.transformRows[2], float4(0.0, 0.0, 0.0, 1.0)));
+    }
+    return ((device const InstanceData*)instanceBytes)[instanceId].instanceTransform;
+}
+
+// Instance transforms are rotations, translations and uniform scales, so the cone survives the transform as is.
+static bool meshletVisible(device const MeshletData& meshlet, float4x4 transform, constant MeshletDraw& draw) {
+    const float3 center = (transform * float4(float3(meshlet.center), 1.0)).xyz;
+    const float scale = max(length(transform[0].xyz), max(length(transform[1].xyz), length(transform[2].xyz)));
+    const float radius = meshlet.radius * scale;
+    for (uint i = 0; i < 6; ++i) {
+        if (dot(draw.frustumPlanes[i].xyz, center) + draw.frustumPlanes[i].w < -radius) {
+            return false;
+        }
+    }
+    if (meshlet.coneCutoff <= 1.0) {
+        const float3 apex = (transform * float4(float3(meshlet.coneApex), 1.0)).xyz;
+        const float3 axis = normalize((transform * float4(float3(meshlet.coneAxis), 0.0)).xyz);
+        if (dot(normalize(apex - draw.cameraPosition), axis) >= meshlet.coneCutoff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Dispatched as (meshlet groups, instances); each threadgroup is one SIMD group, so the survivors are compacted with
+// SIMD prefix sums rather than threadgroup atomics.
+[[object]] void objectMeshlets(object_data MeshletPayload& payload [[payload]], mesh_grid_properties meshGrid, device const uchar* instanceBytes [[buffer(1)]], device const MeshletData* meshlets [[buffer(4)]], constant MeshletDraw& draw [[buffer(7)]], uint2 group [[threadgroup_position_in_grid]], uint thread [[thread_index_in_threadgroup]]) {
+    const uint meshletIndex = group.x * kMeshletsPerObject + thread;
+    bool visible = meshletIndex < draw.meshletCount;
+    if (kCullMeshlets && visible) {
+        visible = meshletVisible(meshlets[meshletIndex], instanceTransform(instanceBytes, group.y), draw);
+    }
+    const uint slot = simd_prefix_exclusive_sum(uint(visible));
+    if (visible) {
+        payload.meshletIndices[slot] = meshletIndex;
+    }
+    const uint visibleCount = simd_sum(uint(visible));
+    if (thread == 0) {
+        payload.instanceId = group.y;
+        meshGrid.set_threadgroups_per_grid(uint3(visibleCount, 1, 1));
+    }
+}
+
+using MeshletMesh = metal::mesh<v2f, void, kMeshletVertices, kMeshletTriangles, topology::triangle>;
+
+// Reads vertices straight from the mesh file's vertex stream, in whichever format kVertexFormat says, since mesh
+// functions have no vertex descriptor.
+[[mesh]] void meshMeshlets(MeshletMesh output, const object_data MeshletPayload& payload [[payload]], device const uchar* vertexBytes [[buffer(0)]], device const uchar* instanceBytes [[buffer(1)]], device const CameraData& cameraData [[buffer(2)]], constant VertexQuantization& quantization [[buffer(3)]], device const MeshletData* meshlets [[buffer(4)]], device const uint* meshletVertices [[buffer(5)]], device const uchar* meshletTriangles [[buffer(6)]], constant MeshletDraw& draw [[buffer(7)]], uint group [[threadgroup_position_in_grid]], uint thread [[thread_index_in_threadgroup]]) {
+    device const MeshletData& meshlet = meshlets[payload.meshletIndices[group]];
+    if (thread == 0) {
+        output.set_primitive_count(meshlet.triangleCount);
+    }
+    
+    if (thread < meshlet.vertexCount) {
+        device const uchar* vertex = vertexBytes + meshletVertices[meshlet.vertexOffset + thread] * draw.vertexStride;
+        float4 pos;
+        float3 normal = float3(0.0);
+        if (kVertexFormat == 0) {
+            pos = float4(((device const VertexData*)vertex)->position, 1.0);
+        } else {
+            // Vertices are only 4-byte aligned, so the positions load as a packed vector.
+            const ushort4 encoded = ushort4(*(device const packed_ushort4*)vertex);
+            pos = float4(quantization.positionMin + float3(encoded.xyz) / 65535.0 * quantization.positionExtent, 1.0);
+        }
+        if (kLitVertices) {
+            // Int1010102Normalized by hand: sign-extend the two 10-bit components.
+            const uint packed = *(device const uint*)(vertex + draw.normalOffset);
+            const int2 e = int2(int(packed << 22) >> 22, int(packed << 12) >> 22);
+            normal = decodeOctahedral(max(float2(e) / 511.0, -1.0));
+        }
+        output.set_vertex(thread, shadeVertex(pos, normal, instanceBytes, cameraData, payload.instanceId));
+    }
+    
+    if (thread < meshlet.triangleCount) {
+        device const uchar* triangle = meshletTriangles + meshlet.triangleOffset + thread * 3;
+        output.set_index(thread * 3, triangle[0]);
+        output.set_index(thread * 3 + 1, triangle[1]);
+        output.set_index(thread * 3 + 2, triangle[2]);
+    }
+}
+
+// Terrain tiles, see TerrainQuadtree.hpp. Every tile instances the same grid of (column, row) vertices; the sample
+// under a vertex is integer, so tiles meeting along an edge read exactly the same heights there.
+v2f vertex vertexTerrain(device const ushort2* vertices [[buffer(0)]], device const TerrainTile* tiles [[buffer(1)]], device const CameraData& cameraData [[buffer(2)]], constant TerrainDraw& draw [[buffer(3)]], texture2d<float, access::read> heightmap [[texture(0)]], uint vertexId [[vertex_id]], uint instanceId [[instance_id]]) {
+    const TerrainTile tile = tiles[instanceId];
+    const uint2 sample = tile.origin + uint2(vertices[vertexId]) * tile.step;
+    const uint2 last = uint2(heightmap.get_width() - 1, heightmap.get_height() - 1);
+    const float height = heightmap.read(sample).r;
+    
+    v2f o;
+    const float4 pos = float4(draw.origin + float3(float(sample.x) * draw.spacing, height, float(sample.y) * draw.spacing), 1.0);
+    o.position = cameraData.perspectiveTransform * cameraData.worldTransform * pos;
+    
+    // Slope from the tile's own sample spacing, so a coarse tile shades like the surface it approximates.
+    const float dx = heightmap.read(uint2(min(sample.x + tile.step, last.x), sample.y)).r - heightmap.read(uint2(sample.x - min(sample.x, tile.step), sample.y)).r;
+    const float dz = heightmap.read(uint2(sample.x, min(sample.y + tile.step, last.y))).r - heightmap.read(uint2(sample.x, sample.y - min(sample.y, tile.step))).r;
+    const float3 normal = normalize(float3(-dx, 2.0 * float(tile.step) * draw.spacing, -dz));
+    const float3 lightDirection = normalize(float3(0.3, 0.6, 0.7));
+    const float t = float(tile.level) / float(max(draw.levels - 1, 1u));
+    const float3 levelColor = mix(float3(0.35, 0.55, 0.25), float3(0.75, 0.65, 0.45), t);
+    o.color = half3(levelColor * (0.35 + 0.65 * saturate(dot(normal, lightDirection))));
+    return o;
+}
+
+// Tessellated terrain: the same heightmap as quad patches without control points, cut up on the GPU as finely as
+// computeTessellationFactors asks and displaced here. R32Float is not filterable on every GPU, so heights between
+// samples are interpolated by hand.
+static float heightBetween(texture2d<float, access::read> heightmap, float2 sample) {
+    const uint2 last = uint2(heightmap.get_width() - 1, heightmap.get_height() - 1);
+    const uint2 i = min(uint2(sample), last - 1);
+    const float2 f = sample - float2(i);
+    const float top = mix(heightmap.read(i).r, heightmap.read(i + uint2(1, 0)).r, f.x);
+    const float bottom = mix(heightmap.read(i + uint2(0, 1)).r, heightmap.read(i + uint2(1, 1)).r, f.x);
+    return mix(top, bottom, f.y);
+}
+
+[[patch(quad)]] v2f vertex vertexTessellatedTerrain(constant TessellationParams& params [[buffer(3)]], device const CameraData& cameraData [[buffer(2)]], texture2d<float, access::read> heightmap [[texture(0)]], uint patchId [[patch_id]], float2 uv [[position_in_patch]]) {
+    // Both patches along an edge reach the same samples on it, and the tessellator cuts it alike from both sides.
+    const float2 patch = float2(patchId % params.patchesPerSide, patchId / params.patchesPerSide);
+    const float2 sample = (patch + uv) * float(params.samplesPerPatch);
+    const float2 last = float2(heightmap.get_width() - 1, heightmap.get_height() - 1);
+    
+    v2f o;
+    const float4 pos = float4(params.origin + float3(sample.x * params.spacing, heightBetween(heightmap, sample), sample.y * params.spacing), 1.0);
+    o.position = cameraData.perspectiveTransform * cameraData.worldTransform * pos;
+    
+    const float dx = heightBetween(heightmap, float2(min(sample.x + 1.0, last.x), sample.y)) - heightBetween(heightmap, float2(max(sample.x - 1.0, 0.0), sample.y));
+    const float dz = heightBetween(heightmap, float2(sample.x, min(sample.y + 1.0, last.y))) - heightBetween(heightmap, float2(sample.x, max(sample.y - 1.0, 0.0)));
+    const float3 normal = normalize(float3(-dx, 2.0 * params.spacing, -dz));
+    const float3 lightDirection = normalize(float3(0.3, 0.6, 0.7));
+    o.color = half3(float3(0.45, 0.6, 0.35) * (0.35 + 0.65 * saturate(dot(normal, lightDirection))));
+    return o;
+}
+
+half4 fragment fragmentMain(v2f in [[stage_in]]) {
+    return half4(in.color, 1.0);
+}
+
+// Material building blocks. MaterialGraph stitches them at runtime into stitchedMaterial, which fragmentMaterial
+// links against: in0 is the interpolated colour, in1 the fragment depth and in2 the tint from buffer(0).
+[[stitchable]] float4 materialGrayscale(float4 color) {
+    float luminance = dot(color.rgb, float3(0.299, 0.587, 0.114));
+    return float4(float3(luminance), color.a);
+}
+
+[[stitchable]] float4 materialTint(float4 color, float4 tint) {
+    return color * tint;
+}
+
+[[stitchable]] float4 materialDepthFade(float4 color, float depth) {
+    return float4(color.rgb * (1.0 - depth), color.a);
+}
+
+[[stitchable]] float4 materialMix(float4 a, float4 b, float t) {
+    return mix(a, b, t);
+}
+
+extern float4 stitchedMaterial(float4 color, float depth, float4 tint);
+
+half4 fragment fragmentMaterial(v2f in [[stage_in]], constant float4& tint [[buffer(0)]]) {
+    return half4(stitchedMaterial(float4(float3(in.color), 1.0), in.position.z, tint));
+}
+
+// The same matrices as math_utils, which writes them out by rows.
+static float4x4 translation(float3 v) {
+    return float4x4(float4(1.0, 0.0, 0.0, 0.0), float4(0.0, 1.0, 0.0, 0.0), float4(0.0, 0.0, 1.0, 0.0), float4(v, 1.0));
+}
+
+static float4x4 rotationY(float a) {
+    return transpose(float4x4(float4(cos(a), 0.0, sin(a), 0.0), float4(0.0, 1.0, 0.0, 0.0), float4(-sin(a), 0.0, cos(a), 0.0), float4(0.0, 0.0, 0.0, 1.0)));
+}
+
+static float4x4 rotationZ(float a) {
+    return transpose(float4x4(float4(cos(a), sin(a), 0.0, 0.0), float4(-sin(a), cos(a), 0.0, 0.0), float4(0.0, 0.0, 1.0, 0.0), float4(0.0, 0.0, 0.0, 1.0)));
+}
+
+// GPU version of the instance loop in Renderer::draw. Dispatched in whole threadgroups, so threads past the last
+// instance return straight away.
+kernel void animateInstances(device PackedInstanceData* instances [[buffer(0)]], constant InstanceAnimation& animation [[buffer(1)]], uint i [[thread_position_in_grid]]) {
+    if (i >= animation.instanceCount) {
+        return;
+    }
+    const float t = float(i) / float(animation.instanceCount);
+    const float xoff = (t * 2.0 - 1.0) + (1.0 / float(animation.instanceCount));
+    const float yoff = sin((t + animation.angle) * 2.0 * M_PI_F);
+    const float3 center = animation.objectPosition;
+    
+    const float4x4 objectRotation = translation(center) * rotationY(-animation.angle) * translation(-center);
+    const float4x4 scale = float4x4(float4(animation.scale, 0.0, 0.0, 0.0), float4(0.0, animation.scale, 0.0, 0.0), float4(0.0, 0.0, animation.scale, 0.0), float4(0.0, 0.0, 0.0, 1.0));
+    const float4x4 transform = objectRotation * translation(center + float3(xoff, yoff, 0.0)) * rotationY(animation.angle) * rotationZ(animation.angle) * scale;
+    const float4x4 rows = transpose(transform);
+    
+    instances[i].transformRows[0] = rows[0];
+    instances[i].transformRows[1] = rows[1];
+    instances[i].transformRows[2] = rows[2];
+    instances[i].instanceColor = float4(t, 1.0 - t, sin(M_PI_F * 2.0 * t), 1.0);
+}
+
+// The GPU version of tessellation::patchFactors, one thread per patch; see TessellationFactors.hpp. An edge's factor
+// comes from its two corners alone, so the patches either side of it always agree. Dispatched in whole threadgroups.
+static float edgeFactor(constant TessellationParams& params, float3 a, float3 b) {
+    const float pixels = length(b - a) * params.pixelsPerUnit / max(length((a + b) * 0.5 - params.cameraPosition), 1e-3);
+    return clamp(pixels / params.edgePixels, 1.0, params.maxFactor);
+}
+
+kernel void computeTessellationFactors(device MTLQuadTessellationFactorsHalf* factors [[buffer(0)]], device const float2* patchBounds [[buffer(1)]], constant TessellationParams& params [[buffer(2)]], texture2d<float, access::read> heightmap [[texture(0)]], uint patch [[thread_position_in_grid]]) {
+    if (patch >= params.patchesPerSide * params.patchesPerSide) {
+        return;
+    }
+    const uint2 xz = uint2(patch % params.patchesPerSide, patch / params.patchesPerSide);
+    const float size = float(params.samplesPerPatch) * params.spacing;
+    const float2 bounds = patchBounds[patch];
+    const float3 boundsMin = params.origin + float3(float(xz.x) * size, bounds.x, float(xz.y) * size);
+    const float3 boundsMax = params.origin + float3(float(xz.x + 1) * size, bounds.y, float(xz.y + 1) * size);
+    for (uint i = 0; i < 6; ++i) {
+        const float4 plane = params.frustumPlanes[i];
+        if (dot(plane.xyz, select(boundsMin, boundsMax, plane.xyz >= 0.0)) + plane.w < 0.0) {
+            // A zero edge factor drops the patch before tessellation.
+            for (uint edge = 0; edge < 4; ++edge) {
+                factors[patch].edgeTessellationFactor[edge] = 0.0h;
+            }
+            factors[patch].insideTessellationFactor[0] = 0.0h;
+            factors[patch].insideTessellationFactor[1] = 0.0h;
+            return;
+        }
+    }
+    
+    // Corners (u, v) = (0, 0), (1, 0), (0, 1), (1, 1); edges in the order u = 0, v = 0, u = 1, v = 1.
+    const uint2 first = xz * params.samplesPerPatch;
+    float3 corners[4];
+    for (uint corner = 0; corner < 4; ++corner) {
+        const uint2 sample = first + uint2(corner & 1, corner >> 1) * params.samplesPerPatch;
+        corners[corner] = params.origin + float3(float(sample.x) * params.spacing, heightmap.read(sample).r, float(sample.y) * params.spacing);
+    }
+    const float u0 = edgeFactor(params, corners[0], corners[2]);
+    const float v0 = edgeFactor(params, corners[0], corners[1]);
+    const float u1 = edgeFactor(params, corners[1], corners[3]);
+    const float v1 = edgeFactor(params, corners[2], corners[3]);
+    factors[patch].edgeTessellationFactor[0] = half(u0);
+    factors[patch].edgeTessellationFactor[1] = half(v0);
+    factors[patch].edgeTessellationFactor[2] = half(u1);
+    factors[patch].edgeTessellationFactor[3] = half(v1);
+    factors[patch].insideTessellationFactor[0] = half(max(v0, v1));
+    factors[patch].insideTessellationFactor[1] = half(max(u0, u1));
+}
@@ -0,0 +1,55 @@
+//
+//  StartupProbe.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/25.
+//
+
+#include "StartupProbe.hpp"
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace startup_probe {
+using Clock = std::chrono::steady_clock;
+
+// Initialized before main(), which is as close to process start as we can get portably.
+static const Clock::time_point kProcessStart = Clock::now();
+
+struct Mark {
+    const char* label;
+    double milliseconds;
+};
+
+static std::mutex sMutex;
+static std::vector<Mark> sMarks;
+
+void mark(const char* label) {
+    const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - kProcessStart).count();
+    std::lock_guard<std::mutex> lock(sMutex);
+    for (const Mark& m : sMarks) {
+        if (strcmp(m.label, label) == 0) {
+            return;
+        }
+    }
+    sMarks.push_back(Mark { label, milliseconds });
+}
+
+double millisecondsAt(const char* label) {
+    std::lock_guard<std::mutex> lock(sMutex);
+    for (const Mark& m : sMarks) {
+        if (strcmp(m.label, label) == 0) {
+            return m.milliseconds;
+        }
+    }
+    return -1.0;
+}
+
+void report() {
+    std::lock_guard<std::mutex> lock(sMutex);
+    for (const Mark& m : sMarks) {
+        __builtin_printf("startup: %s %.2f\n", m.label, m.milliseconds);
+    }
+}
+}
@@ -0,0 +1,21 @@
+//
+//  StartupProbe.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/25.
+//
+
+#ifndef StartupProbe_hpp
+#define StartupProbe_hpp
+
+namespace startup_probe {
+    // Records the time since process start under label, which must be a string literal.
+    // Only the first mark of each label is kept.
+    void mark(const char* label);
+    // Milliseconds since process start for label, or a negative value if it was never marked.
+    double millisecondsAt(const char* label);
+    // Prints one "startup: <label> <ms>" line per mark, in the order they were recorded.
+    void report();
+}
+
+#endif /* StartupProbe_hpp */
@@ -0,0 +1,21 @@
+//
+//  Statistics.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "Statistics.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace statistics {
+double percentile(std::vector<double> values, double fraction) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    const size_t index = std::min(values.size() - 1, static_cast<size_t>(std::lround(fraction * (values.size() - 1))));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+}
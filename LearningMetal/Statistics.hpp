@@ -0,0 +1,18 @@
+//
+//  Statistics.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef Statistics_hpp
+#define Statistics_hpp
+
+#include <vector>
+
+namespace statistics {
+    // Nearest-rank percentile, fraction in [0, 1]; 0 for no values. Takes a copy because it partially sorts it.
+    double percentile(std::vector<double> values, double fraction);
+}
+
+#endif /* Statistics_hpp */
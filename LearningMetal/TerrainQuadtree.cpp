@@ -0,0 +1,321 @@
+//
+//  TerrainQuadtree.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "TerrainQuadtree.hpp"
+#include "ParallelFor.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace terrain {
+// Below this many heightmap samples a range of node rows is not worth a thread.
+static constexpr size_t kMinSamplesPerTask = 1 << 16;
+
+enum NodeState : uint8_t {
+    kUnvisited,
+    kLeaf,
+    kCulled,
+    kSplit
+};
+
+// Neighbours across each edge, in the order of the edge bits.
+static constexpr int kNeighbourX[4] = { 0, 1, 0, -1 };
+static constexpr int kNeighbourZ[4] = { -1, 0, 1, 0 };
+
+TileMesh buildTileMesh(uint32_t tileCells) {
+    const uint32_t n = tileCells;
+    const uint32_t columns = n + 1;
+    TileMesh mesh;
+    mesh.vertices.reserve(size_t(columns) * columns * 2);
+    for (uint32_t row = 0; row <= n; ++row) {
+        for (uint32_t column = 0; column <= n; ++column) {
+            mesh.vertices.push_back(static_cast<uint16_t>(column));
+            mesh.vertices.push_back(static_cast<uint16_t>(row));
+        }
+    }
+
+    // Each variant is the regular grid with the odd vertices of its stitched edges moved onto their even neighbour:
+    // the triangles that collapse are dropped, and those left fan out to the coarser neighbour's vertices.
+    for (uint32_t mask = 0; mask < kStitchVariants; ++mask) {
+        const auto vertex = [&](uint32_t column, uint32_t row) {
+            if (((mask & kEdgeNorth) && row == 0) || ((mask & kEdgeSouth) && row == n)) {
+                column &= ~1u;
+            }
+            if (((mask & kEdgeWest) && column == 0) || ((mask & kEdgeEast) && column == n)) {
+                row &= ~1u;
+            }
+            return static_cast<uint16_t>(row * columns + column);
+        };
+        const auto triangle = [&](uint16_t a, uint16_t b, uint16_t c) {
+            if (a != b && b != c && a != c) {
+                mesh.indices.insert(mesh.indices.end(), { a, b, c });
+            }
+        };
+        mesh.variants[mask].firstIndex = static_cast<uint32_t>(mesh.indices.size());
+        for (uint32_t row = 0; row < n; ++row) {
+            for (uint32_t column = 0; column < n; ++column) {
+                // Counter-clockwise seen from above, split like procedural grids.
+                triangle(vertex(column, row), vertex(column, row + 1), vertex(column + 1, row + 1));
+                triangle(vertex(column, row), vertex(column + 1, row + 1), vertex(column + 1, row));
+            }
+        }
+        mesh.variants[mask].indexCount = static_cast<uint32_t>(mesh.indices.size()) - mesh.variants[mask].firstIndex;
+    }
+    return mesh;
+}
+
+void extractFrustumPlanes(const float viewProjection[16], float planes[6][4]) {
+    const auto row = [&](int r, int i) { return viewProjection[i * 4 + r]; };
+    for (int i = 0; i < 4; ++i) {
+        planes[0][i] = row(3, i) + row(0, i);
+        planes[1][i] = row(3, i) - row(0, i);
+        planes[2][i] = row(3, i) + row(1, i);
+        planes[3][i] = row(3, i) - row(1, i);
+        planes[4][i] = row(2, i);
+        planes[5][i] = row(3, i) - row(2, i);
+    }
+    for (int p = 0; p < 6; ++p) {
+        const float length = std::sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+        for (int i = 0; i < 4; ++i) {
+            planes[p][i] /= length;
+        }
+    }
+}
+
+Quadtree::Quadtree(const TerrainDesc& desc, std::vector<float> heights, uint32_t threads)
+: _desc(desc), _resolution(heightmapResolution(desc)), _heights(std::move(heights)) {
+    size_t offset = 0;
+    for (uint32_t level = 0; level < _desc.levels; ++level) {
+        _levelOffsets.push_back(offset);
+        offset += size_t(1) << (2 * level);
+    }
+    _minHeight.resize(offset);
+    _maxHeight.resize(offset);
+    _error.resize(offset);
+
+    // Leaves first: a parent's bounds are its children's, and its error at least theirs, so that a node whose error
+    // is small enough never hides a detailed descendant.
+    const uint32_t leafLevel = _desc.levels - 1;
+    for (uint32_t level = leafLevel + 1; level-- > 0;) {
+        const uint32_t side = 1u << level;
+        const size_t samplesPerRow = size_t(_resolution) * (_desc.tileCells << (leafLevel - level));
+        parallel::forRange(side, std::max<size_t>(1, kMinSamplesPerTask / samplesPerRow), threads, [&](size_t begin, size_t end, size_t) {
+            for (uint32_t z = static_cast<uint32_t>(begin); z < end; ++z) {
+                for (uint32_t x = 0; x < side; ++x) {
+                    const size_t node = nodeIndex(level, x, z);
+                    float error = tileError(level, x, z);
+                    if (level == leafLevel) {
+                        const uint32_t cells = _desc.tileCells;
+                        float lowest = INFINITY, highest = -INFINITY;
+                        for (uint32_t row = z * cells; row <= (z + 1) * cells; ++row) {
+                            const float* pRow = _heights.data() + size_t(row) * _resolution;
+                            for (uint32_t column = x * cells; column <= (x + 1) * cells; ++column) {
+                                lowest = std::min(lowest, pRow[column]);
+                                highest = std::max(highest, pRow[column]);
+                            }
+                        }
+                        _minHeight[node] = lowest;
+                        _maxHeight[node] = highest;
+                    } else {
+                        _minHeight[node] = INFINITY;
+                        _maxHeight[node] = -INFINITY;
+                        for (uint32_t child = 0; child < 4; ++child) {
+                            const size_t c = nodeIndex(level + 1, 2 * x + (child & 1), 2 * z + (child >> 1));
+                            _minHeight[node] = std::min(_minHeight[node], _minHeight[c]);
+                            _maxHeight[node] = std::max(_maxHeight[node], _maxHeight[c]);
+                            error = std::max(error, _error[c]);
+                        }
+                    }
+                    _error[node] = error;
+                }
+            }
+        });
+    }
+}
+
+// The largest distance between a heightmap sample and the tile's triangles above or below it.
+float Quadtree::tileError(uint32_t level, uint32_t x, uint32_t z) const {
+    const uint32_t step = 1u << (_desc.levels - 1 - level);
+    if (step == 1) {
+        return 0.0f;
+    }
+    const uint32_t cells = _desc.tileCells;
+    const float inverseStep = 1.0f / static_cast<float>(step);
+    float error = 0.0f;
+    for (uint32_t cellRow = 0; cellRow < cells; ++cellRow) {
+        const size_t row0 = size_t(z * cells + cellRow) * step;
+        for (uint32_t cellColumn = 0; cellColumn < cells; ++cellColumn) {
+            const size_t column0 = size_t(x * cells + cellColumn) * step;
+            const float* pTop = _heights.data() + row0 * _resolution + column0;
+            const float* pBottom = pTop + size_t(step) * _resolution;
+            const float a = pTop[0], b = pTop[step], c = pBottom[step], d = pBottom[0];
+            for (uint32_t v = 0; v <= step; ++v) {
+                const float* pRow = pTop + size_t(v) * _resolution;
+                const float fv = static_cast<float>(v) * inverseStep;
+                // Triangle (a, d, c) where u <= v, (a, c, b) past the diagonal.
+                for (uint32_t u = 0; u <= step; ++u) {
+                    const float fu = static_cast<float>(u) * inverseStep;
+                    const float plane = u <= v ? a + (d - a) * fv + (c - d) * fu : a + (b - a) * fu + (c - b) * fv;
+                    error = std::max(error, std::fabs(pRow[u] - plane));
+                }
+            }
+        }
+    }
+    return error;
+}
+
+void Quadtree::nodeBounds(uint32_t level, uint32_t x, uint32_t z, float boundsMin[3], float boundsMax[3]) const {
+    const size_t node = nodeIndex(level, x, z);
+    const float size = static_cast<float>(_desc.tileCells << (_desc.levels - 1 - level)) * _desc.spacing;
+    boundsMin[0] = _desc.origin[0] + static_cast<float>(x) * size;
+    boundsMin[1] = _desc.origin[1] + _minHeight[node];
+    boundsMin[2] = _desc.origin[2] + static_cast<float>(z) * size;
+    boundsMax[0] = boundsMin[0] + size;
+    boundsMax[1] = _desc.origin[1] + _maxHeight[node];
+    boundsMax[2] = boundsMin[2] + size;
+}
+
+// Outside when the box's corner furthest along a plane's normal is still behind it.
+bool Quadtree::isVisible(const View& view, uint32_t level, uint32_t x, uint32_t z) const {
+    float boundsMin[3], boundsMax[3];
+    nodeBounds(level, x, z, boundsMin, boundsMax);
+    for (const float* plane : view.frustumPlanes) {
+        float distance = plane[3];
+        for (int i = 0; i < 3; ++i) {
+            distance += plane[i] * (plane[i] >= 0.0f ? boundsMax[i] : boundsMin[i]);
+        }
+        if (distance < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Quadtree::split(const View& view, Selection& selection, uint32_t level, uint32_t x, uint32_t z) const {
+    selection._states[nodeIndex(level, x, z)] = kSplit;
+    for (uint32_t child = 0; child < 4; ++child) {
+        const uint32_t childX = 2 * x + (child & 1), childZ = 2 * z + (child >> 1);
+        ++selection._stats.visitedNodes;
+        if (isVisible(view, level + 1, childX, childZ)) {
+            selection._states[nodeIndex(level + 1, childX, childZ)] = kLeaf;
+            selection._leaves[level + 1].emplace_back(childX, childZ);
+        } else {
+            selection._states[nodeIndex(level + 1, childX, childZ)] = kCulled;
+            ++selection._stats.culledNodes;
+        }
+    }
+}
+
+// The level of the selected leaf covering node (level, x, z), or level itself if that node was split further.
+int Quadtree::coveringLevel(const Selection& selection, uint32_t level, uint32_t x, uint32_t z, bool& culled) const {
+    for (int l = static_cast<int>(level); l >= 0; --l) {
+        const uint8_t state = selection._states[nodeIndex(l, x >> (level - l), z >> (level - l))];
+        if (state != kUnvisited) {
+            culled = state == kCulled;
+            return state == kSplit ? static_cast<int>(level) : l;
+        }
+    }
+    culled = true;
+    return 0;
+}
+
+void Quadtree::select(const View& view, Selection& selection) const {
+    const uint32_t levels = _desc.levels;
+    selection._states.assign(nodeCount(), kUnvisited);
+    selection._leaves.resize(levels);
+    for (auto& leaves : selection._leaves) {
+        leaves.clear();
+    }
+    selection._stats = {};
+    SelectionStats& stats = selection._stats;
+
+    // Refine level by level: a visible node splits while its error, seen from its nearest point, exceeds the budget.
+    stats.visitedNodes = 1;
+    if (isVisible(view, 0, 0, 0)) {
+        selection._states[0] = kLeaf;
+        selection._leaves[0].emplace_back(0, 0);
+    } else {
+        selection._states[0] = kCulled;
+        stats.culledNodes = 1;
+    }
+    for (uint32_t level = 0; level + 1 < levels; ++level) {
+        for (const auto& [x, z] : selection._leaves[level]) {
+            float boundsMin[3], boundsMax[3];
+            nodeBounds(level, x, z, boundsMin, boundsMax);
+            float distanceSquared = 0.0f;
+            for (int i = 0; i < 3; ++i) {
+                const float outside = std::max({ boundsMin[i] - view.cameraPosition[i], view.cameraPosition[i] - boundsMax[i], 0.0f });
+                distanceSquared += outside * outside;
+            }
+            const float error = _error[nodeIndex(level, x, z)] * view.pixelsPerUnit;
+            if (error > 0.0f && error * error > view.maxPixelError * view.maxPixelError * distanceSquared) {
+                split(view, selection, level, x, z);
+            }
+        }
+    }
+
+    // Finest first, so that splits only ever add leaves at levels still to come: any neighbour more than one level
+    // coarser is split down towards this leaf. Culled neighbours are never drawn, so they never need to match.
+    for (uint32_t level = levels; level-- > 2;) {
+        const uint32_t side = 1u << level;
+        std::vector<std::pair<uint32_t, uint32_t>>& leaves = selection._leaves[level];
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            const auto [x, z] = leaves[i];
+            if (selection._states[nodeIndex(level, x, z)] != kLeaf) {
+                continue;
+            }
+            for (int edge = 0; edge < 4; ++edge) {
+                const uint32_t neighbourX = x + kNeighbourX[edge], neighbourZ = z + kNeighbourZ[edge];
+                if (neighbourX >= side || neighbourZ >= side) {
+                    continue;
+                }
+                bool culled;
+                for (int l = coveringLevel(selection, level, neighbourX, neighbourZ, culled); !culled && l + 1 < static_cast<int>(level); ++l) {
+                    const uint32_t shift = level - l;
+                    if (selection._states[nodeIndex(l, neighbourX >> shift, neighbourZ >> shift)] != kLeaf) {
+                        break;
+                    }
+                    split(view, selection, l, neighbourX >> shift, neighbourZ >> shift);
+                    ++stats.balanceSplits;
+                }
+            }
+        }
+    }
+
+    // Edges bordering a coarser leaf get stitched; then tiles are grouped by stitch mask.
+    selection._unsorted.clear();
+    uint32_t counts[kStitchVariants] = {};
+    for (uint32_t level = 0; level < levels; ++level) {
+        const uint32_t side = 1u << level;
+        for (const auto& [x, z] : selection._leaves[level]) {
+            if (selection._states[nodeIndex(level, x, z)] != kLeaf) {
+                continue;
+            }
+            uint32_t mask = 0;
+            for (int edge = 0; edge < 4; ++edge) {
+                const uint32_t neighbourX = x + kNeighbourX[edge], neighbourZ = z + kNeighbourZ[edge];
+                bool culled;
+                if (neighbourX < side && neighbourZ < side && coveringLevel(selection, level, neighbourX, neighbourZ, culled) < static_cast<int>(level) && !culled) {
+                    mask |= 1u << edge;
+                }
+            }
+            selection._unsorted.push_back({ x, z, level, mask });
+            ++counts[mask];
+            stats.maxLevel = std::max(stats.maxLevel, level);
+        }
+    }
+    uint32_t first = 0;
+    for (uint32_t mask = 0; mask < kStitchVariants; ++mask) {
+        selection._groups[mask] = { first, 0 };
+        first += counts[mask];
+    }
+    selection._tiles.resize(selection._unsorted.size());
+    for (const Tile& tile : selection._unsorted) {
+        TileGroup& group = selection._groups[tile.stitchMask];
+        selection._tiles[group.firstTile + group.tileCount++] = tile;
+    }
+}
+}
@@ -0,0 +1,148 @@
+//
+//  TerrainQuadtree.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef TerrainQuadtree_hpp
+#define TerrainQuadtree_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Chunked heightfield terrain. A square heightmap is covered by a quadtree of tiles that all share one grid of
+ * tileCells x tileCells cells: the root spans the whole heightmap, and each level halves the tile size, so the leaves
+ * sample every height. Each frame select() walks the tree from the camera: tiles outside the frustum are culled and
+ * tiles whose geometric error would cover more than maxPixelError pixels are split. Neighbouring tiles are then kept
+ * within one level of each other, so a tile only ever borders a coarser tile along a whole edge, and it skips its odd
+ * vertices along that edge so both meet without cracks. The 16 edge combinations are 16 index ranges of one shared
+ * index buffer. Plain C++, independent of Metal.
+ */
+namespace terrain {
+    // Bits of a tile's stitch mask, set for each edge along which the neighbour is one level coarser. Rows of a tile
+    // run along +z, so north is its row 0 and west its column 0.
+    enum EdgeBits : uint32_t {
+        kEdgeNorth = 1,
+        kEdgeEast = 2,
+        kEdgeSouth = 4,
+        kEdgeWest = 8
+    };
+    static constexpr uint32_t kStitchVariants = 16;
+
+    struct IndexRange {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    // The geometry every tile draws; heights come from the heightmap in the vertex function.
+    struct TileMesh {
+        std::vector<uint16_t> vertices; // (column, row) of each of the (tileCells + 1)^2 vertices, row-major
+        std::vector<uint16_t> indices;  // every stitch variant back to back
+        IndexRange variants[kStitchVariants];
+    };
+
+    // tileCells is even and at most 254, so indices fit 16 bits.
+    TileMesh buildTileMesh(uint32_t tileCells);
+
+    struct TerrainDesc {
+        uint32_t tileCells = 32;
+        uint32_t levels = 6;          // the root's level is 0, the leaves' levels - 1
+        float spacing = 1.0f;         // world units between heightmap samples
+        float origin[3] = { 0, 0, 0 }; // world position of sample (0, 0) at height 0
+    };
+
+    // Heightmap samples per side: one per vertex of the leaf tiles.
+    inline uint32_t heightmapResolution(const TerrainDesc& desc) {
+        return (desc.tileCells << (desc.levels - 1)) + 1;
+    }
+
+    struct View {
+        float frustumPlanes[6][4]; // world space, normalized, facing inwards
+        float cameraPosition[3];
+        float pixelsPerUnit;       // viewport height over 2 tan(fovY / 2)
+        float maxPixelError = 1.0f;
+    };
+
+    // The planes of a column-major viewProjection with Metal's [0, 1] clip depth, as math_utils::makeFrustumPlanes.
+    void extractFrustumPlanes(const float viewProjection[16], float planes[6][4]);
+
+    // A tile's place at its level, in tiles; it covers samples origin to origin + tileCells * step of the heightmap.
+    struct Tile {
+        uint32_t x;
+        uint32_t z;
+        uint32_t level;
+        uint32_t stitchMask;
+    };
+
+    struct TileGroup {
+        uint32_t firstTile;
+        uint32_t tileCount;
+    };
+
+    struct SelectionStats {
+        uint32_t visitedNodes = 0;
+        uint32_t culledNodes = 0;
+        uint32_t balanceSplits = 0; // nodes split only to keep neighbours within a level
+        uint32_t maxLevel = 0;
+    };
+
+    class Quadtree;
+
+    // What select() produces, kept from frame to frame so its storage is reused.
+    class Selection {
+    public:
+        // Visible tiles grouped by stitch mask: one instanced draw per group.
+        const std::vector<Tile>& tiles() const { return _tiles; }
+        const TileGroup& group(uint32_t stitchMask) const { return _groups[stitchMask]; }
+        const SelectionStats& stats() const { return _stats; }
+
+    private:
+        friend class Quadtree;
+
+        std::vector<uint8_t> _states;                                   // per node
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> _leaves; // per level, (x, z) of visible leaves
+        std::vector<Tile> _unsorted;
+        std::vector<Tile> _tiles;
+        TileGroup _groups[kStitchVariants];
+        SelectionStats _stats;
+    };
+
+    class Quadtree {
+    public:
+        // heights holds heightmapResolution(desc)^2 samples, rows along +z. Bounds and errors are built in parallel;
+        // 0 threads: one per hardware thread.
+        Quadtree(const TerrainDesc& desc, std::vector<float> heights, uint32_t threads = 0);
+
+        void select(const View& view, Selection& selection) const;
+
+        const TerrainDesc& desc() const { return _desc; }
+        uint32_t resolution() const { return _resolution; }
+        const std::vector<float>& heights() const { return _heights; }
+        size_t nodeCount() const { return _error.size(); }
+        // World-space bounding box of a node.
+        void nodeBounds(uint32_t level, uint32_t x, uint32_t z, float boundsMin[3], float boundsMax[3]) const;
+        // The largest vertical distance between the node's tile and the heightmap beneath it, or any descendant's.
+        float nodeError(uint32_t level, uint32_t x, uint32_t z) const { return _error[nodeIndex(level, x, z)]; }
+
+    private:
+        size_t nodeIndex(uint32_t level, uint32_t x, uint32_t z) const { return _levelOffsets[level] + (size_t(z) << level) + x; }
+        float tileError(uint32_t level, uint32_t x, uint32_t z) const;
+        bool isVisible(const View& view, uint32_t level, uint32_t x, uint32_t z) const;
+        void split(const View& view, Selection& selection, uint32_t level, uint32_t x, uint32_t z) const;
+        int coveringLevel(const Selection& selection, uint32_t level, uint32_t x, uint32_t z, bool& culled) const;
+
+        TerrainDesc _desc;
+        uint32_t _resolution;
+        std::vector<float> _heights;
+        std::vector<size_t> _levelOffsets;
+        std::vector<float> _minHeight;
+        std::vector<float> _maxHeight;
+        std::vector<float> _error;
+    };
+}
+
+#endif /* TerrainQuadtree_hpp */
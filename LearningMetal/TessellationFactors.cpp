@@ -0,0 +1,100 @@
+//
+//  TessellationFactors.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "TessellationFactors.hpp"
+#include "ParallelFor.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace tessellation {
+// Below these a range of patch rows is not worth a thread.
+static constexpr size_t kMinSamplesPerTask = 1 << 16;
+static constexpr size_t kMinPatchesPerTask = 1 << 12;
+
+float edgeFactor(const FactorParams& params, const float a[3], const float b[3]) {
+    float lengthSquared = 0.0f, distanceSquared = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+        const float d = b[i] - a[i];
+        const float m = (a[i] + b[i]) * 0.5f - params.cameraPosition[i];
+        lengthSquared += d * d;
+        distanceSquared += m * m;
+    }
+    const float pixels = std::sqrt(lengthSquared) * params.pixelsPerUnit / std::max(std::sqrt(distanceSquared), 1e-3f);
+    return std::clamp(pixels / params.edgePixels, 1.0f, params.maxFactor);
+}
+
+void computeHeightBounds(const PatchGrid& grid, const float* pHeights, float* pBounds, uint32_t threads) {
+    const uint32_t resolution = heightmapResolution(grid);
+    const uint32_t cells = grid.samplesPerPatch;
+    const size_t samplesPerRow = size_t(resolution) * cells;
+    parallel::forRange(grid.patchesPerSide, std::max<size_t>(1, kMinSamplesPerTask / samplesPerRow), threads, [&](size_t begin, size_t end, size_t) {
+        for (uint32_t z = static_cast<uint32_t>(begin); z < end; ++z) {
+            for (uint32_t x = 0; x < grid.patchesPerSide; ++x) {
+                float lowest = INFINITY, highest = -INFINITY;
+                for (uint32_t row = z * cells; row <= (z + 1) * cells; ++row) {
+                    const float* pRow = pHeights + size_t(row) * resolution;
+                    for (uint32_t column = x * cells; column <= (x + 1) * cells; ++column) {
+                        lowest = std::min(lowest, pRow[column]);
+                        highest = std::max(highest, pRow[column]);
+                    }
+                }
+                float* pPatch = pBounds + (size_t(z) * grid.patchesPerSide + x) * 2;
+                pPatch[0] = lowest;
+                pPatch[1] = highest;
+            }
+        }
+    });
+}
+
+QuadFactors patchFactors(const FactorParams& params, const PatchGrid& grid, const float* pHeights, const float* pBounds, uint32_t x, uint32_t z) {
+    const float* pPatch = pBounds + (size_t(z) * grid.patchesPerSide + x) * 2;
+    const float size = static_cast<float>(grid.samplesPerPatch) * grid.spacing;
+    const float boundsMin[3] = { grid.origin[0] + static_cast<float>(x) * size, grid.origin[1] + pPatch[0], grid.origin[2] + static_cast<float>(z) * size };
+    const float boundsMax[3] = { boundsMin[0] + size, grid.origin[1] + pPatch[1], boundsMin[2] + size };
+    for (const float* plane : params.frustumPlanes) {
+        float distance = plane[3];
+        for (int i = 0; i < 3; ++i) {
+            distance += plane[i] * (plane[i] >= 0.0f ? boundsMax[i] : boundsMin[i]);
+        }
+        if (distance < 0.0f) {
+            return {};
+        }
+    }
+
+    // Corners at their heightmap samples: (u, v) = (0, 0), (1, 0), (0, 1), (1, 1).
+    const uint32_t resolution = heightmapResolution(grid);
+    float corners[4][3];
+    for (uint32_t corner = 0; corner < 4; ++corner) {
+        const uint32_t column = (x + (corner & 1)) * grid.samplesPerPatch;
+        const uint32_t row = (z + (corner >> 1)) * grid.samplesPerPatch;
+        corners[corner][0] = grid.origin[0] + static_cast<float>(column) * grid.spacing;
+        corners[corner][1] = grid.origin[1] + pHeights[size_t(row) * resolution + column];
+        corners[corner][2] = grid.origin[2] + static_cast<float>(row) * grid.spacing;
+    }
+    QuadFactors factors;
+    factors.edge[kEdgeU0] = edgeFactor(params, corners[0], corners[2]);
+    factors.edge[kEdgeV0] = edgeFactor(params, corners[0], corners[1]);
+    factors.edge[kEdgeU1] = edgeFactor(params, corners[1], corners[3]);
+    factors.edge[kEdgeV1] = edgeFactor(params, corners[2], corners[3]);
+    // Inside factors cut across the patch: the first along u, as the v = 0 and v = 1 edges run.
+    factors.inside[0] = std::max(factors.edge[kEdgeV0], factors.edge[kEdgeV1]);
+    factors.inside[1] = std::max(factors.edge[kEdgeU0], factors.edge[kEdgeU1]);
+    return factors;
+}
+
+void computeFactors(const FactorParams& params, const PatchGrid& grid, const float* pHeights, const float* pBounds, QuadFactors* pFactors,
+                    uint32_t threads) {
+    const uint32_t side = grid.patchesPerSide;
+    parallel::forRange(side, std::max<size_t>(1, kMinPatchesPerTask / side), threads, [&](size_t begin, size_t end, size_t) {
+        for (uint32_t z = static_cast<uint32_t>(begin); z < end; ++z) {
+            for (uint32_t x = 0; x < side; ++x) {
+                pFactors[size_t(z) * side + x] = patchFactors(params, grid, pHeights, pBounds, x, z);
+            }
+        }
+    });
+}
+}
@@ -0,0 +1,70 @@
+//
+//  TessellationFactors.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef TessellationFactors_hpp
+#define TessellationFactors_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Per-patch tessellation factors for a heightfield split into a grid of quad patches, the reference for the
+ * computeTessellationFactors kernel in Shaders.metal, which does the same arithmetic on the GPU. An edge is cut into as
+ * many segments as keep each about edgePixels long on screen, judged from the edge's length and its midpoint's
+ * distance to the camera. An edge's factor depends only on its two corners, which both patches along it share, so
+ * neighbours always agree and the surface has no cracks. Patches outside the frustum get zero factors, which makes the
+ * tessellator drop them. Plain C++, independent of Metal.
+ */
+namespace tessellation {
+    // Edges in the order of MTLQuadTessellationFactorsHalf, with u along +x and v along +z.
+    enum QuadEdge : uint32_t {
+        kEdgeU0,
+        kEdgeV0,
+        kEdgeU1,
+        kEdgeV1
+    };
+
+    struct PatchGrid {
+        uint32_t patchesPerSide;
+        uint32_t samplesPerPatch;      // heightmap cells along a patch edge
+        float spacing = 1.0f;          // world units between heightmap samples
+        float origin[3] = { 0, 0, 0 }; // world position of sample (0, 0) at height 0
+    };
+
+    // Heightmap samples per side, rows along +z: patch corners fall on samples.
+    inline uint32_t heightmapResolution(const PatchGrid& grid) {
+        return grid.patchesPerSide * grid.samplesPerPatch + 1;
+    }
+
+    struct FactorParams {
+        float frustumPlanes[6][4]; // world space, normalized, facing inwards
+        float cameraPosition[3];
+        float pixelsPerUnit;       // viewport height over 2 tan(fovY / 2)
+        float edgePixels = 8.0f;   // wanted on-screen length of a tessellated segment
+        float maxFactor = 16.0f;   // the pipeline's maxTessellationFactor
+    };
+
+    struct QuadFactors {
+        float edge[4];
+        float inside[2];
+    };
+
+    // Between 1 and maxFactor, the same whichever way round the corners come.
+    float edgeFactor(const FactorParams& params, const float a[3], const float b[3]);
+
+    // Lowest and highest sample of each patch, two floats per patch in row-major patch order. 0 threads: one per
+    // hardware thread.
+    void computeHeightBounds(const PatchGrid& grid, const float* pHeights, float* pBounds, uint32_t threads = 0);
+
+    QuadFactors patchFactors(const FactorParams& params, const PatchGrid& grid, const float* pHeights, const float* pBounds, uint32_t x, uint32_t z);
+
+    // Every patch's factors, in row-major patch order.
+    void computeFactors(const FactorParams& params, const PatchGrid& grid, const float* pHeights, const float* pBounds, QuadFactors* pFactors,
+                        uint32_t threads = 0);
+}
+
+#endif /* TessellationFactors_hpp */
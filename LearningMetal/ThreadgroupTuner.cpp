@@ -0,0 +1,214 @@
+//
+//  ThreadgroupTuner.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "ThreadgroupTuner.hpp"
+#include "Statistics.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace threadgroup_tuning {
+static uint32_t gridBucket(uint32_t gridSize) {
+    uint32_t bucket = 1;
+    while (bucket < gridSize && bucket < (1u << 31)) {
+        bucket <<= 1;
+    }
+    return bucket;
+}
+
+std::vector<uint32_t> candidateWidths(const KernelLimits& limits, uint32_t gridSize) {
+    const uint32_t simdWidth = std::max(1u, limits.threadExecutionWidth);
+    std::vector<uint32_t> widths;
+    for (uint32_t width = simdWidth; width <= limits.maxTotalThreadsPerThreadgroup; width *= 2) {
+        // Past the grid size a wider threadgroup only adds idle threads.
+        if (!widths.empty() && width >= gridSize + simdWidth) {
+            break;
+        }
+        widths.push_back(width);
+    }
+    if (widths.empty()) {
+        // maxTotalThreadsPerThreadgroup below the SIMD width: one partial SIMD group is all the kernel can have.
+        widths.push_back(std::max(1u, limits.maxTotalThreadsPerThreadgroup));
+    }
+    return widths;
+}
+
+DispatchSize dispatchSize(uint32_t gridSize, uint32_t threadsPerThreadgroup) {
+    return DispatchSize { threadsPerThreadgroup, (gridSize + threadsPerThreadgroup - 1) / threadsPerThreadgroup };
+}
+
+Autotuner::Autotuner(uint32_t samplesPerCandidate, uint32_t warmupSamples): _samplesPerCandidate(std::max(1u, samplesPerCandidate)), _warmupSamples(warmupSamples) {}
+
+const Autotuner::Entry* Autotuner::findEntry(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize) const {
+    const uint32_t bucket = gridBucket(gridSize);
+    for (const Entry& entry : _entries) {
+        if (entry.kernel == kernel && entry.gridBucket == bucket && entry.limits.maxTotalThreadsPerThreadgroup == limits.maxTotalThreadsPerThreadgroup && entry.limits.threadExecutionWidth == limits.threadExecutionWidth) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+Autotuner::Entry& Autotuner::entryFor(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize) {
+    if (const Entry* pEntry = findEntry(kernel, limits, gridSize)) {
+        return const_cast<Entry&>(*pEntry);
+    }
+    Entry entry { kernel, limits, gridBucket(gridSize), {}, 0, 0, 0.0 };
+    for (uint32_t width : candidateWidths(limits, gridSize)) {
+        entry.candidates.push_back(Candidate { width, {}, 0 });
+    }
+    if (entry.candidates.size() == 1) {
+        entry.bestWidth = entry.candidates[0].width; // nothing to compare
+    }
+    _entries.push_back(std::move(entry));
+    return _entries.back();
+}
+
+uint32_t Autotuner::threadgroupWidth(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Entry& entry = entryFor(kernel, limits, gridSize);
+    if (entry.bestWidth != 0) {
+        return entry.bestWidth;
+    }
+    // Round-robin over the candidates still short of samples. Timings arrive a few frames late, so this counts
+    // dispatches rather than samples and may overshoot a little; extra samples are simply kept.
+    std::vector<const Candidate*> open;
+    for (const Candidate& candidate : entry.candidates) {
+        if (candidate.samples.size() < _samplesPerCandidate) {
+            open.push_back(&candidate);
+        }
+    }
+    if (open.empty()) {
+        return entry.candidates[entry.dispatches++ % entry.candidates.size()].width;
+    }
+    return open[entry.dispatches++ % open.size()]->width;
+}
+
+void Autotuner::recordTime(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize, uint32_t width, double gpuMilliseconds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Entry& entry = entryFor(kernel, limits, gridSize);
+    if (entry.bestWidth != 0) {
+        return;
+    }
+    for (Candidate& candidate : entry.candidates) {
+        if (candidate.width != width) {
+            continue;
+        }
+        if (candidate.dropped < _warmupSamples) {
+            ++candidate.dropped;
+        } else {
+            candidate.samples.push_back(gpuMilliseconds);
+        }
+        break;
+    }
+    finishIfComplete(entry);
+}
+
+void Autotuner::finishIfComplete(Entry& entry) {
+    double best = 0.0;
+    uint32_t bestWidth = 0;
+    for (const Candidate& candidate : entry.candidates) {
+        if (candidate.samples.size() < _samplesPerCandidate) {
+            return;
+        }
+        const double median = statistics::percentile(candidate.samples, 0.5);
+        if (bestWidth == 0 || median < best) {
+            best = median;
+            bestWidth = candidate.width;
+        }
+    }
+    entry.bestWidth = bestWidth;
+    entry.bestMilliseconds = best;
+    _dirty = true;
+}
+
+bool Autotuner::isTuned(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const Entry* pEntry = findEntry(kernel, limits, gridSize);
+    return pEntry && pEntry->bestWidth != 0;
+}
+
+// One line per tuned kernel: name, maxTotalThreadsPerThreadgroup, threadExecutionWidth, grid bucket, best width, ms.
+bool Autotuner::load(const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        Entry entry {};
+        if (!(fields >> entry.kernel >> entry.limits.maxTotalThreadsPerThreadgroup >> entry.limits.threadExecutionWidth >> entry.gridBucket >> entry.bestWidth >> entry.bestMilliseconds) || entry.bestWidth == 0) {
+            continue;
+        }
+        // A width the limits no longer allow means the file is stale or damaged; tune that kernel again.
+        if (entry.bestWidth > entry.limits.maxTotalThreadsPerThreadgroup || findEntry(entry.kernel, entry.limits, entry.gridBucket)) {
+            continue;
+        }
+        _entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+bool Autotuner::saveIfChanged(const char* path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_dirty) {
+        return true;
+    }
+    const std::string temporaryPath = std::string(path) + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::trunc);
+        for (const Entry& entry : _entries) {
+            if (entry.bestWidth != 0) {
+                file << entry.kernel << ' ' << entry.limits.maxTotalThreadsPerThreadgroup << ' ' << entry.limits.threadExecutionWidth << ' ' << entry.gridBucket << ' ' << entry.bestWidth << ' ' << entry.bestMilliseconds << '\n';
+            }
+        }
+        if (!file) {
+            return false;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), path) != 0) {
+        return false;
+    }
+    _dirty = false;
+    return true;
+}
+
+std::vector<TuningResult> Autotuner::results() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<TuningResult> results;
+    for (const Entry& entry : _entries) {
+        TuningResult result { entry.kernel, entry.limits, entry.gridBucket, entry.bestWidth, entry.bestMilliseconds, {} };
+        for (const Candidate& candidate : entry.candidates) {
+            if (!candidate.samples.empty()) {
+                result.medians.emplace_back(candidate.width, statistics::percentile(candidate.samples, 0.5));
+            }
+        }
+        results.push_back(std::move(result));
+    }
+    return results;
+}
+
+void Autotuner::printReport() const {
+    for (const TuningResult& result : results()) {
+        if (result.bestWidth == 0) {
+            __builtin_printf("Threadgroup tuning %s (grid <= %u): in progress\n", result.kernel.c_str(), result.gridBucket);
+            continue;
+        }
+        if (result.medians.empty() && result.bestMilliseconds == 0.0) {
+            __builtin_printf("Threadgroup tuning %s (grid <= %u): %u threads, the only candidate\n", result.kernel.c_str(), result.gridBucket, result.bestWidth);
+            continue;
+        }
+        __builtin_printf("Threadgroup tuning %s (grid <= %u, simd %u, max %u): %u threads, %.3f ms\n", result.kernel.c_str(), result.gridBucket, result.limits.threadExecutionWidth, result.limits.maxTotalThreadsPerThreadgroup, result.bestWidth, result.bestMilliseconds);
+        for (const auto& [width, median] : result.medians) {
+            __builtin_printf("  %4u: %.3f ms\n", width, median);
+        }
+    }
+}
+}
@@ -0,0 +1,98 @@
+//
+//  ThreadgroupTuner.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef ThreadgroupTuner_hpp
+#define ThreadgroupTuner_hpp
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace threadgroup_tuning {
+    // What MTL::ComputePipelineState reports for a compiled kernel.
+    struct KernelLimits {
+        uint32_t maxTotalThreadsPerThreadgroup;
+        uint32_t threadExecutionWidth;
+    };
+
+    struct DispatchSize {
+        uint32_t threadsPerThreadgroup;
+        uint32_t threadgroups;
+    };
+
+    /**
+     * 1D threadgroup widths worth trying: the SIMD width doubled up to the pipeline's limit. Every candidate is a
+     * multiple of threadExecutionWidth, so pipelines can be built with threadGroupSizeIsMultipleOfThreadExecutionWidth;
+     * widths beyond what the grid can fill are dropped.
+     */
+    std::vector<uint32_t> candidateWidths(const KernelLimits& limits, uint32_t gridSize);
+    // Uniform threadgroups covering gridSize threads; kernels bounds-check against their thread count.
+    DispatchSize dispatchSize(uint32_t gridSize, uint32_t threadsPerThreadgroup);
+
+    struct TuningResult {
+        std::string kernel;
+        KernelLimits limits;
+        uint32_t gridBucket;
+        uint32_t bestWidth;
+        double bestMilliseconds;
+        std::vector<std::pair<uint32_t, double>> medians; // per candidate width, empty when loaded from disk
+    };
+
+    /**
+     * Picks a threadgroup width per kernel by timing every candidate on real dispatches. Candidates take turns
+     * dispatch by dispatch, so drift over the measurement lands on all of them; the first samples of each are
+     * dropped, and the width with the lowest median wins. Results are keyed by kernel, pipeline limits and grid size
+     * rounded up to a power of two, and persist to a small text file so later launches start tuned; a result stored
+     * under different limits (another GPU, a recompiled kernel) is ignored and the kernel is tuned again.
+     */
+    class Autotuner {
+    public:
+        explicit Autotuner(uint32_t samplesPerCandidate = 8, uint32_t warmupSamples = 2);
+
+        // The width the next dispatch of kernel over gridSize should use: a candidate under trial, or the winner.
+        uint32_t threadgroupWidth(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize);
+        // Called, from any thread, with the GPU time of a dispatch made with the given width.
+        void recordTime(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize, uint32_t width, double gpuMilliseconds);
+        bool isTuned(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize) const;
+
+        bool load(const char* path);
+        // Writes only when a kernel finished tuning since the last save.
+        bool saveIfChanged(const char* path);
+        std::vector<TuningResult> results() const;
+        void printReport() const;
+
+    private:
+        struct Candidate {
+            uint32_t width;
+            std::vector<double> samples;
+            uint32_t dropped;
+        };
+
+        struct Entry {
+            std::string kernel;
+            KernelLimits limits;
+            uint32_t gridBucket;
+            std::vector<Candidate> candidates;
+            uint64_t dispatches;
+            uint32_t bestWidth; // 0 while tuning
+            double bestMilliseconds;
+        };
+
+        Entry& entryFor(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize);
+        const Entry* findEntry(const std::string& kernel, const KernelLimits& limits, uint32_t gridSize) const;
+        void finishIfComplete(Entry& entry);
+
+        uint32_t _samplesPerCandidate;
+        uint32_t _warmupSamples;
+        mutable std::mutex _mutex;
+        std::vector<Entry> _entries;
+        bool _dirty = false;
+    };
+}
+
+#endif /* ThreadgroupTuner_hpp */
@@ -0,0 +1,103 @@
+//
+//  TransientHeap.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/23.
+//
+
+#include "TransientHeap.hpp"
+#include <TargetConditionals.h>
+
+TransientHeap::TransientHeap(MTL::Device* pDevice): _pDevice(pDevice->retain()), _pHeap(nullptr) {
+#if TARGET_OS_SIMULATOR
+    _planner.setMemorylessAllowed(false);
+#else
+    _planner.setMemorylessAllowed(pDevice->supportsFamily(MTL::GPUFamilyApple1));
+#endif
+}
+
+TransientHeap::~TransientHeap() {
+    reset();
+    if (_pHeap) {
+        _pHeap->release();
+    }
+    _pDevice->release();
+}
+
+transient::ResourceHandle TransientHeap::declareTexture(const char* name, const MTL::TextureDescriptor* pDesc) {
+    MTL::TextureDescriptor* pCopy = pDesc->copy();
+    pCopy->setStorageMode(MTL::StorageModePrivate);
+    MTL::SizeAndAlign sizeAndAlign = _pDevice->heapTextureSizeAndAlign(pCopy);
+    
+    _entries.push_back(Entry { pCopy, 0, nullptr });
+    return _planner.declare(name, sizeAndAlign.size, sizeAndAlign.align, true);
+}
+
+transient::ResourceHandle TransientHeap::declareBuffer(const char* name, NS::UInteger length) {
+    MTL::SizeAndAlign sizeAndAlign = _pDevice->heapBufferSizeAndAlign(length, MTL::ResourceStorageModePrivate);
+    
+    _entries.push_back(Entry { nullptr, length, nullptr });
+    return _planner.declare(name, sizeAndAlign.size, sizeAndAlign.align, false);
+}
+
+void TransientHeap::build() {
+    releaseResources();
+    _planner.compile();
+    
+    const NS::UInteger heapSize = _planner.heapSize();
+    if (heapSize > 0 && (_pHeap == nullptr || _pHeap->size() < heapSize)) {
+        if (_pHeap) {
+            _pHeap->release();
+        }
+        MTL::HeapDescriptor* pHeapDesc = MTL::HeapDescriptor::alloc()->init();
+        pHeapDesc->setType(MTL::HeapTypePlacement);
+        pHeapDesc->setStorageMode(MTL::StorageModePrivate);
+        pHeapDesc->setHazardTrackingMode(MTL::HazardTrackingModeTracked);
+        pHeapDesc->setSize(heapSize);
+        _pHeap = _pDevice->newHeap(pHeapDesc);
+        pHeapDesc->release();
+    }
+    
+    for (transient::ResourceHandle handle = 0; handle < _entries.size(); ++handle) {
+        Entry& entry = _entries[handle];
+        const transient::Placement& placement = _planner.placement(handle);
+        if (!placement.used) {
+            continue;
+        }
+        
+        if (placement.memoryless) {
+            entry.pTextureDesc->setStorageMode(MTL::StorageModeMemoryless);
+            entry.pResource = _pDevice->newTexture(entry.pTextureDesc);
+            entry.pTextureDesc->setStorageMode(MTL::StorageModePrivate);
+        } else if (entry.pTextureDesc) {
+            entry.pResource = _pHeap->newTexture(entry.pTextureDesc, placement.offset);
+        } else {
+            entry.pResource = _pHeap->newBuffer(entry.bufferLength, MTL::ResourceStorageModePrivate, placement.offset);
+        }
+        
+        if (entry.pResource == nullptr) {
+            __builtin_printf("Failed to place transient resource %s\n", _planner.name(handle).c_str());
+            assert(false);
+        }
+    }
+}
+
+void TransientHeap::releaseResources() {
+    for (Entry& entry : _entries) {
+        if (entry.pResource) {
+            entry.pResource->release();
+            entry.pResource = nullptr;
+        }
+    }
+}
+
+void TransientHeap::reset() {
+    releaseResources();
+    for (Entry& entry : _entries) {
+        if (entry.pTextureDesc) {
+            entry.pTextureDesc->release();
+        }
+    }
+    _entries.clear();
+    _planner.reset();
+}
@@ -0,0 +1,55 @@
+//
+//  TransientHeap.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/23.
+//
+
+#ifndef TransientHeap_hpp
+#define TransientHeap_hpp
+
+#include <Metal/Metal.hpp>
+#include <vector>
+#include "TransientResources.hpp"
+
+/**
+ * Backs a TransientPlanner with a placement MTL::Heap. Resources are declared with their Metal descriptors,
+ * passes and uses are recorded on planner(), then build() sizes the heap and places every resource at its
+ * planned offset. Memoryless resources are created outside the heap with StorageModeMemoryless; on the Simulator and
+ * on devices outside the Apple GPU families, which have no tile memory, the planner places them in the heap instead.
+ *
+ * The heap tracks hazards as a whole, so aliased resources are ordered by Metal without explicit fences.
+ */
+class TransientHeap {
+public:
+    TransientHeap(MTL::Device* pDevice);
+    ~TransientHeap();
+
+    transient::ResourceHandle declareTexture(const char* name, const MTL::TextureDescriptor* pDesc);
+    transient::ResourceHandle declareBuffer(const char* name, NS::UInteger length);
+    transient::TransientPlanner& planner() { return _planner; }
+
+    void build();
+    // Drops declarations and resources; the heap is kept and reused if the next plan fits.
+    void reset();
+
+    MTL::Texture* texture(transient::ResourceHandle handle) const { return static_cast<MTL::Texture*>(_entries[handle].pResource); }
+    MTL::Buffer* buffer(transient::ResourceHandle handle) const { return static_cast<MTL::Buffer*>(_entries[handle].pResource); }
+    MTL::Heap* heap() const { return _pHeap; }
+
+private:
+    struct Entry {
+        MTL::TextureDescriptor* pTextureDesc;
+        NS::UInteger bufferLength;
+        MTL::Resource* pResource;
+    };
+
+    void releaseResources();
+
+    MTL::Device* _pDevice;
+    MTL::Heap* _pHeap;
+    transient::TransientPlanner _planner;
+    std::vector<Entry> _entries;
+};
+
+#endif /* TransientHeap_hpp */
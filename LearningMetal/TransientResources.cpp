@@ -0,0 +1,159 @@
+//
+//  TransientResources.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/23.
+//
+
+#include "TransientResources.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace transient {
+ResourceHandle TransientPlanner::declare(const char* name, uint64_t size, uint64_t alignment, bool isTexture) {
+    _resources.push_back(Resource { name, size, std::max<uint64_t>(alignment, 1), isTexture, false });
+    return static_cast<ResourceHandle>(_resources.size() - 1);
+}
+
+void TransientPlanner::setPersistent(ResourceHandle handle) {
+    _resources[handle].persistent = true;
+}
+
+PassIndex TransientPlanner::addPass(const char* name) {
+    _passes.emplace_back(name);
+    return static_cast<PassIndex>(_passes.size() - 1);
+}
+
+void TransientPlanner::use(PassIndex pass, ResourceHandle handle, Usage usage) {
+    assert(pass < _passes.size() && handle < _resources.size());
+    _uses.push_back(Use { pass, handle, usage });
+}
+
+void TransientPlanner::reset() {
+    _resources.clear();
+    _passes.clear();
+    _uses.clear();
+    _placements.clear();
+    _heapSize = 0;
+}
+
+void TransientPlanner::compile() {
+    const size_t count = _resources.size();
+    const PassIndex lastPass = _passes.empty() ? 0 : static_cast<PassIndex>(_passes.size() - 1);
+
+    _placements.assign(count, Placement {});
+    std::vector<bool> attachmentOnly(count, true);
+
+    for (const Use& use : _uses) {
+        Placement& placement = _placements[use.handle];
+        if (!placement.used) {
+            placement.firstPass = use.pass;
+            placement.lastPass = use.pass;
+            placement.used = true;
+        }
+        placement.firstPass = std::min(placement.firstPass, use.pass);
+        placement.lastPass = std::max(placement.lastPass, use.pass);
+        if (use.usage == Usage::ShaderRead || use.usage == Usage::ShaderWrite) {
+            attachmentOnly[use.handle] = false;
+        }
+    }
+
+    std::vector<ResourceHandle> order;
+    for (ResourceHandle handle = 0; handle < count; ++handle) {
+        const Resource& resource = _resources[handle];
+        Placement& placement = _placements[handle];
+        if (!placement.used) {
+            continue;
+        }
+        if (resource.persistent) {
+            // Last frame's contents are live until this frame's first use, so nothing may alias it anywhere.
+            placement.firstPass = 0;
+            placement.lastPass = lastPass;
+        } else if (_memorylessAllowed && resource.isTexture && attachmentOnly[handle] && placement.firstPass == placement.lastPass) {
+            placement.memoryless = true;
+            continue;
+        }
+        order.push_back(handle);
+    }
+
+    // Largest first, then by first use; this keeps big resources at low offsets and leaves small gaps for small ones.
+    std::sort(order.begin(), order.end(), [this](ResourceHandle a, ResourceHandle b) {
+        if (_resources[a].size != _resources[b].size) {
+            return _resources[a].size > _resources[b].size;
+        }
+        return _placements[a].firstPass < _placements[b].firstPass;
+    });
+
+    struct Range {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    _heapSize = 0;
+    std::vector<ResourceHandle> placed;
+    std::vector<Range> blocked;
+
+    for (ResourceHandle handle : order) {
+        const Resource& resource = _resources[handle];
+        Placement& placement = _placements[handle];
+
+        blocked.clear();
+        for (ResourceHandle other : placed) {
+            const Placement& o = _placements[other];
+            if (o.firstPass <= placement.lastPass && placement.firstPass <= o.lastPass) {
+                blocked.push_back(Range { o.offset, o.offset + _resources[other].size });
+            }
+        }
+        std::sort(blocked.begin(), blocked.end(), [](const Range& a, const Range& b) { return a.begin < b.begin; });
+
+        uint64_t offset = 0;
+        for (const Range& range : blocked) {
+            offset = (offset + resource.alignment - 1) / resource.alignment * resource.alignment;
+            if (offset + resource.size <= range.begin) {
+                break;
+            }
+            offset = std::max(offset, range.end);
+        }
+        offset = (offset + resource.alignment - 1) / resource.alignment * resource.alignment;
+
+        placement.offset = offset;
+        _heapSize = std::max(_heapSize, offset + resource.size);
+        placed.push_back(handle);
+    }
+}
+
+PlanReport TransientPlanner::report() const {
+    PlanReport report;
+    report.heapBytes = _heapSize;
+    for (size_t i = 0; i < _resources.size(); ++i) {
+        if (!_placements[i].used) {
+            continue;
+        }
+        report.dedicatedBytes += _resources[i].size;
+        ++report.resourceCount;
+        if (_placements[i].memoryless) {
+            report.memorylessBytes += _resources[i].size;
+            ++report.memorylessCount;
+        }
+    }
+    return report;
+}
+
+void TransientPlanner::printReport() const {
+    const PlanReport r = report();
+    const double saved = r.dedicatedBytes > 0 ? 100.0 * (1.0 - static_cast<double>(r.heapBytes) / r.dedicatedBytes) : 0.0;
+    __builtin_printf("Transient resources: %u (%u memoryless)\n", r.resourceCount, r.memorylessCount);
+    __builtin_printf("  dedicated %llu bytes, aliased heap %llu bytes (%.1f%% saved)\n", (unsigned long long)r.dedicatedBytes, (unsigned long long)r.heapBytes, saved);
+    for (size_t i = 0; i < _resources.size(); ++i) {
+        const Placement& p = _placements[i];
+        if (!p.used) {
+            continue;
+        }
+        if (p.memoryless) {
+            __builtin_printf("  %-24s passes %u-%u memoryless\n", _resources[i].name.c_str(), p.firstPass, p.lastPass);
+        } else {
+            __builtin_printf("  %-24s passes %u-%u offset %llu size %llu\n", _resources[i].name.c_str(), p.firstPass, p.lastPass, (unsigned long long)p.offset, (unsigned long long)_resources[i].size);
+        }
+    }
+}
+}
@@ -0,0 +1,95 @@
+//
+//  TransientResources.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/23.
+//
+
+#ifndef TransientResources_hpp
+#define TransientResources_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace transient {
+    using ResourceHandle = uint32_t;
+    using PassIndex = uint32_t;
+
+    enum class Usage : uint8_t {
+        AttachmentWrite,
+        AttachmentRead,
+        ShaderRead,
+        ShaderWrite
+    };
+
+    struct Placement {
+        PassIndex firstPass = 0;
+        PassIndex lastPass = 0;
+        uint64_t offset = 0;
+        bool memoryless = false;
+        bool used = false;
+    };
+
+    struct PlanReport {
+        uint64_t dedicatedBytes = 0;  // every resource in its own allocation
+        uint64_t heapBytes = 0;       // aliased heap size
+        uint64_t memorylessBytes = 0; // never backed by memory
+        uint32_t resourceCount = 0;
+        uint32_t memorylessCount = 0;
+    };
+
+    /**
+     * Computes per-frame lifetimes of transient resources across an ordered list of passes and packs
+     * resources whose lifetimes do not overlap into the same heap range. A texture only ever used as an
+     * attachment inside a single pass never leaves tile memory and is marked memoryless instead.
+     */
+    class TransientPlanner {
+    public:
+        // Sizes and alignments are what the heap reports for the resource (heapTextureSizeAndAlign on device).
+        ResourceHandle declare(const char* name, uint64_t size, uint64_t alignment, bool isTexture);
+        // Persistent resources are presented or read next frame, so they live to the end and are never memoryless.
+        void setPersistent(ResourceHandle handle);
+        // Off where memoryless storage does not exist (the Simulator, GPUs without tile memory); every resource then
+        // gets heap memory. Kept across reset().
+        void setMemorylessAllowed(bool allowed) { _memorylessAllowed = allowed; }
+
+        PassIndex addPass(const char* name);
+        void use(PassIndex pass, ResourceHandle handle, Usage usage);
+
+        void compile();
+        void reset();
+
+        const Placement& placement(ResourceHandle handle) const { return _placements[handle]; }
+        const std::string& name(ResourceHandle handle) const { return _resources[handle].name; }
+        size_t resourceCount() const { return _resources.size(); }
+        uint64_t heapSize() const { return _heapSize; }
+        PlanReport report() const;
+        void printReport() const;
+
+    private:
+        struct Resource {
+            std::string name;
+            uint64_t size;
+            uint64_t alignment;
+            bool isTexture;
+            bool persistent;
+        };
+
+        struct Use {
+            PassIndex pass;
+            ResourceHandle handle;
+            Usage usage;
+        };
+
+        std::vector<Resource> _resources;
+        std::vector<std::string> _passes;
+        std::vector<Use> _uses;
+        std::vector<Placement> _placements;
+        uint64_t _heapSize = 0;
+        bool _memorylessAllowed = true;
+    };
+}
+
+#endif /* TransientResources_hpp */
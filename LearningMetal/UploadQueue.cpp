@@ -0,0 +1,219 @@
+//
+//  UploadQueue.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/22.
+//
+
+#include "UploadQueue.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace upload {
+static size_t alignUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+UploadQueue::UploadQueue(BlitBackend* pBackend, size_t bytesPerFrame): _pBackend(pBackend), _bytesPerFrame(bytesPerFrame) {
+    assert(pBackend->stagingCapacity() % kStagingAlignment == 0);
+}
+
+UploadQueue::~UploadQueue() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return _batchesInFlight == 0; });
+}
+
+UploadId UploadQueue::uploadBuffer(void* pDestination, size_t destinationOffset, std::vector<uint8_t>&& data, Priority priority, Completion completion) {
+    Request request { 0, pDestination, destinationOffset, {}, false, std::move(data), 0, std::move(completion) };
+    return enqueue(std::move(request), priority);
+}
+
+UploadId UploadQueue::uploadTexture(void* pDestination, const TextureRegion& region, std::vector<uint8_t>&& data, Priority priority, Completion completion) {
+    if (alignUp(data.size(), kStagingAlignment) > _pBackend->stagingCapacity()) {
+        __builtin_printf("Texture upload of %zu bytes does not fit the staging ring\n", data.size());
+        assert(false);
+        return 0;
+    }
+    Request request { 0, pDestination, 0, region, true, std::move(data), 0, std::move(completion) };
+    return enqueue(std::move(request), priority);
+}
+
+UploadId UploadQueue::enqueue(Request&& request, Priority priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    request.id = _nextId++;
+    const UploadId id = request.id;
+    _pending[static_cast<size_t>(priority)].push_back(std::move(request));
+    ++_stats.submitted;
+    return id;
+}
+
+void UploadQueue::setBytesPerFrame(size_t bytesPerFrame) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _bytesPerFrame = bytesPerFrame;
+}
+
+UploadStats UploadQueue::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    UploadStats stats = _stats;
+    stats.bytesPending = 0;
+    for (const std::deque<Request>& queue : _pending) {
+        for (const Request& request : queue) {
+            stats.bytesPending += request.data.size() - request.uploadedBytes;
+        }
+    }
+    return stats;
+}
+
+bool UploadQueue::allocateStaging(size_t size, size_t* pOffset, size_t* pConsumed) {
+    const size_t capacity = _pBackend->stagingCapacity();
+    size = alignUp(size, kStagingAlignment);
+
+    if (_used == 0) {
+        _head = _tail = 0;
+    }
+
+    const bool full = _used > 0 && _head == _tail;
+    if (full) {
+        return false;
+    }
+
+    size_t consumed = size;
+    if (_head >= _tail) {
+        if (_head + size <= capacity) {
+            *pOffset = _head;
+            _head += size;
+        } else if (size <= _tail) {
+            // Skip the unusable end of the ring; the batch owns the waste until it completes.
+            consumed += capacity - _head;
+            *pOffset = 0;
+            _head = size;
+        } else {
+            return false;
+        }
+    } else {
+        if (_head + size > _tail) {
+            return false;
+        }
+        *pOffset = _head;
+        _head += size;
+    }
+
+    if (_head == capacity) {
+        _head = 0;
+    }
+    _used += consumed;
+    *pConsumed = consumed;
+    return true;
+}
+
+size_t UploadQueue::flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    const size_t capacity = _pBackend->stagingCapacity();
+    size_t budget = _bytesPerFrame;
+    Batch batch { 0, 0, {}, 0 };
+    bool blocked = false;
+
+    for (std::deque<Request>& queue : _pending) {
+        while (!queue.empty() && !blocked) {
+            Request& request = queue.front();
+            const size_t remaining = request.data.size() - request.uploadedBytes;
+
+            size_t chunk = remaining;
+            if (!request.isTexture) {
+                // Largest contiguous run the ring can hand out right now.
+                size_t contiguous = 0;
+                if (_used == 0) {
+                    contiguous = capacity;
+                } else if (_head > _tail) {
+                    contiguous = std::max(capacity - _head, _tail);
+                } else if (_head < _tail) {
+                    contiguous = _tail - _head;
+                }
+                chunk = std::min({ chunk, budget, contiguous });
+                if (chunk < remaining) {
+                    chunk = chunk / kStagingAlignment * kStagingAlignment;
+                }
+            } else if (chunk > budget && batch.bytes > 0) {
+                // Textures are not split; an oversized one goes alone in its own frame.
+                chunk = 0;
+            }
+
+            size_t offset = 0;
+            size_t consumed = 0;
+            if (chunk == 0 || !allocateStaging(chunk, &offset, &consumed)) {
+                // Lower priorities wait rather than overtake a request that does not fit.
+                blocked = true;
+                break;
+            }
+
+            if (batch.bytes == 0) {
+                _pBackend->beginBatch();
+            }
+
+            memcpy(_pBackend->stagingContents() + offset, request.data.data() + request.uploadedBytes, chunk);
+            if (request.isTexture) {
+                _pBackend->copyToTexture(offset, request.pDestination, request.region);
+            } else {
+                _pBackend->copyToBuffer(offset, request.pDestination, request.destinationOffset + request.uploadedBytes, chunk);
+            }
+
+            request.uploadedBytes += chunk;
+            budget -= std::min(budget, chunk);
+            batch.bytes += chunk;
+            batch.ringBytes += consumed;
+            batch.ringEnd = _head;
+
+            if (request.uploadedBytes == request.data.size()) {
+                batch.completions.emplace_back(request.id, std::move(request.completion));
+                queue.pop_front();
+            }
+
+            if (budget == 0) {
+                blocked = true;
+            }
+        }
+        if (blocked) {
+            break;
+        }
+    }
+
+    if (batch.bytes == 0) {
+        return 0;
+    }
+
+    ++_stats.batches;
+    ++_batchesInFlight;
+    const size_t bytes = batch.bytes;
+    lock.unlock();
+
+    _pBackend->commitBatch([this, batch = std::move(batch)]() mutable {
+        completeBatch(batch);
+    });
+    return bytes;
+}
+
+void UploadQueue::completeBatch(Batch& batch) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Batches share one command queue and so complete in submission order.
+        _tail = batch.ringEnd;
+        _used -= batch.ringBytes;
+        _stats.completed += batch.completions.size();
+        _stats.bytesUploaded += batch.bytes;
+    }
+
+    for (auto& [id, completion] : batch.completions) {
+        if (completion) {
+            completion(id);
+        }
+    }
+
+    // Retired only once its completions have run; notified under the lock, since the queue may be destroyed as soon
+    // as the destructor sees the count reach zero.
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_batchesInFlight;
+    _idle.notify_all();
+}
+}
@@ -0,0 +1,126 @@
+//
+//  UploadQueue.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/22.
+//
+
+#ifndef UploadQueue_hpp
+#define UploadQueue_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace upload {
+    enum class Priority : uint8_t {
+        High,
+        Normal,
+        Low,
+        Count
+    };
+
+    using UploadId = uint64_t;
+    using Completion = std::function<void(UploadId id)>;
+
+    struct TextureRegion {
+        uint32_t x = 0, y = 0, z = 0;
+        uint32_t width = 0, height = 1, depth = 1;
+        uint32_t slice = 0;
+        uint32_t level = 0;
+        uint32_t bytesPerRow = 0;
+        uint32_t bytesPerImage = 0;
+    };
+
+    /**
+     * Records copies out of a staging ring into a single command buffer per batch.
+     * Destinations are opaque so the scheduler can be driven by a fake backend off-device.
+     */
+    class BlitBackend {
+    public:
+        virtual ~BlitBackend() = default;
+        virtual uint8_t* stagingContents() = 0;
+        virtual size_t stagingCapacity() const = 0;
+        virtual void beginBatch() = 0;
+        virtual void copyToBuffer(size_t stagingOffset, void* pDestination, size_t destinationOffset, size_t size) = 0;
+        virtual void copyToTexture(size_t stagingOffset, void* pDestination, const TextureRegion& region) = 0;
+        // onCompleted may be called from any thread once the GPU has finished the batch.
+        virtual void commitBatch(std::function<void()> onCompleted) = 0;
+    };
+
+    struct UploadStats {
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+        uint64_t batches = 0;
+        uint64_t bytesUploaded = 0;
+        uint64_t bytesPending = 0;
+    };
+
+    /**
+     * Worker threads submit uploads from any thread; the render thread calls flush() once per frame,
+     * which packs pending uploads into the staging ring, highest priority first, up to the per-frame
+     * byte cap, and commits them as one blit batch. Buffer uploads larger than the cap or the ring
+     * are split across frames; a texture upload must fit in the ring. Destroying the queue waits for the batches
+     * in flight, whose completions call back into it; uploads not yet flushed are dropped.
+     */
+    class UploadQueue {
+    public:
+        static constexpr size_t kStagingAlignment = 256;
+
+        UploadQueue(BlitBackend* pBackend, size_t bytesPerFrame);
+        ~UploadQueue();
+
+        UploadId uploadBuffer(void* pDestination, size_t destinationOffset, std::vector<uint8_t>&& data, Priority priority = Priority::Normal, Completion completion = nullptr);
+        UploadId uploadTexture(void* pDestination, const TextureRegion& region, std::vector<uint8_t>&& data, Priority priority = Priority::Normal, Completion completion = nullptr);
+
+        // Returns the number of bytes committed this frame.
+        size_t flush();
+
+        void setBytesPerFrame(size_t bytesPerFrame);
+        UploadStats stats() const;
+
+    private:
+        struct Request {
+            UploadId id;
+            void* pDestination;
+            size_t destinationOffset;
+            TextureRegion region;
+            bool isTexture;
+            std::vector<uint8_t> data;
+            size_t uploadedBytes;
+            Completion completion;
+        };
+
+        struct Batch {
+            size_t ringEnd;
+            size_t ringBytes;
+            std::vector<std::pair<UploadId, Completion>> completions;
+            size_t bytes;
+        };
+
+        UploadId enqueue(Request&& request, Priority priority);
+        bool allocateStaging(size_t size, size_t* pOffset, size_t* pConsumed);
+        void completeBatch(Batch& batch);
+
+        BlitBackend* _pBackend;
+        size_t _bytesPerFrame;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _idle; // signalled when a batch has retired
+        uint32_t _batchesInFlight = 0;
+        std::deque<Request> _pending[static_cast<size_t>(Priority::Count)];
+        UploadId _nextId = 1;
+        UploadStats _stats;
+
+        // Ring state: [_tail, _head) is in flight, wrapping at capacity.
+        size_t _head = 0;
+        size_t _tail = 0;
+        size_t _used = 0;
+    };
+}
+
+#endif /* UploadQueue_hpp */
@@ -0,0 +1,192 @@
+//
+//  VertexQuantize.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#include "VertexQuantize.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace vertex_quantize {
+uint32_t formatSize(uint32_t format) {
+    switch (format) {
+        case kFormatChar4Normalized: return 4;
+        case kFormatUShort4Normalized: return 8;
+        case kFormatHalf2: return 4;
+        case kFormatFloat2: return 8;
+        case kFormatFloat3: return 12;
+        case kFormatInt1010102Normalized: return 4;
+        default: return 0;
+    }
+}
+
+// Round to nearest even, with overflow to infinity and gradual underflow, as a GPU conversion would.
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t magnitude = bits & 0x7fffffff;
+    if (magnitude >= 0x7f800000) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+    }
+    if (magnitude >= 0x47800000) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    if (magnitude < 0x38800000) {
+        if (magnitude < 0x33000000) {
+            return static_cast<uint16_t>(sign);
+        }
+        const uint32_t shift = 126 - (magnitude >> 23);
+        const uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        half += remainder > halfway || (remainder == halfway && (half & 1)) ? 1 : 0;
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = (magnitude >> 13) - (112 << 10);
+    const uint32_t remainder = magnitude & 0x1fff;
+    half += remainder > 0x1000 || (remainder == 0x1000 && (half & 1)) ? 1 : 0;
+    return static_cast<uint16_t>(sign | half);
+}
+
+float halfToFloat(uint16_t value) {
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1f;
+    const uint32_t mantissa = value & 0x3ff;
+    float result;
+    if (exponent == 0) {
+        result = std::ldexp(static_cast<float>(mantissa), -24);
+    } else if (exponent == 31) {
+        result = mantissa ? std::numeric_limits<float>::quiet_NaN() : std::numeric_limits<float>::infinity();
+    } else {
+        result = std::ldexp(static_cast<float>(mantissa | 0x400), static_cast<int>(exponent) - 25);
+    }
+    uint32_t bits;
+    memcpy(&bits, &result, sizeof(bits));
+    bits |= sign;
+    memcpy(&result, &bits, sizeof(bits));
+    return result;
+}
+
+uint64_t encodePosition(const float position[3], const float minimum[3], const float extent[3]) {
+    uint64_t encoded = uint64_t(0xffff) << 48;
+    for (int i = 0; i < 3; ++i) {
+        const float t = extent[i] > 0.0f ? (position[i] - minimum[i]) / extent[i] : 0.0f;
+        const uint64_t q = static_cast<uint64_t>(std::lround(std::clamp(t, 0.0f, 1.0f) * 65535.0f));
+        encoded |= q << (16 * i);
+    }
+    return encoded;
+}
+
+void decodePosition(uint64_t encoded, const float minimum[3], const float extent[3], float position[3]) {
+    for (int i = 0; i < 3; ++i) {
+        position[i] = minimum[i] + float((encoded >> (16 * i)) & 0xffff) / 65535.0f * extent[i];
+    }
+}
+
+static float signNotZero(float v) {
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+static int32_t snorm(float v, int bits) {
+    const float scale = float((1 << (bits - 1)) - 1);
+    return static_cast<int32_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * scale));
+}
+
+// Metal's snorm conversion: c / (2^(n-1) - 1), clamped so the most negative code also reads -1.
+static float unsnorm(int32_t c, int bits) {
+    const float scale = float((1 << (bits - 1)) - 1);
+    return std::max(float(c) / scale, -1.0f);
+}
+
+static int32_t signExtend(uint32_t value, int bits) {
+    const uint32_t shift = 32 - bits;
+    return static_cast<int32_t>(value << shift) >> shift;
+}
+
+static uint32_t pack1010102(int32_t x, int32_t y, int32_t z, int32_t w) {
+    return (uint32_t(x) & 0x3ff) | (uint32_t(y) & 0x3ff) << 10 | (uint32_t(z) & 0x3ff) << 20 | (uint32_t(w) & 0x3) << 30;
+}
+
+static void octahedralToVector(float x, float y, float vector[3]) {
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+    const float t = std::max(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    const float length = std::sqrt(x * x + y * y + z * z);
+    vector[0] = x / length;
+    vector[1] = y / length;
+    vector[2] = z / length;
+}
+
+uint32_t encodeOctahedral(const float vector[3], int w) {
+    const float l1 = std::fabs(vector[0]) + std::fabs(vector[1]) + std::fabs(vector[2]);
+    float x = l1 > 0.0f ? vector[0] / l1 : 0.0f;
+    float y = l1 > 0.0f ? vector[1] / l1 : 0.0f;
+    if (vector[2] < 0.0f) {
+        const float fx = x;
+        x = (1.0f - std::fabs(y)) * signNotZero(fx);
+        y = (1.0f - std::fabs(fx)) * signNotZero(y);
+    }
+
+    const float scale = 511.0f;
+    const int32_t baseX = static_cast<int32_t>(std::floor(x * scale));
+    const int32_t baseY = static_cast<int32_t>(std::floor(y * scale));
+    int32_t bestX = snorm(x, 10);
+    int32_t bestY = snorm(y, 10);
+    float bestDot = -2.0f;
+    for (int32_t dy = 0; dy <= 1; ++dy) {
+        for (int32_t dx = 0; dx <= 1; ++dx) {
+            const int32_t cx = std::clamp(baseX + dx, -511, 511);
+            const int32_t cy = std::clamp(baseY + dy, -511, 511);
+            float decoded[3];
+            octahedralToVector(unsnorm(cx, 10), unsnorm(cy, 10), decoded);
+            const float d = decoded[0] * vector[0] + decoded[1] * vector[1] + decoded[2] * vector[2];
+            if (d > bestDot) {
+                bestDot = d;
+                bestX = cx;
+                bestY = cy;
+            }
+        }
+    }
+    return pack1010102(bestX, bestY, 0, w);
+}
+
+void decodeOctahedral(uint32_t encoded, float vector[3]) {
+    octahedralToVector(unsnorm(signExtend(encoded, 10), 10), unsnorm(signExtend(encoded >> 10, 10), 10), vector);
+}
+
+uint32_t encodeSnorm8(const float vector[3]) {
+    uint32_t encoded = 0;
+    for (int i = 0; i < 3; ++i) {
+        encoded |= (uint32_t(snorm(vector[i], 8)) & 0xff) << (8 * i);
+    }
+    return encoded;
+}
+
+void decodeSnorm8(uint32_t encoded, float vector[3]) {
+    float length = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+        vector[i] = unsnorm(signExtend(encoded >> (8 * i), 8), 8);
+        length += vector[i] * vector[i];
+    }
+    length = std::sqrt(length);
+    for (int i = 0; i < 3 && length > 0.0f; ++i) {
+        vector[i] /= length;
+    }
+}
+
+uint32_t encodeTexCoord(const float texCoord[2]) {
+    return uint32_t(floatToHalf(texCoord[0])) | uint32_t(floatToHalf(texCoord[1])) << 16;
+}
+
+void decodeTexCoord(uint32_t encoded, float texCoord[2]) {
+    texCoord[0] = halfToFloat(static_cast<uint16_t>(encoded));
+    texCoord[1] = halfToFloat(static_cast<uint16_t>(encoded >> 16));
+}
+}
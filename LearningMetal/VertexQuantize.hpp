@@ -0,0 +1,55 @@
+//
+//  VertexQuantize.hpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+#ifndef VertexQuantize_hpp
+#define VertexQuantize_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Encoders for compact vertex attributes and the exact decoders the vertex fetch hardware and Shaders.metal apply,
+ * so the error of a format can be measured on the host. Positions become 16-bit unorm relative to the mesh bounds,
+ * unit vectors octahedral snorm 10-10-10-2 (or plain snorm8) and texture coordinates half floats.
+ */
+namespace vertex_quantize {
+    // Raw MTL::VertexFormat values, so layouts can be described and stored without Metal.
+    enum VertexFormat : uint32_t {
+        kFormatInvalid = 0,
+        kFormatChar4Normalized = 12,
+        kFormatUShort4Normalized = 21,
+        kFormatHalf2 = 25,
+        kFormatFloat2 = 29,
+        kFormatFloat3 = 30,
+        kFormatInt1010102Normalized = 40
+    };
+
+    uint32_t formatSize(uint32_t format);
+
+    uint16_t floatToHalf(float value);
+    float halfToFloat(uint16_t value);
+
+    // xyz relative to [minimum, minimum + extent] in the low 48 bits; w is 1.0 so the shader reads a ready float4.
+    uint64_t encodePosition(const float position[3], const float minimum[3], const float extent[3]);
+    void decodePosition(uint64_t encoded, const float minimum[3], const float extent[3], float position[3]);
+
+    /**
+     * Octahedral projection of a unit vector into the x and y fields of a 10-10-10-2 word; w holds a tangent's
+     * handedness (-1 or 1, 0 for normals). Of the four neighbouring grid points the one decoding closest to the
+     * input is kept, which halves the worst-case error of plain rounding.
+     */
+    uint32_t encodeOctahedral(const float vector[3], int w = 0);
+    void decodeOctahedral(uint32_t encoded, float vector[3]);
+
+    uint32_t encodeSnorm8(const float vector[3]);
+    void decodeSnorm8(uint32_t encoded, float vector[3]);
+
+    uint32_t encodeTexCoord(const float texCoord[2]);
+    void decodeTexCoord(uint32_t encoded, float texCoord[2]);
+}
+
+#endif /* VertexQuantize_hpp */
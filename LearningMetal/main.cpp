@@ -11,8 +11,10 @@
 #define MTL_PRIVATE_IMPLEMENTATION
 #define MTK_PRIVATE_IMPLEMENTATION
 #include "main.hpp"
+#include "StartupProbe.hpp"
 
 int main(int argc, char* argv[]) {
+    startup_probe::mark("main");
     NS::AutoreleasePool *pAutoReleasePool = NS::AutoreleasePool::alloc()->init();
     
     MyAppDelegate delegate;
@@ -49,7 +51,7 @@ bool MyAppDelegate::applicationDidFinishLaunching(UI::Application *pApp, NS::Val
     _pMtkView = MTK::View::alloc()->init(frame, _pDevice);
     _pMtkView->setColorPixelFormat(MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB);
     _pMtkView->setClearColor(MTL::ClearColor::Make(1.0, 0.0, 0.0, 1.0));
-    _pMtkView->setDepthStencilPixelFormat(MTL::PixelFormat::PixelFormatDepth16Unorm);
+    // No depth format: the renderer attaches a memoryless Depth16Unorm target of its own.
     
     _pViewDelegate = new MyMTKViewDelegate(_pDevice);
     _pMtkView->setDelegate(_pViewDelegate);
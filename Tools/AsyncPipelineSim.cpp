@@ -0,0 +1,377 @@
+//
+//  AsyncPipelineSim.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/27.
+//
+
+// Drives AsyncPipelineCache with mock compilers and checks the scheduler: compiles start by priority then request
+// order, a raised priority takes effect, never more than maxInFlight run at once, draws without a ready pipeline use the
+// fallback or are skipped and make the frame a hitch, recompile() keeps serving the old pipeline until its replacement
+// arrives and keeps it if the rebuild fails, and a cache destroyed while compiles finish on other threads waits for
+// their completion handlers to return. Exits nonzero if any check fails. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -pthread -ILearningMetal Tools/AsyncPipelineSim.cpp LearningMetal/PipelineCache.cpp -o async-pipeline-sim
+//   ./async-pipeline-sim
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "AsyncPipelineCache.hpp"
+
+using namespace pipeline_cache;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+static std::thread::id mainThread() {
+    static const std::thread::id id = std::this_thread::get_id();
+    return id;
+}
+
+struct MockState {
+    std::string function;
+    int build; // how many times this function had been compiled before
+};
+
+static RenderPipelineKey keyFor(const char* function) {
+    RenderPipelineKey key;
+    key.vertexFunction = function;
+    key.fragmentFunction = "fragmentMain";
+    return key;
+}
+
+// Holds every compile until the test completes it, in any order; functions named "broken" fail.
+class DeferredCompiler {
+public:
+    struct Pending {
+        RenderPipelineKey key;
+        AsyncPipelineCache<MockState>::Completion done;
+    };
+
+    AsyncPipelineCache<MockState>::Compiler compiler() {
+        return [this](const RenderPipelineKey& key, AsyncPipelineCache<MockState>::Completion done) {
+            started.push_back(key.vertexFunction);
+            pending.push_back({ key, std::move(done) });
+            maxPending = std::max(maxPending, pending.size());
+        };
+    }
+
+    AsyncPipelineCache<MockState>::Releaser releaser() {
+        return [this](MockState* pState) {
+            released.push_back(pState->function + "#" + std::to_string(pState->build));
+            delete pState;
+        };
+    }
+
+    // Completes the pending compile of function, or the oldest one.
+    void complete(const char* function = nullptr, bool succeed = true) {
+        auto it = pending.begin();
+        while (function && it != pending.end() && it->key.vertexFunction != function) {
+            ++it;
+        }
+        if (it == pending.end()) {
+            fail("mock compiler", "completed a compile that was never started");
+            return;
+        }
+        Pending compile = std::move(*it);
+        pending.erase(it);
+        const bool fails = !succeed || compile.key.vertexFunction == "broken";
+        compile.done(fails ? nullptr : new MockState { compile.key.vertexFunction, builds[compile.key.vertexFunction]++ });
+    }
+
+    std::deque<Pending> pending;
+    std::vector<std::string> started;
+    std::vector<std::string> released;
+    std::unordered_map<std::string, int> builds;
+    size_t maxPending = 0;
+};
+
+static void checkPriorities() {
+    const char* name = "priorities";
+    DeferredCompiler mock;
+    {
+        AsyncPipelineCache<MockState> cache(mock.compiler(), mock.releaser(), 1);
+        // The first request starts at once; the rest wait for the one slot.
+        cache.request(keyFor("a"), CompilePriority::Background);
+        cache.request(keyFor("b"), CompilePriority::Normal);
+        cache.request(keyFor("c"), CompilePriority::Background);
+        cache.request(keyFor("d"), CompilePriority::High);
+        cache.request(keyFor("e"), CompilePriority::Normal);
+        cache.request(keyFor("f"), CompilePriority::Immediate);
+        // Raising c to High puts it ahead of d, requested later; asking for e at a lower priority changes nothing.
+        cache.request(keyFor("c"), CompilePriority::High);
+        cache.request(keyFor("e"), CompilePriority::Background);
+        if (cache.pendingCount() != 6 || cache.stats().maxQueueDepth != 5) {
+            fail(name, "wrong queue depth");
+        }
+        while (!mock.pending.empty()) {
+            mock.complete();
+        }
+        const std::vector<std::string> expected = { "a", "f", "c", "d", "b", "e" };
+        if (mock.started != expected) {
+            fail(name, "compiles did not start by priority then request order");
+        }
+        if (mock.maxPending != 1) {
+            fail(name, "more compiles in flight than allowed");
+        }
+        if (cache.request(keyFor("d"), CompilePriority::Background) == nullptr || cache.stats().compiled != 6 || cache.pendingCount() != 0) {
+            fail(name, "completed pipelines not ready");
+        }
+    }
+    if (mock.released.size() != 6) {
+        fail(name, "cache did not release its pipelines");
+    }
+}
+
+static void checkInFlightCap() {
+    const char* name = "in-flight cap";
+    DeferredCompiler mock;
+    AsyncPipelineCache<MockState> cache(mock.compiler(), mock.releaser(), 3);
+    const char* functions[] = { "k0", "k1", "k2", "k3", "k4", "k5", "k6", "k7" };
+    for (const char* function : functions) {
+        cache.request(keyFor(function), CompilePriority::Normal);
+    }
+    if (mock.pending.size() != 3) {
+        fail(name, "did not start exactly maxInFlight compiles");
+    }
+    // Out of order completion frees a slot each time.
+    mock.complete("k1");
+    if (mock.pending.size() != 3 || mock.started.size() != 4) {
+        fail(name, "a finished compile did not start the next");
+    }
+    while (!mock.pending.empty()) {
+        mock.complete(mock.pending.back().key.vertexFunction.c_str());
+    }
+    if (mock.maxPending != 3 || mock.started.size() != 8 || cache.pendingCount() != 0) {
+        fail(name, "wrong number of compiles");
+    }
+}
+
+static void checkDraws() {
+    const char* name = "draws";
+    DeferredCompiler mock;
+    AsyncPipelineCache<MockState> cache(mock.compiler(), mock.releaser(), 2);
+    MockState fallback { "fallback", 0 };
+    std::vector<std::string> observed;
+    cache.setDrawObserver([&observed](const RenderPipelineKey& key) { observed.push_back(key.vertexFunction); });
+
+    // Frame 1: a background compile of "c" takes one slot; one draw falls back, the other is skipped.
+    cache.beginFrame();
+    cache.request(keyFor("c"), CompilePriority::Background);
+    if (cache.resolve(keyFor("a"), &fallback) != &fallback || cache.resolve(keyFor("b"), nullptr) != nullptr) {
+        fail(name, "draw without a pipeline did not use the fallback or skip");
+    }
+    // Frame 2: the same again.
+    cache.beginFrame();
+    cache.resolve(keyFor("a"), &fallback);
+    cache.resolve(keyFor("b"), nullptr);
+    // Frame 3: both pipelines are ready.
+    mock.complete("c");
+    mock.complete("a");
+    mock.complete("b");
+    cache.beginFrame();
+    MockState* pA = cache.resolve(keyFor("a"), &fallback);
+    MockState* pB = cache.resolve(keyFor("b"), nullptr);
+    if (pA == nullptr || pA->function != "a" || pB == nullptr || pB->function != "b") {
+        fail(name, "ready pipelines not drawn");
+    }
+    cache.beginFrame();
+
+    const AsyncStats stats = cache.stats();
+    if (stats.fallbackDraws != 2 || stats.skippedDraws != 2) {
+        fail(name, "wrong fallback or skip counts");
+    }
+    if (stats.hitchFrames != 2 || stats.frames != 4) {
+        fail(name, "wrong hitch frame count");
+    }
+    // Repeated draws of a pipeline already compiling do not start it again.
+    if (mock.started.size() != 3) {
+        fail(name, "wrong number of compiles");
+    }
+    if (observed != std::vector<std::string> { "a", "b" }) {
+        fail(name, "draw observer not called once per key");
+    }
+}
+
+static void checkRecompile() {
+    const char* name = "recompile";
+    DeferredCompiler mock;
+    AsyncPipelineCache<MockState> cache(mock.compiler(), mock.releaser(), 4);
+    cache.request(keyFor("a"), CompilePriority::Normal);
+    cache.request(keyFor("broken"), CompilePriority::Normal);
+    mock.complete("a");
+    mock.complete("broken");
+    MockState* pOld = cache.request(keyFor("a"), CompilePriority::Normal);
+    if (pOld == nullptr || cache.stats().failed != 1) {
+        fail(name, "setup");
+        return;
+    }
+
+    // The failed pipeline is retried and the ready one rebuilt, which keeps serving the old state meanwhile.
+    if (cache.recompile([](const RenderPipelineKey&) { return true; }) != 2 || mock.pending.size() != 2) {
+        fail(name, "did not queue every matching pipeline");
+    }
+    if (cache.request(keyFor("a"), CompilePriority::Normal) != pOld) {
+        fail(name, "old pipeline not served during the rebuild");
+    }
+    // Asked again while compiling: rebuilt once more after this compile, as its library may be stale.
+    if (cache.recompile([](const RenderPipelineKey& key) { return key.vertexFunction == "a"; }) != 1) {
+        fail(name, "pipeline being rebuilt not marked");
+    }
+    mock.complete("a");
+    MockState* pNew = cache.request(keyFor("a"), CompilePriority::Normal);
+    if (pNew == pOld || pNew->build != 1 || mock.released != std::vector<std::string> { "a#0" }) {
+        fail(name, "replacement not swapped in, or the old state not released");
+    }
+    if (mock.pending.size() != 2) {
+        fail(name, "rebuild during a compile not queued again");
+    }
+    // A failed rebuild keeps the current state.
+    mock.complete("a", false);
+    mock.complete("broken");
+    if (cache.request(keyFor("a"), CompilePriority::Normal) != pNew || cache.request(keyFor("broken"), CompilePriority::Normal) != nullptr) {
+        fail(name, "failed rebuild replaced a working pipeline");
+    }
+    const AsyncStats stats = cache.stats();
+    if (stats.recompiles != 1 || stats.failed != 3 || stats.compiled != 2 || cache.pendingCount() != 0) {
+        fail(name, "wrong recompile counts");
+    }
+}
+
+// Completes compiles on worker threads after a short delay, like Metal's completion handlers.
+class ThreadedCompiler {
+public:
+    explicit ThreadedCompiler(uint32_t threads) {
+        for (uint32_t i = 0; i < threads; ++i) {
+            _workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadedCompiler() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _ready.notify_all();
+        for (std::thread& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    AsyncPipelineCache<MockState>::Compiler compiler() {
+        return [this](const RenderPipelineKey& key, AsyncPipelineCache<MockState>::Completion done) {
+            const uint32_t running = ++inFlight;
+            uint32_t peak = maxInFlight.load();
+            while (running > peak && !maxInFlight.compare_exchange_weak(peak, running)) {
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _work.push_back({ key.vertexFunction, std::move(done) });
+            _ready.notify_one();
+        };
+    }
+
+    std::atomic<uint32_t> inFlight { 0 };
+    std::atomic<uint32_t> maxInFlight { 0 };
+    std::atomic<uint64_t> compiled { 0 };
+
+private:
+    struct Work {
+        std::string function;
+        AsyncPipelineCache<MockState>::Completion done;
+    };
+
+    void run() {
+        for (;;) {
+            Work work;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _ready.wait(lock, [this] { return _stopping || !_work.empty(); });
+                if (_work.empty()) {
+                    return;
+                }
+                work = std::move(_work.front());
+                _work.pop_front();
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            --inFlight;
+            ++compiled;
+            work.done(new MockState { work.function, 0 });
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::deque<Work> _work;
+    std::vector<std::thread> _workers;
+    bool _stopping = false;
+};
+
+// Rebuilds release the replaced state from the completion handler, slowly; each cache is destroyed while those may
+// still be running. A handler that outlives its cache would find it flagged as destroyed.
+static void checkShutdown(uint32_t rounds) {
+    const char* name = "shutdown";
+    ThreadedCompiler compiler(3);
+    std::atomic<uint64_t> created { 0 }, released { 0 }, lateHandlers { 0 };
+    // Outlive the rounds, so a late handler reads its flag rather than freed memory.
+    std::unique_ptr<std::atomic<bool>[]> destroyedFlags(new std::atomic<bool>[rounds]);
+    for (uint32_t round = 0; round < rounds; ++round) {
+        std::atomic<bool>& destroyed = destroyedFlags[round];
+        destroyed = false;
+        {
+            AsyncPipelineCache<MockState> cache(compiler.compiler(), [&](MockState* pState) {
+                if (std::this_thread::get_id() != mainThread()) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    lateHandlers += destroyed.load();
+                }
+                ++released;
+                delete pState;
+            }, 2);
+            const char* functions[] = { "a", "b", "c", "d", "e", "f" };
+            for (const char* function : functions) {
+                cache.request(keyFor(function), CompilePriority::Normal);
+            }
+            cache.waitIdle();
+            cache.recompile([](const RenderPipelineKey&) { return true; });
+            // Some rebuilds finish, others are still queued or compiling when the cache goes.
+            std::this_thread::sleep_for(std::chrono::microseconds(100 * (round % 8)));
+        }
+        destroyed = true;
+    }
+    // Let stray handlers, if any, reach the flag before the checks.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    created = compiler.compiled.load();
+    if (lateHandlers != 0) {
+        fail(name, "a completion handler ran after its cache was destroyed");
+    }
+    if (released != created) {
+        fail(name, "pipelines leaked or released twice");
+    }
+    if (compiler.maxInFlight > 2) {
+        fail(name, "more compiles in flight than allowed");
+    }
+    printf("shutdown: %u caches, %llu compiles\n", rounds, (unsigned long long)created.load());
+}
+
+int main() {
+    mainThread();
+    checkPriorities();
+    checkInFlightCap();
+    checkDraws();
+    checkRecompile();
+    checkShutdown(200);
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+//
+//  GenerateShaderTypes.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+// Regenerates the MSL side of ShaderTypes.hpp. Run on the Mac after changing a shared struct:
+//   c++ -std=c++20 -ILearningMetal Tools/GenerateShaderTypes.cpp LearningMetal/ShaderTypes.cpp -o generate-shader-types
+//   ./generate-shader-types LearningMetal/ShaderTypesGenerated.h
+// With --check it only compares, and exits non-zero if the file is stale; the app target's "Check
+// ShaderTypesGenerated.h" build phase runs that on every build, so a stale header fails the build.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "ShaderTypes.hpp"
+
+int main(int argc, const char* argv[]) {
+    const bool check = argc == 3 && strcmp(argv[1], "--check") == 0;
+    if (argc != 2 && !check) {
+        fprintf(stderr, "usage: %s [--check] <ShaderTypesGenerated.h>\n", argv[0]);
+        return 2;
+    }
+    const char* path = argv[argc - 1];
+    const std::string generated = shader_types::generateMsl();
+
+    if (check) {
+        std::ifstream file(path);
+        std::stringstream existing;
+        existing << file.rdbuf();
+        if (existing.str() != generated) {
+            fprintf(stderr, "%s is out of date with ShaderTypes.hpp\n", path);
+            return 1;
+        }
+        return 0;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file << generated;
+    return file ? 0 : 1;
+}
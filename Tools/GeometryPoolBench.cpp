@@ -0,0 +1,300 @@
+//
+//  GeometryPoolBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Drives a GeometryPool through random mesh churn against a memory backend and reports allocation cost,
+// fragmentation and the high-water mark, then how far budgeted compaction brings them back and what it moves per
+// frame. Every mesh's bytes are checked after each phase, ranges are checked never to overlap, and no range may be
+// reused while a frame in flight could still read it. Ends by trimming indices off meshes, as dropping a LOD does, and
+// checking that shrinking hands the compacted top back. Exits nonzero if any check fails. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/GeometryPoolBench.cpp LearningMetal/GeometryPool.cpp -o geometry-pool-bench
+//   ./geometry-pool-bench [frames]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "GeometryPool.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static constexpr uint32_t kStride = 16;
+static constexpr uint32_t kIndexSize = 4;
+static constexpr uint32_t kFramesInFlight = 3;
+
+class MemoryBackend : public geometry_pool::PoolBackend {
+public:
+    bool resize(geometry_pool::Stream stream, size_t bytes) override {
+        std::vector<uint8_t>& data = _streams[static_cast<size_t>(stream)];
+        data.resize(bytes);
+        ++resizes;
+        return true;
+    }
+
+    void write(geometry_pool::Stream stream, size_t offset, const void* pData, size_t size) override {
+        memcpy(_streams[static_cast<size_t>(stream)].data() + offset, pData, size);
+    }
+
+    void copy(geometry_pool::Stream stream, size_t sourceOffset, size_t destinationOffset, size_t size) override {
+        if (sourceOffset < destinationOffset + size && destinationOffset < sourceOffset + size) {
+            ++overlaps;
+        }
+        uint8_t* pData = _streams[static_cast<size_t>(stream)].data();
+        memcpy(pData + destinationOffset, pData + sourceOffset, size);
+    }
+
+    const uint8_t* data(geometry_pool::Stream stream) const { return _streams[static_cast<size_t>(stream)].data(); }
+    size_t size(geometry_pool::Stream stream) const { return _streams[static_cast<size_t>(stream)].size(); }
+
+    uint64_t resizes = 0;
+    uint64_t overlaps = 0;
+
+private:
+    std::vector<uint8_t> _streams[2];
+};
+
+struct LiveMesh {
+    geometry_pool::MeshHandle handle;
+    uint32_t seed;
+    uint32_t trimmedIndices = 0; // cut off the front, so the first index left is this one of the original
+};
+
+// Every byte of a mesh derives from its seed and its position in the mesh, so any misplaced copy shows.
+static void fill(std::vector<uint8_t>& bytes, uint32_t seed) {
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<uint8_t>((seed * 2654435761u + i * 40503u) >> 11);
+    }
+}
+
+static bool matches(const uint8_t* pData, size_t size, uint32_t seed, size_t start = 0) {
+    for (size_t i = 0; i < size; ++i) {
+        if (pData[i] != static_cast<uint8_t>((seed * 2654435761u + (start + i) * 40503u) >> 11)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Checker {
+    const geometry_pool::GeometryPool& pool;
+    const MemoryBackend& backend;
+    int failures = 0;
+
+    void fail(const char* phase, const char* what) {
+        if (failures++ < 10) {
+            printf("  FAIL %s: %s\n", phase, what);
+        }
+    }
+
+    void check(const char* phase, const std::vector<LiveMesh>& live) {
+        std::vector<std::pair<uint32_t, uint32_t>> ranges[2];
+        for (const LiveMesh& mesh : live) {
+            const geometry_pool::MeshRange& range = pool.range(mesh.handle);
+            ranges[0].emplace_back(range.baseVertex, range.vertexCount);
+            ranges[1].emplace_back(range.firstIndex, range.indexCount);
+            if (!matches(backend.data(geometry_pool::Stream::Vertices) + size_t(range.baseVertex) * kStride, size_t(range.vertexCount) * kStride, mesh.seed) ||
+                !matches(backend.data(geometry_pool::Stream::Indices) + size_t(range.firstIndex) * kIndexSize, size_t(range.indexCount) * kIndexSize, mesh.seed + 1,
+                         size_t(mesh.trimmedIndices) * kIndexSize)) {
+                fail(phase, "mesh contents changed");
+            }
+        }
+        for (std::vector<std::pair<uint32_t, uint32_t>>& stream : ranges) {
+            std::sort(stream.begin(), stream.end());
+            for (size_t i = 1; i < stream.size(); ++i) {
+                if (stream[i - 1].first + stream[i - 1].second > stream[i].first) {
+                    fail(phase, "ranges overlap");
+                }
+            }
+        }
+    }
+};
+
+static void printStats(const char* label, const geometry_pool::GeometryPool& pool) {
+    const geometry_pool::PoolStats stats = pool.stats();
+    for (size_t s = 0; s < 2; ++s) {
+        const double elementSize = s == 0 ? kStride : kIndexSize;
+        printf("  %-22s %-8s used %7.1f MiB, top %7.1f MiB, capacity %7.1f MiB, %5zu holes, largest %6.1f MiB, fragmentation %.2f\n",
+               label, s == 0 ? "vertices" : "indices", stats.used[s] * elementSize / 1048576.0, stats.end[s] * elementSize / 1048576.0,
+               stats.capacity[s] * elementSize / 1048576.0, stats.freeRanges[s], stats.largestFree[s] * elementSize / 1048576.0,
+               stats.fragmentation(static_cast<geometry_pool::Stream>(s)));
+        label = "";
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const uint32_t frames = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 2000;
+    MemoryBackend backend;
+    geometry_pool::GeometryPool pool(&backend, kStride, kIndexSize, 1 << 20, 1 << 21, kFramesInFlight);
+    Checker checker { pool, backend };
+    std::mt19937 random(42);
+    std::vector<LiveMesh> live;
+
+    // Log-uniform between 64 and 16384 vertices, two triangles a vertex: lots of small props, a few large ones.
+    // Contents are made up front so the timings cover the pool alone, copy in included.
+    std::vector<uint8_t> vertices(size_t(16384) * kStride);
+    std::vector<uint8_t> indices(size_t(16384) * 6 * kIndexSize);
+    fill(vertices, 0);
+    fill(indices, 1);
+    double addSeconds = 0.0;
+    auto addMesh = [&]() {
+        const uint32_t vertexCount = static_cast<uint32_t>(64.0 * std::pow(256.0, std::uniform_real_distribution<double>(0.0, 1.0)(random)));
+        const uint32_t indexCount = vertexCount * 6;
+        const Clock::time_point addStart = Clock::now();
+        const geometry_pool::MeshHandle handle = pool.addMesh(vertices.data(), vertexCount, indices.data(), indexCount);
+        addSeconds += seconds(addStart);
+        if (handle == geometry_pool::kInvalidMesh) {
+            checker.fail("churn", "allocation failed");
+            return;
+        }
+        live.push_back({ handle, 0 });
+    };
+
+    // Ranges freed in the last kFramesInFlight frames must not be handed out again yet.
+    struct Freed {
+        uint32_t frame;
+        geometry_pool::MeshRange range;
+    };
+    std::vector<Freed> recentlyFreed;
+    auto checkReuse = [&](uint32_t frame) {
+        recentlyFreed.erase(std::remove_if(recentlyFreed.begin(), recentlyFreed.end(), [&](const Freed& freed) { return freed.frame + kFramesInFlight <= frame; }),
+                            recentlyFreed.end());
+        for (const LiveMesh& mesh : live) {
+            const geometry_pool::MeshRange& range = pool.range(mesh.handle);
+            for (const Freed& freed : recentlyFreed) {
+                if (range.baseVertex < freed.range.baseVertex + freed.range.vertexCount && freed.range.baseVertex < range.baseVertex + range.vertexCount) {
+                    checker.fail("churn", "range reused while in flight");
+                    return;
+                }
+            }
+        }
+    };
+
+    for (int i = 0; i < 2000; ++i) {
+        addMesh();
+    }
+    printf("fill: %zu meshes in %.2f ms\n", live.size(), addSeconds * 1000.0);
+    printStats("after fill", pool);
+    checker.check("fill", live);
+
+    // Churn: each frame replaces a few meshes at random, as streaming would.
+    double removeSeconds = 0.0;
+    addSeconds = 0.0;
+    uint64_t operations = 0;
+    for (uint32_t frame = 1; frame <= frames; ++frame) {
+        pool.advanceFrame();
+        const uint32_t replacements = 1 + random() % 8;
+        for (uint32_t r = 0; r < replacements && !live.empty(); ++r) {
+            const size_t victim = random() % live.size();
+            recentlyFreed.push_back({ frame, pool.range(live[victim].handle) });
+            const Clock::time_point start = Clock::now();
+            pool.removeMesh(live[victim].handle);
+            removeSeconds += seconds(start);
+            live[victim] = live.back();
+            live.pop_back();
+        }
+        for (uint32_t r = 0; r < replacements; ++r) {
+            addMesh();
+        }
+        operations += replacements;
+        if (frame % 64 == 0) {
+            checkReuse(frame);
+        }
+    }
+    printf("churn: %u frames, %llu meshes replaced; add %.2f us (copy in included), remove %.2f us\n", frames, (unsigned long long)operations,
+           addSeconds / double(operations) * 1e6, removeSeconds / double(operations) * 1e6);
+    printStats("after churn", pool);
+    checker.check("churn", live);
+
+    // Budgeted compaction, a few MiB a frame, with churn paused so its effect shows on its own.
+    constexpr size_t kBudget = 4 << 20;
+    uint32_t compactFrames = 0;
+    size_t totalMoved = 0;
+    double compactSeconds = 0.0;
+    for (;; ++compactFrames) {
+        pool.advanceFrame();
+        const Clock::time_point start = Clock::now();
+        const size_t moved = pool.compact(kBudget);
+        compactSeconds += seconds(start);
+        totalMoved += moved;
+        if (moved == 0) {
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < kFramesInFlight; ++i) {
+        pool.advanceFrame();
+    }
+    printf("compaction: %u frames at %zu MiB a frame, %.1f MiB moved, %.2f ms a frame\n", compactFrames, kBudget >> 20, totalMoved / 1048576.0,
+           compactFrames ? compactSeconds * 1000.0 / compactFrames : 0.0);
+    printStats("after compaction", pool);
+    checker.check("compaction", live);
+
+    // Churn once more on the compacted pool: the freed top should absorb new meshes without growth.
+    const uint64_t growthsBefore = pool.stats().growths;
+    for (uint32_t frame = 1; frame <= frames / 4; ++frame) {
+        pool.advanceFrame();
+        pool.compact(kBudget / 4);
+        const size_t victim = random() % live.size();
+        pool.removeMesh(live[victim].handle);
+        live[victim] = live.back();
+        live.pop_back();
+        addMesh();
+    }
+    printf("churn with compaction at %zu MiB a frame: %llu growths\n", (kBudget / 4) >> 20, (unsigned long long)(pool.stats().growths - growthsBefore));
+    printStats("steady state", pool);
+    checker.check("steady state", live);
+
+    // Drop the leading half of every other mesh's indices, then compact and cut the streams back to what is used.
+    size_t trimmed = 0;
+    for (size_t i = 0; i < live.size(); i += 2) {
+        const uint32_t count = pool.range(live[i].handle).indexCount;
+        pool.trimIndices(live[i].handle, count / 2, count - count / 2);
+        live[i].trimmedIndices = count / 2;
+        trimmed += size_t(count / 2) * kIndexSize;
+    }
+    checker.check("trim", live);
+    while (pool.compact(kBudget) > 0) {
+        pool.advanceFrame();
+    }
+    for (uint32_t i = 0; i < kFramesInFlight; ++i) {
+        pool.advanceFrame();
+    }
+    const geometry_pool::PoolStats beforeShrink = pool.stats();
+    const size_t released = pool.shrinkToFit();
+    const geometry_pool::PoolStats afterShrink = pool.stats();
+    size_t expected = 0;
+    for (size_t s = 0; s < 2; ++s) {
+        const size_t elementSize = s == 0 ? kStride : kIndexSize;
+        expected += size_t(beforeShrink.capacity[s] - beforeShrink.end[s]) * elementSize;
+        if (afterShrink.capacity[s] != beforeShrink.end[s] || backend.size(static_cast<geometry_pool::Stream>(s)) != afterShrink.capacity[s] * elementSize) {
+            checker.fail("shrink", "stream not cut back to its last mesh");
+        }
+    }
+    if (released != expected || afterShrink.capacity[1] >= beforeShrink.capacity[1]) {
+        checker.fail("shrink", "trimmed indices not given back");
+    }
+    printf("trim: %.1f MiB of indices dropped, %.1f MiB given back by shrinking\n", trimmed / 1048576.0, released / 1048576.0);
+    printStats("after shrink", pool);
+    checker.check("shrink", live);
+    // And it grows again on demand.
+    addMesh();
+    checker.check("grow after shrink", live);
+
+    if (backend.overlaps != 0) {
+        checker.fail("compaction", "copy between overlapping ranges");
+    }
+    const geometry_pool::PoolStats stats = pool.stats();
+    printf("%zu meshes share 2 buffers; %llu growths, %llu meshes moved (%.1f MiB)\n", stats.meshCount, (unsigned long long)stats.growths,
+           (unsigned long long)stats.movedMeshes, stats.movedBytes / 1048576.0);
+    return checker.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+//
+//  HotReloadSim.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Drives HotReloadService over real files in a temporary directory, with a fake compiler that "builds" a library from
+// the contents of its sources and fails on any that contain "error". Checks that only libraries whose files changed
+// are rebuilt, including a save that renames a temporary over the original; that a newer build supersedes one not yet
+// applied and the superseded one is released; that a failed compile keeps the previous library in use; that the
+// reload thread delivers edits on its own; and that no library leaks. Exits nonzero if any check fails. Plain C++:
+//   c++ -std=c++17 -O2 -pthread -ILearningMetal Tools/HotReloadSim.cpp LearningMetal/FileWatcher.cpp -o hot-reload-sim
+//   ./hot-reload-sim
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "ShaderHotReload.hpp"
+
+using namespace hot_reload;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// Reference counted like an MTL::Library; counts the ones alive.
+struct FakeLibrary {
+    uint32_t id;
+    std::string contents;
+    int references;
+    static int alive;
+};
+
+int FakeLibrary::alive = 0;
+
+static void release(FakeLibrary* pLibrary) {
+    if (--pLibrary->references == 0) {
+        --FakeLibrary::alive;
+        delete pLibrary;
+    }
+}
+
+static std::string read(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static void write(const std::string& path, const std::string& contents) {
+    std::ofstream(path, std::ios::binary) << contents;
+}
+
+// What an editor that saves atomically does.
+static void writeByRename(const std::string& path, const std::string& contents) {
+    write(path + ".tmp", contents);
+    rename((path + ".tmp").c_str(), path.c_str());
+}
+
+class Sim {
+public:
+    explicit Sim(const std::string& directory): _directory(directory) {
+        // Library 0 and 1 share common.h; library 2 has a file of its own.
+        sources = { { path("a.metal"), path("common.h") }, { path("b.metal"), path("common.h") }, { path("c.metal") } };
+        for (const std::vector<std::string>& files : sources) {
+            for (const std::string& file : files) {
+                write(file, "// " + file + "\n");
+            }
+        }
+        pService = new HotReloadService<FakeLibrary>([this](uint32_t library) { return compile(library); }, release);
+        for (const std::vector<std::string>& files : sources) {
+            pService->watch(files);
+        }
+        // The libraries the app starts with.
+        for (uint32_t library = 0; library < sources.size(); ++library) {
+            current.push_back(compile(library));
+        }
+        compiled.clear();
+    }
+
+    ~Sim() {
+        delete pService;
+        for (FakeLibrary* pLibrary : current) {
+            release(pLibrary);
+        }
+        for (const std::vector<std::string>& files : sources) {
+            for (const std::string& file : files) {
+                unlink(file.c_str());
+            }
+        }
+    }
+
+    std::string path(const char* name) const { return _directory + "/" + name; }
+
+    // Swaps rebuilt libraries in, as Renderer::applyShaderReloads does.
+    size_t apply() {
+        return pService->applyPending([this](uint32_t library, FakeLibrary* pLibrary) {
+            ++pLibrary->references;
+            release(current[library]);
+            current[library] = pLibrary;
+            swapped.push_back(library);
+        });
+    }
+
+    FakeLibrary* compile(uint32_t library) {
+        std::string contents;
+        for (const std::string& file : sources[library]) {
+            contents += read(file);
+        }
+        compiled.push_back(library);
+        if (contents.find("error") != std::string::npos) {
+            return nullptr;
+        }
+        ++FakeLibrary::alive;
+        return new FakeLibrary { library, contents, 1 };
+    }
+
+    std::vector<std::vector<std::string>> sources;
+    HotReloadService<FakeLibrary>* pService;
+    std::vector<FakeLibrary*> current;
+    std::vector<uint32_t> compiled; // compile calls since the last clear, from either thread
+    std::vector<uint32_t> swapped;
+
+private:
+    std::string _directory;
+};
+
+static void checkOnlyChangedRebuild(Sim& sim) {
+    const char* name = "changed only";
+    if (sim.pService->pollOnce() != 0 || !sim.compiled.empty()) {
+        fail(name, "rebuilt without a change");
+    }
+    write(sim.path("a.metal"), "float a() { return 1.0; }\n");
+    if (sim.pService->pollOnce() != 1 || sim.compiled != std::vector<uint32_t> { 0 }) {
+        fail(name, "an edit did not rebuild exactly its library");
+    }
+    if (sim.apply() != 1 || sim.swapped != std::vector<uint32_t> { 0 } || sim.current[0]->contents.find("return 1.0") == std::string::npos) {
+        fail(name, "rebuilt library not swapped in");
+    }
+
+    // A shared header rebuilds both libraries that include it, once each.
+    sim.compiled.clear();
+    sim.swapped.clear();
+    write(sim.path("common.h"), "#define SHARED 1\n");
+    if (sim.pService->pollOnce() != 2 || sim.compiled != std::vector<uint32_t> { 0, 1 }) {
+        fail(name, "a shared file did not rebuild exactly the libraries using it");
+    }
+    sim.apply();
+
+    sim.compiled.clear();
+    writeByRename(sim.path("c.metal"), "float c() { return 3.0; }\n");
+    if (sim.pService->pollOnce() != 1 || sim.compiled != std::vector<uint32_t> { 2 }) {
+        fail(name, "a save by rename was missed");
+    }
+    sim.apply();
+    if (sim.pService->pollOnce() != 0) {
+        fail(name, "the same save reported twice");
+    }
+}
+
+static void checkSuperseded(Sim& sim) {
+    const char* name = "superseded";
+    const int alive = FakeLibrary::alive;
+    sim.swapped.clear();
+    write(sim.path("b.metal"), "float b() { return 1.0; }\n");
+    sim.pService->pollOnce();
+    write(sim.path("b.metal"), "float b() { return 2.0f; }\n");
+    sim.pService->pollOnce();
+    if (FakeLibrary::alive != alive + 1) {
+        fail(name, "the superseded build was not released");
+    }
+    if (sim.apply() != 1 || sim.swapped != std::vector<uint32_t> { 1 } || sim.current[1]->contents.find("2.0f") == std::string::npos) {
+        fail(name, "not exactly the newest build applied");
+    }
+    if (FakeLibrary::alive != alive) {
+        fail(name, "the replaced library was not released");
+    }
+}
+
+static void checkFailedCompile(Sim& sim) {
+    const char* name = "failed compile";
+    FakeLibrary* pBefore = sim.current[0];
+    const std::string contents = pBefore->contents;
+    const uint64_t failed = sim.pService->stats().failed;
+    write(sim.path("a.metal"), "float a() { error }\n");
+    if (sim.pService->pollOnce() != 0 || sim.pService->stats().failed != failed + 1) {
+        fail(name, "a broken file counted as built");
+    }
+    if (sim.apply() != 0 || sim.current[0] != pBefore || pBefore->contents != contents) {
+        fail(name, "the previous library was not kept");
+    }
+    // Fixing the file brings the rebuild back.
+    write(sim.path("a.metal"), "float a() { return 4.0; }\n");
+    if (sim.pService->pollOnce() != 1 || sim.apply() != 1 || sim.current[0]->contents.find("4.0") == std::string::npos) {
+        fail(name, "the fixed file was not rebuilt");
+    }
+}
+
+// The reload thread picks an edit up within its poll and settle intervals.
+static void checkThread(Sim& sim) {
+    const char* name = "thread";
+    sim.swapped.clear();
+    sim.pService->start();
+    write(sim.path("c.metal"), "float c() { return 5.0; }\n");
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (sim.swapped.empty() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        sim.apply();
+    }
+    sim.pService->stop();
+    if (sim.swapped != std::vector<uint32_t> { 2 } || sim.current[2]->contents.find("5.0") == std::string::npos) {
+        fail(name, "the reload thread did not deliver the edit");
+    }
+}
+
+int main() {
+    char directory[] = "/tmp/hot-reload-sim-XXXXXX";
+    if (mkdtemp(directory) == nullptr) {
+        perror("mkdtemp");
+        return 2;
+    }
+    {
+        Sim sim(directory);
+        checkOnlyChangedRebuild(sim);
+        checkSuperseded(sim);
+        checkFailedCompile(sim);
+        checkThread(sim);
+        // A build never applied is released with the service.
+        write(sim.path("b.metal"), "float b() { return 6.0; }\n");
+        sim.pService->pollOnce();
+        const ReloadStats stats = sim.pService->stats();
+        printf("%llu changes, %llu compiled, %llu failed, %llu swapped, %.3f ms compiling\n", (unsigned long long)stats.changes,
+               (unsigned long long)stats.compiled, (unsigned long long)stats.failed, (unsigned long long)stats.swapped, stats.compileSeconds * 1000.0);
+    }
+    rmdir(directory);
+    if (FakeLibrary::alive != 0) {
+        fail("leaks", "libraries still alive after the service and the app released theirs");
+    }
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+//
+//  LodBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Builds LOD chains, reports triangles, error and throughput per level, and checks every level: indices in range,
+// no collapsed triangles, counts falling and errors rising, texture seams intact (no triangle spans both sides of a
+// sphere's UV seam) and open borders intact (a terrain grid keeps its exact outline area). Then builds a batch of
+// meshes on one thread and on all of them, checks the results match and reports the speedup. Exits nonzero if any
+// check fails. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/LodBench.cpp LearningMetal/MeshSimplify.cpp LearningMetal/MeshOptimizer.cpp LearningMetal/MeshImport.cpp LearningMetal/MappedMesh.cpp LearningMetal/VertexQuantize.cpp -pthread -o lod-bench
+//   ./lod-bench [model.obj model.glb ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "MeshImport.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplify.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// A unit UV sphere whose seam column and poles repeat positions exactly, with texture coordinates telling them apart.
+static mesh_import::ImportedMesh makeSphere(uint32_t segments) {
+    mesh_import::ImportedMesh mesh;
+    const float pi = 3.14159265f;
+    for (uint32_t ring = 0; ring <= segments; ++ring) {
+        const float theta = pi * float(ring) / float(segments);
+        for (uint32_t step = 0; step <= segments * 2; ++step) {
+            const float phi = pi * float(step % (segments * 2)) / float(segments);
+            float p[3] = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+            if (ring == 0 || ring == segments) {
+                p[0] = p[2] = 0.0f;
+                p[1] = ring == 0 ? 1.0f : -1.0f;
+            }
+            mesh.positions.insert(mesh.positions.end(), { p[0], p[1], p[2] });
+            mesh.normals.insert(mesh.normals.end(), { p[0], p[1], p[2] });
+            mesh.texCoords.insert(mesh.texCoords.end(), { float(step) / float(segments * 2), float(ring) / float(segments) });
+        }
+    }
+    const uint32_t columns = segments * 2 + 1;
+    for (uint32_t ring = 0; ring < segments; ++ring) {
+        for (uint32_t step = 0; step < segments * 2; ++step) {
+            const uint32_t i = ring * columns + step;
+            mesh.indices.insert(mesh.indices.end(), { i, i + columns, i + 1, i + 1, i + columns, i + columns + 1 });
+        }
+    }
+    return mesh;
+}
+
+// Open terrain: rolling hills on a size x size grid in the xy plane.
+static mesh_import::ImportedMesh makeTerrain(uint32_t size) {
+    mesh_import::ImportedMesh mesh;
+    for (uint32_t y = 0; y <= size; ++y) {
+        for (uint32_t x = 0; x <= size; ++x) {
+            const float h = 3.0f * std::sin(float(x) * 0.07f) * std::cos(float(y) * 0.05f) + 0.5f * std::sin(float(x + 2 * y) * 0.3f);
+            mesh.positions.insert(mesh.positions.end(), { float(x), float(y), h });
+        }
+    }
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            const uint32_t i = y * (size + 1) + x;
+            mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + size + 2, i, i + size + 2, i + size + 1 });
+        }
+    }
+    return mesh;
+}
+
+struct Vec3 {
+    double x, y, z;
+};
+
+static Vec3 position(const mesh_import::ImportedMesh& mesh, uint32_t index) {
+    return { mesh.positions[index * 3], mesh.positions[index * 3 + 1], mesh.positions[index * 3 + 2] };
+}
+
+static bool samePosition(const mesh_import::ImportedMesh& mesh, uint32_t a, uint32_t b) {
+    return mesh.positions[a * 3] == mesh.positions[b * 3] && mesh.positions[a * 3 + 1] == mesh.positions[b * 3 + 1] && mesh.positions[a * 3 + 2] == mesh.positions[b * 3 + 2];
+}
+
+static int validate(const char* name, const mesh_import::ImportedMesh& mesh, const mesh_simplify::LodChain& chain) {
+    int failures = 0;
+    auto fail = [&](size_t level, const char* what) {
+        if (failures++ < 10) {
+            printf("  FAIL %s level %zu: %s\n", name, level, what);
+        }
+    };
+
+    const size_t vertexCount = mesh.vertexCount();
+    const bool terrain = mesh.texCoords.empty() && mesh.normals.empty();
+    for (size_t l = 0; l < chain.levels.size(); ++l) {
+        const mesh_simplify::LodLevel& level = chain.levels[l];
+        if (size_t(level.firstIndex) + level.indexCount > chain.indices.size() || level.indexCount % 3 != 0) {
+            fail(l, "range outside the index list");
+            continue;
+        }
+        if (l == 0 ? level.error != 0.0f : level.error < chain.levels[l - 1].error) {
+            fail(l, "error decreased");
+        }
+        if (l > 0 && level.indexCount >= chain.levels[l - 1].indexCount) {
+            fail(l, "triangle count did not fall");
+        }
+
+        const uint32_t* indices = chain.indices.data() + level.firstIndex;
+        double area = 0.0;
+        double folded = 0.0;
+        for (size_t i = 0; i < level.indexCount; i += 3) {
+            const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a >= vertexCount || b >= vertexCount || c >= vertexCount) {
+                fail(l, "index out of range");
+                break;
+            }
+            if (l > 0 && (samePosition(mesh, a, b) || samePosition(mesh, b, c) || samePosition(mesh, a, c))) {
+                fail(l, "collapsed triangle left in");
+                break;
+            }
+            if (!mesh.texCoords.empty()) {
+                // Triangles of the sphere span a small range of u; one spanning half the texture crosses the seam.
+                const float u[3] = { mesh.texCoords[a * 2], mesh.texCoords[b * 2], mesh.texCoords[c * 2] };
+                if (std::max({ u[0], u[1], u[2] }) - std::min({ u[0], u[1], u[2] }) > 0.5f) {
+                    fail(l, "triangle crosses the texture seam");
+                    break;
+                }
+            }
+            const Vec3 p0 = position(mesh, a), p1 = position(mesh, b), p2 = position(mesh, c);
+            const double triangleArea = 0.5 * ((p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y));
+            area += triangleArea;
+            folded += std::max(-triangleArea, 0.0);
+        }
+        if (terrain && folded > 1e-3 * area) {
+            // A height field seen from above: only folds face down. Slivers stood on edge may tip a little past
+            // vertical, but more than a thousandth of the area folded over is a visible fault.
+            fail(l, "surface folded over");
+        }
+        if (terrain && l > 0) {
+            // The signed area projected onto xy is the area inside the outline, which must not move.
+            double reference = 0.0;
+            for (size_t i = 0; i < chain.levels[0].indexCount; i += 3) {
+                const Vec3 p0 = position(mesh, chain.indices[i]), p1 = position(mesh, chain.indices[i + 1]), p2 = position(mesh, chain.indices[i + 2]);
+                reference += 0.5 * ((p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y));
+            }
+            if (std::fabs(area - reference) > 1e-6 * std::fabs(reference)) {
+                fail(l, "outline area changed");
+            }
+        }
+    }
+    return failures;
+}
+
+// Largest distance of a triangle centroid from the unit sphere, a lower bound on the true error of a sphere LOD.
+static double sphereDeviation(const mesh_import::ImportedMesh& mesh, const uint32_t* indices, size_t indexCount) {
+    double deviation = 0.0;
+    for (size_t i = 0; i < indexCount; i += 3) {
+        const Vec3 p0 = position(mesh, indices[i]), p1 = position(mesh, indices[i + 1]), p2 = position(mesh, indices[i + 2]);
+        const Vec3 c = { (p0.x + p1.x + p2.x) / 3.0, (p0.y + p1.y + p2.y) / 3.0, (p0.z + p1.z + p2.z) / 3.0 };
+        deviation = std::max(deviation, 1.0 - std::sqrt(c.x * c.x + c.y * c.y + c.z * c.z));
+    }
+    return deviation;
+}
+
+static int report(const char* name, const mesh_import::ImportedMesh& mesh, bool isSphere) {
+    const Clock::time_point start = Clock::now();
+    const mesh_simplify::LodChain chain = mesh_simplify::buildLodChain(mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float));
+    const double elapsed = seconds(start);
+
+    printf("%s: %zu vertices, %zu triangles, %zu levels in %.1f ms (%.2f Mtri/s)\n", name, mesh.vertexCount(), mesh.triangleCount(), chain.levels.size(),
+           elapsed * 1000.0, double(mesh.triangleCount()) / elapsed * 1e-6);
+    printf("  %5s %10s %12s %12s%s\n", "level", "triangles", "error", "acmr", isSphere ? "     measured" : "");
+    for (size_t l = 0; l < chain.levels.size(); ++l) {
+        const mesh_simplify::LodLevel& level = chain.levels[l];
+        const uint32_t* indices = chain.indices.data() + level.firstIndex;
+        const mesh_optimize::VertexCacheStats cache = mesh_optimize::analyzeVertexCache(indices, level.indexCount, mesh.vertexCount(), mesh_optimize::kVertexCacheSize);
+        printf("  %5zu %10u %12.3g %12.3f", l, level.indexCount / 3, level.error, cache.acmr);
+        if (isSphere) {
+            printf(" %12.3g", sphereDeviation(mesh, indices, level.indexCount));
+        }
+        printf("\n");
+    }
+    return validate(name, mesh, chain);
+}
+
+static bool sameChains(const std::vector<mesh_simplify::LodChain>& a, const std::vector<mesh_simplify::LodChain>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].indices != b[i].indices || a[i].levels.size() != b[i].levels.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int reportBatch(uint32_t meshCount) {
+    std::vector<mesh_import::ImportedMesh> meshes;
+    std::vector<mesh_simplify::LodSource> sources;
+    size_t triangles = 0;
+    for (uint32_t i = 0; i < meshCount; ++i) {
+        // Mixed sizes, so the work per mesh is uneven.
+        meshes.push_back(i % 2 ? makeSphere(48 + 16 * (i % 5)) : makeTerrain(64 + 32 * (i % 3)));
+    }
+    for (const mesh_import::ImportedMesh& mesh : meshes) {
+        sources.push_back({ mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float) });
+        triangles += mesh.triangleCount();
+    }
+
+    Clock::time_point start = Clock::now();
+    const std::vector<mesh_simplify::LodChain> serial = mesh_simplify::buildLodChains(sources, {}, 1);
+    const double serialSeconds = seconds(start);
+    start = Clock::now();
+    const std::vector<mesh_simplify::LodChain> parallel = mesh_simplify::buildLodChains(sources, {}, 0);
+    const double parallelSeconds = seconds(start);
+
+    printf("batch: %u meshes, %zu triangles: 1 thread %.1f ms, all threads %.1f ms (%.1fx, %.2f Mtri/s)\n", meshCount, triangles, serialSeconds * 1000.0,
+           parallelSeconds * 1000.0, serialSeconds / parallelSeconds, double(triangles) / parallelSeconds * 1e-6);
+    if (!sameChains(serial, parallel)) {
+        printf("  FAIL batch: threaded results differ\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    if (argc < 2) {
+        failures += report("UV sphere 64", makeSphere(64), true);
+        failures += report("UV sphere 256", makeSphere(256), true);
+        failures += report("terrain 256", makeTerrain(256), false);
+        mesh_import::ImportedMesh optimized = makeTerrain(512);
+        mesh_optimize::optimizeMesh(optimized);
+        failures += report("terrain 512, optimized", optimized, false);
+        failures += reportBatch(64);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        mesh_import::ImportedMesh mesh;
+        std::string error;
+        if (!mesh_import::importMesh(argv[i], mesh, {}, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            ++failures;
+            continue;
+        }
+        failures += report(argv[i], mesh, false);
+    }
+    return failures == 0 ? 0 : 1;
+}
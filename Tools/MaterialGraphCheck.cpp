@@ -0,0 +1,326 @@
+//
+//  MaterialGraphCheck.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/29.
+//
+
+// Checks MaterialGraph and MaterialCache without a device: the structural hash is the same whatever order nodes were
+// added in and ignores unreachable nodes, but changes with any function, argument order, input index or name;
+// validate() rejects every malformed graph it is meant to, including forward references that call() only asserts on;
+// and the cache stitches each distinct material once and a broken one at most once, against a stub stitcher. Ends
+// with random graphs rebuilt in shuffled node orders. Exits nonzero if any check fails. Built without asserts, as in
+// release builds, so the forward references get through to validate():
+//   c++ -std=c++17 -O2 -DNDEBUG -ILearningMetal Tools/MaterialGraphCheck.cpp LearningMetal/MaterialGraph.cpp -o material-graph-check
+//   ./material-graph-check
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "MaterialGraph.hpp"
+
+using namespace material_graph;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// materialDepthFade(materialTint(materialGrayscale(in0), in2), in1), the second material buildMaterials stitches.
+static MaterialGraph inOrder() {
+    MaterialGraph graph("stitchedMaterial");
+    NodeId color = graph.input(0);
+    NodeId depth = graph.input(1);
+    NodeId tint = graph.input(2);
+    NodeId gray = graph.call("materialGrayscale", { color });
+    graph.setOutput(graph.call("materialDepthFade", { graph.call("materialTint", { gray, tint }), depth }));
+    return graph;
+}
+
+// The same expression with the inputs added backwards and an unused node in between.
+static MaterialGraph reordered() {
+    MaterialGraph graph("stitchedMaterial");
+    NodeId tint = graph.input(2);
+    NodeId color = graph.input(0);
+    graph.call("materialMix", { color, tint, color });
+    NodeId gray = graph.call("materialGrayscale", { color });
+    NodeId tinted = graph.call("materialTint", { gray, tint });
+    NodeId depth = graph.input(1);
+    graph.setOutput(graph.call("materialDepthFade", { tinted, depth }));
+    return graph;
+}
+
+static void checkHash() {
+    const char* name = "hash";
+    const MaterialGraph a = inOrder();
+    const MaterialGraph b = reordered();
+    if (a.hash() != b.hash() || a.describe() != b.describe()) {
+        fail(name, "node order or an unreachable node changed the hash");
+    }
+    if (a.hash() != inOrder().hash()) {
+        fail(name, "not deterministic");
+    }
+    if (a.functionNames() != std::vector<std::string> { "materialGrayscale", "materialTint", "materialDepthFade" }) {
+        fail(name, "wrong building blocks");
+    }
+    if (b.reachableFunctionNodes().size() != 3) {
+        fail(name, "unreachable node counted as reachable");
+    }
+
+    std::vector<MaterialGraph> different;
+    {
+        MaterialGraph graph("stitchedMaterial"); // arguments of materialTint swapped
+        NodeId color = graph.input(0);
+        NodeId depth = graph.input(1);
+        NodeId tint = graph.input(2);
+        graph.setOutput(graph.call("materialDepthFade", { graph.call("materialTint", { tint, graph.call("materialGrayscale", { color }) }), depth }));
+        different.push_back(std::move(graph));
+    }
+    {
+        MaterialGraph graph("stitchedMaterial"); // another function
+        NodeId color = graph.input(0);
+        NodeId depth = graph.input(1);
+        NodeId tint = graph.input(2);
+        graph.setOutput(graph.call("materialDepthFade", { graph.call("materialMix", { graph.call("materialGrayscale", { color }), tint }), depth }));
+        different.push_back(std::move(graph));
+    }
+    {
+        MaterialGraph graph("stitchedMaterial"); // in1 and in2 exchanged
+        NodeId color = graph.input(0);
+        NodeId depth = graph.input(2);
+        NodeId tint = graph.input(1);
+        graph.setOutput(graph.call("materialDepthFade", { graph.call("materialTint", { graph.call("materialGrayscale", { color }), tint }), depth }));
+        different.push_back(std::move(graph));
+    }
+    {
+        MaterialGraph graph = inOrder(); // another output
+        graph.setOutput(3);
+        different.push_back(std::move(graph));
+    }
+    {
+        MaterialGraph graph("otherMaterial"); // another stitched function name
+        NodeId color = graph.input(0);
+        NodeId depth = graph.input(1);
+        NodeId tint = graph.input(2);
+        graph.setOutput(graph.call("materialDepthFade", { graph.call("materialTint", { graph.call("materialGrayscale", { color }), tint }), depth }));
+        different.push_back(std::move(graph));
+    }
+    for (size_t i = 0; i < different.size(); ++i) {
+        if (different[i].hash() == a.hash()) {
+            fail(name, "a different material hashes equal");
+        }
+        for (size_t j = 0; j < i; ++j) {
+            if (different[i].hash() == different[j].hash()) {
+                fail(name, "two different materials hash equal");
+            }
+        }
+    }
+}
+
+static void expectInvalid(const char* what, const MaterialGraph& graph) {
+    std::string error;
+    if (graph.validate(&error) || error.empty()) {
+        fail("validate", what);
+    }
+    // Hashing and describing must still terminate, since the cache does both for graphs that fail.
+    graph.hash();
+    graph.describe();
+}
+
+static void checkValidate() {
+    std::string error;
+    if (!inOrder().validate(&error) || !reordered().validate()) {
+        fail("validate", ("rejected a valid graph: " + error).c_str());
+    }
+    {
+        MaterialGraph graph("");
+        graph.setOutput(graph.call("materialGrayscale", { graph.input(0) }));
+        expectInvalid("accepted an unnamed function", graph);
+    }
+    {
+        MaterialGraph graph("stitchedMaterial");
+        graph.call("materialGrayscale", { graph.input(0) });
+        expectInvalid("accepted a graph without an output", graph);
+    }
+    {
+        MaterialGraph graph("stitchedMaterial");
+        graph.setOutput(graph.input(0));
+        expectInvalid("accepted an input node as the output", graph);
+    }
+    {
+        MaterialGraph graph("stitchedMaterial");
+        NodeId color = graph.input(0);
+        graph.call("", { color });
+        graph.setOutput(graph.call("materialGrayscale", { color }));
+        expectInvalid("accepted a function node without a function", graph);
+    }
+    {
+        MaterialGraph graph("stitchedMaterial");
+        graph.setOutput(graph.call("materialTint", { graph.input(0), graph.input(2) }));
+        expectInvalid("accepted a gap in the argument indices", graph);
+    }
+#ifdef NDEBUG
+    {
+        // Nodes 1 and 2 use each other.
+        MaterialGraph graph("stitchedMaterial");
+        NodeId color = graph.input(0);
+        graph.call("materialGrayscale", { 2 });
+        graph.setOutput(graph.call("materialTint", { 1, color }));
+        expectInvalid("accepted a forward reference", graph);
+    }
+#else
+    fail("validate", "built with asserts, so forward references were not checked");
+#endif
+}
+
+// Stub stitched functions; the stitcher refuses graphs calling "materialBroken".
+struct StubFunction {
+    uint64_t hash;
+};
+
+static void checkCache() {
+    const char* name = "cache";
+    int stitches = 0, released = 0;
+    {
+        MaterialCache<StubFunction> cache(
+            [&stitches](const MaterialGraph& graph) -> StubFunction* {
+                ++stitches;
+                const std::vector<std::string> names = graph.functionNames();
+                return std::find(names.begin(), names.end(), "materialBroken") != names.end() ? nullptr : new StubFunction { graph.hash() };
+            },
+            [&released](StubFunction* pFunction) {
+                ++released;
+                delete pFunction;
+            });
+
+        StubFunction* pFunction = cache.getOrCreate(inOrder());
+        if (pFunction == nullptr || cache.getOrCreate(reordered()) != pFunction || stitches != 1 || cache.stats().hits != 1) {
+            fail(name, "the same material stitched twice");
+        }
+        if (cache.find(inOrder().hash()) != pFunction) {
+            fail(name, "not found by hash");
+        }
+
+        MaterialGraph broken("stitchedMaterial");
+        broken.setOutput(broken.call("materialBroken", { broken.input(0) }));
+        MaterialGraph invalid("stitchedMaterial");
+        invalid.setOutput(invalid.input(0));
+        for (int i = 0; i < 3; ++i) {
+            if (cache.getOrCreate(broken) != nullptr || cache.getOrCreate(invalid) != nullptr) {
+                fail(name, "a broken material returned a function");
+            }
+        }
+        if (stitches != 2) {
+            fail(name, "a broken material was stitched again, or an invalid one stitched at all");
+        }
+        const MaterialCacheStats& stats = cache.stats();
+        if (stats.failures != 2 || stats.failureHits != 4 || stats.builds != 1 || cache.size() != 1) {
+            fail(name, "wrong failure counts");
+        }
+    }
+    if (released != 1) {
+        fail(name, "stitched functions not released");
+    }
+}
+
+// Builds a random expression tree with shared subexpressions, then rebuilds it adding nodes in another valid order.
+static void checkRandomGraphs(uint32_t count) {
+    const char* name = "random graphs";
+    std::mt19937 random(38);
+    const char* functions[] = { "materialTint", "materialMix", "materialGrayscale", "materialDepthFade" };
+    // Expressions and hashes must correspond one to one.
+    std::unordered_map<std::string, uint64_t> hashByExpression;
+    std::unordered_set<uint64_t> hashes;
+    for (uint32_t g = 0; g < count; ++g) {
+        // Node i: an input (argument index) or a call on earlier nodes.
+        struct Spec {
+            bool isInput;
+            uint32_t argumentIndex;
+            const char* function;
+            std::vector<uint32_t> arguments;
+        };
+        const uint32_t inputs = 1 + random() % 3;
+        std::vector<Spec> specs;
+        for (uint32_t i = 0; i < inputs; ++i) {
+            specs.push_back({ true, i, nullptr, {} });
+        }
+        const uint32_t calls = 1 + random() % 8;
+        for (uint32_t i = 0; i < calls; ++i) {
+            Spec spec { false, 0, functions[random() % 4], {} };
+            for (uint32_t a = 1 + random() % 3; a > 0; --a) {
+                spec.arguments.push_back(random() % specs.size());
+            }
+            specs.push_back(spec);
+        }
+
+        // Two topological orders of the same specs: as generated, and by repeatedly taking a random ready node.
+        auto build = [&specs](const std::vector<uint32_t>& order) {
+            MaterialGraph graph("stitchedMaterial");
+            std::vector<NodeId> ids(specs.size());
+            for (uint32_t spec : order) {
+                if (specs[spec].isInput) {
+                    ids[spec] = graph.input(specs[spec].argumentIndex);
+                } else {
+                    std::vector<NodeId> arguments;
+                    for (uint32_t argument : specs[spec].arguments) {
+                        arguments.push_back(ids[argument]);
+                    }
+                    ids[spec] = graph.call(specs[spec].function, arguments);
+                }
+            }
+            graph.setOutput(ids.back());
+            return graph;
+        };
+        std::vector<uint32_t> generated(specs.size()), shuffled;
+        for (uint32_t i = 0; i < specs.size(); ++i) {
+            generated[i] = i;
+        }
+        std::vector<bool> placed(specs.size(), false);
+        while (shuffled.size() < specs.size()) {
+            std::vector<uint32_t> ready;
+            for (uint32_t i = 0; i < specs.size(); ++i) {
+                const bool argumentsPlaced = std::all_of(specs[i].arguments.begin(), specs[i].arguments.end(), [&placed](uint32_t a) { return placed[a]; });
+                if (!placed[i] && argumentsPlaced) {
+                    ready.push_back(i);
+                }
+            }
+            const uint32_t next = ready[random() % ready.size()];
+            placed[next] = true;
+            shuffled.push_back(next);
+        }
+
+        const MaterialGraph a = build(generated);
+        const MaterialGraph b = build(shuffled);
+        if (a.hash() != b.hash() || a.describe() != b.describe()) {
+            fail(name, "the same expression hashed differently in another node order");
+        }
+        if (!b.validate()) {
+            fail(name, "a graph built in a valid order failed to validate");
+        }
+        const auto [it, inserted] = hashByExpression.emplace(a.describe(), a.hash());
+        if (!inserted && it->second != a.hash()) {
+            fail(name, "the same expression hashed differently");
+        }
+        hashes.insert(a.hash());
+    }
+    if (hashes.size() != hashByExpression.size()) {
+        fail(name, "different expressions share a hash");
+    }
+    printf("%u random graphs, %zu distinct expressions\n", count, hashByExpression.size());
+}
+
+int main() {
+    checkHash();
+    checkValidate();
+    checkCache();
+    checkRandomGraphs(2000);
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+//
+//  MemoryBudgetSim.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Drives a MemoryBudget against a simulated device working-set budget and checks it: per category accounting through
+// track, resize and untrack; the over-budget warning fires once per excursion over the high watermark; eviction offers
+// MakePurgeable to every candidate before any DropLod, in priority then least-recently-used order, skips allocations
+// used this frame or without a handler, and stops at the low watermark. Then streams textures through a small budget
+// frame by frame and reports what eviction reclaimed. Exits nonzero if any check fails. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/MemoryBudgetSim.cpp LearningMetal/MemoryBudget.cpp -o memory-budget-sim
+//   ./memory-budget-sim [frames]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "MemoryBudget.hpp"
+
+using namespace memory_budget;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// Sum of the per category totals, which must always equal the overall total.
+static uint64_t categorySum(const MemoryBudget& budget) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < static_cast<size_t>(Category::Count); ++i) {
+        sum += budget.allocatedBytes(static_cast<Category>(i));
+    }
+    return sum;
+}
+
+static void checkTotal(const char* name, const MemoryBudget& budget, uint64_t expected) {
+    if (budget.allocatedBytes() != expected) {
+        fail(name, "wrong total");
+    }
+    if (categorySum(budget) != budget.allocatedBytes()) {
+        fail(name, "categories do not add up to the total");
+    }
+}
+
+static void checkAccounting() {
+    const char* name = "accounting";
+    MemoryBudget budget(1 << 20);
+    const AllocationId vertices = budget.track(Category::VertexData, 1000, "vertices");
+    const AllocationId texture = budget.track(Category::Texture, 4000, "texture");
+    const AllocationId staging = budget.track(Category::Staging, 500, "staging");
+    checkTotal(name, budget, 5500);
+    if (budget.allocatedBytes(Category::Texture) != 4000 || budget.allocatedBytes(Category::VertexData) != 1000) {
+        fail(name, "wrong category after track");
+    }
+
+    budget.resize(texture, 2500);
+    checkTotal(name, budget, 4000);
+    budget.resize(texture, 6000);
+    checkTotal(name, budget, 7500);
+    if (budget.allocatedBytes(Category::Texture) != 6000) {
+        fail(name, "resize did not move the category");
+    }
+
+    budget.untrack(vertices);
+    checkTotal(name, budget, 6500);
+    if (budget.allocatedBytes(Category::VertexData) != 0) {
+        fail(name, "untrack left bytes in the category");
+    }
+    // Stale and unknown ids are ignored.
+    budget.untrack(vertices);
+    budget.resize(vertices, 123);
+    budget.touch(vertices, 1);
+    checkTotal(name, budget, 6500);
+    budget.untrack(texture);
+    budget.untrack(staging);
+    checkTotal(name, budget, 0);
+}
+
+static void checkWarning() {
+    const char* name = "warning";
+    // High watermark 950, low 850.
+    MemoryBudget budget(1000);
+    const AllocationId a = budget.track(Category::Texture, 900, "a");
+    if (budget.isOverBudget() || budget.enforce(1).warned) {
+        fail(name, "warned under the high watermark");
+    }
+    budget.resize(a, 960);
+    if (!budget.isOverBudget() || !budget.enforce(2).warned) {
+        fail(name, "no warning over the high watermark");
+    }
+    if (budget.enforce(3).warned) {
+        fail(name, "warned twice for one excursion");
+    }
+    budget.resize(a, 500);
+    budget.enforce(4);
+    budget.resize(a, 990);
+    if (!budget.enforce(5).warned) {
+        fail(name, "no warning for a second excursion");
+    }
+    budget.setBudget(900);
+    if (!budget.enforce(6).warned) {
+        fail(name, "a new budget did not re-arm the warning");
+    }
+}
+
+struct Evicted {
+    std::string label;
+    EvictionAction action;
+};
+
+static void checkEvictionOrder() {
+    const char* name = "eviction order";
+    std::vector<Evicted> log;
+    // Reclaims the given bytes per action and logs each offer.
+    auto handler = [&log](const char* label, uint64_t purgeable, uint64_t lod) -> EvictionHandler {
+        return [&log, label, purgeable, lod](EvictionAction action) {
+            log.push_back({ label, action });
+            return action == EvictionAction::MakePurgeable ? purgeable : lod;
+        };
+    };
+
+    // High watermark 950, low 850.
+    MemoryBudget budget(1000);
+    budget.track(Category::Uniforms, 300, "pinned");
+    const AllocationId b = budget.track(Category::Texture, 200, "b", 1, handler("b", 20, 50));
+    const AllocationId c = budget.track(Category::Texture, 200, "c", 0, handler("c", 200, 0));
+    const AllocationId d = budget.track(Category::Texture, 200, "d", 0, handler("d", 0, 100));
+    const AllocationId e = budget.track(Category::VertexData, 100, "e", 0, handler("e", 100, 0));
+    budget.touch(b, 1);
+    budget.touch(c, 5);
+    budget.touch(d, 3);
+    budget.touch(e, 10);
+
+    // e was used this frame; d is older than c; c alone brings usage under the low watermark.
+    EvictionReport report = budget.enforce(10);
+    if (log.size() != 2 || log[0].label != "d" || log[1].label != "c" || log[1].action != EvictionAction::MakePurgeable) {
+        fail(name, "wrong first eviction round");
+    }
+    if (report.purgedCount != 1 || report.lodDropCount != 0 || report.bytesBefore != 1000 || report.bytesAfter != 800) {
+        fail(name, "wrong first eviction report");
+    }
+    checkTotal(name, budget, 800);
+
+    // c is restored, so it may be purged again; d reclaimed nothing, so it is asked again.
+    log.clear();
+    budget.resize(c, 200);
+    budget.track(Category::Uniforms, 200, "pinned too");
+    report = budget.enforce(11);
+    const char* expected[] = { "d", "c", "e", "b", "d" };
+    bool matches = log.size() == 5;
+    for (size_t i = 0; matches && i < 5; ++i) {
+        matches = log[i].label == expected[i] && log[i].action == (i < 4 ? EvictionAction::MakePurgeable : EvictionAction::DropLod);
+    }
+    if (!matches) {
+        fail(name, "not every MakePurgeable before DropLod, by priority then age");
+    }
+    if (report.purgedCount != 3 || report.lodDropCount != 1 || report.bytesAfter != 780) {
+        fail(name, "wrong second eviction report");
+    }
+    checkTotal(name, budget, 780);
+
+    // Everything evictable has been purged and dropped, so only restored allocations are offered again.
+    log.clear();
+    budget.track(Category::Uniforms, 200, "pinned three");
+    budget.enforce(12);
+    for (const Evicted& evicted : log) {
+        if (evicted.label == "c" || evicted.label == "e" || (evicted.label == "b" && evicted.action == EvictionAction::MakePurgeable)) {
+            fail(name, "an evicted allocation was offered the same action again");
+            break;
+        }
+    }
+}
+
+// A device with a small working set streams in a texture every frame and draws only the latest few; older ones are
+// purgeable and can be regenerated. After enforce usage must be back under the high watermark, and nothing drawn
+// this frame may be evicted.
+static void simulateStreaming(uint32_t frames) {
+    const char* name = "streaming";
+    const uint64_t kBudget = 256ull << 20;
+    const uint64_t kTextureBytes = 8ull << 20;
+    const uint32_t kDrawn = 4;
+    MemoryBudget budget(kBudget);
+    budget.track(Category::VertexData, 64ull << 20, "meshes");
+
+    struct Texture {
+        AllocationId id;
+        uint64_t resident;
+        bool drawn;
+    };
+    std::vector<Texture> textures;
+    textures.reserve(frames);
+    uint64_t purged = 0, evictedWhileDrawn = 0, peak = 0;
+    for (uint64_t frame = 1; frame <= frames; ++frame) {
+        textures.push_back({ 0, kTextureBytes, false });
+        const size_t index = textures.size() - 1;
+        std::vector<Texture>* pTextures = &textures;
+        textures[index].id = budget.track(Category::Texture, kTextureBytes, "streamed", 0, [pTextures, index, &evictedWhileDrawn](EvictionAction action) -> uint64_t {
+            Texture& texture = (*pTextures)[index];
+            if (action != EvictionAction::MakePurgeable || texture.resident == 0) {
+                return 0;
+            }
+            evictedWhileDrawn += texture.drawn;
+            const uint64_t bytes = texture.resident;
+            texture.resident = 0;
+            return bytes;
+        });
+        for (size_t i = 0; i < textures.size(); ++i) {
+            textures[i].drawn = i + kDrawn >= textures.size();
+            if (textures[i].drawn) {
+                budget.touch(textures[i].id, frame);
+            }
+        }
+        peak = std::max(peak, budget.allocatedBytes());
+        purged += budget.enforce(frame).purgedCount;
+        if (budget.isOverBudget()) {
+            fail(name, "still over budget after enforce");
+        }
+    }
+    if (evictedWhileDrawn != 0) {
+        fail(name, "evicted a texture drawn this frame");
+    }
+    uint64_t resident = 64ull << 20;
+    for (const Texture& texture : textures) {
+        resident += texture.resident;
+    }
+    checkTotal(name, budget, resident);
+    printf("streaming: %u frames of %llu MB textures in a %llu MB budget, peak %llu MB, %llu purged, %llu MB resident\n", frames,
+           (unsigned long long)(kTextureBytes >> 20), (unsigned long long)(kBudget >> 20), (unsigned long long)(peak >> 20),
+           (unsigned long long)purged, (unsigned long long)(budget.allocatedBytes() >> 20));
+}
+
+int main(int argc, const char* argv[]) {
+    const uint32_t frames = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 600;
+    checkAccounting();
+    checkWarning();
+    checkEvictionOrder();
+    simulateStreaming(frames);
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+//
+//  MeshConvert.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Builds a mesh file from an OBJ or GLB source, for the app bundle (as mesh.lmsh) or any other cache, and checks
+// existing ones. The output is left alone when it was built from identical source bytes with the same options.
+// Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/MeshConvert.cpp LearningMetal/MeshImport.cpp LearningMetal/MeshOptimizer.cpp LearningMetal/MappedMesh.cpp LearningMetal/VertexQuantize.cpp LearningMetal/MeshletBuilder.cpp LearningMetal/MeshSimplify.cpp -pthread -o mesh-convert
+//   ./mesh-convert [--split | --quantize] [--attributes pnt] [--meshlets] [--lods] [--no-optimize] [--force] model.obj mesh.lmsh
+//   ./mesh-convert --verify mesh.lmsh...
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "Hash.hpp"
+#include "MappedMesh.hpp"
+#include "MeshImport.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshletBuilder.hpp"
+#include "MeshSimplify.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double milliseconds(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static const char* sectionName(mesh_io::SectionType type) {
+    switch (type) {
+        case mesh_io::SectionType::Vertices: return "vertices";
+        case mesh_io::SectionType::Indices: return "indices";
+        case mesh_io::SectionType::Meshlets: return "meshlets";
+        case mesh_io::SectionType::MeshletVertices: return "meshlet vertices";
+        case mesh_io::SectionType::MeshletTriangles: return "meshlet triangles";
+        case mesh_io::SectionType::Lods: return "lods";
+        case mesh_io::SectionType::VertexFormats: return "vertex formats";
+    }
+    return "unknown";
+}
+
+static void printSections(const mesh_io::MappedMesh& mesh) {
+    const mesh_io::MeshFileHeader& header = mesh.header();
+    for (uint32_t i = 0; i < header.sectionCount; ++i) {
+        const mesh_io::MeshSection& section = mesh.sections()[i];
+        printf("  %-18s %10llu x %3u bytes at %10llu, attributes %x\n", sectionName(section.type), (unsigned long long)section.count,
+               section.elementSize, (unsigned long long)section.offset, section.attributes);
+    }
+}
+
+static int verify(int argc, const char* argv[]) {
+    int failures = 0;
+    for (int i = 2; i < argc; ++i) {
+        mesh_io::MappedMesh mesh;
+        const Clock::time_point start = Clock::now();
+        if (!mesh.load(argv[i])) {
+            fprintf(stderr, "%s: not a readable mesh file\n", argv[i]);
+            ++failures;
+            continue;
+        }
+        const double loadMilliseconds = milliseconds(start);
+        const bool valid = mesh.verify();
+        printf("%s: %s, %llu bytes, mapped in %.3f ms, source %016llx\n", argv[i], valid ? "ok" : "CONTENT HASH MISMATCH",
+               (unsigned long long)mesh.header().fileSize, loadMilliseconds, (unsigned long long)mesh.header().sourceHash);
+        printSections(mesh);
+        failures += valid ? 0 : 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+static bool parseAttributes(const char* text, uint32_t& attributes) {
+    attributes = 0;
+    for (const char* p = text; *p; ++p) {
+        switch (*p) {
+            case 'p': attributes |= mesh_import::kPositionBit; break;
+            case 'n': attributes |= mesh_import::kNormalBit; break;
+            case 't': attributes |= mesh_import::kTexCoordBit; break;
+            default: return false;
+        }
+    }
+    return attributes != 0;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc > 2 && strcmp(argv[1], "--verify") == 0) {
+        return verify(argc, argv);
+    }
+
+    // Position-only interleaved is what vertexMain reads; quantized streams go to vertexQuantized.
+    mesh_import::StreamLayout layout = mesh_import::StreamLayout::Interleaved;
+    uint32_t attributes = mesh_import::kPositionBit;
+    bool optimize = true;
+    bool meshlets = false;
+    bool lods = false;
+    bool force = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "--split") == 0) {
+            layout = mesh_import::StreamLayout::Split;
+        } else if (strcmp(argv[i], "--quantize") == 0) {
+            layout = mesh_import::StreamLayout::Quantized;
+        } else if (strcmp(argv[i], "--meshlets") == 0) {
+            meshlets = true;
+        } else if (strcmp(argv[i], "--lods") == 0) {
+            lods = true;
+        } else if (strcmp(argv[i], "--no-optimize") == 0) {
+            optimize = false;
+        } else if (strcmp(argv[i], "--force") == 0) {
+            force = true;
+        } else if (strcmp(argv[i], "--attributes") == 0 && i + 1 < argc && parseAttributes(argv[i + 1], attributes)) {
+            ++i;
+        } else {
+            break;
+        }
+    }
+    if (argc - i != 2) {
+        fprintf(stderr, "usage: %s [--split | --quantize] [--attributes pnt] [--meshlets] [--lods] [--no-optimize] [--force] <input.obj|input.glb> <output.lmsh>\n"
+                        "       %s --verify <mesh.lmsh>...\n", argv[0], argv[0]);
+        return 2;
+    }
+    const char* inputPath = argv[i];
+    const char* outputPath = argv[i + 1];
+
+    // The options are part of the source hash, so changing them rebuilds the output.
+    uint64_t sourceHash = mesh_io::hashFile(inputPath);
+    if (sourceHash == 0) {
+        fprintf(stderr, "%s: cannot read\n", inputPath);
+        return 1;
+    }
+    const uint32_t options[] = { static_cast<uint32_t>(layout), attributes, optimize ? 1u : 0u, meshlets ? 1u : 0u, lods ? 1u : 0u };
+    sourceHash = hashing::fnv1a(options, sizeof(options), sourceHash);
+
+    if (!force) {
+        mesh_io::MappedFile existing;
+        if (existing.open(outputPath) && existing.size() >= sizeof(mesh_io::MeshFileHeader)) {
+            const mesh_io::MeshFileHeader& header = *static_cast<const mesh_io::MeshFileHeader*>(existing.data());
+            if (header.magic == mesh_io::kMeshFileMagic && header.version == mesh_io::kMeshFileVersion && header.sourceHash == sourceHash) {
+                printf("%s: up to date\n", outputPath);
+                return 0;
+            }
+        }
+    }
+
+    Clock::time_point start = Clock::now();
+    mesh_import::ImportedMesh mesh;
+    std::string error;
+    if (!mesh_import::importMesh(inputPath, mesh, {}, &error)) {
+        fprintf(stderr, "%s: %s\n", inputPath, error.c_str());
+        return 1;
+    }
+    if (optimize) {
+        mesh_optimize::optimizeMesh(mesh);
+    }
+    mesh_import::GpuMesh gpu = mesh_import::buildGpuMesh(mesh, layout, attributes);
+    const double importMilliseconds = milliseconds(start);
+
+    // After optimization, so meshlets follow the post-transform cache order of the index buffer.
+    double meshletMilliseconds = 0.0;
+    if (meshlets) {
+        start = Clock::now();
+        gpu.meshlets = meshlet_builder::buildMeshlets(mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float));
+        meshletMilliseconds = milliseconds(start);
+    }
+
+    // Meshlets stay on the full detail level; the chain's level 0 is the optimized source itself.
+    double lodMilliseconds = 0.0;
+    if (lods) {
+        start = Clock::now();
+        const mesh_simplify::LodChain chain = mesh_simplify::buildLodChain(mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float));
+        mesh_import::setLodChain(gpu, chain);
+        lodMilliseconds = milliseconds(start);
+    }
+
+    start = Clock::now();
+    if (!mesh_import::writeMeshFile(outputPath, gpu, sourceHash, &error)) {
+        fprintf(stderr, "%s: %s\n", outputPath, error.c_str());
+        return 1;
+    }
+    const double writeMilliseconds = milliseconds(start);
+
+    start = Clock::now();
+    mesh_io::MappedMesh mapped;
+    if (!mapped.load(outputPath)) {
+        return 1;
+    }
+    const double loadMilliseconds = milliseconds(start);
+    if (!mapped.verify()) {
+        fprintf(stderr, "%s: content hash mismatch after writing\n", outputPath);
+        return 1;
+    }
+
+    printf("%s -> %s: %zu vertices, %zu triangles; imported in %.1f ms, written in %.1f ms, mapped in %.3f ms\n", inputPath, outputPath,
+           mesh.vertexCount(), mesh.triangleCount(), importMilliseconds, writeMilliseconds, loadMilliseconds);
+    printSections(mapped);
+    if (meshlets) {
+        const meshlet_builder::MeshletStats stats = meshlet_builder::analyzeMeshlets(gpu.meshlets);
+        printf("  %zu meshlets in %.1f ms: %.1f vertices, %.1f triangles on average, %.0f%% with a normal cone\n", stats.meshletCount,
+               meshletMilliseconds, stats.averageVertices, stats.averageTriangles, stats.coneCullable * 100.0f);
+    }
+    if (lods) {
+        printf("  %zu levels in %.1f ms:", gpu.lods.size(), lodMilliseconds);
+        for (const mesh_simplify::LodLevel& level : gpu.lods) {
+            printf(" %u (%.3g)", level.indexCount / 3, level.error);
+        }
+        printf(" triangles (error)\n");
+    }
+    return 0;
+}
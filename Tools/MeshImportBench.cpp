@@ -0,0 +1,83 @@
+//
+//  MeshImportBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Parse throughput of the mesh importer on local files, single-threaded and with every core, plus the time to build
+// GPU streams from the result. Large public models (e.g. the Stanford scans as OBJ, the Khronos glTF samples as GLB)
+// are not in the repo; point it at local copies. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/MeshImportBench.cpp LearningMetal/MeshImport.cpp LearningMetal/MappedMesh.cpp LearningMetal/VertexQuantize.cpp -pthread -o mesh-import-bench
+//   ./mesh-import-bench [--runs N] model.obj model.glb ...
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "MappedMesh.hpp"
+#include "MeshImport.hpp"
+#include "ParallelFor.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, const char* argv[]) {
+    int runs = 3;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "--runs") == 0) {
+        runs = std::max(1, atoi(argv[2]));
+        first = 3;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [--runs N] <mesh.obj|mesh.glb>...\n", argv[0]);
+        return 2;
+    }
+
+    const uint32_t cores = parallel::workerCount(0);
+    int failures = 0;
+    for (int i = first; i < argc; ++i) {
+        mesh_io::MappedFile file;
+        if (!file.open(argv[i])) {
+            fprintf(stderr, "%s: cannot open\n", argv[i]);
+            ++failures;
+            continue;
+        }
+        const double megabytes = file.size() / (1024.0 * 1024.0);
+        file.close(); // each run maps the file itself, as the app would
+
+        for (uint32_t threads : { 1u, cores }) {
+            mesh_import::ImportOptions options;
+            options.threads = threads;
+            mesh_import::ImportedMesh mesh;
+            std::string error;
+            double best = 0.0;
+            for (int run = 0; run < runs; ++run) {
+                const Clock::time_point start = Clock::now();
+                if (!mesh_import::importMesh(argv[i], mesh, options, &error)) {
+                    break;
+                }
+                const double elapsed = seconds(start);
+                best = run == 0 ? elapsed : std::min(best, elapsed);
+            }
+            if (!error.empty()) {
+                fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+                ++failures;
+                break;
+            }
+
+            const Clock::time_point start = Clock::now();
+            const mesh_import::GpuMesh gpu = mesh_import::buildGpuMesh(mesh, mesh_import::StreamLayout::Interleaved, mesh_import::kPositionBit | mesh_import::kNormalBit | mesh_import::kTexCoordBit, threads);
+            const double buildSeconds = seconds(start);
+            printf("%s, %u thread%s: %.1f MB in %.3f s = %.1f MB/s; %zu vertices, %zu triangles, %u-bit indices, streams built in %.3f s\n", argv[i], threads, threads == 1 ? "" : "s", megabytes, best, megabytes / best, mesh.vertexCount(), mesh.triangleCount(), gpu.indexSize * 8, buildSeconds);
+            if (cores == 1) {
+                break;
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+//
+//  MeshLoadBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Times loading mesh files the way buildBuffers used to, read() into staging and memcpy into the buffer, against
+// mapping them and faulting in every page, which is the most the no-copy buffer path can cost. Run each method in its
+// own process on a cold page cache (after a reboot, or `sudo purge` on macOS), otherwise the second run reads from
+// memory. --generate writes synthetic mesh files to load. Every file is checked to map, pass its content hash and load
+// in full with both methods first; exits nonzero if any does not. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/MeshLoadBench.cpp LearningMetal/MappedMesh.cpp -o mesh-load-bench
+//   ./mesh-load-bench --generate dir [count] [megabytes]
+//   ./mesh-load-bench --read | --mmap mesh.lmsh...
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MappedMesh.hpp"
+
+// count files of about megabytes each: one vertex stream of 32-byte vertices and 32-bit indices, a quarter each.
+static int generate(const char* directory, uint32_t count, uint32_t megabytes) {
+    const size_t vertexCount = (size_t(megabytes) << 20) * 3 / 4 / 32;
+    const size_t indexCount = (size_t(megabytes) << 20) / 4 / 4;
+    std::vector<uint8_t> vertices(vertexCount * 32);
+    std::vector<uint32_t> indices(indexCount);
+    for (uint32_t file = 0; file < count; ++file) {
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            vertices[i] = static_cast<uint8_t>((i * 2654435761u + file) >> 13);
+        }
+        for (size_t i = 0; i < indices.size(); ++i) {
+            indices[i] = static_cast<uint32_t>((i * 7 + file) % vertexCount);
+        }
+        const std::vector<mesh_io::SectionData> sections = {
+            { mesh_io::SectionType::Vertices, 32, 0, vertexCount, vertices.data() },
+            { mesh_io::SectionType::Indices, 4, 0, indexCount, indices.data() },
+        };
+        const std::string path = std::string(directory) + "/bench" + std::to_string(file) + ".lmsh";
+        std::string error;
+        if (!mesh_io::writeMeshFile(path.c_str(), sections, file, &error)) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+            return 1;
+        }
+        printf("%s\n", path.c_str());
+    }
+    return 0;
+}
+
+// Both methods must see every byte of every file, and every file must be a valid mesh file.
+static bool check(const std::vector<std::string>& paths) {
+    uint64_t expected = 0;
+    bool valid = true;
+    for (const std::string& path : paths) {
+        mesh_io::MappedMesh mesh;
+        if (!mesh.load(path.c_str()) || !mesh.verify()) {
+            fprintf(stderr, "FAIL %s: not a valid mesh file\n", path.c_str());
+            valid = false;
+            continue;
+        }
+        expected += mesh.file().size();
+    }
+    uint64_t readBytes = 0, mappedBytes = 0;
+    mesh_io::benchmarkLoad(paths, mesh_io::LoadMethod::ReadCopy, &readBytes);
+    mesh_io::benchmarkLoad(paths, mesh_io::LoadMethod::Mmap, &mappedBytes);
+    if (valid && (readBytes != expected || mappedBytes != expected)) {
+        fprintf(stderr, "FAIL: loaded %llu bytes read, %llu mapped, of %llu\n", (unsigned long long)readBytes, (unsigned long long)mappedBytes,
+                (unsigned long long)expected);
+        valid = false;
+    }
+    return valid;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "--generate") == 0) {
+        return generate(argv[2], argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 8, argc > 4 ? static_cast<uint32_t>(atoi(argv[4])) : 64);
+    }
+    const bool read = argc >= 3 && strcmp(argv[1], "--read") == 0;
+    const bool mmap = argc >= 3 && strcmp(argv[1], "--mmap") == 0;
+    if (!read && !mmap) {
+        fprintf(stderr, "usage: %s --generate dir [count] [megabytes]\n       %s --read | --mmap mesh.lmsh...\n", argv[0], argv[0]);
+        return 2;
+    }
+    const std::vector<std::string> paths(argv + 2, argv + argc);
+    // Timed before the check, which would warm the page cache.
+    mesh_io::printBenchmark(paths, read ? mesh_io::LoadMethod::ReadCopy : mesh_io::LoadMethod::Mmap);
+    return check(paths) ? 0 : 1;
+}
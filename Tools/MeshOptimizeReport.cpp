@@ -0,0 +1,174 @@
+//
+//  MeshOptimizeReport.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Runs the index optimizer stages on meshes and reports the simulated cache, overdraw and fetch metrics after each,
+// with the time each stage took. Without arguments it uses generated meshes in shuffled order: a grid and
+// a lattice of spheres, whose overlap gives the overdraw pass something to do. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/MeshOptimizeReport.cpp LearningMetal/MeshOptimizer.cpp LearningMetal/MeshImport.cpp LearningMetal/MappedMesh.cpp LearningMetal/VertexQuantize.cpp -pthread -o mesh-optimize-report
+//   ./mesh-optimize-report [model.obj model.glb ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "MeshImport.hpp"
+#include "MeshOptimizer.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Vertex size the renderer fetches: shader_types::VertexData.
+static constexpr size_t kVertexSize = 16;
+
+// Random triangle and vertex order, the worst case for every stage.
+static void shuffle(mesh_import::ImportedMesh& mesh) {
+    std::mt19937 random(42);
+    std::vector<uint32_t> order(mesh.triangleCount());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+    std::shuffle(order.begin(), order.end(), random);
+    std::vector<uint32_t> shuffled(mesh.indices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        std::copy_n(&mesh.indices[order[i] * 3], 3, &shuffled[i * 3]);
+    }
+    mesh.indices.swap(shuffled);
+
+    std::vector<uint32_t> remap(mesh.vertexCount());
+    for (size_t i = 0; i < remap.size(); ++i) {
+        remap[i] = static_cast<uint32_t>(i);
+    }
+    std::shuffle(remap.begin(), remap.end(), random);
+    std::vector<float> positions(mesh.positions.size());
+    for (size_t v = 0; v < remap.size(); ++v) {
+        std::copy_n(&mesh.positions[v * 3], 3, &positions[remap[v] * 3]);
+    }
+    mesh.positions.swap(positions);
+    for (uint32_t& index : mesh.indices) {
+        index = remap[index];
+    }
+}
+
+static mesh_import::ImportedMesh makeGrid(uint32_t size) {
+    mesh_import::ImportedMesh mesh;
+    for (uint32_t y = 0; y <= size; ++y) {
+        for (uint32_t x = 0; x <= size; ++x) {
+            mesh.positions.insert(mesh.positions.end(), { float(x), float(y), 0.0f });
+        }
+    }
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            const uint32_t i = y * (size + 1) + x;
+            mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + size + 2, i, i + size + 2, i + size + 1 });
+        }
+    }
+    return mesh;
+}
+
+static mesh_import::ImportedMesh makeSphereLattice(uint32_t count, uint32_t segments) {
+    mesh_import::ImportedMesh mesh;
+    const float pi = 3.14159265f;
+    for (uint32_t s = 0; s < count * count * count; ++s) {
+        const float cx = float(s % count) * 1.5f;
+        const float cy = float(s / count % count) * 1.5f;
+        const float cz = float(s / (count * count)) * 1.5f;
+        const uint32_t base = static_cast<uint32_t>(mesh.vertexCount());
+        for (uint32_t ring = 0; ring <= segments; ++ring) {
+            const float theta = pi * float(ring) / float(segments);
+            for (uint32_t step = 0; step <= segments * 2; ++step) {
+                const float phi = pi * float(step) / float(segments);
+                mesh.positions.insert(mesh.positions.end(), { cx + std::sin(theta) * std::cos(phi), cy + std::cos(theta), cz + std::sin(theta) * std::sin(phi) });
+            }
+        }
+        const uint32_t columns = segments * 2 + 1;
+        for (uint32_t ring = 0; ring < segments; ++ring) {
+            for (uint32_t step = 0; step < segments * 2; ++step) {
+                const uint32_t i = base + ring * columns + step;
+                // Counter-clockwise seen from outside.
+                mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + columns, i + 1, i + columns + 1, i + columns });
+            }
+        }
+    }
+    return mesh;
+}
+
+static void printRow(const char* stage, const mesh_import::ImportedMesh& mesh, double milliseconds) {
+    const uint32_t* indices = mesh.indices.data();
+    const size_t indexCount = mesh.indices.size();
+    const size_t vertexCount = mesh.vertexCount();
+    const mesh_optimize::VertexCacheStats cache16 = mesh_optimize::analyzeVertexCache(indices, indexCount, vertexCount, 16);
+    const mesh_optimize::VertexCacheStats cache32 = mesh_optimize::analyzeVertexCache(indices, indexCount, vertexCount, 32);
+    const mesh_optimize::OverdrawStats overdraw = mesh_optimize::analyzeOverdraw(indices, indexCount, mesh.positions.data(), vertexCount, 3 * sizeof(float));
+    const mesh_optimize::VertexFetchStats fetch = mesh_optimize::analyzeVertexFetch(indices, indexCount, vertexCount, kVertexSize);
+    printf("  %-14s %9.3f %9.3f %9.3f %9.3f %9.3f %10.1f\n", stage, cache16.acmr, cache32.acmr, cache32.atvr, overdraw.overdraw, fetch.overfetch, milliseconds);
+}
+
+template <typename Fn>
+static double timed(Fn&& fn) {
+    const Clock::time_point start = Clock::now();
+    fn();
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void report(const char* name, mesh_import::ImportedMesh mesh) {
+    printf("%s: %zu vertices, %zu triangles\n", name, mesh.vertexCount(), mesh.triangleCount());
+    printf("  %-14s %9s %9s %9s %9s %9s %10s\n", "stage", "acmr/16", "acmr/32", "atvr/32", "overdraw", "overfetch", "ms");
+    printRow("original", mesh, 0.0);
+
+    uint32_t* indices = mesh.indices.data();
+    const size_t indexCount = mesh.indices.size();
+    const size_t vertexCount = mesh.vertexCount();
+    double milliseconds = timed([&] { mesh_optimize::optimizeVertexCache(indices, indices, indexCount, vertexCount); });
+    printRow("vertex cache", mesh, milliseconds);
+
+    milliseconds = timed([&] { mesh_optimize::optimizeOverdraw(indices, indices, indexCount, mesh.positions.data(), vertexCount, 3 * sizeof(float)); });
+    printRow("overdraw", mesh, milliseconds);
+
+    milliseconds = timed([&] {
+        std::vector<uint32_t> remap(vertexCount);
+        const size_t usedCount = mesh_optimize::optimizeVertexFetchRemap(remap.data(), indices, indexCount, vertexCount);
+        std::vector<float> positions(usedCount * 3);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            if (remap[v] != UINT32_MAX) {
+                std::copy_n(&mesh.positions[v * 3], 3, &positions[remap[v] * 3]);
+            }
+        }
+        for (uint32_t& index : mesh.indices) {
+            index = remap[index];
+        }
+        mesh.positions.swap(positions);
+    });
+    printRow("vertex fetch", mesh, milliseconds);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        mesh_import::ImportedMesh grid = makeGrid(256);
+        shuffle(grid);
+        report("grid 256x256, shuffled", std::move(grid));
+
+        mesh_import::ImportedMesh spheres = makeSphereLattice(4, 24);
+        shuffle(spheres);
+        report("4x4x4 spheres, shuffled", std::move(spheres));
+        return 0;
+    }
+
+    int failures = 0;
+    for (int i = 1; i < argc; ++i) {
+        mesh_import::ImportedMesh mesh;
+        std::string error;
+        if (!mesh_import::importMesh(argv[i], mesh, {}, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            ++failures;
+            continue;
+        }
+        report(argv[i], std::move(mesh));
+    }
+    return failures == 0 ? 0 : 1;
+}
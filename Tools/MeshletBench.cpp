@@ -0,0 +1,278 @@
+//
+//  MeshletBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Builds meshlets at a few vertex and triangle limits, reports throughput and cluster quality, and checks every
+// result: each triangle lands in exactly one meshlet, limits hold, spheres enclose their vertices and a meshlet the
+// cone test rejects really is back-facing. Exits nonzero if any check fails. Without arguments it uses generated
+// meshes: a shuffled grid, a lattice of spheres and an unindexed triangle soup. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/MeshletBench.cpp LearningMetal/MeshletBuilder.cpp LearningMetal/MeshOptimizer.cpp LearningMetal/MeshImport.cpp LearningMetal/MappedMesh.cpp LearningMetal/VertexQuantize.cpp -pthread -o meshlet-bench
+//   ./meshlet-bench [model.obj model.glb ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "MeshImport.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshletBuilder.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static mesh_import::ImportedMesh makeGrid(uint32_t size) {
+    mesh_import::ImportedMesh mesh;
+    for (uint32_t y = 0; y <= size; ++y) {
+        for (uint32_t x = 0; x <= size; ++x) {
+            // A gentle wave, so normal cones are not all identical.
+            mesh.positions.insert(mesh.positions.end(), { float(x), float(y), 4.0f * std::sin(float(x) * 0.05f) * std::cos(float(y) * 0.05f) });
+        }
+    }
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            const uint32_t i = y * (size + 1) + x;
+            mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + size + 2, i, i + size + 2, i + size + 1 });
+        }
+    }
+    return mesh;
+}
+
+static mesh_import::ImportedMesh makeSphereLattice(uint32_t count, uint32_t segments) {
+    mesh_import::ImportedMesh mesh;
+    const float pi = 3.14159265f;
+    for (uint32_t s = 0; s < count * count * count; ++s) {
+        const float cx = float(s % count) * 2.5f;
+        const float cy = float(s / count % count) * 2.5f;
+        const float cz = float(s / (count * count)) * 2.5f;
+        const uint32_t base = static_cast<uint32_t>(mesh.vertexCount());
+        for (uint32_t ring = 0; ring <= segments; ++ring) {
+            const float theta = pi * float(ring) / float(segments);
+            for (uint32_t step = 0; step <= segments * 2; ++step) {
+                const float phi = pi * float(step) / float(segments);
+                mesh.positions.insert(mesh.positions.end(), { cx + std::sin(theta) * std::cos(phi), cy + std::cos(theta), cz + std::sin(theta) * std::sin(phi) });
+            }
+        }
+        const uint32_t columns = segments * 2 + 1;
+        for (uint32_t ring = 0; ring < segments; ++ring) {
+            for (uint32_t step = 0; step < segments * 2; ++step) {
+                const uint32_t i = base + ring * columns + step;
+                mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + columns, i + 1, i + columns + 1, i + columns });
+            }
+        }
+    }
+    return mesh;
+}
+
+// Every triangle with its own three vertices, the worst case for growing by adjacency.
+static mesh_import::ImportedMesh makeSoup(const mesh_import::ImportedMesh& source) {
+    mesh_import::ImportedMesh mesh;
+    for (uint32_t index : source.indices) {
+        mesh.positions.insert(mesh.positions.end(), { source.positions[index * 3], source.positions[index * 3 + 1], source.positions[index * 3 + 2] });
+        mesh.indices.push_back(static_cast<uint32_t>(mesh.indices.size()));
+    }
+    return mesh;
+}
+
+static void shuffleTriangles(mesh_import::ImportedMesh& mesh) {
+    std::mt19937 random(42);
+    std::vector<uint32_t> order(mesh.triangleCount());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+    std::shuffle(order.begin(), order.end(), random);
+    std::vector<uint32_t> shuffled(mesh.indices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        std::copy_n(&mesh.indices[order[i] * 3], 3, &shuffled[i * 3]);
+    }
+    mesh.indices.swap(shuffled);
+}
+
+struct Vec3 {
+    double x, y, z;
+};
+
+static Vec3 vertex(const mesh_import::ImportedMesh& mesh, uint32_t index) {
+    return { mesh.positions[index * 3], mesh.positions[index * 3 + 1], mesh.positions[index * 3 + 2] };
+}
+
+static Vec3 sub(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+static double dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static Vec3 cross(Vec3 a, Vec3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+// Rotates a triangle so its smallest index comes first, keeping the winding.
+static uint64_t canonicalTriangle(uint32_t a, uint32_t b, uint32_t c) {
+    if (b < a && b < c) {
+        std::swap(a, b);
+        std::swap(b, c);
+    } else if (c < a && c < b) {
+        std::swap(a, c);
+        std::swap(b, c);
+    }
+    return (uint64_t(a) << 42) ^ (uint64_t(b) << 21) ^ uint64_t(c);
+}
+
+static int validate(const mesh_import::ImportedMesh& mesh, const meshlet_builder::MeshletSet& set, uint32_t maxVertices, uint32_t maxTriangles) {
+    int failures = 0;
+    auto fail = [&](const char* what, size_t meshlet) {
+        if (failures++ < 5) {
+            printf("    FAILED: %s (meshlet %zu)\n", what, meshlet);
+        }
+    };
+
+    std::vector<uint64_t> expected;
+    for (size_t t = 0; t < mesh.triangleCount(); ++t) {
+        expected.push_back(canonicalTriangle(mesh.indices[t * 3], mesh.indices[t * 3 + 1], mesh.indices[t * 3 + 2]));
+    }
+    std::vector<uint64_t> found;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> unit(-1.0, 1.0);
+    for (size_t m = 0; m < set.meshlets.size(); ++m) {
+        const meshlet_builder::Meshlet& meshlet = set.meshlets[m];
+        if (meshlet.vertexCount > maxVertices || meshlet.triangleCount > maxTriangles || meshlet.triangleCount == 0) {
+            fail("limits", m);
+        }
+        if (meshlet.triangleOffset % 4 != 0 || meshlet.triangleOffset + meshlet.triangleCount * 3 > set.triangles.size()
+            || meshlet.vertexOffset + meshlet.vertexCount > set.vertices.size()) {
+            fail("offsets", m);
+            continue;
+        }
+        const uint32_t* vertices = &set.vertices[meshlet.vertexOffset];
+        const uint8_t* triangles = &set.triangles[meshlet.triangleOffset];
+        const Vec3 center = { meshlet.center[0], meshlet.center[1], meshlet.center[2] };
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            const Vec3 d = sub(vertex(mesh, vertices[i]), center);
+            if (std::sqrt(dot(d, d)) > meshlet.radius * 1.0001 + 1e-5) {
+                fail("bounding sphere", m);
+                break;
+            }
+        }
+        for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+            if (triangles[t * 3] >= meshlet.vertexCount || triangles[t * 3 + 1] >= meshlet.vertexCount || triangles[t * 3 + 2] >= meshlet.vertexCount) {
+                fail("local index", m);
+                break;
+            }
+            found.push_back(canonicalTriangle(vertices[triangles[t * 3]], vertices[triangles[t * 3 + 1]], vertices[triangles[t * 3 + 2]]));
+        }
+
+        // Cameras the cone test culls must see every face from behind.
+        if (meshlet.coneCutoff > 1.0f) {
+            continue;
+        }
+        const Vec3 apex = { meshlet.coneApex[0], meshlet.coneApex[1], meshlet.coneApex[2] };
+        const Vec3 axis = { meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2] };
+        for (int sample = 0; sample < 32; ++sample) {
+            const double distance = meshlet.radius * (0.5 + 40.0 * (unit(random) + 1.0));
+            Vec3 direction = { unit(random), unit(random), unit(random) };
+            const double length = std::sqrt(dot(direction, direction));
+            direction = { direction.x / length, direction.y / length, direction.z / length };
+            const Vec3 camera = { apex.x + direction.x * distance, apex.y + direction.y * distance, apex.z + direction.z * distance };
+            const Vec3 view = sub(apex, camera);
+            if (dot(view, axis) / std::sqrt(dot(view, view)) < meshlet.coneCutoff) {
+                continue;
+            }
+            for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+                const Vec3 a = vertex(mesh, vertices[triangles[t * 3]]);
+                const Vec3 n = cross(sub(vertex(mesh, vertices[triangles[t * 3 + 1]]), a), sub(vertex(mesh, vertices[triangles[t * 3 + 2]]), a));
+                // Slivers whose float normal is noise face no particular way.
+                const double area = std::sqrt(dot(n, n));
+                if (area > 1e-5 * meshlet.radius * meshlet.radius && dot(n, sub(camera, a)) > 1e-6 * area * distance) {
+                    fail("cone culls a front face", m);
+                    t = meshlet.triangleCount;
+                    sample = 32;
+                }
+            }
+        }
+    }
+
+    std::sort(expected.begin(), expected.end());
+    std::sort(found.begin(), found.end());
+    if (expected != found) {
+        fail("triangles differ from the input", 0);
+    }
+    return failures;
+}
+
+// Fraction of meshlets the cone test rejects, averaged over cameras on a sphere around the mesh.
+static float coneCullRate(const mesh_import::ImportedMesh& mesh, const meshlet_builder::MeshletSet& set) {
+    float minimum[3] = { 1e30f, 1e30f, 1e30f };
+    float maximum[3] = { -1e30f, -1e30f, -1e30f };
+    for (size_t v = 0; v < mesh.vertexCount(); ++v) {
+        for (int i = 0; i < 3; ++i) {
+            minimum[i] = std::min(minimum[i], mesh.positions[v * 3 + i]);
+            maximum[i] = std::max(maximum[i], mesh.positions[v * 3 + i]);
+        }
+    }
+    const Vec3 center = { (minimum[0] + maximum[0]) * 0.5, (minimum[1] + maximum[1]) * 0.5, (minimum[2] + maximum[2]) * 0.5 };
+    const double radius = std::sqrt(dot(sub({ maximum[0], maximum[1], maximum[2] }, center), sub({ maximum[0], maximum[1], maximum[2] }, center)));
+    const Vec3 directions[] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0.577, 0.577, 0.577 }, { -0.577, 0.577, -0.577 } };
+    size_t culled = 0;
+    for (const Vec3& direction : directions) {
+        const Vec3 camera = { center.x + direction.x * radius * 2.0, center.y + direction.y * radius * 2.0, center.z + direction.z * radius * 2.0 };
+        for (const meshlet_builder::Meshlet& meshlet : set.meshlets) {
+            const Vec3 view = sub({ meshlet.coneApex[0], meshlet.coneApex[1], meshlet.coneApex[2] }, camera);
+            const double d = dot(view, { meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2] }) / std::sqrt(dot(view, view));
+            culled += d >= meshlet.coneCutoff ? 1 : 0;
+        }
+    }
+    return set.meshlets.empty() ? 0.0f : float(culled) / float(set.meshlets.size() * (sizeof(directions) / sizeof(directions[0])));
+}
+
+static int report(const char* name, const mesh_import::ImportedMesh& mesh) {
+    printf("%s: %zu vertices, %zu triangles\n", name, mesh.vertexCount(), mesh.triangleCount());
+    printf("  %-8s %9s %8s %8s %8s %8s %8s %10s %9s\n", "limits", "meshlets", "verts", "tris", "fill", "cones", "culled", "Mtri/s", "ms");
+    const uint32_t limits[][2] = { { 64, 124 }, { 64, 84 }, { 128, 256 } };
+    int failures = 0;
+    for (const auto& limit : limits) {
+        // Best of a few runs, so the number reflects the code rather than the scheduler.
+        meshlet_builder::MeshletSet set;
+        double best = 1e30;
+        for (int run = 0; run < 3; ++run) {
+            const Clock::time_point start = Clock::now();
+            set = meshlet_builder::buildMeshlets(mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), mesh.vertexCount(), 3 * sizeof(float), limit[0], limit[1]);
+            best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        const meshlet_builder::MeshletStats stats = meshlet_builder::analyzeMeshlets(set);
+        char label[16];
+        snprintf(label, sizeof(label), "%u/%u", limit[0], limit[1]);
+        printf("  %-8s %9zu %8.1f %8.1f %7.0f%% %7.0f%% %7.1f%% %10.2f %9.2f\n", label, stats.meshletCount, stats.averageVertices, stats.averageTriangles,
+               100.0f * stats.averageTriangles / float(limit[1]), 100.0f * stats.coneCullable, 100.0f * coneCullRate(mesh, set),
+               double(mesh.triangleCount()) / best / 1000.0, best);
+        failures += validate(mesh, set, limit[0], limit[1]);
+    }
+    return failures;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    if (argc < 2) {
+        mesh_import::ImportedMesh grid = makeGrid(512);
+        shuffleTriangles(grid);
+        failures += report("grid 512x512, shuffled", grid);
+
+        mesh_import::ImportedMesh spheres = makeSphereLattice(5, 32);
+        mesh_optimize::optimizeMesh(spheres);
+        failures += report("5x5x5 spheres, optimized", spheres);
+
+        failures += report("sphere soup", makeSoup(makeSphereLattice(2, 32)));
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        mesh_import::ImportedMesh mesh;
+        std::string error;
+        if (!mesh_import::importMesh(argv[i], mesh, {}, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            ++failures;
+            continue;
+        }
+        failures += report(argv[i], mesh);
+    }
+    if (failures) {
+        printf("%d checks failed\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
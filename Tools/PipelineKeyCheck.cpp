@@ -0,0 +1,225 @@
+//
+//  PipelineKeyCheck.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/26.
+//
+
+// Checks RenderPipelineKey hashing and equality and the in-process PipelineCache against a stub compiler: equal keys
+// hash alike and compile once, every field of the key (functions, constants, blending, vertex layout, compile profile,
+// stitched material, mesh functions, tessellation) changes both the hash and equality, failed compiles are not cached,
+// and the cache releases what it compiled. Ends with a few thousand random keys. Exits nonzero if any check fails:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/PipelineKeyCheck.cpp LearningMetal/PipelineCache.cpp -o pipeline-key-check
+//   ./pipeline-key-check
+
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PipelineCache.hpp"
+
+using namespace pipeline_cache;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// Roughly what buildShaders sets up for the instanced cube: two attributes in one buffer, one alpha-blended target.
+static RenderPipelineKey baseKey() {
+    RenderPipelineKey key;
+    key.vertexFunction = "vertexMain";
+    key.fragmentFunction = "fragmentMain";
+    key.constants = { { 0, 53, 1 }, { 1, 33, 4 } };
+    key.colorAttachments[0].pixelFormat = 81;
+    key.colorAttachments[0].blendingEnabled = true;
+    key.colorAttachments[0].sourceRGBBlendFactor = 4;
+    key.colorAttachments[0].destinationRGBBlendFactor = 5;
+    key.depthPixelFormat = 252;
+    key.vertexAttributes = { { 30, 0, 0 }, { 30, 12, 0 } };
+    key.vertexLayouts = { { 24, 1, 1 } };
+    return key;
+}
+
+struct Mutation {
+    const char* field;
+    std::function<void(RenderPipelineKey&)> apply;
+};
+
+static std::vector<Mutation> mutations() {
+    std::vector<Mutation> all = {
+        { "vertexFunction", [](RenderPipelineKey& k) { k.vertexFunction = "vertexQuantized"; } },
+        { "fragmentFunction", [](RenderPipelineKey& k) { k.fragmentFunction = "fragmentStitched"; } },
+        { "function boundary", [](RenderPipelineKey& k) { k.vertexFunction = "vertexMainf"; k.fragmentFunction = "ragmentMain"; } },
+        { "constant index", [](RenderPipelineKey& k) { k.constants[1].index = 2; } },
+        { "constant type", [](RenderPipelineKey& k) { k.constants[1].dataType = 29; } },
+        { "constant value", [](RenderPipelineKey& k) { k.constants[1].value = 5; } },
+        { "constant added", [](RenderPipelineKey& k) { k.constants.push_back({ 2, 53, 0 }); } },
+        { "constant removed", [](RenderPipelineKey& k) { k.constants.pop_back(); } },
+        { "constants swapped", [](RenderPipelineKey& k) { std::swap(k.constants[0], k.constants[1]); } },
+        { "depth format", [](RenderPipelineKey& k) { k.depthPixelFormat = 250; } },
+        { "stencil format", [](RenderPipelineKey& k) { k.stencilPixelFormat = 253; } },
+        { "sample count", [](RenderPipelineKey& k) { k.sampleCount = 4; } },
+        { "attribute format", [](RenderPipelineKey& k) { k.vertexAttributes[1].format = 31; } },
+        { "attribute offset", [](RenderPipelineKey& k) { k.vertexAttributes[1].offset = 16; } },
+        { "attribute buffer", [](RenderPipelineKey& k) { k.vertexAttributes[1].bufferIndex = 1; } },
+        { "attribute added", [](RenderPipelineKey& k) { k.vertexAttributes.push_back({ 29, 24, 0 }); } },
+        { "layout stride", [](RenderPipelineKey& k) { k.vertexLayouts[0].stride = 32; } },
+        { "layout step function", [](RenderPipelineKey& k) { k.vertexLayouts[0].stepFunction = 2; } },
+        { "layout step rate", [](RenderPipelineKey& k) { k.vertexLayouts[0].stepRate = 2; } },
+        { "layout added", [](RenderPipelineKey& k) { k.vertexLayouts.push_back({ 16, 1, 1 }); } },
+        { "compile profile", [](RenderPipelineKey& k) { k.compileProfile = 2; } },
+        { "stitched material", [](RenderPipelineKey& k) { k.stitchedMaterial = 0x1234567800000000ull; } },
+        { "object function", [](RenderPipelineKey& k) { k.objectFunction = "objectCull"; } },
+        { "mesh function", [](RenderPipelineKey& k) { k.meshFunction = "meshMeshlets"; } },
+        { "tessellation", [](RenderPipelineKey& k) { k.maxTessellationFactor = 16; } },
+    };
+    // Every blend field, on the first and the last color attachment.
+    for (size_t slot : { size_t(0), kMaxColorAttachments - 1 }) {
+        const bool first = slot == 0;
+        all.push_back({ first ? "pixel format 0" : "pixel format 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].pixelFormat = 70; } });
+        all.push_back({ first ? "blending 0" : "blending 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].blendingEnabled ^= true; } });
+        all.push_back({ first ? "rgb operation 0" : "rgb operation 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].rgbBlendOperation = 1; } });
+        all.push_back({ first ? "alpha operation 0" : "alpha operation 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].alphaBlendOperation = 1; } });
+        all.push_back({ first ? "source rgb 0" : "source rgb 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].sourceRGBBlendFactor = 6; } });
+        all.push_back({ first ? "destination rgb 0" : "destination rgb 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].destinationRGBBlendFactor = 6; } });
+        all.push_back({ first ? "source alpha 0" : "source alpha 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].sourceAlphaBlendFactor = 6; } });
+        all.push_back({ first ? "destination alpha 0" : "destination alpha 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].destinationAlphaBlendFactor = 6; } });
+        all.push_back({ first ? "write mask 0" : "write mask 7", [slot](RenderPipelineKey& k) { k.colorAttachments[slot].writeMask = 0x7; } });
+    }
+    return all;
+}
+
+static void checkFields() {
+    const RenderPipelineKey base = baseKey();
+    const RenderPipelineKey copy = base;
+    if (!(copy == base) || copy.hash() != base.hash()) {
+        fail("equal keys", "a copy does not compare or hash equal");
+    }
+    for (const Mutation& mutation : mutations()) {
+        RenderPipelineKey changed = base;
+        mutation.apply(changed);
+        if (changed.hash() == base.hash()) {
+            fail(mutation.field, "does not change the hash");
+        }
+        if (changed == base || base == changed) {
+            fail(mutation.field, "does not change equality");
+        }
+    }
+}
+
+// The stub compiler hands out numbered states and fails keys whose vertex function is "broken".
+struct StubState {
+    uint64_t hash;
+    int serial;
+};
+
+static void checkDedup() {
+    const char* name = "dedup";
+    int compiles = 0, released = 0;
+    {
+        PipelineCache<StubState> cache(
+            [&compiles](const RenderPipelineKey& key) -> StubState* {
+                ++compiles;
+                return key.vertexFunction == "broken" ? nullptr : new StubState { key.hash(), compiles };
+            },
+            [&released](StubState* pState) {
+                ++released;
+                delete pState;
+            });
+
+        const RenderPipelineKey base = baseKey();
+        StubState* pFirst = cache.getOrCreate(base);
+        StubState* pAgain = cache.getOrCreate(baseKey());
+        if (pFirst == nullptr || pAgain != pFirst || compiles != 1 || cache.stats().hits != 1 || cache.stats().compiles != 1) {
+            fail(name, "equal keys compiled twice");
+        }
+        if (cache.find(base, base.hash()) != pFirst || cache.find(base, base.hash() + 1) != nullptr) {
+            fail(name, "find does not match on hash and key");
+        }
+
+        // Each mutation is a pipeline of its own; asking again hits.
+        const std::vector<Mutation> all = mutations();
+        std::set<StubState*> states = { pFirst };
+        for (const Mutation& mutation : all) {
+            RenderPipelineKey changed = base;
+            mutation.apply(changed);
+            StubState* pState = cache.getOrCreate(changed);
+            if (pState == nullptr || !states.insert(pState).second || pState->hash != changed.hash()) {
+                fail(mutation.field, "shares a pipeline with another key");
+            }
+            if (cache.getOrCreate(changed) != pState) {
+                fail(mutation.field, "not found again");
+            }
+        }
+        if (cache.size() != all.size() + 1 || compiles != static_cast<int>(all.size() + 1)) {
+            fail(name, "wrong number of cached pipelines");
+        }
+
+        // Failures are counted and retried, never cached.
+        RenderPipelineKey broken = base;
+        broken.vertexFunction = "broken";
+        const int before = compiles;
+        if (cache.getOrCreate(broken) != nullptr || cache.getOrCreate(broken) != nullptr || compiles != before + 2 || cache.stats().failures != 2) {
+            fail(name, "failed compile cached or not retried");
+        }
+        if (cache.size() != all.size() + 1) {
+            fail(name, "failed compile took an entry");
+        }
+    }
+    if (released != compiles - 2) {
+        fail(name, "cache did not release every state it compiled");
+    }
+}
+
+// Random keys over a few values per field, so many repeat: distinct keys never share a hash.
+static void checkRandomKeys(uint32_t count) {
+    const char* name = "random keys";
+    std::mt19937 random(32);
+    const char* functions[] = { "vertexMain", "vertexQuantized", "vertexTerrain", "" };
+    std::vector<RenderPipelineKey> keys;
+    std::unordered_map<uint64_t, size_t> byHash;
+    size_t duplicates = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        RenderPipelineKey key;
+        key.vertexFunction = functions[random() % 4];
+        key.fragmentFunction = functions[random() % 4];
+        for (uint32_t c = random() % 3; c > 0; --c) {
+            key.constants.push_back({ static_cast<uint32_t>(random() % 3), 53, static_cast<uint32_t>(random() % 2) });
+        }
+        key.colorAttachments[random() % 2].blendingEnabled = random() % 2;
+        key.colorAttachments[0].writeMask = random() % 2 ? 0xF : 0x7;
+        key.depthPixelFormat = random() % 2 ? 252 : 0;
+        key.vertexLayouts.resize(random() % 2, { 24, 1, 1 });
+        key.compileProfile = random() % 3;
+        key.stitchedMaterial = random() % 3;
+        key.meshFunction = random() % 4 == 0 ? "meshMeshlets" : "";
+        key.maxTessellationFactor = random() % 4 == 0 ? 16 : 0;
+
+        const uint64_t hash = key.hash();
+        auto it = byHash.find(hash);
+        if (it == byHash.end()) {
+            byHash.emplace(hash, keys.size());
+            keys.push_back(key);
+        } else if (keys[it->second] == key) {
+            ++duplicates;
+        } else {
+            fail(name, "distinct keys share a hash");
+        }
+    }
+    printf("%u random keys: %zu distinct, %zu repeats\n", count, keys.size(), duplicates);
+}
+
+int main() {
+    checkFields();
+    checkDedup();
+    checkRandomKeys(20000);
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+//
+//  PipelineMerge.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/28.
+//
+
+// Merges pipeline recordings from several play sessions into one pre-warm list to ship in the app bundle.
+// Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/PipelineMerge.cpp LearningMetal/PipelineRecorder.cpp LearningMetal/PipelineCache.cpp -o pipeline-merge
+//   ./pipeline-merge pipelines.lprc session1.lprc session2.lprc ...
+
+#include <cstdio>
+#include "PipelineRecorder.hpp"
+
+int main(int argc, const char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <output.lprc> <input.lprc>...\n", argv[0]);
+        return 2;
+    }
+
+    pipeline_record::Recording merged;
+    for (int i = 2; i < argc; ++i) {
+        pipeline_record::Recording recording;
+        if (!recording.load(argv[i])) {
+            fprintf(stderr, "%s: not a readable pipeline recording\n", argv[i]);
+            return 1;
+        }
+        printf("%-40s %6zu pipelines\n", argv[i], recording.pipelines().size());
+        merged.merge(recording);
+    }
+
+    if (!merged.save(argv[1])) {
+        fprintf(stderr, "%s: write failed\n", argv[1]);
+        return 1;
+    }
+
+    printf("%-40s %6zu pipelines\n", argv[1], merged.pipelines().size());
+    for (const pipeline_record::RecordedPipeline* pPipeline : merged.prewarmOrder()) {
+        printf("  frame %6llu  sessions %4u  %s/%s  %zu constants  %016llx\n", (unsigned long long)pPipeline->firstFrame, pPipeline->sessions,
+               (pPipeline->key.meshFunction.empty() ? pPipeline->key.vertexFunction : pPipeline->key.meshFunction).c_str(), pPipeline->key.fragmentFunction.c_str(), pPipeline->key.constants.size(),
+               (unsigned long long)pPipeline->key.hash());
+    }
+    return 0;
+}
@@ -0,0 +1,295 @@
+//
+//  ResourceCacheSim.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Drives a ResourceCache against a fake purgeable backend whose "OS" discards volatile contents at random, and checks
+// the policy and its bookkeeping: misses create and hits reuse, only entries idle for the configured frames go
+// volatile, discarded contents are regenerated into the same resource, trimming drops the least recently used idle
+// entries and never one in use, resident and total bytes match the backend, and nothing leaks. Ends with a random
+// workload and reports its hit rate. Exits nonzero if any check fails. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/ResourceCacheSim.cpp LearningMetal/ResourceCache.cpp -o resource-cache-sim
+//   ./resource-cache-sim [frames]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_set>
+#include <vector>
+#include "ResourceCache.hpp"
+
+using namespace resource_cache;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+struct FakeResource {
+    Key key;
+    uint64_t size;
+    bool isVolatile;
+    bool valid; // contents present; false once the OS discarded them
+};
+
+class FakeBackend : public CacheBackend {
+public:
+    ~FakeBackend() override {
+        for (FakeResource* pResource : live) {
+            delete pResource;
+        }
+    }
+
+    void makeVolatile(void* pResource) override {
+        FakeResource* pFake = find(pResource);
+        if (pFake) {
+            pFake->isVolatile = true;
+        }
+    }
+
+    bool makeNonVolatile(void* pResource) override {
+        FakeResource* pFake = find(pResource);
+        if (pFake == nullptr) {
+            return false;
+        }
+        pFake->isVolatile = false;
+        return pFake->valid;
+    }
+
+    void destroy(void* pResource) override {
+        FakeResource* pFake = find(pResource);
+        if (pFake) {
+            live.erase(pFake);
+            delete pFake;
+            ++destroyed;
+        }
+    }
+
+    uint64_t size(void* pResource) const override {
+        return static_cast<FakeResource*>(pResource)->size;
+    }
+
+    // What the OS does under memory pressure: volatile contents may vanish.
+    void purge(std::mt19937& random, uint32_t percent) {
+        for (FakeResource* pResource : live) {
+            if (pResource->isVolatile && random() % 100 < percent) {
+                pResource->valid = false;
+            }
+        }
+    }
+
+    uint64_t residentBytes() const {
+        uint64_t bytes = 0;
+        for (const FakeResource* pResource : live) {
+            bytes += pResource->isVolatile ? 0 : pResource->size;
+        }
+        return bytes;
+    }
+
+    uint64_t totalBytes() const {
+        uint64_t bytes = 0;
+        for (const FakeResource* pResource : live) {
+            bytes += pResource->size;
+        }
+        return bytes;
+    }
+
+    std::unordered_set<FakeResource*> live;
+    uint64_t destroyed = 0;
+    uint64_t unknown = 0;
+
+private:
+    FakeResource* find(void* pResource) {
+        FakeResource* pFake = static_cast<FakeResource*>(pResource);
+        if (live.count(pFake) == 0) {
+            ++unknown;
+            return nullptr;
+        }
+        return pFake;
+    }
+};
+
+static uint64_t sizeOf(Key key) {
+    return 1000 * (1 + key % 7);
+}
+
+// Creates a resource for key, or refills the one given; counts both.
+struct Generators {
+    Generator forKey(Key key) {
+        return [this, key](void* pExisting) -> void* {
+            if (pExisting) {
+                FakeResource* pFake = static_cast<FakeResource*>(pExisting);
+                if (pFake->key != key) {
+                    ++wrongResource;
+                }
+                pFake->valid = true;
+                ++refills;
+                return pExisting;
+            }
+            FakeResource* pFake = new FakeResource { key, sizeOf(key), false, true };
+            pBackend->live.insert(pFake);
+            ++creations;
+            return pFake;
+        };
+    }
+
+    FakeBackend* pBackend;
+    uint64_t creations = 0;
+    uint64_t refills = 0;
+    uint64_t wrongResource = 0;
+};
+
+static void checkBooks(const char* name, const ResourceCache& cache, const FakeBackend& backend) {
+    if (cache.residentBytes() != backend.residentBytes()) {
+        fail(name, "resident bytes disagree with the backend");
+    }
+    if (backend.unknown != 0) {
+        fail(name, "backend called with a resource it does not own");
+    }
+}
+
+static void checkPolicy() {
+    const char* name = "policy";
+    FakeBackend backend;
+    Generators generators { &backend };
+    {
+        // Room for three of the 2000-byte resources (keys 1, 8, 15...); idle for two frames before going volatile.
+        ResourceCache cache(&backend, 6000, 2);
+        cache.tick(1);
+        void* pA = cache.acquire(1, generators.forKey(1));
+        if (cache.acquire(1, generators.forKey(1)) != pA || generators.creations != 1 || cache.stats().misses != 1 || cache.stats().hits != 1) {
+            fail(name, "second acquire did not hit");
+        }
+        cache.release(1);
+        cache.release(1);
+
+        cache.tick(2);
+        if (static_cast<FakeResource*>(pA)->isVolatile) {
+            fail(name, "volatile before its idle frames");
+        }
+        cache.tick(3);
+        if (!static_cast<FakeResource*>(pA)->isVolatile || cache.residentBytes() != 0) {
+            fail(name, "not volatile after its idle frames");
+        }
+        checkBooks(name, cache, backend);
+
+        // Still there: a hit, made non-volatile, nothing regenerated.
+        if (cache.acquire(1, generators.forKey(1)) != pA || generators.refills != 0 || static_cast<FakeResource*>(pA)->isVolatile) {
+            fail(name, "intact volatile entry not reused");
+        }
+        cache.release(1);
+        cache.tick(5);
+        static_cast<FakeResource*>(pA)->valid = false;
+        if (cache.acquire(1, generators.forKey(1)) != pA || generators.refills != 1 || cache.stats().regenerations != 1 || generators.wrongResource != 0) {
+            fail(name, "discarded contents not regenerated into the same resource");
+        }
+        cache.release(1);
+        checkBooks(name, cache, backend);
+
+        // Over capacity, the least recently used idle entry goes first.
+        cache.tick(6);
+        for (Key key : { 8, 15, 22 }) {
+            cache.acquire(key, generators.forKey(key));
+            cache.release(key);
+            cache.tick(7 + key);
+        }
+        cache.tick(40);
+        if (backend.live.size() != 3 || cache.stats().evictions != 1) {
+            fail(name, "trimmed the wrong number of entries");
+        }
+        for (const FakeResource* pResource : backend.live) {
+            if (pResource->key == 1) {
+                fail(name, "evicted something other than the least recently used idle entry");
+            }
+        }
+        for (Key key : { 29, 36, 43, 50 }) {
+            cache.acquire(key, generators.forKey(key));
+        }
+        cache.tick(41);
+        if (backend.live.size() != 4 || cache.residentBytes() != 8000) {
+            fail(name, "evicted an entry in use, or kept idle ones over capacity");
+        }
+        checkBooks(name, cache, backend);
+
+        // makeIdleVolatile takes every idle entry at once and reports their bytes; in-use entries stay.
+        for (Key key : { 29, 36 }) {
+            cache.release(key);
+        }
+        if (cache.makeIdleVolatile() != 4000 || cache.residentBytes() != 4000) {
+            fail(name, "makeIdleVolatile reclaimed the wrong bytes");
+        }
+        checkBooks(name, cache, backend);
+        for (Key key : { 43, 50 }) {
+            cache.release(key);
+        }
+    }
+    if (!backend.live.empty()) {
+        fail(name, "resources leaked past the cache");
+    }
+}
+
+// Random acquire and release over more keys than fit, with the OS discarding volatile contents.
+static void runWorkload(uint32_t frames) {
+    const char* name = "workload";
+    std::mt19937 random(30);
+    FakeBackend backend;
+    Generators generators { &backend };
+    {
+        ResourceCache cache(&backend, 40000, 3);
+        std::vector<Key> held;
+        for (uint64_t frame = 1; frame <= frames; ++frame) {
+            cache.tick(frame);
+            // Skewed towards a few hot keys, so there is something to hit.
+            const uint32_t acquires = 1 + random() % 4;
+            for (uint32_t i = 0; i < acquires; ++i) {
+                const Key key = random() % 2 == 0 ? random() % 8 : random() % 64;
+                FakeResource* pResource = static_cast<FakeResource*>(cache.acquire(key, generators.forKey(key)));
+                if (pResource->key != key || !pResource->valid || pResource->isVolatile) {
+                    fail(name, "acquired a wrong, discarded or volatile resource");
+                }
+                held.push_back(key);
+            }
+            // What this frame acquired is released a frame or two later, as when the GPU is done with it.
+            while (held.size() > 6) {
+                cache.release(held.front());
+                held.erase(held.begin());
+            }
+            if (frame % 10 == 0) {
+                backend.purge(random, 50);
+            }
+            if (frame % 97 == 0) {
+                cache.makeIdleVolatile();
+            }
+            checkBooks(name, cache, backend);
+            if (backend.totalBytes() > 40000 + 6 * sizeOf(6)) {
+                fail(name, "over capacity by more than what is in use");
+            }
+        }
+        for (Key key : held) {
+            cache.release(key);
+        }
+        const CacheStats& stats = cache.stats();
+        if (stats.misses != generators.creations || stats.regenerations != generators.refills || generators.wrongResource != 0) {
+            fail(name, "stats do not match the generators");
+        }
+        const uint64_t lookups = stats.hits + stats.misses + stats.regenerations;
+        printf("workload: %u frames, %llu lookups, %.1f%% hits, %llu regenerations, %llu evictions\n", frames, (unsigned long long)lookups,
+               100.0 * stats.hits / lookups, (unsigned long long)stats.regenerations, (unsigned long long)stats.evictions);
+        cache.printStats();
+    }
+    if (!backend.live.empty()) {
+        fail(name, "resources leaked past the cache");
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    checkPolicy();
+    runWorkload(argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 5000);
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
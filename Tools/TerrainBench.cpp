@@ -0,0 +1,470 @@
+//
+//  TerrainBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Builds terrain quadtrees over synthetic heightmaps and checks them: every stitch variant of the tile mesh covers the
+// tile exactly once with triangles facing up, node bounds and errors grow towards the root, and along a camera path
+// every selection covers what the frustum sees without overlap, keeps neighbours within a level, stitches exactly the
+// edges along a coarser neighbour so that both sides share their edge vertices, meets the pixel error budget, and
+// groups tiles by stitch mask. Then reports build time and selection time per frame. Exits nonzero if any check
+// fails. Plain C++, no Metal:
+//   c++ -std=c++17 -O3 -ILearningMetal Tools/TerrainBench.cpp LearningMetal/TerrainQuadtree.cpp LearningMetal/ProceduralMesh.cpp -pthread -o terrain-bench
+//   ./terrain-bench [frames]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ProceduralMesh.hpp"
+#include "TerrainQuadtree.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// Fractal value noise from the procedural grids, spanning the whole heightmap.
+static std::vector<float> makeHeights(const terrain::TerrainDesc& desc, float heightScale, uint32_t seed) {
+    const uint32_t resolution = terrain::heightmapResolution(desc);
+    procedural::GridDesc grid;
+    grid.extent[0] = grid.extent[1] = static_cast<float>(resolution - 1);
+    grid.heightScale = heightScale;
+    grid.frequency = 6.0f;
+    grid.seed = seed;
+    std::vector<float> heights(size_t(resolution) * resolution);
+    const float half = 0.5f * static_cast<float>(resolution - 1);
+    for (uint32_t row = 0; row < resolution; ++row) {
+        for (uint32_t column = 0; column < resolution; ++column) {
+            heights[size_t(row) * resolution + column] = procedural::heightAt(grid, static_cast<float>(column) - half, static_cast<float>(row) - half);
+        }
+    }
+    return heights;
+}
+
+// Along each edge of each variant, the positions of the edge vertices its triangles use.
+struct EdgeVertices {
+    std::vector<uint32_t> positions[terrain::kStitchVariants][4];
+};
+
+static EdgeVertices checkTileMesh(const terrain::TileMesh& mesh, uint32_t tileCells) {
+    const uint32_t columns = tileCells + 1;
+    EdgeVertices edges;
+    for (uint32_t mask = 0; mask < terrain::kStitchVariants; ++mask) {
+        const terrain::IndexRange& range = mesh.variants[mask];
+        std::vector<bool> used(size_t(columns) * columns, false);
+        double area = 0.0;
+        for (uint32_t i = range.firstIndex; i + 2 < range.firstIndex + range.indexCount; i += 3) {
+            int64_t x[3], z[3];
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                const uint16_t vertex = mesh.indices[i + corner];
+                if (vertex >= columns * columns) {
+                    fail("tile mesh", "index out of range");
+                    return edges;
+                }
+                used[vertex] = true;
+                x[corner] = mesh.vertices[2 * vertex];
+                z[corner] = mesh.vertices[2 * vertex + 1];
+            }
+            // Counter-clockwise seen from above (+y), with x right and z towards the viewer: negative in the xz plane.
+            const int64_t twiceArea = (x[1] - x[0]) * (z[2] - z[0]) - (z[1] - z[0]) * (x[2] - x[0]);
+            if (twiceArea == 0) {
+                fail("tile mesh", "degenerate triangle");
+            } else if (twiceArea > 0) {
+                fail("tile mesh", "triangle facing down");
+            }
+            area -= 0.5 * static_cast<double>(twiceArea);
+        }
+        if (area != static_cast<double>(tileCells) * tileCells) {
+            printf("  variant %u area %.1f\n", mask, area);
+            fail("tile mesh", "variant does not cover the tile exactly once");
+        }
+        for (uint32_t t = 0; t <= tileCells; ++t) {
+            const uint32_t onEdge[4] = { t, t * columns + tileCells, tileCells * columns + t, t * columns };
+            for (uint32_t edge = 0; edge < 4; ++edge) {
+                if (used[onEdge[edge]]) {
+                    edges.positions[mask][edge].push_back(t);
+                    if ((mask >> edge & 1) && t % 2 == 1) {
+                        fail("tile mesh", "stitched edge uses an odd vertex");
+                    }
+                }
+            }
+        }
+    }
+    return edges;
+}
+
+static void checkTree(const terrain::Quadtree& tree) {
+    const terrain::TerrainDesc& desc = tree.desc();
+    float lowest = INFINITY, highest = -INFINITY;
+    for (float height : tree.heights()) {
+        lowest = std::min(lowest, height);
+        highest = std::max(highest, height);
+    }
+    float boundsMin[3], boundsMax[3];
+    tree.nodeBounds(0, 0, 0, boundsMin, boundsMax);
+    if (boundsMin[1] != desc.origin[1] + lowest || boundsMax[1] != desc.origin[1] + highest) {
+        fail("tree", "root bounds differ from the heightmap's");
+    }
+    for (uint32_t level = 0; level + 1 < desc.levels; ++level) {
+        for (uint32_t z = 0; z < 1u << level; ++z) {
+            for (uint32_t x = 0; x < 1u << level; ++x) {
+                float childMin[3], childMax[3];
+                tree.nodeBounds(level, x, z, boundsMin, boundsMax);
+                for (uint32_t child = 0; child < 4; ++child) {
+                    const uint32_t childX = 2 * x + (child & 1), childZ = 2 * z + (child >> 1);
+                    tree.nodeBounds(level + 1, childX, childZ, childMin, childMax);
+                    if (childMin[1] < boundsMin[1] || childMax[1] > boundsMax[1]) {
+                        fail("tree", "child outside its parent's bounds");
+                    }
+                    if (tree.nodeError(level + 1, childX, childZ) > tree.nodeError(level, x, z)) {
+                        fail("tree", "child error above its parent's");
+                    }
+                }
+            }
+        }
+    }
+    if (tree.nodeError(desc.levels - 1, 0, 0) != 0.0f) {
+        fail("tree", "leaf with an error");
+    }
+}
+
+// Column-major, looking down -z, with Metal's [0, 1] clip depth.
+static void makeViewProjection(const float eye[3], const float target[3], float aspect, float fovY, float viewProjection[16]) {
+    float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    const float fLength = std::sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    for (float& v : f) {
+        v /= fLength;
+    }
+    float s[3] = { -f[2], 0.0f, f[0] }; // f x up, up = +y
+    const float sLength = std::sqrt(s[0] * s[0] + s[2] * s[2]);
+    s[0] /= sLength;
+    s[2] /= sLength;
+    const float u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+    float view[16] = {
+        s[0], u[0], -f[0], 0,
+        s[1], u[1], -f[1], 0,
+        s[2], u[2], -f[2], 0,
+        0, 0, 0, 1
+    };
+    for (int r = 0; r < 3; ++r) {
+        view[12 + r] = -(view[r] * eye[0] + view[4 + r] * eye[1] + view[8 + r] * eye[2]);
+    }
+    const float nearZ = 0.1f, farZ = 5000.0f;
+    const float ys = 1.0f / std::tan(fovY * 0.5f);
+    const float zs = farZ / (nearZ - farZ);
+    const float projection[16] = {
+        ys / aspect, 0, 0, 0,
+        0, ys, 0, 0,
+        0, 0, zs, -1,
+        0, 0, zs * nearZ, 0
+    };
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                sum += projection[k * 4 + r] * view[c * 4 + k];
+            }
+            viewProjection[c * 4 + r] = sum;
+        }
+    }
+}
+
+// A camera some way above the terrain at time t, flying a loop and looking ahead and down.
+static terrain::View makeView(const terrain::Quadtree& tree, float t, float maxPixelError) {
+    const uint32_t resolution = tree.resolution();
+    const float size = static_cast<float>(resolution - 1) * tree.desc().spacing;
+    const float angle = t * 6.2831853f;
+    const float radius = 0.35f * size;
+    const float centre[2] = { tree.desc().origin[0] + 0.5f * size, tree.desc().origin[2] + 0.5f * size };
+    const float eye[3] = { centre[0] + radius * std::cos(angle), 0.0f, centre[1] + radius * std::sin(angle) };
+    const uint32_t column = std::min(resolution - 1, static_cast<uint32_t>((eye[0] - tree.desc().origin[0]) / tree.desc().spacing));
+    const uint32_t row = std::min(resolution - 1, static_cast<uint32_t>((eye[2] - tree.desc().origin[2]) / tree.desc().spacing));
+    const float ground = tree.desc().origin[1] + tree.heights()[size_t(row) * resolution + column];
+    const float position[3] = { eye[0], ground + 0.02f * size, eye[2] };
+    const float target[3] = { position[0] - 0.2f * size * std::sin(angle), ground, position[2] + 0.2f * size * std::cos(angle) };
+
+    terrain::View view;
+    float viewProjection[16];
+    const float fovY = 45.0f * 3.14159265f / 180.0f;
+    makeViewProjection(position, target, 16.0f / 9.0f, fovY, viewProjection);
+    terrain::extractFrustumPlanes(viewProjection, view.frustumPlanes);
+    for (int i = 0; i < 3; ++i) {
+        view.cameraPosition[i] = position[i];
+    }
+    view.pixelsPerUnit = 1080.0f / (2.0f * std::tan(fovY * 0.5f));
+    view.maxPixelError = maxPixelError;
+    return view;
+}
+
+static bool boxVisible(const terrain::View& view, const float boundsMin[3], const float boundsMax[3]) {
+    for (const float* plane : view.frustumPlanes) {
+        float distance = plane[3];
+        for (int i = 0; i < 3; ++i) {
+            distance += plane[i] * (plane[i] >= 0.0f ? boundsMax[i] : boundsMin[i]);
+        }
+        if (distance < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void checkSelection(const char* name, const terrain::Quadtree& tree, const terrain::View& view, const terrain::Selection& selection,
+                           const EdgeVertices& edges) {
+    const terrain::TerrainDesc& desc = tree.desc();
+    const uint32_t leafLevel = desc.levels - 1;
+    const uint32_t side = 1u << leafLevel;
+    const std::vector<terrain::Tile>& tiles = selection.tiles();
+
+    // Which tile covers each leaf-sized cell.
+    std::vector<int32_t> cover(size_t(side) * side, -1);
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const terrain::Tile& tile = tiles[i];
+        const uint32_t span = 1u << (leafLevel - tile.level);
+        for (uint32_t z = tile.z * span; z < (tile.z + 1) * span; ++z) {
+            for (uint32_t x = tile.x * span; x < (tile.x + 1) * span; ++x) {
+                if (cover[size_t(z) * side + x] >= 0) {
+                    fail(name, "tiles overlap");
+                }
+                cover[size_t(z) * side + x] = static_cast<int32_t>(i);
+            }
+        }
+    }
+    for (uint32_t z = 0; z < side; ++z) {
+        for (uint32_t x = 0; x < side; ++x) {
+            float boundsMin[3], boundsMax[3];
+            tree.nodeBounds(leafLevel, x, z, boundsMin, boundsMax);
+            if (cover[size_t(z) * side + x] < 0 && boxVisible(view, boundsMin, boundsMax)) {
+                fail(name, "visible area left uncovered");
+                z = side;
+                break;
+            }
+        }
+    }
+
+    uint32_t grouped = 0;
+    for (uint32_t mask = 0; mask < terrain::kStitchVariants; ++mask) {
+        const terrain::TileGroup& group = selection.group(mask);
+        for (uint32_t i = group.firstTile; i < group.firstTile + group.tileCount; ++i) {
+            if (i >= tiles.size() || tiles[i].stitchMask != mask) {
+                fail(name, "tile outside its stitch mask's group");
+            }
+        }
+        grouped += group.tileCount;
+    }
+    if (grouped != tiles.size()) {
+        fail(name, "groups do not add up to the tiles");
+    }
+
+    for (const terrain::Tile& tile : tiles) {
+        const uint32_t span = 1u << (leafLevel - tile.level);
+        const uint32_t step = span;
+        float boundsMin[3], boundsMax[3];
+        tree.nodeBounds(tile.level, tile.x, tile.z, boundsMin, boundsMax);
+        float distanceSquared = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            const float outside = std::max({ boundsMin[i] - view.cameraPosition[i], view.cameraPosition[i] - boundsMax[i], 0.0f });
+            distanceSquared += outside * outside;
+        }
+        const float error = tree.nodeError(tile.level, tile.x, tile.z) * view.pixelsPerUnit;
+        if (tile.level < leafLevel && error > 0.0f && error * error > view.maxPixelError * view.maxPixelError * distanceSquared * 1.0001f) {
+            fail(name, "tile over the pixel error budget");
+        }
+
+        for (uint32_t edge = 0; edge < 4; ++edge) {
+            // Walk the leaf cells just across the edge: every tile there is within a level, a coarser one stitched.
+            const bool alongX = edge % 2 == 0;
+            int32_t cellX = tile.x * span + (edge == 1 ? span : 0) + (edge == 3 ? -1 : 0);
+            int32_t cellZ = tile.z * span + (edge == 2 ? span : 0) + (edge == 0 ? -1 : 0);
+            if (cellX < 0 || cellZ < 0 || cellX >= static_cast<int32_t>(side) || cellZ >= static_cast<int32_t>(side)) {
+                if (tile.stitchMask >> edge & 1) {
+                    fail(name, "stitched edge on the terrain's border");
+                }
+                continue;
+            }
+            bool coarser = false;
+            int32_t coarserTile = -1;
+            for (uint32_t k = 0; k < span; ++k) {
+                const int32_t c = cover[size_t(cellZ + (alongX ? 0 : k)) * side + cellX + (alongX ? k : 0)];
+                if (c < 0) {
+                    continue;
+                }
+                const terrain::Tile& neighbour = tiles[c];
+                if (std::abs(static_cast<int>(neighbour.level) - static_cast<int>(tile.level)) > 1) {
+                    fail(name, "neighbours more than a level apart");
+                }
+                if (neighbour.level < tile.level) {
+                    coarser = true;
+                    coarserTile = c;
+                }
+            }
+            if (coarser != ((tile.stitchMask >> edge & 1) != 0)) {
+                fail(name, "stitch mask disagrees with the neighbours");
+                continue;
+            }
+            if (!coarser) {
+                continue;
+            }
+
+            // Both sides of the edge use the same heightmap samples along it, so they meet without a T-junction.
+            const terrain::Tile& neighbour = tiles[coarserTile];
+            const uint32_t neighbourStep = 1u << (leafLevel - neighbour.level);
+            const uint32_t start = (alongX ? tile.x : tile.z) * desc.tileCells * step;
+            const uint32_t end = start + desc.tileCells * step;
+            const uint32_t neighbourStart = (alongX ? neighbour.x : neighbour.z) * desc.tileCells * neighbourStep;
+            std::vector<uint32_t> ours, theirs;
+            for (uint32_t t : edges.positions[tile.stitchMask][edge]) {
+                ours.push_back(start + t * step);
+            }
+            for (uint32_t t : edges.positions[neighbour.stitchMask][(edge + 2) % 4]) {
+                const uint32_t sample = neighbourStart + t * neighbourStep;
+                if (sample >= start && sample <= end) {
+                    theirs.push_back(sample);
+                }
+            }
+            if (ours != theirs) {
+                fail(name, "crack along a stitched edge");
+            }
+        }
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const int frames = argc > 1 ? std::max(1, atoi(argv[1])) : 600;
+
+    for (uint32_t tileCells : { 2u, 8u, 32u, 254u }) {
+        const terrain::TileMesh mesh = terrain::buildTileMesh(tileCells);
+        checkTileMesh(mesh, tileCells);
+    }
+
+    // Small trees against every check, flat and rough, frame by frame along the path.
+    struct Case {
+        const char* name;
+        uint32_t tileCells;
+        uint32_t levels;
+        float heightScale;
+        float maxPixelError;
+        bool spikes; // flat but for a few tall samples, so that detail ends abruptly and needs balancing
+    };
+    const Case cases[] = {
+        { "flat", 16, 5, 0.0f, 1.0f, false },
+        { "hills", 16, 6, 40.0f, 1.0f, false },
+        { "rough", 8, 7, 120.0f, 0.5f, false },
+        { "coarse budget", 32, 5, 60.0f, 8.0f, false },
+        { "spikes", 8, 7, 30.0f, 1.0f, true },
+    };
+    for (const Case& c : cases) {
+        terrain::TerrainDesc desc;
+        desc.tileCells = c.tileCells;
+        desc.levels = c.levels;
+        desc.spacing = 0.5f;
+        desc.origin[0] = -100.0f;
+        desc.origin[1] = 5.0f;
+        desc.origin[2] = 30.0f;
+        std::vector<float> heights = makeHeights(desc, c.spikes ? 0.0f : c.heightScale, 7);
+        if (c.spikes) {
+            const uint32_t resolution = terrain::heightmapResolution(desc);
+            uint32_t random = 12345;
+            for (int spike = 0; spike < 24; ++spike) {
+                random = random * 1664525u + 1013904223u;
+                const uint32_t column = (random >> 8) % resolution;
+                random = random * 1664525u + 1013904223u;
+                heights[size_t((random >> 8) % resolution) * resolution + column] = c.heightScale;
+            }
+        }
+        const terrain::Quadtree tree(desc, std::move(heights), 3);
+        checkTree(tree);
+        const EdgeVertices edges = checkTileMesh(terrain::buildTileMesh(c.tileCells), c.tileCells);
+        terrain::Selection selection;
+        size_t tiles = 0, balanceSplits = 0;
+        for (int frame = 0; frame < 64; ++frame) {
+            const terrain::View view = makeView(tree, frame / 64.0f, c.maxPixelError);
+            tree.select(view, selection);
+            checkSelection(c.name, tree, view, selection, edges);
+            tiles += selection.tiles().size();
+            balanceSplits += selection.stats().balanceSplits;
+        }
+        if (c.spikes && balanceSplits == 0) {
+            fail(c.name, "abrupt detail never needed balancing");
+        }
+        if (c.heightScale == 0.0f && tiles > 64) {
+            fail(c.name, "flat terrain split below the root");
+        }
+        if (c.heightScale > 0.0f && tiles <= 64) {
+            fail(c.name, "rough terrain never split");
+        }
+    }
+
+    // The same bounds and errors from one thread as from several.
+    {
+        terrain::TerrainDesc desc;
+        desc.tileCells = 16;
+        desc.levels = 6;
+        std::vector<float> heights = makeHeights(desc, 50.0f, 3);
+        const terrain::Quadtree serial(desc, heights, 1), threaded(desc, heights, 5);
+        for (uint32_t level = 0; level < desc.levels; ++level) {
+            for (uint32_t z = 0; z < 1u << level; ++z) {
+                for (uint32_t x = 0; x < 1u << level; ++x) {
+                    if (serial.nodeError(level, x, z) != threaded.nodeError(level, x, z)) {
+                        fail("threads", "threaded build differs");
+                    }
+                }
+            }
+        }
+    }
+
+    const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    terrain::TerrainDesc desc;
+    desc.tileCells = 32;
+    desc.levels = 8;
+    const terrain::TileMesh mesh = terrain::buildTileMesh(desc.tileCells);
+    std::vector<float> heights = makeHeights(desc, 250.0f, 11);
+    const uint32_t resolution = terrain::heightmapResolution(desc);
+    printf("heightmap %ux%u, %u cells per tile, %u levels, %u hardware threads\n", resolution, resolution, desc.tileCells, desc.levels, hardwareThreads);
+    for (uint32_t threads : { 1u, hardwareThreads }) {
+        const Clock::time_point start = Clock::now();
+        const terrain::Quadtree tree(desc, heights, threads);
+        printf("  build %2u threads %8.1f ms, %zu nodes\n", threads, seconds(start) * 1000.0, tree.nodeCount());
+        if (hardwareThreads == 1) {
+            break;
+        }
+    }
+    const terrain::Quadtree tree(desc, std::move(heights));
+    for (float maxPixelError : { 0.5f, 1.0f, 4.0f }) {
+        terrain::Selection selection;
+        double total = 0.0, worst = 0.0, tiles = 0.0, triangles = 0.0, visited = 0.0, balanced = 0.0;
+        for (int frame = 0; frame < frames; ++frame) {
+            const terrain::View view = makeView(tree, static_cast<float>(frame) / frames, maxPixelError);
+            const Clock::time_point start = Clock::now();
+            tree.select(view, selection);
+            const double elapsed = seconds(start);
+            total += elapsed;
+            worst = std::max(worst, elapsed);
+            tiles += selection.tiles().size();
+            for (uint32_t mask = 0; mask < terrain::kStitchVariants; ++mask) {
+                triangles += selection.group(mask).tileCount * (mesh.variants[mask].indexCount / 3.0);
+            }
+            visited += selection.stats().visitedNodes;
+            balanced += selection.stats().balanceSplits;
+        }
+        printf("  select %4.1f px %7.1f us mean %7.1f us worst %7.1f tiles %9.0f triangles %7.1f nodes visited %5.1f balance splits\n", maxPixelError,
+               total / frames * 1e6, worst * 1e6, tiles / frames, triangles / frames, visited / frames, balanced / frames);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+//
+//  TessellationBench.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Computes tessellation factors for heightfield patches along a camera path and checks them: patches share their
+// edge factors exactly with each neighbour, factors stay within [1, maxFactor] and the inside factors follow the edges,
+// patches are zeroed exactly when their bounds leave the frustum, factors fall with distance and scale with the
+// viewport until clamped, and threads change nothing. Then reports factor computation time per frame, and how much
+// geometry the patches store against a mesh pre-tessellated to the same detail. Exits nonzero if any check fails.
+// Plain C++, no Metal:
+//   c++ -std=c++17 -O3 -ILearningMetal Tools/TessellationBench.cpp LearningMetal/TessellationFactors.cpp LearningMetal/TerrainQuadtree.cpp LearningMetal/ProceduralMesh.cpp -pthread -o tessellation-bench
+//   ./tessellation-bench [frames]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "ProceduralMesh.hpp"
+#include "TerrainQuadtree.hpp"
+#include "TessellationFactors.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+struct Terrain {
+    tessellation::PatchGrid grid;
+    std::vector<float> heights;
+    std::vector<float> bounds;
+};
+
+static Terrain makeTerrain(uint32_t patchesPerSide, uint32_t samplesPerPatch, float heightScale) {
+    Terrain terrain;
+    terrain.grid.patchesPerSide = patchesPerSide;
+    terrain.grid.samplesPerPatch = samplesPerPatch;
+    terrain.grid.spacing = 0.5f;
+    terrain.grid.origin[0] = -80.0f;
+    terrain.grid.origin[1] = 3.0f;
+    terrain.grid.origin[2] = 20.0f;
+    const uint32_t resolution = tessellation::heightmapResolution(terrain.grid);
+    procedural::GridDesc noise;
+    noise.extent[0] = noise.extent[1] = static_cast<float>(resolution - 1);
+    noise.heightScale = heightScale;
+    noise.frequency = 6.0f;
+    terrain.heights.resize(size_t(resolution) * resolution);
+    const float half = 0.5f * static_cast<float>(resolution - 1);
+    for (uint32_t row = 0; row < resolution; ++row) {
+        for (uint32_t column = 0; column < resolution; ++column) {
+            terrain.heights[size_t(row) * resolution + column] = procedural::heightAt(noise, static_cast<float>(column) - half, static_cast<float>(row) - half);
+        }
+    }
+    terrain.bounds.resize(size_t(patchesPerSide) * patchesPerSide * 2);
+    tessellation::computeHeightBounds(terrain.grid, terrain.heights.data(), terrain.bounds.data());
+    return terrain;
+}
+
+// Column-major, looking down -z, with Metal's [0, 1] clip depth, as math_utils.
+static void makeViewProjection(const float eye[3], const float target[3], float fovY, float viewProjection[16]) {
+    float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    const float fLength = std::sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    for (float& v : f) {
+        v /= fLength;
+    }
+    const float sLength = std::sqrt(f[0] * f[0] + f[2] * f[2]);
+    const float s[3] = { -f[2] / sLength, 0.0f, f[0] / sLength }; // f x up, up = +y
+    const float u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+    float view[16] = {
+        s[0], u[0], -f[0], 0,
+        s[1], u[1], -f[1], 0,
+        s[2], u[2], -f[2], 0,
+        0, 0, 0, 1
+    };
+    for (int r = 0; r < 3; ++r) {
+        view[12 + r] = -(view[r] * eye[0] + view[4 + r] * eye[1] + view[8 + r] * eye[2]);
+    }
+    const float nearZ = 0.1f, farZ = 2000.0f, aspect = 16.0f / 9.0f;
+    const float ys = 1.0f / std::tan(fovY * 0.5f);
+    const float zs = farZ / (nearZ - farZ);
+    const float projection[16] = {
+        ys / aspect, 0, 0, 0,
+        0, ys, 0, 0,
+        0, 0, zs, -1,
+        0, 0, zs * nearZ, 0
+    };
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                sum += projection[k * 4 + r] * view[c * 4 + k];
+            }
+            viewProjection[c * 4 + r] = sum;
+        }
+    }
+}
+
+// A camera above the terrain at time t, flying a loop and looking ahead and down.
+static tessellation::FactorParams makeParams(const Terrain& terrain, float t) {
+    const tessellation::PatchGrid& grid = terrain.grid;
+    const uint32_t resolution = tessellation::heightmapResolution(grid);
+    const float size = static_cast<float>(resolution - 1) * grid.spacing;
+    const float angle = t * 6.2831853f;
+    const float eye[3] = { grid.origin[0] + size * (0.5f + 0.3f * std::cos(angle)), 0.0f, grid.origin[2] + size * (0.5f + 0.3f * std::sin(angle)) };
+    const uint32_t column = std::min(resolution - 1, static_cast<uint32_t>((eye[0] - grid.origin[0]) / grid.spacing));
+    const uint32_t row = std::min(resolution - 1, static_cast<uint32_t>((eye[2] - grid.origin[2]) / grid.spacing));
+    const float ground = grid.origin[1] + terrain.heights[size_t(row) * resolution + column];
+    const float position[3] = { eye[0], ground + 0.03f * size, eye[2] };
+    const float target[3] = { position[0] - 0.2f * size * std::sin(angle), ground, position[2] + 0.2f * size * std::cos(angle) };
+
+    tessellation::FactorParams params;
+    const float fovY = 45.0f * 3.14159265f / 180.0f;
+    float viewProjection[16];
+    makeViewProjection(position, target, fovY, viewProjection);
+    terrain::extractFrustumPlanes(viewProjection, params.frustumPlanes);
+    for (int i = 0; i < 3; ++i) {
+        params.cameraPosition[i] = position[i];
+    }
+    params.pixelsPerUnit = 1080.0f / (2.0f * std::tan(fovY * 0.5f));
+    return params;
+}
+
+static bool isCulled(const tessellation::QuadFactors& factors) {
+    return factors.edge[0] == 0.0f;
+}
+
+static void checkFactors(const char* name, const Terrain& terrain, const tessellation::FactorParams& params, const std::vector<tessellation::QuadFactors>& factors) {
+    using namespace tessellation;
+    const PatchGrid& grid = terrain.grid;
+    const uint32_t side = grid.patchesPerSide;
+    const float size = static_cast<float>(grid.samplesPerPatch) * grid.spacing;
+    for (uint32_t z = 0; z < side; ++z) {
+        for (uint32_t x = 0; x < side; ++x) {
+            const QuadFactors& patch = factors[size_t(z) * side + x];
+
+            // Culled exactly when the patch's box lies behind one of the planes.
+            const float* pBounds = terrain.bounds.data() + (size_t(z) * side + x) * 2;
+            const float boundsMin[3] = { grid.origin[0] + x * size, grid.origin[1] + pBounds[0], grid.origin[2] + z * size };
+            const float boundsMax[3] = { boundsMin[0] + size, grid.origin[1] + pBounds[1], boundsMin[2] + size };
+            bool outside = false;
+            for (const float* plane : params.frustumPlanes) {
+                float distance = plane[3];
+                for (int i = 0; i < 3; ++i) {
+                    distance += plane[i] * (plane[i] >= 0.0f ? boundsMax[i] : boundsMin[i]);
+                }
+                outside = outside || distance < 0.0f;
+            }
+            if (outside != isCulled(patch)) {
+                fail(name, "culled patch disagrees with the frustum");
+            }
+            if (outside) {
+                for (float f : patch.edge) {
+                    if (f != 0.0f) {
+                        fail(name, "culled patch with a non-zero edge factor");
+                    }
+                }
+                continue;
+            }
+
+            for (float f : patch.edge) {
+                if (!(f >= 1.0f && f <= params.maxFactor)) {
+                    fail(name, "edge factor out of range");
+                }
+            }
+            if (patch.inside[0] != std::max(patch.edge[kEdgeV0], patch.edge[kEdgeV1]) || patch.inside[1] != std::max(patch.edge[kEdgeU0], patch.edge[kEdgeU1])) {
+                fail(name, "inside factors do not follow the edges");
+            }
+
+            // Shared edges cut the same way from both sides, culled neighbours aside: those are never drawn.
+            if (x + 1 < side && !isCulled(factors[size_t(z) * side + x + 1]) && factors[size_t(z) * side + x + 1].edge[kEdgeU0] != patch.edge[kEdgeU1]) {
+                fail(name, "neighbours along x disagree on their shared edge");
+            }
+            if (z + 1 < side && !isCulled(factors[size_t(z + 1) * side + x]) && factors[size_t(z + 1) * side + x].edge[kEdgeV0] != patch.edge[kEdgeV1]) {
+                fail(name, "neighbours along z disagree on their shared edge");
+            }
+        }
+    }
+}
+
+// Further away is never more detailed, and a taller viewport scales unclamped factors with it.
+static void checkEdgeFactor() {
+    tessellation::FactorParams params = {};
+    params.pixelsPerUnit = 1000.0f;
+    const float a[3] = { 0.0f, 0.0f, -10.0f }, b[3] = { 1.0f, 0.5f, -10.0f };
+    float previous = INFINITY;
+    for (float distance = 0.0f; distance < 4000.0f; distance = distance * 1.5f + 0.25f) {
+        params.cameraPosition[2] = distance;
+        const float f = tessellation::edgeFactor(params, a, b);
+        if (f > previous) {
+            fail("edge factor", "rises with distance");
+        }
+        if (tessellation::edgeFactor(params, b, a) != f) {
+            fail("edge factor", "depends on the order of the corners");
+        }
+        previous = f;
+    }
+    params.cameraPosition[2] = 40.0f;
+    const float f = tessellation::edgeFactor(params, a, b);
+    params.pixelsPerUnit *= 2.0f;
+    const float doubled = tessellation::edgeFactor(params, a, b);
+    if (f <= 1.0f || doubled >= params.maxFactor || std::fabs(doubled - 2.0f * f) > 1e-4f * f) {
+        printf("  factor %.4f, doubled viewport %.4f\n", f, doubled);
+        fail("edge factor", "does not scale with the viewport");
+    }
+}
+
+// Triangles of a quad patch under integer partitioning, close enough for fractional ones.
+static double patchTriangles(const tessellation::QuadFactors& factors) {
+    return 2.0 * std::ceil(factors.inside[0]) * std::ceil(factors.inside[1]);
+}
+
+int main(int argc, const char* argv[]) {
+    const int frames = argc > 1 ? std::max(1, atoi(argv[1])) : 300;
+    checkEdgeFactor();
+
+    struct Case {
+        const char* name;
+        uint32_t patchesPerSide;
+        uint32_t samplesPerPatch;
+        float heightScale;
+    };
+    const Case cases[] = {
+        { "flat", 16, 8, 0.0f },
+        { "hills", 32, 16, 30.0f },
+        { "steep", 24, 4, 150.0f },
+    };
+    for (const Case& c : cases) {
+        const Terrain terrain = makeTerrain(c.patchesPerSide, c.samplesPerPatch, c.heightScale);
+        std::vector<tessellation::QuadFactors> serial(size_t(c.patchesPerSide) * c.patchesPerSide), threaded(serial.size());
+        size_t visible = 0;
+        for (int frame = 0; frame < 48; ++frame) {
+            const tessellation::FactorParams params = makeParams(terrain, frame / 48.0f);
+            tessellation::computeFactors(params, terrain.grid, terrain.heights.data(), terrain.bounds.data(), serial.data(), 1);
+            tessellation::computeFactors(params, terrain.grid, terrain.heights.data(), terrain.bounds.data(), threaded.data(), 5);
+            checkFactors(c.name, terrain, params, serial);
+            for (size_t i = 0; i < serial.size(); ++i) {
+                if (std::memcmp(&serial[i], &threaded[i], sizeof(serial[i])) != 0) {
+                    fail(c.name, "threaded factors differ");
+                    break;
+                }
+                visible += !isCulled(serial[i]);
+            }
+        }
+        if (visible == 0 || visible == serial.size() * 48) {
+            fail(c.name, "the path never culls, or never sees, the terrain");
+        }
+    }
+
+    // Patches of 16 cells cut up to 16 times, as in the renderer, so full detail is a segment per cell.
+    const uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    const Terrain terrain = makeTerrain(256, 16, 200.0f);
+    const uint32_t resolution = tessellation::heightmapResolution(terrain.grid);
+    const size_t patches = size_t(terrain.grid.patchesPerSide) * terrain.grid.patchesPerSide;
+    printf("heightmap %ux%u, %zu patches of %u cells, %u hardware threads\n", resolution, resolution, patches, terrain.grid.samplesPerPatch, hardwareThreads);
+    std::vector<tessellation::QuadFactors> factors(patches);
+    for (uint32_t threads : { 1u, hardwareThreads }) {
+        double total = 0.0, worst = 0.0, triangles = 0.0, visible = 0.0;
+        for (int frame = 0; frame < frames; ++frame) {
+            const tessellation::FactorParams params = makeParams(terrain, static_cast<float>(frame) / frames);
+            const Clock::time_point start = Clock::now();
+            tessellation::computeFactors(params, terrain.grid, terrain.heights.data(), terrain.bounds.data(), factors.data(), threads);
+            const double elapsed = seconds(start);
+            total += elapsed;
+            worst = std::max(worst, elapsed);
+            for (const tessellation::QuadFactors& patch : factors) {
+                triangles += patchTriangles(patch);
+                visible += !isCulled(patch);
+            }
+        }
+        printf("  factors %2u threads %8.1f us mean %8.1f us worst %8.1f Mpatch/s %8.0f visible patches %10.0f triangles\n", threads, total / frames * 1e6,
+               worst * 1e6, patches / (total / frames) * 1e-6, visible / frames, triangles / frames);
+        if (hardwareThreads == 1) {
+            break;
+        }
+    }
+
+    // Stored per patch: its height bounds, and a frame's factors, six halves, per frame in flight. The heightmap is
+    // needed either way. Pre-tessellated: a 16-byte vertex per sample and 16-bit indices per 65536-vertex chunk.
+    const double patchBytes = patches * (2 * sizeof(float) + 3 * 6 * sizeof(uint16_t));
+    const double cells = double(resolution - 1) * (resolution - 1);
+    const double meshBytes = double(resolution) * resolution * 16.0 + cells * 6.0 * sizeof(uint16_t);
+    printf("  geometry stored: patches %.2f MB, pre-tessellated mesh %.2f MB (%.0fx)\n", patchBytes * 1e-6, meshBytes * 1e-6, meshBytes / patchBytes);
+    return failures == 0 ? 0 : 1;
+}
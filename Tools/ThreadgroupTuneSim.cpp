@@ -0,0 +1,96 @@
+//
+//  ThreadgroupTuneSim.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Runs the threadgroup autotuner against a simulated GPU so its choices can be checked without a device: for each
+// kernel it prints the width the tuner picked next to the best width under the noise-free cost model.
+// Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/ThreadgroupTuneSim.cpp LearningMetal/ThreadgroupTuner.cpp LearningMetal/Statistics.cpp -o threadgroup-tune-sim
+//   ./threadgroup-tune-sim [noise fraction, default 0.1]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include "ThreadgroupTuner.hpp"
+
+using namespace threadgroup_tuning;
+
+// A GPU of a few cores, each running threadgroups side by side until it runs out of threads or registers.
+struct SimulatedGpu {
+    uint32_t cores = 4;
+    uint32_t threadsPerCore = 1024;
+    uint32_t maxGroupsPerCore = 16;
+    double launchMicroseconds = 0.35; // per threadgroup
+    double dispatchMicroseconds = 4.0;
+};
+
+struct SimulatedKernel {
+    const char* name;
+    KernelLimits limits;
+    uint32_t gridSize;
+    double microsecondsPerWave; // one round of resident threadgroups
+    uint32_t registerLimitedThreads; // threads a core can hold given the kernel's register use
+    double barrierMicroseconds;  // threadgroup barriers cost more in wide groups
+};
+
+static double simulatedMicroseconds(const SimulatedGpu& gpu, const SimulatedKernel& kernel, uint32_t width) {
+    const DispatchSize size = dispatchSize(kernel.gridSize, width);
+    const uint32_t threadsPerCore = std::min(gpu.threadsPerCore, kernel.registerLimitedThreads);
+    const uint32_t groupsPerCore = std::max(1u, std::min(gpu.maxGroupsPerCore, threadsPerCore / width));
+    const uint32_t waves = (size.threadgroups + gpu.cores * groupsPerCore - 1) / (gpu.cores * groupsPerCore);
+    const double barrier = kernel.barrierMicroseconds * std::log2(static_cast<double>(width) / kernel.limits.threadExecutionWidth + 1.0);
+    return gpu.dispatchMicroseconds + waves * (kernel.microsecondsPerWave + barrier) + size.threadgroups * gpu.launchMicroseconds / gpu.cores;
+}
+
+int main(int argc, const char* argv[]) {
+    const double noise = argc > 1 ? atof(argv[1]) : 0.1;
+    const SimulatedGpu gpu;
+    const SimulatedKernel kernels[] = {
+        { "animateInstances", { 1024, 32 }, 32, 3.0, 1024, 0.0 },
+        { "animateInstances", { 1024, 32 }, 100000, 3.0, 1024, 0.0 },
+        { "cullInstances", { 512, 32 }, 65536, 5.0, 384, 0.4 },
+        { "reduceBounds", { 1024, 32 }, 262144, 2.0, 1024, 1.5 },
+        { "skinVertices", { 256, 32 }, 500000, 8.0, 256, 0.2 },
+    };
+
+    std::mt19937 random(1234);
+    std::normal_distribution<double> jitter(0.0, noise);
+    Autotuner tuner;
+    int mismatches = 0;
+    for (const SimulatedKernel& kernel : kernels) {
+        // Timings come back a few dispatches late, as they do from command buffer completion handlers.
+        std::deque<uint32_t> inFlight;
+        uint32_t dispatches = 0;
+        while (!tuner.isTuned(kernel.name, kernel.limits, kernel.gridSize) && dispatches < 10000) {
+            inFlight.push_back(tuner.threadgroupWidth(kernel.name, kernel.limits, kernel.gridSize));
+            ++dispatches;
+            if (inFlight.size() > 3) {
+                const uint32_t width = inFlight.front();
+                inFlight.pop_front();
+                const double microseconds = simulatedMicroseconds(gpu, kernel, width) * std::max(0.1, 1.0 + jitter(random));
+                tuner.recordTime(kernel.name, kernel.limits, kernel.gridSize, width, microseconds / 1000.0);
+            }
+        }
+
+        uint32_t bestWidth = 0;
+        double best = 0.0;
+        for (uint32_t width : candidateWidths(kernel.limits, kernel.gridSize)) {
+            const double microseconds = simulatedMicroseconds(gpu, kernel, width);
+            if (bestWidth == 0 || microseconds < best) {
+                best = microseconds;
+                bestWidth = width;
+            }
+        }
+        const uint32_t chosen = tuner.threadgroupWidth(kernel.name, kernel.limits, kernel.gridSize);
+        const double chosenMicroseconds = simulatedMicroseconds(gpu, kernel, chosen);
+        printf("%-18s grid %7u: tuned %4u (%.1f us) after %u dispatches, model best %4u (%.1f us)%s\n", kernel.name, kernel.gridSize, chosen, chosenMicroseconds, dispatches, bestWidth, best, chosenMicroseconds > best * 1.05 ? "  <- off by more than 5%" : "");
+        mismatches += chosenMicroseconds > best * 1.05;
+    }
+    tuner.printReport();
+    return mismatches == 0 ? 0 : 1;
+}
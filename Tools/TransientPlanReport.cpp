@@ -0,0 +1,270 @@
+//
+//  TransientPlanReport.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Plans the transient resources of a deferred frame at a few resolutions and reports what aliasing them in one heap
+// and keeping single-pass attachments memoryless saves over dedicated allocations. Checks every plan, and a few
+// thousand random ones: resources alive in the same pass never share bytes, offsets honour alignment, the heap covers
+// every placement, only textures used as attachments within a single pass are memoryless (and none where memoryless
+// is unavailable), and persistent resources live through the whole frame so nothing aliases last frame's contents.
+// Exits nonzero if any check fails. Plain C++:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/TransientPlanReport.cpp LearningMetal/TransientResources.cpp -o transient-plan-report
+//   ./transient-plan-report
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "TransientResources.hpp"
+
+using namespace transient;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// What the planner was told, so the checks do not take its word for lifetimes.
+struct Declared {
+    uint64_t size;
+    uint64_t alignment;
+    bool isTexture;
+    bool persistent;
+    PassIndex firstPass = UINT32_MAX;
+    PassIndex lastPass = 0;
+    bool shaderAccess = false;
+    bool used = false;
+};
+
+class CheckedPlan {
+public:
+    ResourceHandle declare(const char* name, uint64_t size, uint64_t alignment, bool isTexture, bool persistent = false) {
+        const ResourceHandle handle = planner.declare(name, size, alignment, isTexture);
+        if (persistent) {
+            planner.setPersistent(handle);
+        }
+        declared.push_back({ size, alignment, isTexture, persistent });
+        return handle;
+    }
+
+    void setMemorylessAllowed(bool allowed) {
+        planner.setMemorylessAllowed(allowed);
+        memorylessAllowed = allowed;
+    }
+
+    PassIndex addPass(const char* name) {
+        ++passCount;
+        return planner.addPass(name);
+    }
+
+    void use(PassIndex pass, ResourceHandle handle, Usage usage) {
+        planner.use(pass, handle, usage);
+        Declared& resource = declared[handle];
+        resource.firstPass = std::min(resource.firstPass, pass);
+        resource.lastPass = std::max(resource.lastPass, pass);
+        resource.shaderAccess |= usage == Usage::ShaderRead || usage == Usage::ShaderWrite;
+        resource.used = true;
+    }
+
+    void compileAndCheck(const char* name) {
+        planner.compile();
+        uint64_t heapEnd = 0;
+        for (ResourceHandle a = 0; a < declared.size(); ++a) {
+            const Declared& resource = declared[a];
+            const Placement& placement = planner.placement(a);
+            if (placement.used != resource.used) {
+                fail(name, "wrong used flag");
+                continue;
+            }
+            if (!resource.used) {
+                continue;
+            }
+            // The live range the plan must protect: persistent resources are live from the frame's start to its end.
+            const PassIndex first = resource.persistent ? 0 : resource.firstPass;
+            const PassIndex last = resource.persistent ? passCount - 1 : resource.lastPass;
+            if (placement.firstPass > first || placement.lastPass < last) {
+                fail(name, "planned lifetime shorter than the uses");
+            }
+            const bool memoryless = memorylessAllowed && resource.isTexture && !resource.shaderAccess && !resource.persistent && resource.firstPass == resource.lastPass;
+            if (placement.memoryless != memoryless) {
+                fail(name, memoryless ? "single-pass attachment not memoryless" : "memoryless resource that needs memory");
+            }
+            if (placement.memoryless) {
+                continue;
+            }
+            if (placement.offset % resource.alignment != 0) {
+                fail(name, "misaligned offset");
+            }
+            heapEnd = std::max(heapEnd, placement.offset + resource.size);
+            for (ResourceHandle b = 0; b < a; ++b) {
+                const Placement& other = planner.placement(b);
+                if (!other.used || other.memoryless) {
+                    continue;
+                }
+                const bool liveTogether = other.firstPass <= placement.lastPass && placement.firstPass <= other.lastPass;
+                const bool shareBytes = other.offset < placement.offset + resource.size && placement.offset < other.offset + declared[b].size;
+                if (liveTogether && shareBytes) {
+                    fail(name, "resources alive in the same pass share bytes");
+                }
+            }
+        }
+        if (heapEnd != planner.heapSize()) {
+            fail(name, "heap size does not match the placements");
+        }
+    }
+
+    TransientPlanner planner;
+    std::vector<Declared> declared;
+    PassIndex passCount = 0;
+    bool memorylessAllowed = true;
+};
+
+// Heap sizes are rounded like heapTextureSizeAndAlign on Apple GPUs: 16 KB pages, 64 KB for large textures.
+static uint64_t textureSize(uint32_t width, uint32_t height, uint32_t bytesPerPixel, uint64_t* pAlignment) {
+    const uint64_t bytes = uint64_t(width) * height * bytesPerPixel;
+    *pAlignment = bytes >= (1 << 20) ? 65536 : 16384;
+    return (bytes + *pAlignment - 1) / *pAlignment * *pAlignment;
+}
+
+static ResourceHandle declareTexture(CheckedPlan& plan, const char* name, uint32_t width, uint32_t height, uint32_t bytesPerPixel, bool persistent = false) {
+    uint64_t alignment = 0;
+    const uint64_t size = textureSize(width, height, bytesPerPixel, &alignment);
+    return plan.declare(name, size, alignment, true, persistent);
+}
+
+// G-buffer, shadow map, SSAO, lighting, a four-level bloom chain, tonemapping into a persistent history for TAA, and
+// a depth-tested overlay.
+static void planDeferredFrame(uint32_t width, uint32_t height, bool print) {
+    CheckedPlan plan;
+    const ResourceHandle albedo = declareTexture(plan, "gbuffer albedo", width, height, 4);
+    const ResourceHandle normal = declareTexture(plan, "gbuffer normal", width, height, 8);
+    const ResourceHandle depth = declareTexture(plan, "depth", width, height, 4);
+    const ResourceHandle shadow = declareTexture(plan, "shadow map", 2048, 2048, 4);
+    const ResourceHandle ao = declareTexture(plan, "ssao", width / 2, height / 2, 1);
+    const ResourceHandle lit = declareTexture(plan, "lit hdr", width, height, 8);
+    ResourceHandle bloom[4];
+    const char* bloomNames[] = { "bloom 1/2", "bloom 1/4", "bloom 1/8", "bloom 1/16" };
+    for (uint32_t i = 0; i < 4; ++i) {
+        bloom[i] = declareTexture(plan, bloomNames[i], width >> (i + 1), height >> (i + 1), 8);
+    }
+    const ResourceHandle history = declareTexture(plan, "taa history", width, height, 4, true);
+    const ResourceHandle overlayDepth = declareTexture(plan, "overlay depth", width, height, 4);
+    uint64_t alignment = 0;
+    const ResourceHandle lightList = plan.declare("light list", textureSize(width / 16, height / 16, 256, &alignment), 256, false);
+
+    const PassIndex shadowPass = plan.addPass("shadow");
+    const PassIndex gbufferPass = plan.addPass("gbuffer");
+    const PassIndex aoPass = plan.addPass("ssao");
+    const PassIndex cullPass = plan.addPass("light culling");
+    const PassIndex lightPass = plan.addPass("lighting");
+    PassIndex bloomPasses[4];
+    for (uint32_t i = 0; i < 4; ++i) {
+        bloomPasses[i] = plan.addPass(bloomNames[i]);
+    }
+    const PassIndex tonemapPass = plan.addPass("tonemap");
+    const PassIndex overlayPass = plan.addPass("overlay");
+
+    plan.use(shadowPass, shadow, Usage::AttachmentWrite);
+    plan.use(gbufferPass, albedo, Usage::AttachmentWrite);
+    plan.use(gbufferPass, normal, Usage::AttachmentWrite);
+    plan.use(gbufferPass, depth, Usage::AttachmentWrite);
+    plan.use(aoPass, depth, Usage::ShaderRead);
+    plan.use(aoPass, normal, Usage::ShaderRead);
+    plan.use(aoPass, ao, Usage::AttachmentWrite);
+    plan.use(cullPass, depth, Usage::ShaderRead);
+    plan.use(cullPass, lightList, Usage::ShaderWrite);
+    plan.use(lightPass, albedo, Usage::ShaderRead);
+    plan.use(lightPass, normal, Usage::ShaderRead);
+    plan.use(lightPass, depth, Usage::ShaderRead);
+    plan.use(lightPass, shadow, Usage::ShaderRead);
+    plan.use(lightPass, ao, Usage::ShaderRead);
+    plan.use(lightPass, lightList, Usage::ShaderRead);
+    plan.use(lightPass, lit, Usage::AttachmentWrite);
+    for (uint32_t i = 0; i < 4; ++i) {
+        plan.use(bloomPasses[i], i == 0 ? lit : bloom[i - 1], Usage::ShaderRead);
+        plan.use(bloomPasses[i], bloom[i], Usage::AttachmentWrite);
+    }
+    plan.use(tonemapPass, lit, Usage::ShaderRead);
+    plan.use(tonemapPass, bloom[3], Usage::ShaderRead);
+    plan.use(tonemapPass, history, Usage::ShaderRead);
+    plan.use(tonemapPass, history, Usage::AttachmentWrite);
+    plan.use(overlayPass, overlayDepth, Usage::AttachmentWrite);
+
+    plan.compileAndCheck("deferred frame");
+    if (plan.planner.placement(overlayDepth).memoryless != true || plan.planner.placement(history).memoryless) {
+        fail("deferred frame", "wrong memoryless choice");
+    }
+    const PlanReport report = plan.planner.report();
+    if (report.heapBytes + report.memorylessBytes > report.dedicatedBytes) {
+        fail("deferred frame", "aliasing used more memory than dedicated allocations");
+    }
+    printf("%ux%u: dedicated %.1f MB, heap %.1f MB + %.1f MB memoryless, %.1f%% saved\n", width, height, report.dedicatedBytes / 1048576.0,
+           report.heapBytes / 1048576.0, report.memorylessBytes / 1048576.0, 100.0 * (1.0 - double(report.heapBytes) / report.dedicatedBytes));
+    if (print) {
+        plan.planner.printReport();
+    }
+}
+
+// A persistent resource first touched late in the frame still holds last frame's contents before that: the
+// transient used only in the first pass must not be placed over it.
+static void checkPersistent() {
+    const char* name = "persistent";
+    CheckedPlan plan;
+    const ResourceHandle early = plan.declare("early", 1 << 20, 4096, true);
+    const ResourceHandle history = plan.declare("history", 1 << 20, 4096, true, true);
+    const PassIndex first = plan.addPass("first");
+    plan.addPass("second");
+    const PassIndex third = plan.addPass("third");
+    plan.use(first, early, Usage::ShaderWrite);
+    plan.use(third, history, Usage::AttachmentWrite);
+    plan.compileAndCheck(name);
+    if (plan.planner.placement(history).firstPass != 0 || plan.planner.placement(history).lastPass != third) {
+        fail(name, "persistent resource does not live through the frame");
+    }
+    if (plan.planner.heapSize() != 2 << 20) {
+        fail(name, "a transient aliases last frame's contents");
+    }
+}
+
+// Buffers and textures of random sizes and alignments over random passes.
+static void checkRandomPlans(uint32_t count) {
+    std::mt19937 random(29);
+    uint64_t dedicated = 0, heap = 0;
+    for (uint32_t plan = 0; plan < count; ++plan) {
+        CheckedPlan checked;
+        // As on the Simulator, where every resource needs heap memory.
+        checked.setMemorylessAllowed(random() % 4 != 0);
+        const uint32_t resources = 1 + random() % 24;
+        const uint32_t passes = 1 + random() % 10;
+        for (uint32_t i = 0; i < resources; ++i) {
+            const uint64_t alignment = uint64_t(1) << (random() % 17);
+            checked.declare("random", 1 + random() % (4 << 20), alignment, random() % 3 != 0, random() % 8 == 0);
+        }
+        for (uint32_t i = 0; i < passes; ++i) {
+            checked.addPass("random");
+        }
+        for (uint32_t i = 0; i < resources * 2; ++i) {
+            checked.use(random() % passes, random() % resources, static_cast<Usage>(random() % 4));
+        }
+        checked.compileAndCheck("random plan");
+        dedicated += checked.planner.report().dedicatedBytes;
+        heap += checked.planner.heapSize();
+    }
+    printf("%u random plans: heaps %.1f%% of dedicated\n", count, 100.0 * heap / dedicated);
+}
+
+int main() {
+    planDeferredFrame(1170, 2532, true);
+    planDeferredFrame(1920, 1080, false);
+    planDeferredFrame(750, 1334, false);
+    checkPersistent();
+    checkRandomPlans(5000);
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,425 @@
+//
+//  UploadQueueSim.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Drives an UploadQueue against a fake blit backend whose GPU runs a few frames behind, and checks the scheduler: no
+// frame commits more than the byte cap (a lone oversized texture excepted), higher priorities go first and lower ones
+// never overtake a blocked request, buffer uploads split across frames and wrap around the staging ring without
+// overwriting staging bytes still in flight, and every completion runs exactly once, after its batch. Ends with
+// uploads submitted from worker threads while the render thread flushes, and a queue destroyed with a batch still in
+// flight, which has to wait for it. Exits nonzero if any check fails. Plain C++:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/UploadQueueSim.cpp LearningMetal/UploadQueue.cpp -pthread -o upload-queue-sim
+//   ./upload-queue-sim
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+#include "UploadQueue.hpp"
+
+using namespace upload;
+
+static int failures = 0;
+
+static void fail(const char* name, const char* what) {
+    if (failures++ < 20) {
+        printf("  FAIL %s: %s\n", name, what);
+    }
+}
+
+// Destinations are byte arrays; a texture is rows of bytesPerRow bytes.
+struct FakeTexture {
+    uint32_t bytesPerRow;
+    std::vector<uint8_t> bytes;
+};
+
+/**
+ * Copies run when a batch completes, not when they are recorded, as on the GPU; if the queue reused staging bytes a
+ * batch in flight still reads, the destination ends up wrong.
+ */
+class FakeBlitBackend : public BlitBackend {
+public:
+    explicit FakeBlitBackend(size_t capacity): _staging(capacity) {}
+
+    uint8_t* stagingContents() override { return _staging.data(); }
+    size_t stagingCapacity() const override { return _staging.size(); }
+
+    void beginBatch() override {
+        if (_recording) {
+            ++nestedBatches;
+        }
+        _recording = true;
+    }
+
+    void copyToBuffer(size_t stagingOffset, void* pDestination, size_t destinationOffset, size_t size) override {
+        checkRange(stagingOffset, size);
+        checkInFlight(stagingOffset, size);
+        _copies.push_back([this, stagingOffset, pDestination, destinationOffset, size]() {
+            memcpy(static_cast<uint8_t*>(pDestination) + destinationOffset, _staging.data() + stagingOffset, size);
+        });
+        wrapped += stagingOffset < _lastOffset;
+        _lastOffset = stagingOffset;
+    }
+
+    void copyToTexture(size_t stagingOffset, void* pDestination, const TextureRegion& region) override {
+        checkRange(stagingOffset, size_t(region.bytesPerRow) * region.height);
+        checkInFlight(stagingOffset, size_t(region.bytesPerRow) * region.height);
+        wrapped += stagingOffset < _lastOffset;
+        _lastOffset = stagingOffset;
+        _copies.push_back([this, stagingOffset, pDestination, region]() {
+            FakeTexture* pTexture = static_cast<FakeTexture*>(pDestination);
+            for (uint32_t row = 0; row < region.height; ++row) {
+                memcpy(pTexture->bytes.data() + size_t(region.y + row) * pTexture->bytesPerRow + region.x,
+                       _staging.data() + stagingOffset + size_t(row) * region.bytesPerRow, region.bytesPerRow);
+            }
+        });
+    }
+
+    void commitBatch(std::function<void()> onCompleted) override {
+        _recording = false;
+        lastBatchCopies = _copies.size();
+        _inFlight.push_back({ std::move(_copies), std::move(_ranges), std::move(onCompleted) });
+        _copies.clear();
+        _ranges.clear();
+        ++batches;
+    }
+
+    // Runs the oldest batch's copies, then its completion.
+    bool completeOldest() {
+        if (_inFlight.empty()) {
+            return false;
+        }
+        Batch batch = std::move(_inFlight.front());
+        _inFlight.pop_front();
+        for (const std::function<void()>& copy : batch.copies) {
+            copy();
+        }
+        batch.onCompleted();
+        return true;
+    }
+
+    size_t inFlight() const { return _inFlight.size(); }
+
+    uint64_t batches = 0;
+    uint64_t nestedBatches = 0;
+    uint64_t outOfRange = 0;
+    uint64_t overwrites = 0;
+    uint64_t wrapped = 0;
+    size_t lastBatchCopies = 0;
+
+private:
+    struct Batch {
+        std::vector<std::function<void()>> copies;
+        std::vector<std::pair<size_t, size_t>> ranges; // staging bytes the copies read
+        std::function<void()> onCompleted;
+    };
+
+    void checkRange(size_t offset, size_t size) {
+        outOfRange += offset % UploadQueue::kStagingAlignment != 0 || offset + size > _staging.size();
+    }
+
+    // Staging bytes handed out again while a committed batch has yet to read them.
+    void checkInFlight(size_t offset, size_t size) {
+        for (const Batch& batch : _inFlight) {
+            for (const auto& [begin, end] : batch.ranges) {
+                overwrites += offset < end && begin < offset + size;
+            }
+        }
+        _ranges.emplace_back(offset, offset + size);
+    }
+
+    std::vector<uint8_t> _staging;
+    std::vector<std::function<void()>> _copies;
+    std::vector<std::pair<size_t, size_t>> _ranges;
+    std::deque<Batch> _inFlight;
+    size_t _lastOffset = 0;
+    bool _recording = false;
+};
+
+static std::vector<uint8_t> pattern(size_t size, uint32_t seed) {
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; ++i) {
+        bytes[i] = static_cast<uint8_t>((seed * 2654435761u + i * 40503u) >> 11);
+    }
+    return bytes;
+}
+
+static void checkBackend(const char* name, const FakeBlitBackend& backend) {
+    if (backend.outOfRange != 0) {
+        fail(name, "copy outside the ring or misaligned");
+    }
+    if (backend.overwrites != 0) {
+        fail(name, "staging bytes reused while a batch in flight still reads them");
+    }
+    if (backend.nestedBatches != 0) {
+        fail(name, "batch begun inside a batch");
+    }
+}
+
+static void checkPriorities() {
+    const char* name = "priorities";
+    FakeBlitBackend backend(64 * 1024);
+    UploadQueue queue(&backend, 4096);
+    std::vector<uint8_t> destination(8 * 4096);
+    std::vector<UploadId> order;
+    auto record = [&order](UploadId id) { order.push_back(id); };
+
+    const UploadId low = queue.uploadBuffer(destination.data(), 0, pattern(4096, 1), Priority::Low, record);
+    const UploadId normal = queue.uploadBuffer(destination.data(), 4096, pattern(4096, 2), Priority::Normal, record);
+    const UploadId high = queue.uploadBuffer(destination.data(), 8192, pattern(4096, 3), Priority::High, record);
+    for (int frame = 0; frame < 3; ++frame) {
+        if (queue.flush() != 4096) {
+            fail(name, "frame did not use exactly its byte cap");
+        }
+        backend.completeOldest();
+    }
+    if (order != std::vector<UploadId> { high, normal, low }) {
+        fail(name, "not uploaded highest priority first");
+    }
+
+    // A texture larger than what is left of the frame's budget waits for the next frame, and the low priority buffer
+    // behind it waits too rather than overtaking it.
+    order.clear();
+    FakeTexture texture { 1024, std::vector<uint8_t>(1024 * 4) };
+    TextureRegion region;
+    region.width = 256;
+    region.height = 4;
+    region.bytesPerRow = 1024;
+    region.bytesPerImage = 4096;
+    const UploadId first = queue.uploadBuffer(destination.data(), 12288, pattern(1024, 4), Priority::Normal, record);
+    const UploadId blocked = queue.uploadTexture(&texture, region, pattern(4096, 5), Priority::Normal, record);
+    const UploadId behind = queue.uploadBuffer(destination.data(), 16384, pattern(512, 6), Priority::Low, record);
+    if (queue.flush() != 1024) {
+        fail(name, "a texture or a lower priority went past the byte cap");
+    }
+    backend.completeOldest();
+    if (order != std::vector<UploadId> { first }) {
+        fail(name, "a lower priority overtook a blocked request");
+    }
+    queue.flush();
+    backend.completeOldest();
+    queue.flush();
+    backend.completeOldest();
+    if (order != std::vector<UploadId> { first, blocked, behind }) {
+        fail(name, "blocked texture and the request behind it not uploaded in order");
+    }
+    if (texture.bytes != pattern(4096, 5) || memcmp(destination.data() + 16384, pattern(512, 6).data(), 512) != 0) {
+        fail(name, "wrong bytes");
+    }
+
+    // An oversized texture goes alone in its own frame.
+    FakeTexture big { 4096, std::vector<uint8_t>(4096 * 4) };
+    region.width = 1024;
+    region.bytesPerRow = 4096;
+    region.bytesPerImage = 16384;
+    queue.uploadTexture(&big, region, pattern(16384, 7), Priority::High);
+    queue.uploadBuffer(destination.data(), 0, pattern(256, 8), Priority::High);
+    if (queue.flush() != 16384 || queue.flush() != 256) {
+        fail(name, "oversized texture not alone in its frame");
+    }
+    while (backend.completeOldest()) {
+    }
+    if (big.bytes != pattern(16384, 7)) {
+        fail(name, "wrong texture bytes");
+    }
+    checkBackend(name, backend);
+}
+
+// Random buffers and textures through a small ring, with the GPU a random zero to three batches behind: every frame
+// stays under the cap unless it carries a lone oversized texture, the ring wraps, and the bytes arrive intact.
+static void checkRing(uint32_t seed) {
+    const char* name = "ring";
+    const size_t kRing = 48 * 1024;
+    const size_t kCap = 20 * 1024;
+    const uint32_t kUploads = 400;
+    std::mt19937 random(seed);
+    FakeBlitBackend backend(kRing);
+    UploadQueue queue(&backend, kCap);
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<FakeTexture> textures;
+    buffers.reserve(kUploads);
+    textures.reserve(kUploads);
+    std::vector<uint32_t> completions(kUploads, 0);
+    std::vector<bool> isTexture(kUploads);
+    uint64_t expectedBytes = 0;
+    for (uint32_t i = 0; i < kUploads; ++i) {
+        uint32_t* pCount = &completions[i];
+        const Priority priority = static_cast<Priority>(random() % 3);
+        isTexture[i] = random() % 3 == 0;
+        if (isTexture[i]) {
+            // Up to 32 KB, some over the cap; rows of 256-byte multiples up to 4 KB.
+            TextureRegion region;
+            region.bytesPerRow = 256 * (1 + random() % 16);
+            region.height = 1 + random() % static_cast<uint32_t>(32 * 1024 / region.bytesPerRow);
+            region.width = region.bytesPerRow / 4;
+            region.bytesPerImage = region.bytesPerRow * region.height;
+            textures.push_back({ region.bytesPerRow, std::vector<uint8_t>(region.bytesPerImage) });
+            buffers.emplace_back();
+            expectedBytes += region.bytesPerImage;
+            queue.uploadTexture(&textures.back(), region, pattern(region.bytesPerImage, i), priority, [pCount](UploadId) { ++*pCount; });
+        } else {
+            // Odd sizes split at unaligned points and leave unusable ends at the top of the ring.
+            buffers.emplace_back(1 + random() % 60000);
+            textures.push_back({ 0, {} });
+            expectedBytes += buffers.back().size();
+            queue.uploadBuffer(buffers.back().data(), 0, pattern(buffers.back().size(), i), priority, [pCount](UploadId) { ++*pCount; });
+        }
+    }
+
+    uint32_t frames = 0;
+    while (queue.stats().completed < kUploads && frames < 100000) {
+        const size_t bytes = queue.flush();
+        if (bytes > kCap && backend.lastBatchCopies != 1) {
+            fail(name, "frame over its byte cap");
+        }
+        for (uint32_t n = random() % 4; n > 0 || backend.inFlight() > 3 || (bytes == 0 && backend.inFlight() > 0); --n) {
+            backend.completeOldest();
+            if (n == 0) {
+                break;
+            }
+        }
+        ++frames;
+    }
+    while (backend.completeOldest()) {
+    }
+
+    for (uint32_t i = 0; i < kUploads; ++i) {
+        if (completions[i] != 1) {
+            fail(name, "completion not called exactly once");
+            break;
+        }
+        const std::vector<uint8_t>& bytes = isTexture[i] ? textures[i].bytes : buffers[i];
+        if (bytes != pattern(bytes.size(), i)) {
+            fail(name, "bytes overwritten in the ring before their batch completed");
+            break;
+        }
+    }
+    const UploadStats stats = queue.stats();
+    if (stats.submitted != kUploads || stats.completed != kUploads || stats.bytesUploaded != expectedBytes || stats.bytesPending != 0) {
+        fail(name, "stats do not add up");
+    }
+    if (backend.wrapped == 0) {
+        fail(name, "the ring never wrapped");
+    }
+    checkBackend(name, backend);
+    printf("ring: %llu bytes in %u frames, %llu batches, %llu wraps of a %zu KB ring\n", (unsigned long long)expectedBytes, frames,
+           (unsigned long long)backend.batches, (unsigned long long)backend.wrapped, kRing / 1024);
+}
+
+// Completions must not run before their batch has.
+static void checkCompletionTiming() {
+    const char* name = "completion timing";
+    FakeBlitBackend backend(16 * 1024);
+    UploadQueue queue(&backend, 16 * 1024);
+    std::vector<uint8_t> destination(1024);
+    bool completed = false;
+    bool sawBytes = false;
+    queue.uploadBuffer(destination.data(), 0, pattern(1024, 9), Priority::Normal, [&](UploadId) {
+        completed = true;
+        sawBytes = destination == pattern(1024, 9);
+    });
+    queue.flush();
+    if (completed || queue.stats().completed != 0) {
+        fail(name, "completed before the GPU ran the batch");
+    }
+    backend.completeOldest();
+    if (!completed || !sawBytes) {
+        fail(name, "completion ran before the copy");
+    }
+    if (queue.flush() != 0 || backend.inFlight() != 0) {
+        fail(name, "empty flush committed a batch");
+    }
+}
+
+// Workers submit while the render thread flushes and the GPU completes.
+static void checkThreads() {
+    const char* name = "threads";
+    const uint32_t kWorkers = 4;
+    const uint32_t kPerWorker = 200;
+    FakeBlitBackend backend(128 * 1024);
+    UploadQueue queue(&backend, 32 * 1024);
+    std::vector<std::vector<uint8_t>> destinations(kWorkers * kPerWorker);
+    std::atomic<uint32_t> completions(0);
+    std::vector<std::thread> workers;
+    for (uint32_t worker = 0; worker < kWorkers; ++worker) {
+        workers.emplace_back([&, worker]() {
+            for (uint32_t i = 0; i < kPerWorker; ++i) {
+                const uint32_t index = worker * kPerWorker + i;
+                destinations[index].resize(256 + (index * 37) % 3000);
+                queue.uploadBuffer(destinations[index].data(), 0, pattern(destinations[index].size(), index), static_cast<Priority>(index % 3),
+                                   [&completions](UploadId) { completions.fetch_add(1); });
+            }
+        });
+    }
+    // Workers may not even have started yet, so the render thread gives up on time rather than on a frame count.
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    uint32_t frames = 0;
+    while (completions.load() < kWorkers * kPerWorker && std::chrono::steady_clock::now() < deadline) {
+        queue.flush();
+        if (backend.inFlight() >= 3 || frames % 2 == 0) {
+            backend.completeOldest();
+        }
+        ++frames;
+        std::this_thread::yield();
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    while (backend.completeOldest()) {
+    }
+    for (uint32_t index = 0; index < destinations.size(); ++index) {
+        if (destinations[index] != pattern(destinations[index].size(), index)) {
+            fail(name, "wrong bytes");
+            break;
+        }
+    }
+    if (completions.load() != kWorkers * kPerWorker) {
+        fail(name, "uploads lost");
+    }
+    checkBackend(name, backend);
+}
+
+// The completion of a batch in flight calls back into the queue, so destroying the queue waits for it.
+static void checkShutdown() {
+    const char* name = "shutdown";
+    FakeBlitBackend backend(16 * 1024);
+    std::vector<uint8_t> destination(1024);
+    std::atomic<bool> completed(false);
+    UploadQueue* pQueue = new UploadQueue(&backend, 16 * 1024);
+    pQueue->uploadBuffer(destination.data(), 0, pattern(1024, 10), Priority::Normal, [&completed](UploadId) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        completed = true;
+    });
+    pQueue->flush();
+    std::thread gpu([&backend]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        backend.completeOldest();
+    });
+    delete pQueue;
+    if (!completed) {
+        fail(name, "destroyed before the batch in flight completed");
+    }
+    gpu.join();
+}
+
+int main() {
+    checkPriorities();
+    for (uint32_t seed = 1; seed <= 8; ++seed) {
+        checkRing(seed);
+    }
+    checkCompletionTiming();
+    checkThreads();
+    checkShutdown();
+    printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+//
+//  VertexQuantizeReport.cpp
+//  LearningMetal
+//
+//  Created by eternal on 2024/4/30.
+//
+
+// Measures what the quantized vertex formats lose and save: position, normal and texture coordinate error after a
+// round trip through the encoders, and the vertex bytes each stream layout stores and fetches. Without arguments it
+// uses a generated UV sphere. Plain C++, no Metal:
+//   c++ -std=c++17 -O2 -ILearningMetal Tools/VertexQuantizeReport.cpp LearningMetal/VertexQuantize.cpp LearningMetal/MeshImport.cpp LearningMetal/MeshOptimizer.cpp LearningMetal/MappedMesh.cpp -pthread -o vertex-quantize-report
+//   ./vertex-quantize-report [model.obj model.glb ...]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "MeshImport.hpp"
+#include "MeshOptimizer.hpp"
+#include "VertexQuantize.hpp"
+
+struct ErrorStats {
+    double maximum = 0.0;
+    double sum = 0.0;
+    size_t count = 0;
+
+    void add(double error) {
+        maximum = std::max(maximum, error);
+        sum += error;
+        ++count;
+    }
+    double mean() const { return count ? sum / double(count) : 0.0; }
+};
+
+static double angleDegrees(const float a[3], const float b[3]) {
+    const double d = std::clamp(double(a[0]) * b[0] + double(a[1]) * b[1] + double(a[2]) * b[2], -1.0, 1.0);
+    return std::acos(d) * 180.0 / 3.14159265358979;
+}
+
+static mesh_import::ImportedMesh makeSphere(uint32_t segments) {
+    mesh_import::ImportedMesh mesh;
+    const float pi = 3.14159265f;
+    for (uint32_t ring = 0; ring <= segments; ++ring) {
+        const float theta = pi * float(ring) / float(segments);
+        for (uint32_t step = 0; step <= segments * 2; ++step) {
+            const float phi = pi * float(step) / float(segments);
+            const float normal[3] = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+            // Off the origin and scaled, so the bounds are not symmetric.
+            mesh.positions.insert(mesh.positions.end(), { 3.0f + 2.0f * normal[0], -1.0f + 2.0f * normal[1], 0.5f + 2.0f * normal[2] });
+            mesh.normals.insert(mesh.normals.end(), { normal[0], normal[1], normal[2] });
+            mesh.texCoords.insert(mesh.texCoords.end(), { float(step) / float(segments * 2), float(ring) / float(segments) });
+        }
+    }
+    const uint32_t columns = segments * 2 + 1;
+    for (uint32_t ring = 0; ring < segments; ++ring) {
+        for (uint32_t step = 0; step < segments * 2; ++step) {
+            const uint32_t i = ring * columns + step;
+            mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + columns, i + 1, i + columns + 1, i + columns });
+        }
+    }
+    return mesh;
+}
+
+static void reportErrors(const mesh_import::ImportedMesh& mesh, const mesh_import::GpuMesh& gpu) {
+    const size_t vertexCount = mesh.vertexCount();
+    const double diagonal = std::sqrt(double(gpu.positionExtent[0]) * gpu.positionExtent[0] + double(gpu.positionExtent[1]) * gpu.positionExtent[1]
+                                      + double(gpu.positionExtent[2]) * gpu.positionExtent[2]);
+    ErrorStats position;
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const float* pSource = &mesh.positions[v * 3];
+        float decoded[3];
+        vertex_quantize::decodePosition(vertex_quantize::encodePosition(pSource, gpu.positionMin, gpu.positionExtent), gpu.positionMin, gpu.positionExtent, decoded);
+        const double dx = decoded[0] - pSource[0], dy = decoded[1] - pSource[1], dz = decoded[2] - pSource[2];
+        position.add(std::sqrt(dx * dx + dy * dy + dz * dz));
+    }
+    printf("  position unorm16     max %.3g (%.2e of diagonal), mean %.3g\n", position.maximum, diagonal > 0.0 ? position.maximum / diagonal : 0.0, position.mean());
+
+    if (!mesh.normals.empty()) {
+        ErrorStats octahedral;
+        ErrorStats snorm8;
+        for (size_t v = 0; v < vertexCount; ++v) {
+            float normal[3] = { mesh.normals[v * 3], mesh.normals[v * 3 + 1], mesh.normals[v * 3 + 2] };
+            const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            if (length == 0.0f) {
+                continue;
+            }
+            for (float& c : normal) {
+                c /= length;
+            }
+            float decoded[3];
+            vertex_quantize::decodeOctahedral(vertex_quantize::encodeOctahedral(normal), decoded);
+            octahedral.add(angleDegrees(normal, decoded));
+            vertex_quantize::decodeSnorm8(vertex_quantize::encodeSnorm8(normal), decoded);
+            snorm8.add(angleDegrees(normal, decoded));
+        }
+        printf("  normal octahedral10  max %.3f deg, mean %.3f deg\n", octahedral.maximum, octahedral.mean());
+        printf("  normal snorm8        max %.3f deg, mean %.3f deg\n", snorm8.maximum, snorm8.mean());
+    }
+
+    if (!mesh.texCoords.empty()) {
+        ErrorStats texCoord;
+        for (size_t v = 0; v < vertexCount; ++v) {
+            float decoded[2];
+            vertex_quantize::decodeTexCoord(vertex_quantize::encodeTexCoord(&mesh.texCoords[v * 2]), decoded);
+            texCoord.add(std::max(std::fabs(decoded[0] - mesh.texCoords[v * 2]), std::fabs(decoded[1] - mesh.texCoords[v * 2 + 1])));
+        }
+        // One texel of a 4096 texture is 2.4e-4.
+        printf("  texCoord half        max %.3g, mean %.3g\n", texCoord.maximum, texCoord.mean());
+    }
+}
+
+static void reportLayouts(const mesh_import::ImportedMesh& mesh) {
+    const uint32_t attributes = mesh_import::kPositionBit | mesh_import::kNormalBit | mesh_import::kTexCoordBit;
+    const struct {
+        const char* name;
+        mesh_import::StreamLayout layout;
+    } layouts[] = {
+        { "interleaved", mesh_import::StreamLayout::Interleaved },
+        { "split", mesh_import::StreamLayout::Split },
+        { "quantized", mesh_import::StreamLayout::Quantized },
+    };
+    printf("  %-12s %8s %12s %12s %10s\n", "layout", "bytes/v", "stored", "fetched", "overfetch");
+    for (const auto& entry : layouts) {
+        const mesh_import::GpuMesh gpu = mesh_import::buildGpuMesh(mesh, entry.layout, attributes);
+        size_t vertexSize = 0;
+        uint64_t fetched = 0;
+        uint64_t referenced = 0;
+        // Split streams are fetched through separate lines, one cache walk each.
+        for (const mesh_import::VertexStream& stream : gpu.streams) {
+            vertexSize += stream.stride;
+            const mesh_optimize::VertexFetchStats stats = mesh_optimize::analyzeVertexFetch(mesh.indices.data(), mesh.indices.size(), gpu.vertexCount, stream.stride);
+            fetched += stats.bytesFetched;
+            referenced += stats.overfetch > 0.0f ? uint64_t(double(stats.bytesFetched) / stats.overfetch) : 0;
+        }
+        printf("  %-12s %8zu %12zu %12llu %10.2f\n", entry.name, vertexSize, vertexSize * gpu.vertexCount, (unsigned long long)fetched,
+               referenced ? double(fetched) / double(referenced) : 0.0);
+    }
+}
+
+static void report(const char* name, mesh_import::ImportedMesh mesh) {
+    printf("%s: %zu vertices, %zu triangles%s%s\n", name, mesh.vertexCount(), mesh.triangleCount(), mesh.normals.empty() ? "" : ", normals",
+           mesh.texCoords.empty() ? "" : ", texCoords");
+    mesh_optimize::optimizeMesh(mesh);
+    reportLayouts(mesh);
+    reportErrors(mesh, mesh_import::buildGpuMesh(mesh, mesh_import::StreamLayout::Quantized, mesh_import::kPositionBit));
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        report("UV sphere 100", makeSphere(100));
+        return 0;
+    }
+
+    int failures = 0;
+    for (int i = 1; i < argc; ++i) {
+        mesh_import::ImportedMesh mesh;
+        std::string error;
+        if (!mesh_import::importMesh(argv[i], mesh, {}, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            ++failures;
+            continue;
+        }
+        report(argv[i], std::move(mesh));
+    }
+    return failures == 0 ? 0 : 1;
+}